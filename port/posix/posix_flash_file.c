@@ -4,26 +4,33 @@
  * Interfaces and defines to support Flash on a POSIX-based simulator
  */
 
+/* For pread, pwrite, ftruncate and mmap under -std=c99 */
+#define _POSIX_C_SOURCE 200809L
+
 #include <stddef.h>     /* For NULL */
 #include <fcntl.h>      /* For O_xxxx */
 #include <sys/types.h>  /* For off_t, stat */
 #include <sys/stat.h>   /* For fstat */
+#include <sys/mman.h>   /* For mmap, msync, munmap */
 #include <unistd.h>     /* For open, close, pread, pwrite */
 #include <errno.h>      /* For errno */
 #include <string.h>     /* For memset, memcpy */
 
 #include "wolfhsm/wh_error.h"
 #include "wolfhsm/wh_flash.h"
+#include "wolfhsm/wh_flash_unit.h"
 
 #include "posix_flash_file.h"
 
 enum {
     PFF_VERIFY_BUFFER_LEN = 64,
     PFF_BLANKCHECK_BUFFER_LEN = 64,
+    PFF_COPY_BUFFER_LEN = 256,
 };
 
 /** Local declarations */
-#define MAX_OFFSET(_context) (_context->partition_size * 2)
+#define MAX_OFFSET(_context) \
+        (_context->partition_size * _context->partition_count)
 
 /* Helper for pwrite like memset.  Write the byte in c to filedes for size
  * bytes starting at offset */
@@ -66,6 +73,8 @@ int posixFlashFile_Init(   void* c,
         memset(context, 0, sizeof(*context));
         context->fd_p1 = rc + 1;
         context->partition_size = config->partition_size;
+        context->partition_count = (config->partition_count != 0) ?
+                config->partition_count : 2;
         context->erased_byte = config->erased_byte;
 
         rc = fstat(context->fd_p1 - 1, &st);
@@ -73,11 +82,17 @@ int posixFlashFile_Init(   void* c,
             file_size = st.st_size;
 
             if (file_size < MAX_OFFSET(context)) {
-                /* Write ERASE_BYTE to fill up to the storage size */
-                rc = pfill( context->fd_p1 - 1,
-                            context->erased_byte,
-                            MAX_OFFSET(context) - file_size,
-                            file_size);
+                if (config->use_mmap != 0) {
+                    /* Extend the file now and fill it once mapped */
+                    rc = ftruncate( context->fd_p1 - 1,
+                                    MAX_OFFSET(context));
+                } else {
+                    /* Write ERASE_BYTE to fill up to the storage size */
+                    rc = pfill( context->fd_p1 - 1,
+                                context->erased_byte,
+                                MAX_OFFSET(context) - file_size,
+                                file_size);
+                }
                 if (rc < 0) {
                     /* Error while writing */
                     ret = WH_ERROR_ABORTED;
@@ -92,6 +107,20 @@ int posixFlashFile_Init(   void* c,
             }
         }
 
+        if ((ret == 0) && (config->use_mmap != 0)) {
+            void* map = mmap(NULL, MAX_OFFSET(context),
+                    PROT_READ | PROT_WRITE, MAP_SHARED, context->fd_p1 - 1, 0);
+            if (map == MAP_FAILED) {
+                ret = WH_ERROR_ABORTED;
+            } else {
+                context->map = map;
+                if (file_size < MAX_OFFSET(context)) {
+                    memset(context->map + file_size, context->erased_byte,
+                            MAX_OFFSET(context) - file_size);
+                }
+            }
+        }
+
         if (ret != 0) {
             /* Error at some point. Clean up */
             posixFlashFile_Cleanup(context);
@@ -111,6 +140,12 @@ int posixFlashFile_Cleanup(void* c)
         return WH_ERROR_BADARGS;
     }
 
+    if (context->map != NULL) {
+        /* Ignore errors here */
+        (void)msync(context->map, MAX_OFFSET(context), MS_SYNC);
+        (void)munmap(context->map, MAX_OFFSET(context));
+        context->map = NULL;
+    }
     if(context->fd_p1 > 0) {
         /* Ignore errors here */
         (void)close(context->fd_p1 - 1);
@@ -170,6 +205,11 @@ int posixFlashFile_Read(   void* c,
         return 0;
     }
 
+    if (context->map != NULL) {
+        memcpy(data, context->map + offset, size);
+        return 0;
+    }
+
     ssize_t rc = pread( context->fd_p1 - 1,
                         (void*) data,
                         (size_t) size,
@@ -201,6 +241,11 @@ int posixFlashFile_Program(void* c,
         return WH_ERROR_LOCKED;
     }
 
+    if (context->map != NULL) {
+        memcpy(context->map + offset, data, size);
+        return 0;
+    }
+
     ssize_t rc = pwrite(    context->fd_p1 - 1,
                             (void*) data,
                             (size_t) size,
@@ -233,6 +278,10 @@ int posixFlashFile_Verify( void* c,
         return 0;
     }
 
+    if (context->map != NULL) {
+        return wh_FlashUnit_MemVerify(context->map + offset, size, data);
+    }
+
     while (offset < end_offset) {
         uint32_t this_size = sizeof(buffer);
         int ret = 0;
@@ -245,8 +294,9 @@ int posixFlashFile_Verify( void* c,
         if (ret != 0) {
             return ret;
         }
-        if (memcmp(data + data_offset, buffer, this_size) != 0) {
-            return WH_ERROR_NOTVERIFIED;
+        ret = wh_FlashUnit_MemVerify(buffer, this_size, data + data_offset);
+        if (ret != 0) {
+            return ret;
         }
         offset += this_size;
         data_offset += this_size;
@@ -273,6 +323,11 @@ int posixFlashFile_Erase(void* c,
         return WH_ERROR_LOCKED;
     }
 
+    if (context->map != NULL) {
+        memset(context->map + offset, context->erased_byte, size);
+        return 0;
+    }
+
     ssize_t rc = pfill( context->fd_p1 - 1,
                         context->erased_byte,
                         (size_t) size,
@@ -290,7 +345,6 @@ int posixFlashFile_BlankCheck(void* c,
     int ret = 0;
     posixFlashFileContext* context = c;
     uint8_t buffer[PFF_BLANKCHECK_BUFFER_LEN];
-    uint8_t erased[PFF_BLANKCHECK_BUFFER_LEN];
     uint32_t end_offset = offset + size;
     uint32_t this_size = 0;
 
@@ -304,7 +358,10 @@ int posixFlashFile_BlankCheck(void* c,
         return 0;
     }
 
-    memset(erased, context->erased_byte, sizeof(erased));
+    if (context->map != NULL) {
+        return wh_FlashUnit_MemBlankCheck(context->map + offset, size,
+                context->erased_byte);
+    }
 
     while (offset < end_offset) {
         this_size = sizeof(buffer);
@@ -318,12 +375,81 @@ int posixFlashFile_BlankCheck(void* c,
             /* Error reading. Return error */
             break;
         }
-        if (memcmp(erased, buffer, this_size) != 0) {
+        ret = wh_FlashUnit_MemBlankCheck(buffer, this_size,
+                context->erased_byte);
+        if (ret != 0) {
             /* Didn't match.  Early return */
-            ret = WH_ERROR_NOTBLANK;
             break;
         }
         offset += this_size;
     }
     return ret;
 }
+
+int posixFlashFile_Copy(void* c,
+        uint32_t dst_offset, uint32_t src_offset, uint32_t size)
+{
+    int ret = 0;
+    posixFlashFileContext* context = c;
+    uint8_t buffer[PFF_COPY_BUFFER_LEN];
+    uint32_t done = 0;
+    uint32_t this_size = 0;
+
+    if (    (context == NULL) ||
+            (dst_offset + size > MAX_OFFSET(context)) ||
+            (src_offset + size > MAX_OFFSET(context)) ||
+            ((dst_offset < src_offset + size) &&
+             (src_offset < dst_offset + size))) {
+        return WH_ERROR_BADARGS;
+    }
+
+    /* Simulate a controller copy one buffer at a time */
+    while ((ret == 0) && (done < size)) {
+        this_size = sizeof(buffer);
+
+        if (this_size > size - done) {
+            this_size = size - done;
+        }
+
+        ret = posixFlashFile_Read(context, src_offset + done, this_size,
+                buffer);
+        if (ret == 0) {
+            ret = posixFlashFile_Program(context, dst_offset + done,
+                    this_size, buffer);
+        }
+        if (ret == 0) {
+            ret = posixFlashFile_Verify(context, dst_offset + done,
+                    this_size, buffer);
+        }
+        done += this_size;
+    }
+    return ret;
+}
+
+int posixFlashFile_Sync(void* c, uint32_t offset, uint32_t size)
+{
+    posixFlashFileContext* context = c;
+    long page_size = 0;
+    uint32_t start = 0;
+
+    if (    (context == NULL) ||
+            (offset + size > MAX_OFFSET(context))){
+        return WH_ERROR_BADARGS;
+    }
+
+    if ((context->map == NULL) || (size == 0)) {
+        /* pwrite on an O_SYNC file is already durable */
+        return 0;
+    }
+
+    /* msync requires a page aligned address */
+    page_size = sysconf(_SC_PAGESIZE);
+    if (page_size <= 0) {
+        return WH_ERROR_ABORTED;
+    }
+    start = offset - (offset % (uint32_t)page_size);
+    if (msync(context->map + start, offset + size - start, MS_SYNC) != 0) {
+        return WH_ERROR_ABORTED;
+    }
+    return 0;
+}
@@ -12,6 +12,11 @@
  * the erase will cover half of the entire space and atomic updates will
  * require fully copying the "active" half NVM to the "inactive" half and
  * updating the initial flags to update the state.
+ *
+ * By default each access is a pread or pwrite on a file opened with O_SYNC.
+ * With use_mmap, the file is mapped once and accessed with memory operations
+ * instead, and posixFlashFile_Sync uses msync to make the programmed data
+ * durable at the commit points of the NVM.
  */
 
 #include "wolfhsm/wh_flash.h"
@@ -21,14 +26,18 @@ typedef struct posixFlashFileContext_t {
     int fd_p1;              /* fd + 1, so fd == 0 is invalid */
     int unlocked;
     uint32_t partition_size;
+    uint32_t partition_count;
     uint8_t erased_byte;
+    uint8_t* map;           /* Mapping of the file in mmap mode, else NULL */
 } posixFlashFileContext;
 
 /* In memory configuration structure associated with an NVM instance */
 typedef struct posixFlashFileConfig_t {
     const char* filename;       /* Null terminated */
     uint32_t partition_size;
+    uint32_t partition_count;   /* Partitions in the file.  0 for 2 */
     uint8_t erased_byte;
+    int use_mmap;               /* Nonzero to access the file using mmap */
 } posixFlashFileConfig;
 
 int posixFlashFile_Init(void* c, const void* cf);
@@ -44,6 +53,9 @@ int posixFlashFile_Erase(void* c, uint32_t offset, uint32_t size);
 int posixFlashFile_Verify(void* c, uint32_t offset, uint32_t size,
         const uint8_t* data);
 int posixFlashFile_BlankCheck(void* c, uint32_t offset, uint32_t size);
+int posixFlashFile_Copy(void* c, uint32_t dst_offset, uint32_t src_offset,
+        uint32_t size);
+int posixFlashFile_Sync(void* c, uint32_t offset, uint32_t size);
 
 #define POSIX_FLASH_FILE_CB                         \
 {                                                   \
@@ -57,6 +69,8 @@ int posixFlashFile_BlankCheck(void* c, uint32_t offset, uint32_t size);
     .Erase = posixFlashFile_Erase,                  \
     .Verify = posixFlashFile_Verify,                \
     .BlankCheck = posixFlashFile_BlankCheck,        \
+    .Copy = posixFlashFile_Copy,                    \
+    .Sync = posixFlashFile_Sync,                    \
 }
 
 #endif /* PORT_POSIX_POSIX_FLASH_FILE_H_ */
@@ -0,0 +1,261 @@
+/*
+ * port/posix/posix_transport_shm.c
+ *
+ * Implementation of transport callbacks using POSIX shared memory
+ */
+
+/* For shm_open, ftruncate and mmap under -std=c99 */
+#define _POSIX_C_SOURCE 200809L
+
+#include <stddef.h>
+#include <string.h>
+#include <stdint.h>
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <fcntl.h>
+
+#include "wolfhsm/wh_error.h"
+#include "wolfhsm/wh_transport.h"
+#include "wolfhsm/wh_transport_mem.h"
+#include "port/posix/posix_transport_shm.h"
+
+/** Local declarations */
+
+/* Common utility function to map the shared memory object and initialize the
+ * memory transport over it */
+static int posixTransportShm_Map(posixTransportShmContext* c,
+        const posixTransportShmConfig* cf, int clear);
+
+/* Common utility function to unmap the shared memory object */
+static void posixTransportShm_Unmap(posixTransportShmContext* c);
+
+/** Local implementations */
+static int posixTransportShm_Map(posixTransportShmContext* c,
+        const posixTransportShmConfig* cf, int clear)
+{
+    int rc = 0;
+    int fd = -1;
+    void* map = MAP_FAILED;
+    size_t map_size = 0;
+    whTransportMemConfig mem_config[1] = {{0}};
+
+    if (    (c == NULL) ||
+            (cf == NULL) ||
+            (cf->name == NULL) ||
+            (cf->req_size == 0) ||
+            ((cf->req_size % sizeof(whTransportMemCsr)) != 0) ||
+            (cf->resp_size == 0) ) {
+        return WH_ERROR_BADARGS;
+    }
+
+    memset(c, 0, sizeof(*c));
+    map_size = (size_t)cf->req_size + cf->resp_size;
+
+    /* Either side may create the object.  New objects are zero filled */
+    fd = shm_open(cf->name, O_RDWR | O_CREAT, S_IRUSR | S_IWUSR);
+    if (fd < 0) {
+        return WH_ERROR_ABORTED;
+    }
+    rc = ftruncate(fd, (off_t)map_size);
+    if (rc == 0) {
+        map = mmap(NULL, map_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    }
+    /* The mapping remains valid after the fd is closed */
+    close(fd);
+    if ((rc != 0) || (map == MAP_FAILED)) {
+        return WH_ERROR_ABORTED;
+    }
+
+    mem_config->req = map;
+    mem_config->req_size = cf->req_size;
+    mem_config->resp = (uint8_t*)map + cf->req_size;
+    mem_config->resp_size = cf->resp_size;
+    mem_config->slot_count = cf->slot_count;
+    mem_config->notify_cb = cf->notify_cb;
+    mem_config->notify_context = cf->notify_context;
+
+    if (cf->slot_count != 0) {
+        rc = (clear != 0) ? wh_TransportMemRing_InitClear(&c->mem, mem_config)
+                          : wh_TransportMemRing_Init(&c->mem, mem_config);
+    } else {
+        rc = (clear != 0) ? wh_TransportMem_InitClear(&c->mem, mem_config)
+                          : wh_TransportMem_Init(&c->mem, mem_config);
+    }
+    if (rc != 0) {
+        munmap(map, map_size);
+        return rc;
+    }
+
+    c->map = map;
+    c->map_size = map_size;
+    c->name = cf->name;
+    c->ring = (cf->slot_count != 0);
+    return 0;
+}
+
+static void posixTransportShm_Unmap(posixTransportShmContext* c)
+{
+    (void)wh_TransportMem_Cleanup(&c->mem);
+    if (c->map != NULL) {
+        munmap(c->map, c->map_size);
+        c->map = NULL;
+        c->map_size = 0;
+    }
+}
+
+/** Client functions */
+int posixTransportShm_InitClient(void* context, const void* config)
+{
+    /* The client clears the buffers, matching the memory transport */
+    return posixTransportShm_Map(context, config, 1);
+}
+
+int posixTransportShm_SendRequest(void* context, uint16_t size,
+        const void* data)
+{
+    posixTransportShmContext* c = context;
+    if (c == NULL) {
+        return WH_ERROR_BADARGS;
+    }
+    return (c->ring != 0) ?
+            wh_TransportMemRing_SendRequest(&c->mem, size, data) :
+            wh_TransportMem_SendRequest(&c->mem, size, data);
+}
+
+int posixTransportShm_RecvResponse(void* context, uint16_t *out_size,
+        void* data)
+{
+    posixTransportShmContext* c = context;
+    if (c == NULL) {
+        return WH_ERROR_BADARGS;
+    }
+    return (c->ring != 0) ?
+            wh_TransportMemRing_RecvResponse(&c->mem, out_size, data) :
+            wh_TransportMem_RecvResponse(&c->mem, out_size, data);
+}
+
+int posixTransportShm_ClientWait(void* context, uint32_t timeout_us)
+{
+    posixTransportShmContext* c = context;
+    if (c == NULL) {
+        return WH_ERROR_BADARGS;
+    }
+    return (c->ring != 0) ?
+            wh_TransportMemRing_ClientWait(&c->mem, timeout_us) :
+            wh_TransportMem_ClientWait(&c->mem, timeout_us);
+}
+
+int posixTransportShm_CleanupClient(void* context)
+{
+    posixTransportShmContext* c = context;
+    if (c == NULL) {
+        return WH_ERROR_BADARGS;
+    }
+    posixTransportShm_Unmap(c);
+    return 0;
+}
+
+/** Server functions */
+int posixTransportShm_InitServer(void* context, const void* config)
+{
+    return posixTransportShm_Map(context, config, 0);
+}
+
+int posixTransportShm_RecvRequest(void* context, uint16_t *out_size,
+        void* data)
+{
+    posixTransportShmContext* c = context;
+    if (c == NULL) {
+        return WH_ERROR_BADARGS;
+    }
+    return (c->ring != 0) ?
+            wh_TransportMemRing_RecvRequest(&c->mem, out_size, data) :
+            wh_TransportMem_RecvRequest(&c->mem, out_size, data);
+}
+
+int posixTransportShm_SendResponse(void* context, uint16_t size,
+        const void* data)
+{
+    posixTransportShmContext* c = context;
+    if (c == NULL) {
+        return WH_ERROR_BADARGS;
+    }
+    return (c->ring != 0) ?
+            wh_TransportMemRing_SendResponse(&c->mem, size, data) :
+            wh_TransportMem_SendResponse(&c->mem, size, data);
+}
+
+int posixTransportShm_RecvRequestInPlace(void* context, uint16_t *out_size,
+        void** out_data)
+{
+    posixTransportShmContext* c = context;
+    if (c == NULL) {
+        return WH_ERROR_BADARGS;
+    }
+    return (c->ring != 0) ?
+            wh_TransportMemRing_RecvRequestInPlace(&c->mem, out_size,
+                    out_data) :
+            wh_TransportMem_RecvRequestInPlace(&c->mem, out_size, out_data);
+}
+
+int posixTransportShm_GetResponseBuffer(void* context, uint16_t *out_size,
+        void** out_data)
+{
+    posixTransportShmContext* c = context;
+    if (c == NULL) {
+        return WH_ERROR_BADARGS;
+    }
+    return (c->ring != 0) ?
+            wh_TransportMemRing_GetResponseBuffer(&c->mem, out_size,
+                    out_data) :
+            wh_TransportMem_GetResponseBuffer(&c->mem, out_size, out_data);
+}
+
+int posixTransportShm_SendResponseInPlace(void* context, uint16_t size)
+{
+    posixTransportShmContext* c = context;
+    if (c == NULL) {
+        return WH_ERROR_BADARGS;
+    }
+    return (c->ring != 0) ?
+            wh_TransportMemRing_SendResponseInPlace(&c->mem, size) :
+            wh_TransportMem_SendResponseInPlace(&c->mem, size);
+}
+
+int posixTransportShm_ServerWait(void* context, uint32_t timeout_us)
+{
+    posixTransportShmContext* c = context;
+    if (c == NULL) {
+        return WH_ERROR_BADARGS;
+    }
+    /* Both modes wait for req->notify to move past resp->notify */
+    return wh_TransportMem_ServerWait(&c->mem, timeout_us);
+}
+
+int posixTransportShm_GetQueueDepth(void* context, uint16_t* out_depth)
+{
+    posixTransportShmContext* c = context;
+    if (c == NULL) {
+        return WH_ERROR_BADARGS;
+    }
+    return (c->ring != 0) ?
+            wh_TransportMemRing_GetQueueDepth(&c->mem, out_depth) :
+            wh_TransportMem_GetQueueDepth(&c->mem, out_depth);
+}
+
+int posixTransportShm_CleanupServer(void* context)
+{
+    posixTransportShmContext* c = context;
+    if (c == NULL) {
+        return WH_ERROR_BADARGS;
+    }
+    if (c->name != NULL) {
+        /* Existing mappings stay valid after the name is removed */
+        (void)shm_unlink(c->name);
+        c->name = NULL;
+    }
+    posixTransportShm_Unmap(c);
+    return 0;
+}
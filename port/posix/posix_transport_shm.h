@@ -0,0 +1,121 @@
+/*
+ * port/posix/posix_transport_shm.h
+ *
+ * wolfHSM Transport binding using POSIX shared memory
+ */
+
+#ifndef PORT_POSIX_POSIX_TRANSPORT_SHM_H_
+#define PORT_POSIX_POSIX_TRANSPORT_SHM_H_
+
+/* Places the whTransportMem request and response buffers in a named shared
+ * memory object so a client and server in separate processes communicate
+ * without syscalls.  The object holds the request buffer followed by the
+ * response buffer.  Either side may start first: both create the object if it
+ * does not exist, the client clears the buffers as the memory client does,
+ * and the server removes the name on cleanup.  Without a notify_cb both sides
+ * poll the CSRs.  A nonzero slot_count uses the ring mode.
+ *
+ * Example usage:
+ *
+ * posixTransportShmConfig ptshmcfg[1] = {{
+ *      .name = "/wolfhsm",
+ *      .req_size = 4096,
+ *      .resp_size = 4096,
+ * }};
+ *
+ * whTransportClientCb ptshmccb[1] = {PTSHM_CLIENT_CB};
+ * posixTransportShmContext ptshmcc[1] = {0};
+ * whCommClientConfig ccc[1] = {{
+ *      .transport_cb = ptshmccb,
+ *      .transport_context = ptshmcc,
+ *      .transport_config = ptshmcfg,
+ *      .client_id = 1234,
+ * }};
+ * whCommClient cc[1] = {0};
+ * wh_CommClient_Init(cc, ccc);
+ *
+ * whTransportServerCb ptshmscb[1] = {PTSHM_SERVER_CB};
+ * posixTransportShmContext ptshmsc[1] = {0};
+ * whCommServerConfig csc[1] = {{
+ *      .transport_cb = ptshmscb,
+ *      .transport_context = ptshmsc,
+ *      .transport_config = ptshmcfg,
+ *      .server_id = 5678,
+ * }};
+ * whCommServer cs[1] = {0};
+ * wh_CommServer_Init(cs, csc);
+ *
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "wolfhsm/wh_transport.h"
+#include "wolfhsm/wh_transport_mem.h"
+
+/** Common configuration structure */
+typedef struct {
+    const char* name;       /* shm_open name, such as "/wolfhsm" */
+    uint16_t req_size;      /* Bytes of the request buffer.  Multiple of 8 */
+    uint16_t resp_size;     /* Bytes of the response buffer */
+    uint16_t slot_count;    /* 0 for single packets, else ring slot count */
+    const whTransportMemNotifyCb* notify_cb;    /* Optional doorbell */
+    void* notify_context;   /* Context passed to notify_cb */
+} posixTransportShmConfig;
+
+/** Common context */
+typedef struct {
+    whTransportMemContext mem;
+    void* map;              /* Mapping of the shared memory object */
+    size_t map_size;
+    const char* name;
+    int ring;
+} posixTransportShmContext;
+
+/** Client functions */
+int posixTransportShm_InitClient(void* context, const void* config);
+int posixTransportShm_SendRequest(void* context, uint16_t size,
+        const void* data);
+int posixTransportShm_RecvResponse(void* context, uint16_t *out_size,
+        void* data);
+int posixTransportShm_ClientWait(void* context, uint32_t timeout_us);
+int posixTransportShm_CleanupClient(void* context);
+
+#define PTSHM_CLIENT_CB                             \
+{                                                   \
+    .Init =     posixTransportShm_InitClient,       \
+    .Send =     posixTransportShm_SendRequest,      \
+    .Recv =     posixTransportShm_RecvResponse,     \
+    .Cleanup =  posixTransportShm_CleanupClient,    \
+    .Wait =     posixTransportShm_ClientWait,       \
+}
+
+/** Server functions */
+int posixTransportShm_InitServer(void* context, const void* config);
+int posixTransportShm_RecvRequest(void* context, uint16_t *out_size,
+        void* data);
+int posixTransportShm_SendResponse(void* context, uint16_t size,
+        const void* data);
+int posixTransportShm_RecvRequestInPlace(void* context, uint16_t *out_size,
+        void** out_data);
+int posixTransportShm_GetResponseBuffer(void* context, uint16_t *out_size,
+        void** out_data);
+int posixTransportShm_SendResponseInPlace(void* context, uint16_t size);
+int posixTransportShm_ServerWait(void* context, uint32_t timeout_us);
+int posixTransportShm_GetQueueDepth(void* context, uint16_t* out_depth);
+int posixTransportShm_CleanupServer(void* context);
+
+#define PTSHM_SERVER_CB                                         \
+{                                                               \
+    .Init =     posixTransportShm_InitServer,                   \
+    .Recv =     posixTransportShm_RecvRequest,                  \
+    .Send =     posixTransportShm_SendResponse,                 \
+    .Cleanup =  posixTransportShm_CleanupServer,                \
+    .RecvInPlace = posixTransportShm_RecvRequestInPlace,        \
+    .GetSendBuffer = posixTransportShm_GetResponseBuffer,       \
+    .SendInPlace = posixTransportShm_SendResponseInPlace,       \
+    .Wait =     posixTransportShm_ServerWait,                   \
+    .GetQueueDepth = posixTransportShm_GetQueueDepth,           \
+}
+
+#endif /* PORT_POSIX_POSIX_TRANSPORT_SHM_H_ */
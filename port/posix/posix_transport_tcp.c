@@ -10,6 +10,7 @@
 
 #include <arpa/inet.h>
 #include <sys/socket.h>
+#include <sys/uio.h>
 #include <netinet/in.h>
 #include <netinet/tcp.h>
 #include <unistd.h>
@@ -21,6 +22,20 @@
 #include "wolfhsm/wh_transport.h"
 #include "port/posix/posix_transport_tcp.h"
 
+/* Suppress SIGPIPE per send where supported */
+#ifdef MSG_NOSIGNAL
+#define PTT_SEND_FLAGS MSG_NOSIGNAL
+#else
+#define PTT_SEND_FLAGS 0
+#endif
+
+/* Socket option to hold partial segments.  Cork is ignored without one */
+#if defined(TCP_CORK)
+#define PTT_TCP_CORK TCP_CORK
+#elif defined(TCP_NOPUSH)
+#define PTT_TCP_CORK TCP_NOPUSH
+#endif
+
 /** Local declarations */
 
 /* Common utility function to make a fd non-blocking */
@@ -32,7 +47,16 @@ static int posixTransportTcp_MakeNoSigpipe(int sock);
 /* Server utility function to make a socket no linger and reuse addr */
 static int posixTransportTcp_MakeNoLinger(int sock);
 
-/* Common send/write function with a byte buffer */
+/* Common utility function to set an integer TCP socket option */
+static int posixTransportTcp_SetTcpOption(int sock, int name, int value);
+
+/* Common gather write function resuming after *offset bytes */
+static int posixTransportTcp_SendIov(int fd, uint16_t* offset,
+        struct iovec* iov, int iov_count);
+
+/* Common send function writing the length prefix from buffer and then data.
+ * buffer must hold PTT_BUFFER_SIZE bytes to keep the frame after a partial
+ * write */
 static int posixTransportTcp_Send(int fd, uint16_t* buffer_offset,
         uint8_t* buffer, uint16_t size, const void* data);
 
@@ -40,6 +64,13 @@ static int posixTransportTcp_Send(int fd, uint16_t* buffer_offset,
 static int posixTransportTcp_Recv(int fd, uint16_t* buffer_offset,
         uint8_t* buffer, uint16_t *out_size, void* data);
 
+/* Server utility function to open a non-blocking listening socket */
+static int posixTransportTcp_Listen(const posixTransportTcpConfig* cf,
+        struct sockaddr_in* addr, int backlog, int* out_fd_p1);
+
+/* Common wait function for an event on a single fd */
+static int posixTransportTcp_Wait(int fd, short events, uint32_t timeout_us);
+
 /** Local implementations */
 static int posixTransportTcp_MakeNonBlocking(int fd)
 {
@@ -90,32 +121,125 @@ static int posixTransportTcp_MakeNoLinger(int sock)
     return 0;
 }
 
-static int posixTransportTcp_Send(int fd, uint16_t* buffer_offset,
-        uint8_t* buffer, uint16_t size, const void* data)
+static int posixTransportTcp_Listen(const posixTransportTcpConfig* cf,
+        struct sockaddr_in* addr, int backlog, int* out_fd_p1)
 {
     int rc = 0;
-    int send_size = 0;
-    uint32_t* packet_len = (uint32_t*)&(buffer[0]);
-    void* packet_data = &(buffer[sizeof(uint32_t)]);
+    int fd = -1;
 
-    if (    (fd < 0) ||
-            (buffer_offset == NULL) ||
-            (buffer == NULL) ||
-            (size == 0) ||
-            (size > PTT_PACKET_MAX_SIZE) ||
-            (data == NULL) ) {
+    rc = inet_pton(AF_INET, cf->server_ip_string, &addr->sin_addr);
+    if (rc != 1) {
+        /* rc == -1 means errno set. rc == 0 means string is not understood. */
         return WH_ERROR_BADARGS;
     }
+    addr->sin_family = AF_INET;
+    addr->sin_port = htons(cf->server_port);
+    rc = socket(AF_INET, SOCK_STREAM, 0);
+    if (rc < 0) {
+        return WH_ERROR_ABORTED;
+    }
+    fd = rc;
+
+    /* Make socket non-blocking */
+    rc = posixTransportTcp_MakeNonBlocking(fd);
+    if (rc != 0) {
+        close(fd);
+        return WH_ERROR_ABORTED;
+    }
+
+    /* Ensure listen port does not linger */
+    rc = posixTransportTcp_MakeNoLinger(fd);
+    /* Ok to fail to linger.  Annoying, but ok. */
+
+    /* Suppress signals on failed writes */
+    rc = posixTransportTcp_MakeNoSigpipe(fd);
+    /* Ok to fail to ignore signals */
+
+    rc = bind(fd,
+            (struct sockaddr*)addr,
+            sizeof(*addr));
+    if (rc < 0) {
+        close(fd);
+        return WH_ERROR_ABORTED;
+    }
 
-    if(*buffer_offset == 0) {
-        /* Initial write.  Copy data to buffer */
-        /* Prepend packet data with the size in network order */
-        *packet_len = htonl((uint32_t)size);
-        memcpy(packet_data, data, size);
-        send_size = sizeof(uint32_t) + size;
+    rc = listen(fd, backlog);
+    if (rc < 0) {
+        close(fd);
+        return WH_ERROR_ABORTED;
     }
-    int remaining_size = send_size - *buffer_offset;
-    rc = write(fd, &(buffer[*buffer_offset]), remaining_size);
+
+    /* All good */
+    *out_fd_p1 = fd + 1;
+    return 0;
+}
+
+static int posixTransportTcp_Wait(int fd, short events, uint32_t timeout_us)
+{
+    int rc = 0;
+    struct pollfd pfd = {
+            .fd = fd,
+            .events = events,
+            .revents = 0,
+    };
+
+    /* Round up so a short timeout still blocks */
+    rc = poll(&pfd, 1, (int)((timeout_us + 999) / 1000));
+    if (rc < 0) {
+        if (errno == EINTR) {
+            /* Interrupted.  Poll again */
+            return 0;
+        }
+        return WH_ERROR_ABORTED;
+    }
+    if (rc == 0) {
+        return WH_ERROR_NOTREADY;
+    }
+    /* Ready or error/hangup, which the next Send or Recv reports */
+    return 0;
+}
+
+static int posixTransportTcp_SetTcpOption(int sock, int name, int value)
+{
+    int rc = 0;
+
+    rc = setsockopt(sock, IPPROTO_TCP, name, &value, sizeof(value));
+    if (rc != 0) {
+        return WH_ERROR_ABORTED;
+    }
+    return 0;
+}
+
+static int posixTransportTcp_SendIov(int fd, uint16_t* offset,
+        struct iovec* iov, int iov_count)
+{
+    struct msghdr msg;
+    size_t total = 0;
+    size_t skip = *offset;
+    ssize_t rc = 0;
+    int first = 0;
+    int i = 0;
+
+    for (i = 0; i < iov_count; i++) {
+        total += iov[i].iov_len;
+    }
+    if (skip >= total) {
+        *offset = 0;
+        return WH_ERROR_BADARGS;
+    }
+
+    /* Skip the bytes sent by earlier, partial writes */
+    while (skip >= iov[first].iov_len) {
+        skip -= iov[first].iov_len;
+        first++;
+    }
+    iov[first].iov_base = (uint8_t*)iov[first].iov_base + skip;
+    iov[first].iov_len -= skip;
+
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov[first];
+    msg.msg_iovlen = iov_count - first;
+    rc = sendmsg(fd, &msg, PTT_SEND_FLAGS);
 
     if (rc < 0) {
         switch (errno) {
@@ -126,22 +250,66 @@ static int posixTransportTcp_Send(int fd, uint16_t* buffer_offset,
 
         default:
             /* Other error. Assume fatal. */
-            *buffer_offset = 0;
+            *offset = 0;
             return WH_ERROR_ABORTED;
         }
     }
 
-    if(rc != remaining_size) {
+    if (*offset + (size_t)rc < total) {
         /* Incomplete write */
-        *buffer_offset += rc;
+        *offset += rc;
         return WH_ERROR_NOTREADY;
     }
 
     /* All good. Reset state */
-    *buffer_offset = 0;
+    *offset = 0;
     return 0;
 }
 
+static int posixTransportTcp_Send(int fd, uint16_t* buffer_offset,
+        uint8_t* buffer, uint16_t size, const void* data)
+{
+    int rc = 0;
+    uint32_t packet_len = 0;
+    struct iovec iov[2];
+
+    if (    (fd < 0) ||
+            (buffer_offset == NULL) ||
+            (buffer == NULL) ||
+            (size == 0) ||
+            (size > PTT_PACKET_MAX_SIZE) ||
+            (data == NULL) ) {
+        return WH_ERROR_BADARGS;
+    }
+
+    if (*buffer_offset != 0) {
+        /* Resume the partial write from the copy in buffer.  The caller may
+         * have reused data, so only the size must match */
+        memcpy(&packet_len, buffer, sizeof(packet_len));
+        if (ntohl(packet_len) != size) {
+            return WH_ERROR_BADARGS;
+        }
+        iov[0].iov_base = buffer;
+        iov[0].iov_len = sizeof(packet_len) + size;
+        return posixTransportTcp_SendIov(fd, buffer_offset, iov, 1);
+    }
+
+    /* Prepend packet data with the size in network order */
+    packet_len = htonl((uint32_t)size);
+    memcpy(buffer, &packet_len, sizeof(packet_len));
+
+    iov[0].iov_base = buffer;
+    iov[0].iov_len = sizeof(packet_len);
+    iov[1].iov_base = (void*)data;
+    iov[1].iov_len = size;
+    rc = posixTransportTcp_SendIov(fd, buffer_offset, iov, 2);
+    if ((rc == WH_ERROR_NOTREADY) && (*buffer_offset != 0)) {
+        /* Partial write.  Keep the frame so a retry sends the same bytes */
+        memcpy(&buffer[sizeof(packet_len)], data, size);
+    }
+    return rc;
+}
+
 static int posixTransportTcp_Recv(int fd, uint16_t* buffer_offset,
         uint8_t* buffer, uint16_t *out_size, void* data)
 {
@@ -176,6 +344,11 @@ static int posixTransportTcp_Recv(int fd, uint16_t* buffer_offset,
                 return WH_ERROR_ABORTED;
             }
         }
+        if (rc == 0) {
+            /* Peer closed the connection */
+            *buffer_offset = 0;
+            return WH_ERROR_ABORTED;
+        }
         *buffer_offset += rc;
     }
     if(*buffer_offset < sizeof(uint32_t)) {
@@ -207,6 +380,11 @@ static int posixTransportTcp_Recv(int fd, uint16_t* buffer_offset,
             return WH_ERROR_ABORTED;
         }
     }
+    if (rc == 0) {
+        /* Peer closed the connection */
+        *buffer_offset = 0;
+        return WH_ERROR_ABORTED;
+    }
     *buffer_offset += rc;
     size_remaining -= rc;
     if (size_remaining > 0) {
@@ -236,12 +414,16 @@ int posixTransportTcp_InitConnect(void* context, const void* config)
     }
 
     memset(c, 0, sizeof(*c));
+    c->nodelay = cf->nodelay;
+    c->cork = cf->cork;
+    c->coalesce = cf->coalesce;
 
     rc = inet_pton(AF_INET, cf->server_ip_string, &c->server_addr.sin_addr);
     if (rc != 1) {
         /* rc == -1 means errno set. rc == 0 means string is not understood. */
         return WH_ERROR_BADARGS;
     }
+    c->server_addr.sin_family = AF_INET;
     c->server_addr.sin_port = htons(cf->server_port);
     rc = socket(AF_INET, SOCK_STREAM, 0);
     if (rc < 0) {
@@ -287,10 +469,90 @@ int posixTransportTcp_InitConnect(void* context, const void* config)
     return 0;
 }
 
+/* Client utility to finish a late/slow connect */
+static int posixTransportTcp_CheckConnect(posixTransportTcpClientContext* c)
+{
+    int rc = 0;
+    struct pollfd pfd = {
+            .fd = c->connect_fd_p1 - 1,
+            .events = POLLOUT,
+            .revents = 0,
+    };
+
+    if (c->connected != 0) {
+        return 0;
+    }
+
+    /* Check for writeable with no timeout */
+    rc = poll(&pfd, 1, 0);
+    if (rc < 0) {
+        /* Error.  */
+        return WH_ERROR_ABORTED;
+    }
+    if (rc == 0) {
+        /* Poll timeout, not connected yet */
+        return WH_ERROR_NOTREADY;
+    }
+    if ((pfd.revents & POLLOUT) == 0) {
+        /* Not connected yet */
+        return WH_ERROR_NOTREADY;
+    }
+    c->connected = 1;
+
+    if (c->nodelay != 0) {
+        /* Ok to fail to disable Nagle */
+        (void)posixTransportTcp_SetTcpOption(c->connect_fd_p1 - 1,
+                TCP_NODELAY, 1);
+    }
+    return 0;
+}
+
+/* Client utility to write the coalesced requests */
+static int posixTransportTcp_FlushConnect(posixTransportTcpClientContext* c)
+{
+    int rc = 0;
+    struct iovec iov[1];
+
+    if (c->batch_size == 0) {
+        return 0;
+    }
+
+    iov[0].iov_base = c->batch;
+    iov[0].iov_len = c->batch_size;
+    rc = posixTransportTcp_SendIov(c->connect_fd_p1 - 1, &c->send_offset,
+            iov, 1);
+    if (rc != WH_ERROR_NOTREADY) {
+        /* Sent or fatal.  Reset state either way */
+        c->batch_size = 0;
+    }
+    return rc;
+}
+
+/* Client utility to push all sent requests to the server before waiting */
+static int posixTransportTcp_PushConnect(posixTransportTcpClientContext* c)
+{
+    int rc = 0;
+
+    rc = posixTransportTcp_FlushConnect(c);
+    if (rc != 0) {
+        return rc;
+    }
+#ifdef PTT_TCP_CORK
+    if (c->corked != 0) {
+        /* Uncorking sends any held partial segment */
+        (void)posixTransportTcp_SetTcpOption(c->connect_fd_p1 - 1,
+                PTT_TCP_CORK, 0);
+        c->corked = 0;
+    }
+#endif
+    return 0;
+}
+
 int posixTransportTcp_SendRequest(void* context,
         uint16_t size, const void* data)
 {
     int rc = 0;
+    uint32_t packet_len = 0;
     posixTransportTcpClientContext* c = context;
     if (    (c == NULL) ||
             (c->connect_fd_p1 == 0) ||
@@ -300,49 +562,51 @@ int posixTransportTcp_SendRequest(void* context,
         return WH_ERROR_BADARGS;
     }
 
-    if (c->request_sent == 1) {
+    if (c->request_count == UINT16_MAX) {
         return WH_ERROR_NOTREADY;
     }
 
     /* Handle late/slow connect */
-    if (c->connected == 0) {
-        /* Ensure writeable */
-        struct pollfd pfd = {
-                .fd = c->connect_fd_p1 - 1,
-                .events = POLLOUT,
-                .revents = 0,
-        };
-        /* Check for writeable with no timeout */
-        rc = poll(&pfd, 1, 0);
-        if (rc < 0) {
-            /* Error.  */
-            return WH_ERROR_ABORTED;
-        }
-        if (rc == 0) {
-            /* Poll timeout, not connected yet */
-            return WH_ERROR_NOTREADY;
-        }
-        if ((pfd.revents & POLLOUT) == 0) {
-            /* Not connected yet */
-            return WH_ERROR_NOTREADY;
-        }
-        c->connected = 1;
+    rc = posixTransportTcp_CheckConnect(c);
+    if (rc != 0) {
+        return rc;
     }
 
-    rc = posixTransportTcp_Send(
-            c->connect_fd_p1 - 1,
-            &c->buffer_offset,
-            c->buffer,
-            size, data);
-
-    if (rc != WH_ERROR_NOTREADY) {
-        /* Reset state */
-        c->buffer_offset = 0;
-        if (rc == 0) {
-            c->request_sent = 1;
+#ifdef PTT_TCP_CORK
+    if ((c->cork != 0) && (c->corked == 0)) {
+        /* Ok to fail to cork */
+        if (posixTransportTcp_SetTcpOption(c->connect_fd_p1 - 1,
+                PTT_TCP_CORK, 1) == 0) {
+            c->corked = 1;
         }
     }
-    return rc;
+#endif
+
+    if (c->coalesce != 0) {
+        if (c->batch_size + sizeof(packet_len) + size > sizeof(c->batch)) {
+            /* No room.  Write the queued requests first */
+            rc = posixTransportTcp_FlushConnect(c);
+            if (rc != 0) {
+                return rc;
+            }
+        }
+        /* Queue the request with its size in network order */
+        packet_len = htonl((uint32_t)size);
+        memcpy(&c->batch[c->batch_size], &packet_len, sizeof(packet_len));
+        memcpy(&c->batch[c->batch_size + sizeof(packet_len)], data, size);
+        c->batch_size += sizeof(packet_len) + size;
+    } else {
+        rc = posixTransportTcp_Send(
+                c->connect_fd_p1 - 1,
+                &c->send_offset,
+                c->batch,
+                size, data);
+        if (rc != 0) {
+            return rc;
+        }
+    }
+    c->request_count++;
+    return 0;
 }
 
 int posixTransportTcp_RecvResponse(void* context,
@@ -355,7 +619,13 @@ int posixTransportTcp_RecvResponse(void* context,
         return WH_ERROR_BADARGS;
     }
 
-    if (c->request_sent != 1) {
+    /* Ensure the server has the requests before expecting a response */
+    rc = posixTransportTcp_PushConnect(c);
+    if (rc != 0) {
+        return rc;
+    }
+
+    if (c->request_count == 0) {
         return WH_ERROR_NOTREADY;
     }
 
@@ -369,11 +639,34 @@ int posixTransportTcp_RecvResponse(void* context,
     if (rc != WH_ERROR_NOTREADY) {
         /* Success or fatal.  Reset state either way */
         c->buffer_offset = 0;
-        c->request_sent = 0;
+        c->request_count--;
     }
     return rc;
 }
 
+int posixTransportTcp_WaitConnect(void* context, uint32_t timeout_us)
+{
+    int rc = 0;
+    posixTransportTcpClientContext* c = context;
+    if (    (c == NULL) ||
+            (c->connect_fd_p1 == 0) ) {
+        return WH_ERROR_BADARGS;
+    }
+
+    /* Waiting means the client expects progress, so push the requests */
+    rc = posixTransportTcp_PushConnect(c);
+    if ((rc != 0) && (rc != WH_ERROR_NOTREADY)) {
+        return rc;
+    }
+
+    /* Wait to connect or send, otherwise for the response */
+    return posixTransportTcp_Wait(c->connect_fd_p1 - 1,
+            (   (c->connected == 0) ||
+                (c->batch_size != 0) ||
+                (c->request_count == 0)) ? POLLOUT : POLLIN,
+            timeout_us);
+}
+
 int posixTransportTcp_CleanupConnect(void* context)
 {
      posixTransportTcpClientContext* c = context;
@@ -395,7 +688,6 @@ int posixTransportTcp_CleanupConnect(void* context)
 
 int posixTransportTcp_InitListen(void* context, const void* config)
 {
-    int rc = 0;
     posixTransportTcpServerContext* c = context;
     const posixTransportTcpConfig* cf = config;
 
@@ -404,53 +696,8 @@ int posixTransportTcp_InitListen(void* context, const void* config)
     }
 
     memset(c, 0, sizeof(*c));
-
-    rc = inet_pton(AF_INET, cf->server_ip_string, &c->server_addr.sin_addr);
-    if (rc != 1) {
-        /* rc == -1 means errno set. rc == 0 means string is not understood. */
-        return WH_ERROR_BADARGS;
-    }
-    c->server_addr.sin_port = htons(cf->server_port);
-    rc = socket(AF_INET, SOCK_STREAM, 0);
-    if (rc < 0) {
-        return WH_ERROR_ABORTED;
-    }
-    c->listen_fd_p1 = rc + 1;
-
-    /* Make socket non-blocking */
-    rc = posixTransportTcp_MakeNonBlocking(c->listen_fd_p1 - 1);
-    if (rc != 0) {
-        close(c->listen_fd_p1 - 1);
-        c->listen_fd_p1 = 0;
-        return WH_ERROR_ABORTED;
-    }
-
-    /* Ensure listen port does not linger */
-    rc = posixTransportTcp_MakeNoLinger(c->listen_fd_p1 - 1);
-    /* Ok to fail to linger.  Annoying, but ok. */
-
-    /* Suppress signals on failed writes */
-    rc = posixTransportTcp_MakeNoSigpipe(c->listen_fd_p1 - 1);
-    /* Ok to fail to ignore signals */
-
-    rc = bind(c->listen_fd_p1 - 1,
-            (struct sockaddr*)&c->server_addr,
-            sizeof(c->server_addr));
-    if (rc < 0) {
-        close(c->listen_fd_p1 - 1);
-        c->listen_fd_p1 = 0;
-        return WH_ERROR_ABORTED;
-    }
-
-    rc = listen(c->listen_fd_p1 - 1, 1);
-    if (rc < 0) {
-        close(c->listen_fd_p1 - 1);
-        c->listen_fd_p1 = 0;
-        return WH_ERROR_ABORTED;
-    }
-
-    /* All good */
-    return 0;
+    c->nodelay = cf->nodelay;
+    return posixTransportTcp_Listen(cf, &c->server_addr, 1, &c->listen_fd_p1);
 }
 
 int posixTransportTcp_RecvRequest(void* context,
@@ -484,6 +731,10 @@ int posixTransportTcp_RecvRequest(void* context,
             }
         }
         c->accept_fd_p1 = rc + 1;
+        if (c->nodelay != 0) {
+            /* Ok to fail to disable Nagle */
+            (void)posixTransportTcp_SetTcpOption(rc, TCP_NODELAY, 1);
+        }
     }
 
     if (c->request_recv == 1) {
@@ -542,6 +793,25 @@ int posixTransportTcp_SendResponse(void* context,
     return rc;
 }
 
+int posixTransportTcp_WaitListen(void* context, uint32_t timeout_us)
+{
+    posixTransportTcpServerContext* c = context;
+    if (    (c == NULL) ||
+            (c->listen_fd_p1 == 0) ) {
+        return WH_ERROR_BADARGS;
+    }
+
+    if (c->accept_fd_p1 == 0) {
+        /* Wait for a client to connect */
+        return posixTransportTcp_Wait(c->listen_fd_p1 - 1, POLLIN,
+                timeout_us);
+    }
+    /* Wait to send the response, otherwise for a request */
+    return posixTransportTcp_Wait(c->accept_fd_p1 - 1,
+            (c->request_recv == 1) ? POLLOUT : POLLIN,
+            timeout_us);
+}
+
 int posixTransportTcp_CleanupListen(void* context)
 {
     posixTransportTcpServerContext* c = context;
@@ -560,3 +830,277 @@ int posixTransportTcp_CleanupListen(void* context)
 
     return 0;
 }
+
+
+/** Multi-connection Server Functions */
+
+/* Close a connection and free its slot */
+static void posixTransportTcp_CloseMulti(
+        posixTransportTcpMultiServerContext* c, int index)
+{
+    posixTransportTcpConnection* conn = &c->connections[index];
+
+    if (conn->fd_p1 != 0) {
+        close(conn->fd_p1 - 1);
+        conn->fd_p1 = 0;
+        c->connection_count--;
+    }
+    conn->buffer_offset = 0;
+    c->pfds[index + 1].fd = -1;
+    c->pfds[index + 1].revents = 0;
+    if (c->active_p1 == index + 1) {
+        c->active_p1 = 0;
+    }
+}
+
+/* Accept pending clients into free slots */
+static int posixTransportTcp_AcceptMulti(
+        posixTransportTcpMultiServerContext* c)
+{
+    int rc = 0;
+    int i = 0;
+
+    for (i = 0; i < PTT_MULTI_MAX_CONNECTIONS; i++) {
+        if (c->connections[i].fd_p1 != 0) {
+            continue;
+        }
+        rc = accept(c->listen_fd_p1 - 1, NULL, NULL);
+        if (rc < 0) {
+            switch (errno) {
+            case EAGAIN:
+            case EINTR:
+            case ECONNABORTED:
+                /* No more clients for now */
+                return 0;
+
+            default:
+                /* Other error. Assume fatal. */
+                return WH_ERROR_ABORTED;
+            }
+        }
+        if (posixTransportTcp_MakeNonBlocking(rc) != 0) {
+            close(rc);
+            continue;
+        }
+        /* Ok to fail to ignore signals */
+        (void)posixTransportTcp_MakeNoSigpipe(rc);
+        if (c->nodelay != 0) {
+            /* Ok to fail to disable Nagle */
+            (void)posixTransportTcp_SetTcpOption(rc, TCP_NODELAY, 1);
+        }
+
+        c->connections[i].fd_p1 = rc + 1;
+        c->connections[i].buffer_offset = 0;
+        c->pfds[i + 1].fd = rc;
+        c->pfds[i + 1].revents = 0;
+        c->connection_count++;
+    }
+    return 0;
+}
+
+/* Poll the listening socket, while a slot is free, and all connections */
+static int posixTransportTcp_PollMulti(
+        posixTransportTcpMultiServerContext* c, int timeout_ms)
+{
+    int rc = 0;
+
+    c->pfds[0].fd = (c->connection_count < PTT_MULTI_MAX_CONNECTIONS) ?
+            (c->listen_fd_p1 - 1) : -1;
+    rc = poll(c->pfds, PTT_MULTI_MAX_CONNECTIONS + 1, timeout_ms);
+    if (rc < 0) {
+        if (errno == EINTR) {
+            /* Interrupted.  Poll again */
+            return WH_ERROR_NOTREADY;
+        }
+        return WH_ERROR_ABORTED;
+    }
+    if (rc == 0) {
+        return WH_ERROR_NOTREADY;
+    }
+    return 0;
+}
+
+int posixTransportTcp_InitListenMulti(void* context, const void* config)
+{
+    int rc = 0;
+    int i = 0;
+    posixTransportTcpMultiServerContext* c = context;
+    const posixTransportTcpConfig* cf = config;
+
+    if ( (c == NULL) || (cf == NULL)) {
+        return WH_ERROR_BADARGS;
+    }
+
+    memset(c, 0, sizeof(*c));
+    c->nodelay = cf->nodelay;
+    for (i = 0; i < PTT_MULTI_MAX_CONNECTIONS + 1; i++) {
+        c->pfds[i].fd = -1;
+        c->pfds[i].events = POLLIN;
+    }
+
+    rc = posixTransportTcp_Listen(cf, &c->server_addr, SOMAXCONN,
+            &c->listen_fd_p1);
+    return rc;
+}
+
+int posixTransportTcp_RecvRequestMulti(void* context,
+        uint16_t* out_size, void* data)
+{
+    int rc = 0;
+    int i = 0;
+    int index = 0;
+    posixTransportTcpMultiServerContext* c = context;
+    posixTransportTcpConnection* conn = NULL;
+
+    if (    (c == NULL) ||
+            (c->listen_fd_p1 == 0) ) {
+        return WH_ERROR_BADARGS;
+    }
+
+    if (c->active_p1 != 0) {
+        /* Already working on a request. */
+        return WH_ERROR_NOTREADY;
+    }
+
+    rc = posixTransportTcp_PollMulti(c, 0);
+    if (rc != 0) {
+        return rc;
+    }
+
+    if ((c->pfds[0].revents & POLLIN) != 0) {
+        rc = posixTransportTcp_AcceptMulti(c);
+        if (rc != 0) {
+            return rc;
+        }
+    }
+
+    /* Take one request, starting after the last connection served */
+    for (i = 0; i < PTT_MULTI_MAX_CONNECTIONS; i++) {
+        index = (c->next + i) % PTT_MULTI_MAX_CONNECTIONS;
+        conn = &c->connections[index];
+        if (    (conn->fd_p1 == 0) ||
+                (c->pfds[index + 1].revents == 0)) {
+            continue;
+        }
+
+        rc = posixTransportTcp_Recv(
+                conn->fd_p1 - 1,
+                &conn->buffer_offset,
+                conn->buffer,
+                out_size,
+                data);
+        if (rc == 0) {
+            c->active_p1 = index + 1;
+            c->next = (index + 1) % PTT_MULTI_MAX_CONNECTIONS;
+            return 0;
+        }
+        if (rc != WH_ERROR_NOTREADY) {
+            /* Client failed or closed.  Drop only this connection */
+            posixTransportTcp_CloseMulti(c, index);
+        }
+    }
+    return WH_ERROR_NOTREADY;
+}
+
+int posixTransportTcp_SendResponseMulti(void* context,
+        uint16_t size, const void* data)
+{
+    int rc = 0;
+    int index = 0;
+    posixTransportTcpMultiServerContext* c = context;
+    posixTransportTcpConnection* conn = NULL;
+
+    if (    (c == NULL) ||
+            (c->listen_fd_p1 == 0) ||
+            (size == 0) ||
+            (size > PTT_PACKET_MAX_SIZE) ||
+            (data == NULL) ) {
+        return WH_ERROR_BADARGS;
+    }
+
+    if (c->active_p1 == 0) {
+        return WH_ERROR_NOTREADY;
+    }
+    index = c->active_p1 - 1;
+    conn = &c->connections[index];
+
+    rc = posixTransportTcp_Send(
+            conn->fd_p1 - 1,
+            &conn->buffer_offset,
+            conn->buffer,
+            size, data);
+    if (rc == WH_ERROR_NOTREADY) {
+        return rc;
+    }
+
+    if (rc != 0) {
+        /* Drop the response with its connection */
+        posixTransportTcp_CloseMulti(c, index);
+    }
+    conn->buffer_offset = 0;
+    c->active_p1 = 0;
+    return 0;
+}
+
+int posixTransportTcp_WaitListenMulti(void* context, uint32_t timeout_us)
+{
+    posixTransportTcpMultiServerContext* c = context;
+    if (    (c == NULL) ||
+            (c->listen_fd_p1 == 0) ) {
+        return WH_ERROR_BADARGS;
+    }
+
+    if (c->active_p1 != 0) {
+        /* Wait to send the response */
+        return posixTransportTcp_Wait(
+                c->connections[c->active_p1 - 1].fd_p1 - 1,
+                POLLOUT, timeout_us);
+    }
+    /* Wait for a client or a request.  Round up so a short timeout blocks */
+    return posixTransportTcp_PollMulti(c, (int)((timeout_us + 999) / 1000));
+}
+
+int posixTransportTcp_GetQueueDepthMulti(void* context, uint16_t* out_depth)
+{
+    int rc = 0;
+    int i = 0;
+    uint16_t depth = 0;
+    posixTransportTcpMultiServerContext* c = context;
+
+    if (    (c == NULL) ||
+            (c->listen_fd_p1 == 0) ||
+            (out_depth == NULL)) {
+        return WH_ERROR_BADARGS;
+    }
+
+    /* Count the connections with data waiting and the current request */
+    rc = posixTransportTcp_PollMulti(c, 0);
+    for (i = 0; i < PTT_MULTI_MAX_CONNECTIONS; i++) {
+        if (    (c->active_p1 == i + 1) ||
+                ((rc == 0) && (c->connections[i].fd_p1 != 0) &&
+                 (c->pfds[i + 1].revents != 0))) {
+            depth++;
+        }
+    }
+    *out_depth = depth;
+    return (rc == WH_ERROR_ABORTED) ? rc : 0;
+}
+
+int posixTransportTcp_CleanupListenMulti(void* context)
+{
+    int i = 0;
+    posixTransportTcpMultiServerContext* c = context;
+    if (c == NULL) {
+        return WH_ERROR_BADARGS;
+    }
+
+    for (i = 0; i < PTT_MULTI_MAX_CONNECTIONS; i++) {
+        posixTransportTcp_CloseMulti(c, i);
+    }
+    if (c->listen_fd_p1 != 0) {
+        close(c->listen_fd_p1 - 1);
+        c->listen_fd_p1 = 0;
+    }
+
+    return 0;
+}
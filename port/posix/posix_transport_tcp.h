@@ -12,6 +12,7 @@
  * posixTransportTcpConfig pttcfg[1] = {{
  *      .server_ip_string = "127.0.0.1",
  *      .server_port = 2345,
+ *      .nodelay = 1,
  * }};
  *
  * wh_TransportClient_Cb pttccb[1] = {PTT_CLIENT_CB};
@@ -40,6 +41,7 @@
 
 #include <stdint.h>
 #include <netinet/in.h>
+#include <poll.h>
 
 #include "wolfhsm/wh_comm.h"        /* For WOLFHSM_COMM_MTU */
 #include "wolfhsm/wh_transport.h"
@@ -48,22 +50,56 @@
 #define PTT_PACKET_MAX_SIZE WOLFHSM_COMM_MTU
 #define PTT_BUFFER_SIZE (sizeof(uint32_t) + PTT_PACKET_MAX_SIZE)
 
+/* Size of the client buffer of coalesced requests.  Must be at least
+ * PTT_BUFFER_SIZE and at most 65535.  The default holds 4 full frames,
+ * matching the default depth of the pipelined client. */
+#ifndef PTT_COALESCE_BUFFER_SIZE
+#define PTT_COALESCE_BUFFER_SIZE (4 * PTT_BUFFER_SIZE)
+#endif
+
+/* Maximum number of connections accepted by the multi-connection server */
+#ifndef PTT_MULTI_MAX_CONNECTIONS
+#define PTT_MULTI_MAX_CONNECTIONS 32
+#endif
+
 /** Common configuration structure */
 typedef struct {
     char* server_ip_string;
     short int server_port;
+    int nodelay;    /* Nonzero to set TCP_NODELAY on connected sockets */
+    int cork;       /* Nonzero for the client to cork its socket while sending
+                     * requests and uncork it to wait for a response */
+    int coalesce;   /* Nonzero for the client to queue requests and write them
+                     * with a single send once it waits for a response */
 } posixTransportTcpConfig;
 
 
-/** Client context and functions */
+/** Client context and functions
+ *
+ * Each request is written as its length prefix and packet with one sendmsg().
+ * Requests may be sent before the previous responses are received, which
+ * allows use with the pipelined client.  With coalesce, requests are copied
+ * into a batch that is written with one send when the client receives or
+ * waits, or when the batch is full.  A request that is only partly written
+ * is copied into the context, so a retry does not depend on the caller's
+ * buffer but must pass the same size.
+ */
 
 typedef struct {
     struct sockaddr_in server_addr;
     int connect_fd_p1;      /* fd plus 1 so 0 is invalid */
     int connected;
-    int request_sent;
-    uint16_t buffer_offset;
+    int nodelay;
+    int cork;
+    int coalesce;
+    int corked;             /* Socket is currently corked */
+    uint16_t request_count; /* Requests sent without a response yet */
+    uint16_t buffer_offset; /* Bytes received of the current response */
+    uint16_t send_offset;   /* Bytes sent of the current request or batch */
+    uint16_t batch_size;    /* Bytes of coalesced requests in batch */
     uint8_t buffer[PTT_BUFFER_SIZE];
+    uint8_t batch[PTT_COALESCE_BUFFER_SIZE]; /* Coalesced requests, or the
+                                              * request being sent */
 } posixTransportTcpClientContext;
 
 int posixTransportTcp_InitConnect(void* context, const void* config);
@@ -71,6 +107,7 @@ int posixTransportTcp_SendRequest(void* context, uint16_t size,
         const void* data);
 int posixTransportTcp_RecvResponse(void* context, uint16_t *out_size,
         void* data);
+int posixTransportTcp_WaitConnect(void* context, uint32_t timeout_us);
 int posixTransportTcp_CleanupConnect(void* context);
 
 #define PTT_CLIENT_CB                               \
@@ -79,6 +116,7 @@ int posixTransportTcp_CleanupConnect(void* context);
     .Send =     posixTransportTcp_SendRequest,      \
     .Recv =     posixTransportTcp_RecvResponse,     \
     .Cleanup =  posixTransportTcp_CleanupConnect,   \
+    .Wait =     posixTransportTcp_WaitConnect,      \
 }
 
 
@@ -89,6 +127,7 @@ typedef struct {
     struct sockaddr_in client_addr;
     int listen_fd_p1;       /* fd plus 1 so 0 is invalid */
     int accept_fd_p1;       /* fd plus 1 so 0 is invalid */
+    int nodelay;
     int request_recv;
     uint16_t buffer_offset;
     uint8_t buffer[PTT_BUFFER_SIZE];
@@ -99,6 +138,7 @@ int posixTransportTcp_RecvRequest(void* context, uint16_t *out_size,
         void* data);
 int posixTransportTcp_SendResponse(void* context, uint16_t size,
         const void* data);
+int posixTransportTcp_WaitListen(void* context, uint32_t timeout_us);
 int posixTransportTcp_CleanupListen(void* context);
 
 #define PTT_SERVER_CB                               \
@@ -107,6 +147,54 @@ int posixTransportTcp_CleanupListen(void* context);
     .Recv =     posixTransportTcp_RecvRequest,      \
     .Send =     posixTransportTcp_SendResponse,     \
     .Cleanup =  posixTransportTcp_CleanupListen,    \
+    .Wait =     posixTransportTcp_WaitListen,       \
+}
+
+
+/** Multi-connection server context and functions
+ *
+ * Accepts up to PTT_MULTI_MAX_CONNECTIONS clients on one listening socket and
+ * serves them all through a single whCommServer endpoint.  All sockets are
+ * checked with one poll() per Recv, and requests are taken from connections
+ * round-robin so a busy client cannot starve the others.  Each connection
+ * keeps its own partial frame, and a connection that fails or closes is
+ * dropped without affecting the others.
+ */
+
+typedef struct {
+    int fd_p1;              /* fd plus 1 so 0 is invalid */
+    uint16_t buffer_offset;
+    uint8_t buffer[PTT_BUFFER_SIZE];
+} posixTransportTcpConnection;
+
+typedef struct {
+    struct sockaddr_in server_addr;
+    int listen_fd_p1;       /* fd plus 1 so 0 is invalid */
+    int active_p1;          /* Connection of the current request plus 1 */
+    int next;               /* Connection checked first by the next Recv */
+    int connection_count;
+    int nodelay;
+    posixTransportTcpConnection connections[PTT_MULTI_MAX_CONNECTIONS];
+    struct pollfd pfds[PTT_MULTI_MAX_CONNECTIONS + 1];
+} posixTransportTcpMultiServerContext;
+
+int posixTransportTcp_InitListenMulti(void* context, const void* config);
+int posixTransportTcp_RecvRequestMulti(void* context, uint16_t *out_size,
+        void* data);
+int posixTransportTcp_SendResponseMulti(void* context, uint16_t size,
+        const void* data);
+int posixTransportTcp_WaitListenMulti(void* context, uint32_t timeout_us);
+int posixTransportTcp_GetQueueDepthMulti(void* context, uint16_t* out_depth);
+int posixTransportTcp_CleanupListenMulti(void* context);
+
+#define PTT_MULTI_SERVER_CB                                 \
+{                                                           \
+    .Init =     posixTransportTcp_InitListenMulti,          \
+    .Recv =     posixTransportTcp_RecvRequestMulti,         \
+    .Send =     posixTransportTcp_SendResponseMulti,        \
+    .Cleanup =  posixTransportTcp_CleanupListenMulti,       \
+    .Wait =     posixTransportTcp_WaitListenMulti,          \
+    .GetQueueDepth = posixTransportTcp_GetQueueDepthMulti,  \
 }
 
 #endif /* WH_TRANSPORT_TCP_H_ */
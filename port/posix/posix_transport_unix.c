@@ -0,0 +1,501 @@
+/*
+ * port/posix/posix_transport_unix.c
+ *
+ * Implementation of transport callbacks using Unix domain seqpacket sockets
+ */
+
+#include <stddef.h>
+#include <string.h>
+#include <stdint.h>
+
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <poll.h>
+
+#include "wolfhsm/wh_error.h"
+#include "wolfhsm/wh_transport.h"
+#include "port/posix/posix_transport_unix.h"
+
+/* Suppress SIGPIPE per send where supported */
+#ifdef MSG_NOSIGNAL
+#define PTU_SEND_FLAGS MSG_NOSIGNAL
+#else
+#define PTU_SEND_FLAGS 0
+#endif
+
+/** Local declarations */
+
+/* Common utility function to make a fd non-blocking */
+static int posixTransportUnix_MakeNonBlocking(int fd);
+
+/* Common utility function to fill in the socket address from the path */
+static int posixTransportUnix_SetAddr(const posixTransportUnixConfig* cf,
+        struct sockaddr_un* addr);
+
+/* Common utility function to open a non-blocking seqpacket socket */
+static int posixTransportUnix_Socket(int* out_fd_p1);
+
+/* Common send function of one packet */
+static int posixTransportUnix_Send(int fd, uint16_t size, const void* data);
+
+/* Common recv function of one packet */
+static int posixTransportUnix_Recv(int fd, uint16_t *out_size, void* data);
+
+/* Common wait function for an event on a single fd */
+static int posixTransportUnix_Wait(int fd, short events, uint32_t timeout_us);
+
+/** Local implementations */
+static int posixTransportUnix_MakeNonBlocking(int fd)
+{
+    int rc = 0;
+    rc = fcntl(fd, F_GETFL, 0);
+    if (rc == -1) {
+        /* Error getting flags */
+        return WH_ERROR_ABORTED;
+    }
+    /* Set the nonblocking flag */
+    rc = fcntl(fd, F_SETFL, rc | O_NONBLOCK);
+    if (rc == -1) {
+        /* Error setting flags */
+        return WH_ERROR_ABORTED;
+    }
+    return 0;
+}
+
+static int posixTransportUnix_SetAddr(const posixTransportUnixConfig* cf,
+        struct sockaddr_un* addr)
+{
+    size_t len = 0;
+
+    if (cf->socket_path == NULL) {
+        return WH_ERROR_BADARGS;
+    }
+    len = strlen(cf->socket_path);
+    if ((len == 0) || (len >= sizeof(addr->sun_path))) {
+        return WH_ERROR_BADARGS;
+    }
+
+    memset(addr, 0, sizeof(*addr));
+    addr->sun_family = AF_UNIX;
+    memcpy(addr->sun_path, cf->socket_path, len);
+    return 0;
+}
+
+static int posixTransportUnix_Socket(int* out_fd_p1)
+{
+    int rc = 0;
+
+    rc = socket(AF_UNIX, SOCK_SEQPACKET, 0);
+    if (rc < 0) {
+        return WH_ERROR_ABORTED;
+    }
+    if (posixTransportUnix_MakeNonBlocking(rc) != 0) {
+        close(rc);
+        return WH_ERROR_ABORTED;
+    }
+    *out_fd_p1 = rc + 1;
+    return 0;
+}
+
+static int posixTransportUnix_Send(int fd, uint16_t size, const void* data)
+{
+    ssize_t rc = 0;
+
+    if (    (size == 0) ||
+            (size > PTU_PACKET_MAX_SIZE) ||
+            (data == NULL) ) {
+        return WH_ERROR_BADARGS;
+    }
+
+    /* Packets are sent whole or not at all */
+    rc = send(fd, data, size, PTU_SEND_FLAGS);
+    if (rc < 0) {
+        switch (errno) {
+        case EAGAIN:
+        case EINTR:
+        case ENOBUFS:
+            /* Not enough buffer space */
+            return WH_ERROR_NOTREADY;
+
+        default:
+            /* Other error. Assume fatal. */
+            return WH_ERROR_ABORTED;
+        }
+    }
+    if (rc != size) {
+        return WH_ERROR_ABORTED;
+    }
+    return 0;
+}
+
+static int posixTransportUnix_Recv(int fd, uint16_t *out_size, void* data)
+{
+    ssize_t rc = 0;
+    struct iovec iov[1];
+    struct msghdr msg;
+
+    if (data == NULL) {
+        return WH_ERROR_BADARGS;
+    }
+
+    iov[0].iov_base = data;
+    iov[0].iov_len = PTU_PACKET_MAX_SIZE;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = iov;
+    msg.msg_iovlen = 1;
+
+    rc = recvmsg(fd, &msg, 0);
+    if (rc < 0) {
+        switch (errno) {
+        case EAGAIN:
+        case EINTR:
+            /* No recv data */
+            return WH_ERROR_NOTREADY;
+
+        default:
+            /* Other error. Assume fatal. */
+            return WH_ERROR_ABORTED;
+        }
+    }
+    if (rc == 0) {
+        /* Peer closed the connection */
+        return WH_ERROR_ABORTED;
+    }
+    if ((msg.msg_flags & MSG_TRUNC) != 0) {
+        /* Packet larger than the MTU.  Assume fatal */
+        return WH_ERROR_ABORTED;
+    }
+
+    if (out_size != NULL) {
+        *out_size = (uint16_t)rc;
+    }
+    return 0;
+}
+
+static int posixTransportUnix_Wait(int fd, short events, uint32_t timeout_us)
+{
+    int rc = 0;
+    struct pollfd pfd = {
+            .fd = fd,
+            .events = events,
+            .revents = 0,
+    };
+
+    /* Round up so a short timeout still blocks.  A negative fd just sleeps */
+    rc = poll(&pfd, 1, (int)((timeout_us + 999) / 1000));
+    if (rc < 0) {
+        if (errno == EINTR) {
+            /* Interrupted.  Poll again */
+            return 0;
+        }
+        return WH_ERROR_ABORTED;
+    }
+    if (rc == 0) {
+        return WH_ERROR_NOTREADY;
+    }
+    /* Ready or error/hangup, which the next Send or Recv reports */
+    return 0;
+}
+
+/** Client functions */
+
+/* Client utility to connect, retrying until the server is listening */
+static int posixTransportUnix_Connect(posixTransportUnixClientContext* c)
+{
+    int rc = 0;
+
+    if (c->connected != 0) {
+        return 0;
+    }
+
+    rc = connect(c->connect_fd_p1 - 1,
+            (struct sockaddr*)&c->server_addr,
+            sizeof(c->server_addr));
+    if (rc < 0) {
+        switch (errno) {
+        case EAGAIN:
+        case EINTR:
+        case ENOENT:
+        case ECONNREFUSED:
+            /* Ok.  Server not listening or accepting yet. */
+            return WH_ERROR_NOTREADY;
+
+        case EISCONN:
+            /* Connected by an earlier attempt */
+            break;
+
+        default:
+            /* Some other error. Assume fatal. */
+            return WH_ERROR_ABORTED;
+        }
+    }
+    c->connected = 1;
+    return 0;
+}
+
+int posixTransportUnix_InitConnect(void* context, const void* config)
+{
+    int rc = 0;
+    posixTransportUnixClientContext* c = context;
+    const posixTransportUnixConfig* cf = config;
+
+    if ( (c == NULL) || (cf == NULL)) {
+        return WH_ERROR_BADARGS;
+    }
+
+    memset(c, 0, sizeof(*c));
+    rc = posixTransportUnix_SetAddr(cf, &c->server_addr);
+    if (rc != 0) {
+        return rc;
+    }
+    rc = posixTransportUnix_Socket(&c->connect_fd_p1);
+    if (rc != 0) {
+        return rc;
+    }
+
+    /* Start the connect process */
+    rc = posixTransportUnix_Connect(c);
+    if ((rc != 0) && (rc != WH_ERROR_NOTREADY)) {
+        close(c->connect_fd_p1 - 1);
+        c->connect_fd_p1 = 0;
+        return rc;
+    }
+
+    /* All good */
+    return 0;
+}
+
+int posixTransportUnix_SendRequest(void* context,
+        uint16_t size, const void* data)
+{
+    int rc = 0;
+    posixTransportUnixClientContext* c = context;
+    if (    (c == NULL) ||
+            (c->connect_fd_p1 == 0) ) {
+        return WH_ERROR_BADARGS;
+    }
+
+    if (c->request_count == UINT16_MAX) {
+        return WH_ERROR_NOTREADY;
+    }
+
+    /* Handle late connect */
+    rc = posixTransportUnix_Connect(c);
+    if (rc != 0) {
+        return rc;
+    }
+
+    rc = posixTransportUnix_Send(c->connect_fd_p1 - 1, size, data);
+    if (rc == 0) {
+        c->request_count++;
+    }
+    return rc;
+}
+
+int posixTransportUnix_RecvResponse(void* context,
+        uint16_t* out_size, void* data)
+{
+    int rc = 0;
+    posixTransportUnixClientContext* c = context;
+    if (    (c == NULL) ||
+            (c->connect_fd_p1 == 0) ) {
+        return WH_ERROR_BADARGS;
+    }
+
+    if (c->request_count == 0) {
+        return WH_ERROR_NOTREADY;
+    }
+
+    rc = posixTransportUnix_Recv(c->connect_fd_p1 - 1, out_size, data);
+    if (rc != WH_ERROR_NOTREADY) {
+        /* Success or fatal.  Done with this request either way */
+        c->request_count--;
+    }
+    return rc;
+}
+
+int posixTransportUnix_WaitConnect(void* context, uint32_t timeout_us)
+{
+    posixTransportUnixClientContext* c = context;
+    if (    (c == NULL) ||
+            (c->connect_fd_p1 == 0) ) {
+        return WH_ERROR_BADARGS;
+    }
+
+    if (c->connected == 0) {
+        /* Nothing to poll until the server listens.  Sleep instead */
+        return posixTransportUnix_Wait(-1, 0, timeout_us);
+    }
+    /* Wait to send, otherwise for the response */
+    return posixTransportUnix_Wait(c->connect_fd_p1 - 1,
+            (c->request_count == 0) ? POLLOUT : POLLIN,
+            timeout_us);
+}
+
+int posixTransportUnix_CleanupConnect(void* context)
+{
+    posixTransportUnixClientContext* c = context;
+    if (c == NULL) {
+        return WH_ERROR_BADARGS;
+    }
+
+    if (c->connect_fd_p1 != 0) {
+        close(c->connect_fd_p1 - 1);
+        c->connect_fd_p1 = 0;
+    }
+    c->connected = 0;
+    c->request_count = 0;
+
+    return 0;
+}
+
+
+/** Server Functions */
+
+int posixTransportUnix_InitListen(void* context, const void* config)
+{
+    int rc = 0;
+    posixTransportUnixServerContext* c = context;
+    const posixTransportUnixConfig* cf = config;
+
+    if ( (c == NULL) || (cf == NULL)) {
+        return WH_ERROR_BADARGS;
+    }
+
+    memset(c, 0, sizeof(*c));
+    rc = posixTransportUnix_SetAddr(cf, &c->server_addr);
+    if (rc != 0) {
+        return rc;
+    }
+    rc = posixTransportUnix_Socket(&c->listen_fd_p1);
+    if (rc != 0) {
+        return rc;
+    }
+
+    /* Remove a stale socket file from an earlier server */
+    (void)unlink(c->server_addr.sun_path);
+
+    rc = bind(c->listen_fd_p1 - 1,
+            (struct sockaddr*)&c->server_addr,
+            sizeof(c->server_addr));
+    if (rc == 0) {
+        rc = listen(c->listen_fd_p1 - 1, 1);
+    }
+    if (rc < 0) {
+        close(c->listen_fd_p1 - 1);
+        c->listen_fd_p1 = 0;
+        return WH_ERROR_ABORTED;
+    }
+
+    /* All good */
+    return 0;
+}
+
+int posixTransportUnix_RecvRequest(void* context,
+        uint16_t* out_size, void* data)
+{
+    int rc = 0;
+    posixTransportUnixServerContext* c = context;
+    if (    (c == NULL) ||
+            (c->listen_fd_p1 == 0) ) {
+        return WH_ERROR_BADARGS;
+    }
+
+    if (c->accept_fd_p1 == 0) {
+        rc = accept(c->listen_fd_p1 - 1, NULL, NULL);
+        if (rc < 0) {
+            switch (errno) {
+            case EAGAIN:
+            case EINTR:
+            case ECONNABORTED:
+                /* No client yet */
+                return WH_ERROR_NOTREADY;
+
+            default:
+                /* Other error. Assume fatal. */
+                return WH_ERROR_ABORTED;
+            }
+        }
+        if (posixTransportUnix_MakeNonBlocking(rc) != 0) {
+            close(rc);
+            return WH_ERROR_ABORTED;
+        }
+        c->accept_fd_p1 = rc + 1;
+    }
+
+    if (c->request_recv == 1) {
+        /* Already working on a request. */
+        return WH_ERROR_NOTREADY;
+    }
+
+    rc = posixTransportUnix_Recv(c->accept_fd_p1 - 1, out_size, data);
+    if (rc == 0) {
+        c->request_recv = 1;
+    }
+    return rc;
+}
+
+int posixTransportUnix_SendResponse(void* context,
+        uint16_t size, const void* data)
+{
+    int rc = 0;
+    posixTransportUnixServerContext* c = context;
+    if (    (c == NULL) ||
+            (c->listen_fd_p1 == 0) ||
+            (c->accept_fd_p1 == 0) ) {
+        return WH_ERROR_BADARGS;
+    }
+
+    if (c->request_recv == 0) {
+        return WH_ERROR_NOTREADY;
+    }
+
+    rc = posixTransportUnix_Send(c->accept_fd_p1 - 1, size, data);
+    if (rc == 0) {
+        c->request_recv = 0;
+    }
+    return rc;
+}
+
+int posixTransportUnix_WaitListen(void* context, uint32_t timeout_us)
+{
+    posixTransportUnixServerContext* c = context;
+    if (    (c == NULL) ||
+            (c->listen_fd_p1 == 0) ) {
+        return WH_ERROR_BADARGS;
+    }
+
+    if (c->accept_fd_p1 == 0) {
+        /* Wait for a client to connect */
+        return posixTransportUnix_Wait(c->listen_fd_p1 - 1, POLLIN,
+                timeout_us);
+    }
+    /* Wait to send the response, otherwise for a request */
+    return posixTransportUnix_Wait(c->accept_fd_p1 - 1,
+            (c->request_recv == 1) ? POLLOUT : POLLIN,
+            timeout_us);
+}
+
+int posixTransportUnix_CleanupListen(void* context)
+{
+    posixTransportUnixServerContext* c = context;
+    if (c == NULL) {
+        return WH_ERROR_BADARGS;
+    }
+
+    if (c->accept_fd_p1 != 0) {
+        close(c->accept_fd_p1 - 1);
+        c->accept_fd_p1 = 0;
+    }
+    if (c->listen_fd_p1 != 0) {
+        close(c->listen_fd_p1 - 1);
+        c->listen_fd_p1 = 0;
+        (void)unlink(c->server_addr.sun_path);
+    }
+
+    return 0;
+}
@@ -0,0 +1,113 @@
+/*
+ * port/posix/posix_transport_unix.h
+ *
+ * wolfHSM Transport binding using Unix domain sequenced packet sockets
+ */
+
+#ifndef PORT_POSIX_POSIX_TRANSPORT_UNIX_H_
+#define PORT_POSIX_POSIX_TRANSPORT_UNIX_H_
+
+/* Local IPC between processes on the same machine.  SOCK_SEQPACKET preserves
+ * message boundaries, so each packet is sent and received with one syscall
+ * and without a length prefix.  The client may send several requests before
+ * receiving their responses.  The server removes the socket file when it is
+ * initialized and cleaned up.
+ *
+ * Example usage:
+ *
+ * posixTransportUnixConfig ptucfg[1] = {{
+ *      .socket_path = "/tmp/wolfhsm.sock",
+ * }};
+ *
+ * whTransportClientCb ptuccb[1] = {PTU_CLIENT_CB};
+ * posixTransportUnixClientContext ptucc[1] = {0};
+ * whCommClientConfig ccc[1] = {{
+ *      .transport_cb = ptuccb,
+ *      .transport_context = ptucc,
+ *      .transport_config = ptucfg,
+ *      .client_id = 1234,
+ * }};
+ * whCommClient cc[1] = {0};
+ * wh_CommClient_Init(cc, ccc);
+ *
+ * whTransportServerCb ptuscb[1] = {PTU_SERVER_CB};
+ * posixTransportUnixServerContext ptusc[1] = {0};
+ * whCommServerConfig csc[1] = {{
+ *      .transport_cb = ptuscb,
+ *      .transport_context = ptusc,
+ *      .transport_config = ptucfg,
+ *      .server_id = 5678,
+ * }};
+ * whCommServer cs[1] = {0};
+ * wh_CommServer_Init(cs, csc);
+ *
+ */
+
+#include <stdint.h>
+#include <sys/un.h>
+
+#include "wolfhsm/wh_comm.h"        /* For WOLFHSM_COMM_MTU */
+#include "wolfhsm/wh_transport.h"
+
+#define PTU_PACKET_MAX_SIZE WOLFHSM_COMM_MTU
+
+/** Common configuration structure */
+typedef struct {
+    const char* socket_path;    /* Filesystem path of the server socket */
+} posixTransportUnixConfig;
+
+
+/** Client context and functions */
+
+typedef struct {
+    struct sockaddr_un server_addr;
+    int connect_fd_p1;      /* fd plus 1 so 0 is invalid */
+    int connected;
+    uint16_t request_count; /* Requests sent without a response yet */
+} posixTransportUnixClientContext;
+
+int posixTransportUnix_InitConnect(void* context, const void* config);
+int posixTransportUnix_SendRequest(void* context, uint16_t size,
+        const void* data);
+int posixTransportUnix_RecvResponse(void* context, uint16_t *out_size,
+        void* data);
+int posixTransportUnix_WaitConnect(void* context, uint32_t timeout_us);
+int posixTransportUnix_CleanupConnect(void* context);
+
+#define PTU_CLIENT_CB                               \
+{                                                   \
+    .Init =     posixTransportUnix_InitConnect,     \
+    .Send =     posixTransportUnix_SendRequest,     \
+    .Recv =     posixTransportUnix_RecvResponse,    \
+    .Cleanup =  posixTransportUnix_CleanupConnect,  \
+    .Wait =     posixTransportUnix_WaitConnect,     \
+}
+
+
+/** Server context and functions */
+
+typedef struct {
+    struct sockaddr_un server_addr;
+    int listen_fd_p1;       /* fd plus 1 so 0 is invalid */
+    int accept_fd_p1;       /* fd plus 1 so 0 is invalid */
+    int request_recv;
+} posixTransportUnixServerContext;
+
+int posixTransportUnix_InitListen(void* context, const void* config);
+int posixTransportUnix_RecvRequest(void* context, uint16_t *out_size,
+        void* data);
+int posixTransportUnix_SendResponse(void* context, uint16_t size,
+        const void* data);
+int posixTransportUnix_WaitListen(void* context, uint32_t timeout_us);
+int posixTransportUnix_CleanupListen(void* context);
+
+#define PTU_SERVER_CB                               \
+{                                                   \
+    .Init =     posixTransportUnix_InitListen,      \
+    .Recv =     posixTransportUnix_RecvRequest,     \
+    .Send =     posixTransportUnix_SendResponse,    \
+    .Cleanup =  posixTransportUnix_CleanupListen,   \
+    .Wait =     posixTransportUnix_WaitListen,      \
+}
+
+#endif /* PORT_POSIX_POSIX_TRANSPORT_UNIX_H_ */
@@ -119,6 +119,150 @@ int wh_Client_Cleanup(whClient* c)
     return 0;
 }
 
+int wh_Client_SubmitRequest(whClient* c, uint16_t type,
+        uint16_t size, const void* data,
+        whClientCompleteCb cb, void* arg, uint16_t* out_seq)
+{
+    int rc = 0;
+    int i = 0;
+    uint16_t seq = 0;
+    whClientRequest* req = NULL;
+
+    if (    (c == NULL) ||
+            ((size > 0) && (data == NULL)) ){
+        return WH_ERROR_BADARGS;
+    }
+
+    for (i = 0; i < WH_CLIENT_INFLIGHT_COUNT; i++) {
+        if (c->inflight[i].used == 0) {
+            req = &c->inflight[i];
+            break;
+        }
+    }
+    if (req == NULL) {
+        /* Poll to complete a request first */
+        return WH_ERROR_NOTREADY;
+    }
+
+    rc = wh_CommClient_SendRequest(c->comm,
+            WH_COMM_MAGIC_NATIVE, type, &seq,
+            size, data);
+    if (rc == 0) {
+        req->used = 1;
+        req->seq = seq;
+        req->type = type;
+        req->cb = cb;
+        req->arg = arg;
+        c->inflight_count++;
+        if (out_seq != NULL) *out_seq = seq;
+    }
+    return rc;
+}
+
+int wh_Client_Poll(whClient* c)
+{
+    int rc = 0;
+    int i = 0;
+    uint16_t magic = 0;
+    uint16_t type = 0;
+    uint16_t seq = 0;
+    uint16_t size = 0;
+    const void* data = NULL;
+    whClientCompleteCb cb = NULL;
+    void* arg = NULL;
+
+    if (c == NULL) {
+        return WH_ERROR_BADARGS;
+    }
+
+    rc = wh_CommClient_RecvResponseInPlace(c->comm,
+            &magic, &type, &seq, &size, &data);
+    if (rc == 0) {
+        for (i = 0; i < WH_CLIENT_INFLIGHT_COUNT; i++) {
+            if ((c->inflight[i].used != 0) && (c->inflight[i].seq == seq)) {
+                break;
+            }
+        }
+        if (i == WH_CLIENT_INFLIGHT_COUNT) {
+            /* Response to a request not in flight */
+            return WH_ERROR_ABORTED;
+        }
+
+        /* Free the entry before the callback so it may submit again */
+        cb = c->inflight[i].cb;
+        arg = c->inflight[i].arg;
+        memset(&c->inflight[i], 0, sizeof(c->inflight[i]));
+        c->inflight_count--;
+
+        if (cb != NULL) {
+            cb(c, arg, magic, type, seq, size, data);
+        }
+    }
+    return rc;
+}
+
+int wh_Client_Complete(whClient* c, uint16_t seq)
+{
+    int rc = 0;
+    int i = 0;
+
+    if (c == NULL) {
+        return WH_ERROR_BADARGS;
+    }
+
+    for (i = 0; i < WH_CLIENT_INFLIGHT_COUNT; i++) {
+        if ((c->inflight[i].used != 0) && (c->inflight[i].seq == seq)) {
+            break;
+        }
+    }
+    if (i == WH_CLIENT_INFLIGHT_COUNT) {
+        /* Already complete */
+        return 0;
+    }
+
+    rc = wh_Client_Poll(c);
+    if (rc == 0) {
+        /* The response may have been to a different request */
+        rc = (c->inflight[i].used == 0) ? 0 : WH_ERROR_NOTREADY;
+    }
+    return rc;
+}
+
+int wh_Client_EchoDecode(uint16_t magic, uint16_t type,
+        uint16_t size, const void* data,
+        uint16_t *out_size, void* out_data)
+{
+    const whMessageCommLenData* msg = data;
+
+    /* Validate response */
+    if (    (magic != WH_COMM_MAGIC_NATIVE) ||
+            (type != WOLFHSM_MESSAGE_TYPE_COMM_ECHO) ||
+            (size != sizeof(*msg)) ||
+            (msg == NULL) ||
+            (msg->len > sizeof(msg->data))) {
+        /* Invalid message */
+        return WH_ERROR_ABORTED;
+    }
+
+    if (out_size != NULL) {
+        *out_size = msg->len;
+    }
+    if (out_data != NULL) {
+        memcpy(out_data, msg->data, msg->len);
+    }
+    return 0;
+}
+
+/* Completion of the request sent by EchoRequest */
+static void _wh_Client_EchoComplete(whClient* c, void* arg,
+        uint16_t magic, uint16_t type, uint16_t seq,
+        uint16_t size, const void* data)
+{
+    (void)arg; (void)seq;
+    c->echo_rc = wh_Client_EchoDecode(magic, type, size, data,
+            c->echo_out_size, c->echo_out_data);
+}
+
 int wh_Client_EchoRequest(whClient* c, uint16_t size, const void* data)
 {
     int rc = 0;
@@ -135,9 +279,9 @@ int wh_Client_EchoRequest(whClient* c, uint16_t size, const void* data)
     msg.len = size;
     memcpy(msg.data, data, size);
 
-    rc = wh_CommClient_SendRequest(c->comm,
-            WH_COMM_MAGIC_NATIVE, req_type, &req_id,
-            sizeof(msg), &msg);
+    rc = wh_Client_SubmitRequest(c, req_type,
+            sizeof(msg), &msg,
+            _wh_Client_EchoComplete, NULL, &req_id);
     if (rc == 0) {
         c->last_req_id = req_id;
         c->last_type = req_type;
@@ -148,35 +292,23 @@ int wh_Client_EchoRequest(whClient* c, uint16_t size, const void* data)
 int wh_Client_EchoResponse(whClient* c, uint16_t *out_size, void* data)
 {
     int rc = 0;
-    whMessageCommLenData msg;
-    uint16_t resp_magic = 0;
-    uint16_t resp_id = 0;
-    uint16_t resp_type = 0;
-    uint16_t resp_size = 0;
 
     if (c == NULL){
         return WH_ERROR_BADARGS;
     }
+    if (c->last_type != WOLFHSM_MESSAGE_TYPE_COMM_ECHO) {
+        /* No request outstanding */
+        return WH_ERROR_BADARGS;
+    }
 
-    rc = wh_CommClient_RecvResponse(c->comm,
-            &resp_magic, &resp_type, &resp_id,
-            &resp_size, &msg);
+    c->echo_rc = WH_ERROR_ABORTED;
+    c->echo_out_size = out_size;
+    c->echo_out_data = data;
+    rc = wh_Client_Complete(c, c->last_req_id);
+    c->echo_out_size = NULL;
+    c->echo_out_data = NULL;
     if (rc == 0) {
-        /* Validate response */
-        if (    (resp_magic != WH_COMM_MAGIC_NATIVE) ||
-                (resp_type != WOLFHSM_MESSAGE_TYPE_COMM_ECHO) ||
-                (resp_id != c->last_req_id) ||
-                (resp_size != sizeof(msg)) ){
-            /* Invalid message */
-            return WH_ERROR_ABORTED;
-        }
-
-        if (out_size != NULL) {
-            *out_size = msg.len;
-        }
-        if (data != NULL) {
-            memcpy(data, msg.data, msg.len);
-        }
+        rc = c->echo_rc;
         c->last_req_id = 0;
         c->last_type = 0;
     }
@@ -187,17 +319,21 @@ int wh_Client_Echo(whClient* c, uint16_t snd_len, const void* snd_data,
         uint16_t *out_rcv_len, void* rcv_data)
 {
     int rc = 0;
+    uint32_t polls = 0;
     if (c == NULL) {
         return WH_ERROR_BADARGS;
     }
     do {
         rc = wh_Client_EchoRequest(c, snd_len, snd_data);
-    } while (rc == WH_ERROR_NOTREADY);
+    } while (   (rc == WH_ERROR_NOTREADY) &&
+                ((rc = wh_CommClient_Wait(c->comm, &polls)) == 0));
 
     if (rc == 0) {
+        polls = 0;
         do {
             rc = wh_Client_EchoResponse(c, out_rcv_len, rcv_data);
-        } while (rc == WH_ERROR_NOTREADY);
+        } while (   (rc == WH_ERROR_NOTREADY) &&
+                    ((rc = wh_CommClient_Wait(c->comm, &polls)) == 0));
     }
     return rc;
 }
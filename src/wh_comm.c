@@ -9,6 +9,7 @@
 
 #include "wolfhsm/wh_error.h"
 #include "wolfhsm/wh_comm.h"
+#include "wolfhsm/wh_stats.h"
 
 /** Client functions */
 
@@ -25,6 +26,10 @@ int wh_CommClient_Init(whCommClient* context, const whCommClientConfig* config)
     context->transport_cb = config->transport_cb;
     context->transport_context = config->transport_context;
     context->client_id = config->client_id;
+    context->wait_spins = (config->wait_spins != 0) ?
+            config->wait_spins : WOLFHSM_COMM_WAIT_SPINS;
+    context->wait_timeout_us = (config->wait_timeout_us != 0) ?
+            config->wait_timeout_us : WOLFHSM_COMM_WAIT_TIMEOUT_US;
     if (context->transport_cb->Init != NULL) {
         rc = context->transport_cb->Init(context->transport_context,
                 config->transport_config);
@@ -119,6 +124,73 @@ int wh_CommClient_RecvResponse(whCommClient* context,
     return rc;
 }
 
+int wh_CommClient_RecvResponseInPlace(whCommClient* context,
+        uint16_t* out_magic, uint16_t* out_type, uint16_t* out_seq,
+        uint16_t* out_size, const void** out_data)
+{
+    int rc = WH_ERROR_NOTREADY;
+    uint16_t size = sizeof(context->packet);
+
+    if (    (context == NULL) ||
+            (out_data == NULL)) {
+        return WH_ERROR_BADARGS;
+    }
+
+    if ((context->initialized != 0) &&
+        (context->transport_cb != NULL) &&
+        (context->transport_cb->Recv != NULL)) {
+
+        rc = context->transport_cb->Recv(context->transport_context,
+                &size,
+                context->packet);
+        if (rc == 0) {
+            if (size >= sizeof(*context->hdr)) {
+                uint16_t magic = context->hdr->magic;
+                if (out_magic != NULL) *out_magic = magic;
+                if (out_type != NULL) *out_type = wh_Translate16(magic,
+                        context->hdr->type);
+                if (out_seq != NULL) *out_seq = wh_Translate16(magic,
+                        context->hdr->seq);
+                if (out_size != NULL) *out_size = size - sizeof(*context->hdr);
+                *out_data = context->data;
+            } else {
+                /* Size is too small */
+                rc = WH_ERROR_ABORTED;
+            }
+        }
+    }
+    return rc;
+}
+
+int wh_CommClient_Wait(whCommClient* context, uint32_t* inout_polls)
+{
+    int rc = 0;
+
+    if (    (context == NULL) ||
+            (inout_polls == NULL)) {
+        return WH_ERROR_BADARGS;
+    }
+
+    WH_STATS_INC(notready_polls);
+    if (*inout_polls < context->wait_spins) {
+        /* Still spinning */
+        (*inout_polls)++;
+        return 0;
+    }
+
+    if ((context->initialized != 0) &&
+        (context->transport_cb != NULL) &&
+        (context->transport_cb->Wait != NULL)) {
+        rc = context->transport_cb->Wait(context->transport_context,
+                context->wait_timeout_us);
+        if (rc == WH_ERROR_NOTREADY) {
+            /* Timed out.  Poll again */
+            rc = 0;
+        }
+    }
+    return rc;
+}
+
 /* Inform the server that no further communications are necessary and any
  * unfinished requests can be ignored.
  */
@@ -155,6 +227,11 @@ int wh_CommServer_Init(whCommServer* context, const whCommServerConfig* config)
     context->transport_context = config->transport_context;
     context->transport_cb = config->transport_cb;
     context->server_id = config->server_id;
+    context->client_id = config->client_id;
+    context->wait_spins = (config->wait_spins != 0) ?
+            config->wait_spins : WOLFHSM_COMM_WAIT_SPINS;
+    context->wait_timeout_us = (config->wait_timeout_us != 0) ?
+            config->wait_timeout_us : WOLFHSM_COMM_WAIT_TIMEOUT_US;
     if (context->transport_cb->Init != NULL) {
         rc = context->transport_cb->Init(context->transport_context,
                 config->transport_config);
@@ -191,7 +268,7 @@ int wh_CommServer_RecvRequest(whCommServer* context,
                 context->packet);
         if (rc == 0) {
             if (size >= sizeof(*context->hdr)) {
-
+                WH_STATS_ADD(comm_rx_bytes, size);
                 size -= sizeof(*context->hdr);
                 magic = context->hdr->magic;
                 type = wh_Translate16(magic, context->hdr->type);
@@ -236,6 +313,174 @@ int wh_CommServer_SendResponse(whCommServer* context,
         rc = context->transport_cb->Send(context->transport_context,
                 sizeof(*(context->hdr)) + data_size,
                 context->packet);
+        if (rc == 0) {
+            WH_STATS_ADD(comm_tx_bytes, sizeof(*(context->hdr)) + data_size);
+        }
+    }
+    return rc;
+}
+
+int wh_CommServer_RecvRequestInPlace(whCommServer* context,
+        uint16_t* out_magic, uint16_t* out_type, uint16_t* out_seq,
+        uint16_t* out_size, const void** out_data)
+{
+    int rc = WH_ERROR_NOTREADY;
+    uint16_t size = sizeof(context->packet);
+    void* packet = NULL;
+    whHeader* hdr = NULL;
+
+    if (    (context == NULL) ||
+            (out_data == NULL)) {
+        return WH_ERROR_BADARGS;
+    }
+
+    if ((context->initialized == 0) ||
+        (context->transport_cb == NULL)) {
+        return rc;
+    }
+
+    if (context->transport_cb->RecvInPlace != NULL) {
+        rc = context->transport_cb->RecvInPlace(context->transport_context,
+                &size, &packet);
+    } else if (context->transport_cb->Recv != NULL) {
+        /* Fall back to receiving into the context buffer */
+        packet = context->packet;
+        rc = context->transport_cb->Recv(context->transport_context,
+                &size, packet);
+    }
+    if (rc == 0) {
+        if ((packet != NULL) && (size >= sizeof(*hdr))) {
+            WH_STATS_ADD(comm_rx_bytes, size);
+            hdr = (whHeader*)packet;
+            if (out_magic != NULL) *out_magic = hdr->magic;
+            if (out_type != NULL) *out_type = wh_Translate16(hdr->magic,
+                    hdr->type);
+            if (out_seq != NULL) *out_seq = wh_Translate16(hdr->magic,
+                    hdr->seq);
+            if (out_size != NULL) *out_size = size - sizeof(*hdr);
+            *out_data = (const uint8_t*)packet + sizeof(*hdr);
+        } else {
+            /* Size is too small */
+            rc = WH_ERROR_ABORTED;
+        }
+    }
+    return rc;
+}
+
+int wh_CommServer_GetResponseBuffer(whCommServer* context,
+        uint16_t* out_size, void** out_data)
+{
+    int rc = 0;
+    uint16_t size = 0;
+    void* packet = NULL;
+
+    if (    (context == NULL) ||
+            (out_data == NULL) ||
+            (context->initialized == 0) ||
+            (context->transport_cb == NULL)) {
+        return WH_ERROR_BADARGS;
+    }
+
+    if (    (context->transport_cb->GetSendBuffer != NULL) &&
+            (context->transport_cb->SendInPlace != NULL)) {
+        rc = context->transport_cb->GetSendBuffer(context->transport_context,
+                &size, &packet);
+        if ((rc == 0) && (size < sizeof(context->packet))) {
+            /* Transport buffer is too small for a full response */
+            packet = NULL;
+        }
+    }
+    if (rc == 0) {
+        if (packet == NULL) {
+            /* Build the response in the context buffer */
+            packet = context->packet;
+        }
+        context->resp_packet = packet;
+        *out_data = context->resp_packet + WOLFHSM_COMM_HEADER_LEN;
+        if (out_size != NULL) *out_size = WOLFHSM_COMM_DATA_LEN;
+    }
+    return rc;
+}
+
+int wh_CommServer_SendResponseInPlace(whCommServer* context,
+        uint16_t magic, uint16_t type, uint16_t seq,
+        uint16_t data_size)
+{
+    int rc = WH_ERROR_NOTREADY;
+    whHeader* hdr = NULL;
+
+    if (    (context == NULL) ||
+            (context->resp_packet == NULL) ||
+            (data_size > WOLFHSM_COMM_DATA_LEN)) {
+        return WH_ERROR_BADARGS;
+    }
+
+    if ((context->initialized != 0) &&
+        (context->transport_cb != NULL)) {
+
+        hdr = (whHeader*)context->resp_packet;
+        hdr->magic = magic;
+        hdr->type = wh_Translate16(magic, type);
+        hdr->seq = wh_Translate16(magic, seq);
+
+        if (context->resp_packet != context->packet) {
+            rc = context->transport_cb->SendInPlace(
+                    context->transport_context,
+                    sizeof(*hdr) + data_size);
+        } else if (context->transport_cb->Send != NULL) {
+            rc = context->transport_cb->Send(context->transport_context,
+                    sizeof(*hdr) + data_size,
+                    context->packet);
+        }
+        if (rc == 0) {
+            WH_STATS_ADD(comm_tx_bytes, sizeof(*hdr) + data_size);
+            context->resp_packet = NULL;
+        }
+    }
+    return rc;
+}
+
+int wh_CommServer_GetQueueDepth(whCommServer* context, uint16_t* out_depth)
+{
+    if (    (context == NULL) ||
+            (out_depth == NULL)) {
+        return WH_ERROR_BADARGS;
+    }
+
+    if (    (context->initialized == 0) ||
+            (context->transport_cb == NULL) ||
+            (context->transport_cb->GetQueueDepth == NULL)) {
+        return WH_ERROR_NOTFOUND;
+    }
+    return context->transport_cb->GetQueueDepth(context->transport_context,
+            out_depth);
+}
+
+int wh_CommServer_Wait(whCommServer* context, uint32_t* inout_polls)
+{
+    int rc = 0;
+
+    if (    (context == NULL) ||
+            (inout_polls == NULL)) {
+        return WH_ERROR_BADARGS;
+    }
+
+    WH_STATS_INC(notready_polls);
+    if (*inout_polls < context->wait_spins) {
+        /* Still spinning */
+        (*inout_polls)++;
+        return 0;
+    }
+
+    if ((context->initialized != 0) &&
+        (context->transport_cb != NULL) &&
+        (context->transport_cb->Wait != NULL)) {
+        rc = context->transport_cb->Wait(context->transport_context,
+                context->wait_timeout_us);
+        if (rc == WH_ERROR_NOTREADY) {
+            /* Timed out.  Poll again */
+            rc = 0;
+        }
     }
     return rc;
 }
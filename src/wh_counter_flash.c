@@ -0,0 +1,410 @@
+/*
+ * src/wh_counter_flash.c
+ *
+ * Non-volatile counters on top of generic flash layer
+ *
+ */
+
+#include <stddef.h>     /* For NULL */
+#include <string.h>     /* For memset, memcpy */
+
+#include "wolfhsm/wh_common.h"
+#include "wolfhsm/wh_error.h"
+#include "wolfhsm/wh_flash.h"
+#include "wolfhsm/wh_flash_unit.h"
+#include "wolfhsm/wh_counter.h"
+#include "wolfhsm/wh_counter_flash.h"
+
+/* On-flash layout of the header that commits a partition */
+typedef struct {
+    uint32_t epoch;         /* Incremented for each new partition */
+    uint32_t epoch_inv;     /* ~epoch.  Never matches when erased */
+} cfHeader;
+
+/* On-flash layout of one log unit, which adds one to counter id */
+typedef struct {
+    whCounterId id;
+    whCounterId id_inv;     /* ~id.  Never matches when erased */
+    uint32_t epoch;         /* Epoch of the partition header */
+} cfRecord;
+
+#define CF_UNITS_PER_BASES \
+        WHFU_BYTES2UNITS(sizeof(uint32_t) * WOLFHSM_NUM_COUNTERS)
+
+/* On-flash layout of the start of a Partition.  The log fills the rest */
+typedef struct {
+    union {
+        whFlashUnit unit;
+        cfHeader header;
+    } h;
+    union {
+        whFlashUnit units[CF_UNITS_PER_BASES];      /* Pad to units */
+        uint32_t values[WOLFHSM_NUM_COUNTERS];
+    } bases;
+} cfPartition;
+#define CF_PARTITION_HEADER_OFFSET WHFU_BYTES2UNITS(offsetof(cfPartition, h))
+#define CF_PARTITION_BASES_OFFSET WHFU_BYTES2UNITS(offsetof(cfPartition, bases))
+#define CF_PARTITION_LOG_OFFSET WHFU_BYTES2UNITS(sizeof(cfPartition))
+
+typedef union {
+    whFlashUnit unit;
+    cfRecord record;
+} cfRecordUnit;
+
+/** Local declarations */
+static uint32_t cfPartition_Offset(whCounterFlashContext* context,
+        int partition);
+static int cfFlash_Sync(whCounterFlashContext* context, uint32_t offset,
+        uint32_t count);
+static int cfPartition_Erase(whCounterFlashContext* context, int partition);
+static int cfPartition_ReadEpoch(whCounterFlashContext* context, int partition,
+        uint32_t* out_epoch);
+static int cfPartition_Format(whCounterFlashContext* context, int partition,
+        uint32_t epoch);
+static int cfPartition_Mount(whCounterFlashContext* context, int partition);
+static int cfPartition_Rotate(whCounterFlashContext* context);
+
+/** Local implementations */
+static uint32_t cfPartition_Offset(whCounterFlashContext* context,
+        int partition)
+{
+    return (uint32_t)partition * context->partition_units;
+}
+
+/* Make earlier programs to count units at offset durable using the optional
+ * Sync */
+static int cfFlash_Sync(whCounterFlashContext* context, uint32_t offset,
+        uint32_t count)
+{
+    if (context->cb->Sync == NULL) {
+        return 0;
+    }
+    return context->cb->Sync(context->flash, offset * WHFU_BYTES_PER_UNIT,
+            count * WHFU_BYTES_PER_UNIT);
+}
+
+static int cfPartition_Erase(whCounterFlashContext* context, int partition)
+{
+    return wh_FlashUnit_Erase(
+            context->cb,
+            context->flash,
+            cfPartition_Offset(context, partition),
+            context->partition_units);
+}
+
+/* Read the epoch of a committed partition.  Returns WH_ERROR_NOTFOUND if the
+ * header is not valid */
+static int cfPartition_ReadEpoch(whCounterFlashContext* context, int partition,
+        uint32_t* out_epoch)
+{
+    int ret = 0;
+    cfPartition p;
+
+    ret = wh_FlashUnit_Read(
+            context->cb,
+            context->flash,
+            cfPartition_Offset(context, partition) + CF_PARTITION_HEADER_OFFSET,
+            1,
+            &p.h.unit);
+    if (ret != 0) {
+        return ret;
+    }
+    if (p.h.header.epoch_inv != (uint32_t)~p.h.header.epoch) {
+        return WH_ERROR_NOTFOUND;
+    }
+    *out_epoch = p.h.header.epoch;
+    return 0;
+}
+
+/* Write the current values as the bases of the partition, then commit it with
+ * the header.  Nothing in the context is changed */
+static int cfPartition_Format(whCounterFlashContext* context, int partition,
+        uint32_t epoch)
+{
+    int ret = 0;
+    cfPartition p;
+
+    memset(&p, 0, sizeof(p));
+    p.h.header.epoch = epoch;
+    p.h.header.epoch_inv = ~epoch;
+    memcpy(p.bases.values, context->values, sizeof(p.bases.values));
+
+    ret = wh_FlashUnit_BlankCheck(
+            context->cb,
+            context->flash,
+            cfPartition_Offset(context, partition),
+            context->partition_units);
+    if (ret == WH_ERROR_NOTBLANK) {
+        ret = cfPartition_Erase(context, partition);
+    }
+    if (ret == 0) {
+        ret = wh_FlashUnit_Program(
+                context->cb,
+                context->flash,
+                cfPartition_Offset(context, partition) +
+                    CF_PARTITION_BASES_OFFSET,
+                CF_UNITS_PER_BASES,
+                p.bases.units);
+    }
+    if (ret == 0) {
+        ret = cfFlash_Sync(context, cfPartition_Offset(context, partition),
+                context->partition_units);
+    }
+    if (ret == 0) {
+        /* The header is programmed last to commit the bases */
+        ret = wh_FlashUnit_Program(
+                context->cb,
+                context->flash,
+                cfPartition_Offset(context, partition) +
+                    CF_PARTITION_HEADER_OFFSET,
+                1,
+                &p.h.unit);
+    }
+    if (ret == 0) {
+        ret = cfFlash_Sync(context, cfPartition_Offset(context, partition),
+                context->partition_units);
+    }
+    return ret;
+}
+
+/* Load the bases of the committed partition and add each logged increment.
+ * The first blank log unit is where the next increment is programmed */
+static int cfPartition_Mount(whCounterFlashContext* context, int partition)
+{
+    int ret = 0;
+    uint32_t base = cfPartition_Offset(context, partition);
+    uint32_t offset = 0;
+    uint32_t count = 0;
+    uint32_t i = 0;
+    cfPartition p;
+    cfRecordUnit log[CF_LOG_READ_UNITS];
+    const cfRecord* r = NULL;
+
+    ret = wh_FlashUnit_Read(
+            context->cb,
+            context->flash,
+            base + CF_PARTITION_BASES_OFFSET,
+            CF_UNITS_PER_BASES,
+            p.bases.units);
+    if (ret != 0) {
+        return ret;
+    }
+    memcpy(context->values, p.bases.values, sizeof(context->values));
+
+    for (   offset = CF_PARTITION_LOG_OFFSET;
+            offset < context->partition_units;
+            offset += count) {
+        count = context->partition_units - offset;
+        if (count > CF_LOG_READ_UNITS) {
+            count = CF_LOG_READ_UNITS;
+        }
+        /* cfRecordUnit is exactly one unit */
+        ret = wh_FlashUnit_Read(context->cb, context->flash, base + offset,
+                count, &log[0].unit);
+        if (ret != 0) {
+            return ret;
+        }
+        for (i = 0; i < count; i++) {
+            r = &log[i].record;
+            if (    ((whCounterId)(r->id_inv ^ r->id) ==
+                        (whCounterId)~(whCounterId)0) &&
+                    (r->id < WOLFHSM_NUM_COUNTERS) &&
+                    (r->epoch == context->epoch)) {
+                if (context->values[r->id] != UINT32_MAX) {
+                    context->values[r->id]++;
+                }
+                continue;
+            }
+
+            /* Either the end of the log or an interrupted program to skip */
+            ret = wh_FlashUnit_BlankCheck(context->cb, context->flash,
+                    base + offset + i, 1);
+            if (ret == 0) {
+                context->next_log = offset + i;
+                return 0;
+            }
+            if (ret != WH_ERROR_NOTBLANK) {
+                return ret;
+            }
+        }
+    }
+    context->next_log = context->partition_units;
+    return 0;
+}
+
+/* Move the current values to the other partition and erase the full one */
+static int cfPartition_Rotate(whCounterFlashContext* context)
+{
+    int ret = 0;
+    int old_part = context->active;
+
+    ret = cfPartition_Format(context, !old_part, context->epoch + 1);
+    if (ret == 0) {
+        context->active = !old_part;
+        context->epoch++;
+        context->next_log = CF_PARTITION_LOG_OFFSET;
+
+        /* A reset before this completes is handled by Init */
+        ret = cfPartition_Erase(context, old_part);
+    }
+    return ret;
+}
+
+int wh_CounterFlash_Init(void* c, const void* cf)
+{
+    whCounterFlashContext* context = c;
+    const whCounterFlashConfig* config = cf;
+    int ret = 0;
+    int valid[2] = {0};
+    uint32_t epochs[2] = {0};
+    int i = 0;
+
+    if (    (context == NULL) ||
+            (config == NULL) ||
+            (config->cb == NULL)) {
+        return WH_ERROR_BADARGS;
+    }
+
+    if (config->cb->Init != NULL) {
+        ret = config->cb->Init(config->context, config->config);
+    }
+    if (ret != 0) {
+        return ret;
+    }
+
+    memset(context, 0, sizeof(*context));
+    context->cb = config->cb;
+    context->flash = config->context;
+    if (context->cb->PartitionSize != NULL) {
+        context->partition_units =
+                context->cb->PartitionSize(context->flash) /
+                WHFU_BYTES_PER_UNIT;
+    }
+    if (context->partition_units <= CF_PARTITION_LOG_OFFSET) {
+        /* No room for the log */
+        return WH_ERROR_BADARGS;
+    }
+
+    for (i = 0; i < 2; i++) {
+        (void)wh_FlashUnit_WriteUnlock(context->cb, context->flash,
+                cfPartition_Offset(context, i), context->partition_units);
+        ret = cfPartition_ReadEpoch(context, i, &epochs[i]);
+        if (ret == 0) {
+            valid[i] = 1;
+        } else if (ret != WH_ERROR_NOTFOUND) {
+            return ret;
+        }
+    }
+    ret = 0;
+
+    /* The partition with the larger epoch is active.  Both are valid only
+     * when a reset interrupted the erase of the old one */
+    if (valid[0] && valid[1]) {
+        context->active = (epochs[1] > epochs[0]);
+        ret = cfPartition_Erase(context, !context->active);
+    } else if (valid[0] || valid[1]) {
+        context->active = valid[1];
+    } else {
+        /* Neither is committed.  Start with all counters at 0 */
+        context->active = 0;
+        epochs[0] = 0;
+        ret = cfPartition_Format(context, 0, 0);
+    }
+    if (ret == 0) {
+        context->epoch = epochs[context->active];
+        ret = cfPartition_Mount(context, context->active);
+    }
+    if (ret == 0) {
+        context->initialized = 1;
+    }
+    return ret;
+}
+
+int wh_CounterFlash_Cleanup(void* c)
+{
+    whCounterFlashContext* context = c;
+    int rc = 0;
+    int i = 0;
+
+    if (context == NULL) {
+        return WH_ERROR_BADARGS;
+    }
+    if (context->initialized == 0) {
+        /* Already cleaned up */
+        return 0;
+    }
+
+    /* Ignore errors here */
+    for (i = 0; i < 2; i++) {
+        (void)wh_FlashUnit_WriteLock(context->cb, context->flash,
+                cfPartition_Offset(context, i), context->partition_units);
+    }
+
+    if (context->cb->Cleanup != NULL) {
+        rc = context->cb->Cleanup(context->flash);
+    }
+    context->initialized = 0;
+    return rc;
+}
+
+int wh_CounterFlash_Read(void* c, whCounterId id, uint32_t* out_value)
+{
+    whCounterFlashContext* context = c;
+
+    if (    (context == NULL) ||
+            (context->initialized == 0) ||
+            (id >= WOLFHSM_NUM_COUNTERS) ||
+            (out_value == NULL)) {
+        return WH_ERROR_BADARGS;
+    }
+    *out_value = context->values[id];
+    return 0;
+}
+
+int wh_CounterFlash_Increment(void* c, whCounterId id, uint32_t* out_value)
+{
+    whCounterFlashContext* context = c;
+    int ret = 0;
+    uint32_t offset = 0;
+    cfRecordUnit r;
+
+    if (    (context == NULL) ||
+            (context->initialized == 0) ||
+            (id >= WOLFHSM_NUM_COUNTERS)) {
+        return WH_ERROR_BADARGS;
+    }
+    if (context->values[id] == UINT32_MAX) {
+        return WH_ERROR_NOSPACE;
+    }
+
+    do {
+        if (context->next_log >= context->partition_units) {
+            ret = cfPartition_Rotate(context);
+            if (ret != 0) {
+                return ret;
+            }
+        }
+        memset(&r, 0, sizeof(r));
+        r.record.id = id;
+        r.record.id_inv = (whCounterId)~id;
+        r.record.epoch = context->epoch;
+
+        /* Each unit is tried once.  Skip units an interrupted program left */
+        offset = cfPartition_Offset(context, context->active) +
+                context->next_log;
+        ret = wh_FlashUnit_Program(context->cb, context->flash, offset, 1,
+                &r.unit);
+        context->next_log++;
+    } while (ret == WH_ERROR_NOTBLANK);
+
+    if (ret == 0) {
+        ret = cfFlash_Sync(context, offset, 1);
+    }
+    if (ret == 0) {
+        context->values[id]++;
+        if (out_value != NULL) {
+            *out_value = context->values[id];
+        }
+    }
+    return ret;
+}
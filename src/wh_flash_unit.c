@@ -7,11 +7,23 @@
  */
 
 #include <stddef.h>     /* For NULL */
+#include <stdint.h>     /* For uintptr_t */
 #include <string.h>     /* For memset, memcpy */
 
+#if !defined(WHFU_NO_SIMD)
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#define WHFU_SIMD_SSE2
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define WHFU_SIMD_NEON
+#endif
+#endif
+
 #include "wolfhsm/wh_error.h"
 #include "wolfhsm/wh_flash.h"
 #include "wolfhsm/wh_flash_unit.h"
+#include "wolfhsm/wh_stats.h"
 
 /** Helper functions based on units rather than bytes */
 
@@ -46,35 +58,53 @@ int wh_FlashUnit_Read(const whFlashCb* cb, void* context,
     if ((cb == NULL) || (cb->Read == NULL)) {
         return WH_ERROR_BADARGS;
     }
+    WH_STATS_INC(flash_reads);
+    WH_STATS_ADD(flash_read_bytes, byte_count);
     return cb->Read(context, byte_offset, byte_count,(uint8_t*) data);
 }
 
 /* Program from data count units starting at offset */
 int wh_FlashUnit_Program(const whFlashCb* cb, void* context,
         uint32_t offset, uint32_t count, const whFlashUnit* data)
+{
+    return wh_FlashUnit_ProgramEx(cb, context, offset, count, data,
+            WHFU_PROGRAM_DEFAULT);
+}
+
+int wh_FlashUnit_ProgramEx(const whFlashCb* cb, void* context,
+        uint32_t offset, uint32_t count, const whFlashUnit* data,
+        uint32_t flags)
 {
     uint32_t byte_offset = offset * WHFU_BYTES_PER_UNIT;
     uint32_t byte_count = count * WHFU_BYTES_PER_UNIT;
     int ret = 0;
     if (    (cb == NULL) ||
-            (cb->BlankCheck == NULL) ||
             (cb->Program == NULL) ||
-            (cb->Verify == NULL)) {
+            ((flags & WHFU_PROGRAM_BLANKCHECK) && (cb->BlankCheck == NULL)) ||
+            ((flags & WHFU_PROGRAM_VERIFY) && (cb->Verify == NULL))) {
             return WH_ERROR_BADARGS;
     }
     /* Blank check first */
-    ret = cb->BlankCheck(context,
-            byte_offset,
-            byte_count);
+    if (flags & WHFU_PROGRAM_BLANKCHECK) {
+        WH_STATS_INC(flash_blankchecks);
+        WH_STATS_ADD(flash_blankcheck_bytes, byte_count);
+        ret = cb->BlankCheck(context,
+                byte_offset,
+                byte_count);
+    }
     if (ret == 0) {
         /* Program the output data */
+        WH_STATS_INC(flash_programs);
+        WH_STATS_ADD(flash_program_bytes, byte_count);
         ret = cb->Program(
                 context,
                 byte_offset,
                 byte_count,
                 (uint8_t*) data);
-        if (ret == 0) {
+        if ((ret == 0) && (flags & WHFU_PROGRAM_VERIFY)) {
             /* Verify the programming was successful */
+            WH_STATS_INC(flash_verifies);
+            WH_STATS_ADD(flash_verify_bytes, byte_count);
             ret = cb->Verify(
                     context,
                     byte_offset,
@@ -93,6 +123,8 @@ int wh_FlashUnit_BlankCheck(const whFlashCb* cb, void* context,
     if ((cb == NULL) || (cb->BlankCheck == NULL)) {
         return WH_ERROR_BADARGS;
     }
+    WH_STATS_INC(flash_blankchecks);
+    WH_STATS_ADD(flash_blankcheck_bytes, byte_count);
     return cb->BlankCheck(context, byte_offset, byte_count);
 }
 
@@ -110,15 +142,50 @@ int wh_FlashUnit_Erase(const whFlashCb* cb, void* context,
 
     if (count == 0) return 0;
 
+    WH_STATS_INC(flash_erases);
+    WH_STATS_ADD(flash_erase_bytes, byte_count);
     int ret = cb->Erase(context, byte_offset, byte_count);
 
     if (ret == 0) {
+        WH_STATS_INC(flash_blankchecks);
+        WH_STATS_ADD(flash_blankcheck_bytes, byte_count);
         ret = cb->BlankCheck(context, byte_offset, byte_count);
     }
 
     return ret;
 }
 
+int wh_FlashUnit_Copy(const whFlashCb* cb, void* context,
+        uint32_t dst_offset, uint32_t src_offset, uint32_t count,
+        uint32_t flags)
+{
+    uint32_t byte_dst = dst_offset * WHFU_BYTES_PER_UNIT;
+    uint32_t byte_src = src_offset * WHFU_BYTES_PER_UNIT;
+    uint32_t byte_count = count * WHFU_BYTES_PER_UNIT;
+    int ret = 0;
+
+    if (    (cb == NULL) ||
+            (cb->Copy == NULL) ||
+            ((flags & WHFU_PROGRAM_BLANKCHECK) && (cb->BlankCheck == NULL))) {
+        return WH_ERROR_BADARGS;
+    }
+
+    if (count == 0) return 0;
+
+    /* Blank check first.  Copy verifies the destination */
+    if (flags & WHFU_PROGRAM_BLANKCHECK) {
+        WH_STATS_INC(flash_blankchecks);
+        WH_STATS_ADD(flash_blankcheck_bytes, byte_count);
+        ret = cb->BlankCheck(context, byte_dst, byte_count);
+    }
+    if (ret == 0) {
+        WH_STATS_INC(flash_programs);
+        WH_STATS_ADD(flash_program_bytes, byte_count);
+        ret = cb->Copy(context, byte_dst, byte_src, byte_count);
+    }
+    return ret;
+}
+
 /** Helper functions to use buffered reads and writes for bytes */
 
 uint32_t wh_FlashUnit_Bytes2Units(uint32_t bytes)
@@ -146,9 +213,9 @@ int wh_FlashUnit_ReadBytes(const whFlashCb* cb, void* context,
     if (offset_rem != 0) {
         ret = wh_FlashUnit_Read(cb, context, offset_units, 1, &buffer.unit);
         if (ret == 0) {
-            int this_size = offset_rem;
+            uint32_t this_size = WHFU_BYTES_PER_UNIT - offset_rem;
             if (data_len < this_size) this_size = data_len;
-            memcpy(data, &buffer.bytes[WHFU_BYTES_PER_UNIT - offset_rem], this_size);
+            memcpy(data, &buffer.bytes[offset_rem], this_size);
             data += this_size;
             data_len -= this_size;
             offset_units++;
@@ -178,6 +245,14 @@ int wh_FlashUnit_ReadBytes(const whFlashCb* cb, void* context,
 
 int wh_FlashUnit_ProgramBytes(const whFlashCb* cb, void* context,
         uint32_t byte_offset, uint32_t byte_count, const uint8_t* data)
+{
+    return wh_FlashUnit_ProgramBytesEx(cb, context, byte_offset, byte_count,
+            data, WHFU_PROGRAM_DEFAULT);
+}
+
+int wh_FlashUnit_ProgramBytesEx(const whFlashCb* cb, void* context,
+        uint32_t byte_offset, uint32_t byte_count, const uint8_t* data,
+        uint32_t flags)
 {
     int ret = 0;
     whFlashUnitBuffer buffer = {0};
@@ -194,16 +269,165 @@ int wh_FlashUnit_ProgramBytes(const whFlashCb* cb, void* context,
     }
 
     /* Aligned programming */
-    ret = wh_FlashUnit_Program(cb, context,
-            offset, count, (whFlashUnit*)data);
+    ret = wh_FlashUnit_ProgramEx(cb, context,
+            offset, count, (whFlashUnit*)data, flags);
 
     /* Final partial unit */
     if ((ret == 0) && (rem != 0)) {
         /* Short writes are filled with erased value */
         data = data + count * WHFU_BYTES_PER_UNIT;
         memcpy(buffer.bytes, data, rem);
-        ret = wh_FlashUnit_Program(cb, context,
-                offset + count, 1, &buffer.unit);
+        ret = wh_FlashUnit_ProgramEx(cb, context,
+                offset + count, 1, &buffer.unit, flags);
     }
     return ret;
 }
+
+/** Memory kernels */
+
+/* Bytes per SIMD block, checked as 4 vectors before testing for a mismatch */
+#define WHFU_SIMD_BLOCK 64
+
+int wh_FlashUnit_MemBlankCheck(const uint8_t* data, uint32_t size,
+        uint8_t erased_byte)
+{
+    const uint64_t pattern = 0x0101010101010101ull * erased_byte;
+    uint64_t word = 0;
+
+    if ((data == NULL) && (size != 0)) {
+        return WH_ERROR_BADARGS;
+    }
+
+    /* Bytes up to word alignment */
+    while ((size > 0) && (((uintptr_t)data % sizeof(word)) != 0)) {
+        if (*data != erased_byte) return WH_ERROR_NOTBLANK;
+        data++;
+        size--;
+    }
+
+#if defined(WHFU_SIMD_SSE2)
+    {
+        const __m128i vpattern = _mm_set1_epi8((char)erased_byte);
+        while (size >= WHFU_SIMD_BLOCK) {
+            __m128i v0 = _mm_cmpeq_epi8(
+                    _mm_loadu_si128((const __m128i*)data), vpattern);
+            __m128i v1 = _mm_cmpeq_epi8(
+                    _mm_loadu_si128((const __m128i*)(data + 16)), vpattern);
+            __m128i v2 = _mm_cmpeq_epi8(
+                    _mm_loadu_si128((const __m128i*)(data + 32)), vpattern);
+            __m128i v3 = _mm_cmpeq_epi8(
+                    _mm_loadu_si128((const __m128i*)(data + 48)), vpattern);
+            v0 = _mm_and_si128(_mm_and_si128(v0, v1), _mm_and_si128(v2, v3));
+            if (_mm_movemask_epi8(v0) != 0xFFFF) return WH_ERROR_NOTBLANK;
+            data += WHFU_SIMD_BLOCK;
+            size -= WHFU_SIMD_BLOCK;
+        }
+    }
+#elif defined(WHFU_SIMD_NEON)
+    {
+        const uint8x16_t vpattern = vdupq_n_u8(erased_byte);
+        while (size >= WHFU_SIMD_BLOCK) {
+            uint8x16_t v0 = veorq_u8(vld1q_u8(data), vpattern);
+            uint8x16_t v1 = veorq_u8(vld1q_u8(data + 16), vpattern);
+            uint8x16_t v2 = veorq_u8(vld1q_u8(data + 32), vpattern);
+            uint8x16_t v3 = veorq_u8(vld1q_u8(data + 48), vpattern);
+            uint64x2_t v = vreinterpretq_u64_u8(
+                    vorrq_u8(vorrq_u8(v0, v1), vorrq_u8(v2, v3)));
+            if ((vgetq_lane_u64(v, 0) | vgetq_lane_u64(v, 1)) != 0) {
+                return WH_ERROR_NOTBLANK;
+            }
+            data += WHFU_SIMD_BLOCK;
+            size -= WHFU_SIMD_BLOCK;
+        }
+    }
+#endif
+
+    while (size >= sizeof(word)) {
+        memcpy(&word, data, sizeof(word));
+        if (word != pattern) return WH_ERROR_NOTBLANK;
+        data += sizeof(word);
+        size -= sizeof(word);
+    }
+
+    /* Trailing bytes */
+    while (size > 0) {
+        if (*data != erased_byte) return WH_ERROR_NOTBLANK;
+        data++;
+        size--;
+    }
+    return 0;
+}
+
+int wh_FlashUnit_MemVerify(const uint8_t* flash, uint32_t size,
+        const uint8_t* data)
+{
+    uint64_t word = 0;
+    uint64_t expected = 0;
+
+    if (((flash == NULL) || (data == NULL)) && (size != 0)) {
+        return WH_ERROR_BADARGS;
+    }
+
+    /* Bytes up to word alignment of the flash */
+    while ((size > 0) && (((uintptr_t)flash % sizeof(word)) != 0)) {
+        if (*flash != *data) return WH_ERROR_NOTVERIFIED;
+        flash++;
+        data++;
+        size--;
+    }
+
+#if defined(WHFU_SIMD_SSE2)
+    while (size >= WHFU_SIMD_BLOCK) {
+        __m128i v0 = _mm_cmpeq_epi8(
+                _mm_loadu_si128((const __m128i*)flash),
+                _mm_loadu_si128((const __m128i*)data));
+        __m128i v1 = _mm_cmpeq_epi8(
+                _mm_loadu_si128((const __m128i*)(flash + 16)),
+                _mm_loadu_si128((const __m128i*)(data + 16)));
+        __m128i v2 = _mm_cmpeq_epi8(
+                _mm_loadu_si128((const __m128i*)(flash + 32)),
+                _mm_loadu_si128((const __m128i*)(data + 32)));
+        __m128i v3 = _mm_cmpeq_epi8(
+                _mm_loadu_si128((const __m128i*)(flash + 48)),
+                _mm_loadu_si128((const __m128i*)(data + 48)));
+        v0 = _mm_and_si128(_mm_and_si128(v0, v1), _mm_and_si128(v2, v3));
+        if (_mm_movemask_epi8(v0) != 0xFFFF) return WH_ERROR_NOTVERIFIED;
+        flash += WHFU_SIMD_BLOCK;
+        data += WHFU_SIMD_BLOCK;
+        size -= WHFU_SIMD_BLOCK;
+    }
+#elif defined(WHFU_SIMD_NEON)
+    while (size >= WHFU_SIMD_BLOCK) {
+        uint8x16_t v0 = veorq_u8(vld1q_u8(flash), vld1q_u8(data));
+        uint8x16_t v1 = veorq_u8(vld1q_u8(flash + 16), vld1q_u8(data + 16));
+        uint8x16_t v2 = veorq_u8(vld1q_u8(flash + 32), vld1q_u8(data + 32));
+        uint8x16_t v3 = veorq_u8(vld1q_u8(flash + 48), vld1q_u8(data + 48));
+        uint64x2_t v = vreinterpretq_u64_u8(
+                vorrq_u8(vorrq_u8(v0, v1), vorrq_u8(v2, v3)));
+        if ((vgetq_lane_u64(v, 0) | vgetq_lane_u64(v, 1)) != 0) {
+            return WH_ERROR_NOTVERIFIED;
+        }
+        flash += WHFU_SIMD_BLOCK;
+        data += WHFU_SIMD_BLOCK;
+        size -= WHFU_SIMD_BLOCK;
+    }
+#endif
+
+    while (size >= sizeof(word)) {
+        memcpy(&word, flash, sizeof(word));
+        memcpy(&expected, data, sizeof(expected));
+        if (word != expected) return WH_ERROR_NOTVERIFIED;
+        flash += sizeof(word);
+        data += sizeof(word);
+        size -= sizeof(word);
+    }
+
+    /* Trailing bytes */
+    while (size > 0) {
+        if (*flash != *data) return WH_ERROR_NOTVERIFIED;
+        flash++;
+        data++;
+        size--;
+    }
+    return 0;
+}
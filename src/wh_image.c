@@ -0,0 +1,359 @@
+/*
+ * src/wh_image.c
+ *
+ * Boot image verification with double buffered payload reads
+ */
+
+#include <stdint.h>
+#include <stddef.h>     /* For NULL, offsetof */
+#include <string.h>     /* For memset, memcpy */
+
+#include "wolfhsm/wh_common.h"
+#include "wolfhsm/wh_error.h"
+#include "wolfhsm/wh_nvm.h"
+#include "wolfhsm/wh_image.h"
+
+/* Record of the manifests verified at an epoch, stored as an NVM object.
+ * Any client with NVM access could write the object, so it is authenticated
+ * with the image verification key */
+typedef struct {
+    uint32_t epoch;
+    uint32_t verified;      /* Bit i set if manifest i was verified */
+    uint8_t manifest_cmac[WOLFHSM_NUM_MANIFESTS][WOLFHSM_MANIFEST_CMAC_LEN];
+    uint8_t record_cmac[WOLFHSM_MANIFEST_CMAC_LEN];   /* CMAC of the above */
+} whImageRecord;
+
+/* Position of a chunk within the payloads being verified */
+typedef struct {
+    int seg;                /* Index into the list of payloads to verify */
+    uint32_t offset;
+    uint32_t len;
+} whImageChunk;
+
+/** Local declarations */
+static int whImage_MacEqual(const uint8_t* a, const uint8_t* b);
+static int whImage_CheckManifest(whImageContext* context,
+        const whManifest_ex* manifest);
+static int whImage_NextChunk(const whManifest_ex* list, const int* segs,
+        int seg_count, const whImageChunk* cur, whImageChunk* out_next);
+static int whImage_VerifyPayloads(whImageContext* context,
+        const whManifest_ex* list, const int* segs, int seg_count,
+        uint32_t* inout_verified);
+static int whImage_RecordMac(whImageContext* context,
+        const whImageRecord* record, uint8_t* out_mac);
+static void whImage_LoadRecord(whImageContext* context,
+        whImageRecord* out_record);
+static int whImage_StoreRecord(whImageContext* context,
+        whImageRecord* record);
+
+/** Local implementations */
+/* Compare MACs without an early exit */
+static int whImage_MacEqual(const uint8_t* a, const uint8_t* b)
+{
+    uint8_t diff = 0;
+    int i = 0;
+
+    for (i = 0; i < WOLFHSM_MANIFEST_CMAC_LEN; i++) {
+        diff |= a[i] ^ b[i];
+    }
+    return diff == 0;
+}
+
+static int whImage_CheckManifest(whImageContext* context,
+        const whManifest_ex* manifest)
+{
+    uint8_t mac[WOLFHSM_MANIFEST_CMAC_LEN];
+    int rc = context->cmac_cb->Init(context->cmac_context);
+
+    if (rc == 0) {
+        rc = context->cmac_cb->Update(context->cmac_context,
+                (const uint8_t*)manifest,
+                offsetof(whManifest_ex, manifest_cmac));
+    }
+    if (rc == 0) {
+        rc = context->cmac_cb->Final(context->cmac_context, mac);
+    }
+    if ((rc == 0) && (whImage_MacEqual(mac, manifest->manifest_cmac) == 0)) {
+        rc = WH_ERROR_NOTVERIFIED;
+    }
+    return rc;
+}
+
+/* Find the chunk after cur, moving to the first chunk of the next payload at
+ * the end of one.  An empty payload is a single chunk of 0 bytes.  Returns 0
+ * after the last chunk of the last payload */
+static int whImage_NextChunk(const whManifest_ex* list, const int* segs,
+        int seg_count, const whImageChunk* cur, whImageChunk* out_next)
+{
+    whImageChunk next = *cur;
+    uint32_t payload_len = 0;
+
+    next.offset += cur->len;
+    if ((next.seg < 0) || (next.offset >= list[segs[next.seg]].payload_len)) {
+        next.seg++;
+        next.offset = 0;
+    }
+    if (next.seg >= seg_count) {
+        return 0;
+    }
+    payload_len = list[segs[next.seg]].payload_len;
+    next.len = payload_len - next.offset;
+    if (next.len > WH_IMAGE_CHUNK_SIZE) {
+        next.len = WH_IMAGE_CHUNK_SIZE;
+    }
+    *out_next = next;
+    return 1;
+}
+
+/* CMAC the payloads of list[segs[0..seg_count-1]] in one pipeline, setting
+ * the bit of each one that matches its payload_cmac */
+static int whImage_VerifyPayloads(whImageContext* context,
+        const whManifest_ex* list, const int* segs, int seg_count,
+        uint32_t* inout_verified)
+{
+    const whManifest_ex* manifest = NULL;
+    uint8_t mac[WOLFHSM_MANIFEST_CMAC_LEN];
+    whImageChunk cur = {-1, 0, 0};
+    whImageChunk next = {0};
+    const uint8_t* data = NULL;
+    int have_next = 0;
+    int buf = 0;
+    int rc = 0;
+
+    have_next = whImage_NextChunk(list, segs, seg_count, &cur, &next);
+    if (have_next == 0) {
+        return 0;
+    }
+    cur = next;
+    if ((context->read_cb != NULL) && (cur.len != 0)) {
+        rc = context->read_cb->ReadStart(context->read_context,
+                list[segs[cur.seg]].payload_start,
+                cur.len, (uint8_t*)context->buffer[buf]);
+    }
+    if (rc == 0) {
+        rc = context->cmac_cb->Init(context->cmac_context);
+    }
+
+    while (rc == 0) {
+        manifest = &list[segs[cur.seg]];
+        if (context->read_cb != NULL) {
+            if (cur.len != 0) {
+                rc = context->read_cb->ReadWait(context->read_context);
+            }
+            data = (const uint8_t*)context->buffer[buf];
+        } else {
+            data = manifest->payload_start + cur.offset;
+        }
+
+        /* Start reading the next chunk before this one is in the CMAC */
+        have_next = whImage_NextChunk(list, segs, seg_count, &cur, &next);
+        if (    (rc == 0) && (have_next != 0) &&
+                (context->read_cb != NULL) && (next.len != 0)) {
+            rc = context->read_cb->ReadStart(context->read_context,
+                    list[segs[next.seg]].payload_start + next.offset,
+                    next.len, (uint8_t*)context->buffer[buf ^ 1]);
+        }
+        if ((rc == 0) && (cur.len != 0)) {
+            rc = context->cmac_cb->Update(context->cmac_context, data,
+                    cur.len);
+            context->chunks++;
+        }
+
+        if (    (rc == 0) &&
+                ((have_next == 0) || (next.seg != cur.seg))) {
+            /* Last chunk of this payload */
+            rc = context->cmac_cb->Final(context->cmac_context, mac);
+            if (    (rc == 0) &&
+                    (whImage_MacEqual(mac, manifest->payload_cmac) != 0)) {
+                *inout_verified |= 1ul << segs[cur.seg];
+            }
+            if ((rc == 0) && (have_next != 0)) {
+                rc = context->cmac_cb->Init(context->cmac_context);
+            }
+        }
+        if (have_next == 0) {
+            break;
+        }
+        cur = next;
+        buf ^= 1;
+    }
+
+    if ((rc != 0) && (context->read_cb != NULL)) {
+        /* Do not leave a copy running into the buffers */
+        (void)context->read_cb->ReadWait(context->read_context);
+    }
+    return rc;
+}
+
+static int whImage_RecordMac(whImageContext* context,
+        const whImageRecord* record, uint8_t* out_mac)
+{
+    int rc = context->cmac_cb->Init(context->cmac_context);
+
+    if (rc == 0) {
+        rc = context->cmac_cb->Update(context->cmac_context,
+                (const uint8_t*)record,
+                offsetof(whImageRecord, record_cmac));
+    }
+    if (rc == 0) {
+        rc = context->cmac_cb->Final(context->cmac_context, out_mac);
+    }
+    return rc;
+}
+
+static void whImage_LoadRecord(whImageContext* context,
+        whImageRecord* out_record)
+{
+    whNvmMetadata meta = {0};
+    uint8_t mac[WOLFHSM_MANIFEST_CMAC_LEN];
+
+    memset(out_record, 0, sizeof(*out_record));
+    if (    (context->nvm_cb == NULL) ||
+            (context->cache_id == 0) ||
+            (context->nvm_cb->GetMetadata(context->nvm_context,
+                context->cache_id, &meta) != 0) ||
+            (meta.len != sizeof(*out_record)) ||
+            (context->nvm_cb->Read(context->nvm_context, context->cache_id,
+                0, sizeof(*out_record), (uint8_t*)out_record) != 0) ||
+            (whImage_RecordMac(context, out_record, mac) != 0) ||
+            (whImage_MacEqual(mac, out_record->record_cmac) == 0)) {
+        /* No usable record, so verify everything */
+        memset(out_record, 0, sizeof(*out_record));
+    }
+}
+
+static int whImage_StoreRecord(whImageContext* context,
+        whImageRecord* record)
+{
+    int rc = 0;
+    whNvmMetadata meta = {0};
+
+    if ((context->nvm_cb == NULL) || (context->cache_id == 0)) {
+        return 0;
+    }
+    rc = whImage_RecordMac(context, record, record->record_cmac);
+    if (rc != 0) {
+        return rc;
+    }
+    meta.id = context->cache_id;
+    meta.len = sizeof(*record);
+    memcpy(meta.label, "image record", sizeof("image record"));
+    rc = context->nvm_cb->AddObject(context->nvm_context, &meta, meta.len,
+            (const uint8_t*)record);
+    if (rc == WH_ERROR_NOSPACE) {
+        /* Reclaim the space of older records */
+        rc = context->nvm_cb->DestroyObjects(context->nvm_context, 0, NULL);
+        if (rc == 0) {
+            rc = context->nvm_cb->AddObject(context->nvm_context, &meta,
+                    meta.len, (const uint8_t*)record);
+        }
+    }
+    return rc;
+}
+
+int wh_Image_Init(whImageContext* context, const whImageConfig* config)
+{
+    if (    (context == NULL) ||
+            (config == NULL) ||
+            (config->cmac_cb == NULL) ||
+            ((config->read_cb != NULL) &&
+                ((config->read_cb->ReadStart == NULL) ||
+                 (config->read_cb->ReadWait == NULL)))) {
+        return WH_ERROR_BADARGS;
+    }
+
+    memset(context, 0, sizeof(*context));
+    context->cmac_cb = config->cmac_cb;
+    context->cmac_context = config->cmac_context;
+    context->read_cb = config->read_cb;
+    context->read_context = config->read_context;
+    context->nvm_cb = config->nvm_cb;
+    context->nvm_context = config->nvm_context;
+    context->cache_id = config->cache_id;
+    context->initialized = 1;
+    return 0;
+}
+
+int wh_Image_Cleanup(whImageContext* context)
+{
+    if (context == NULL) {
+        return WH_ERROR_BADARGS;
+    }
+    /* Payloads may be confidential */
+    memset(context, 0, sizeof(*context));
+    return 0;
+}
+
+int wh_Image_Verify(whImageContext* context, const whManifest_ex* list,
+        int count, uint32_t epoch, uint32_t* out_verified)
+{
+    whImageRecord record;
+    whImageRecord updated;
+    int segs[WOLFHSM_NUM_MANIFESTS];
+    int seg_count = 0;
+    uint32_t verified = 0;
+    uint32_t bit = 0;
+    int rc = 0;
+    int i = 0;
+
+    if (    (context == NULL) ||
+            (context->initialized == 0) ||
+            ((list == NULL) && (count != 0)) ||
+            (count < 0) ||
+            (count > WOLFHSM_NUM_MANIFESTS)) {
+        return WH_ERROR_BADARGS;
+    }
+
+    whImage_LoadRecord(context, &record);
+    if (record.epoch != epoch) {
+        record.verified = 0;
+    }
+
+    /* Manifests are short, so check them all before streaming payloads */
+    for (i = 0; (rc == 0) && (i < count); i++) {
+        bit = 1ul << i;
+        rc = whImage_CheckManifest(context, &list[i]);
+        if (rc == WH_ERROR_NOTVERIFIED) {
+            rc = 0;
+            continue;
+        }
+        if (    (rc == 0) &&
+                ((record.verified & bit) != 0) &&
+                (whImage_MacEqual(record.manifest_cmac[i],
+                    list[i].manifest_cmac) != 0)) {
+            /* Payload already verified at this epoch */
+            verified |= bit;
+            context->cache_hits++;
+            continue;
+        }
+        segs[seg_count++] = i;
+    }
+
+    if (rc == 0) {
+        rc = whImage_VerifyPayloads(context, list, segs, seg_count,
+                &verified);
+    }
+
+    if (rc == 0) {
+        memset(&updated, 0, sizeof(updated));
+        updated.epoch = epoch;
+        updated.verified = verified;
+        for (i = 0; i < count; i++) {
+            if ((verified & (1ul << i)) != 0) {
+                memcpy(updated.manifest_cmac[i], list[i].manifest_cmac,
+                        WOLFHSM_MANIFEST_CMAC_LEN);
+            }
+        }
+        if (memcmp(&updated, &record,
+                offsetof(whImageRecord, record_cmac)) != 0) {
+            /* Only write the NVM when the result changed */
+            rc = whImage_StoreRecord(context, &updated);
+        }
+    }
+
+    if (out_verified != NULL) *out_verified = verified;
+    if ((rc == 0) && (verified != (1ul << count) - 1)) {
+        rc = WH_ERROR_NOTVERIFIED;
+    }
+    return rc;
+}
@@ -39,14 +39,73 @@ int wh_MessageComm_TranslateInitResponse(uint16_t magic,
 int wh_MessageComm_TranslateLenData(uint16_t magic,
         const whMessageCommLenData* src,
         whMessageCommLenData* dest)
+{
+    uint16_t len = 0;
+
+    if (    (src == NULL) ||
+            (dest == NULL)  ) {
+        return WH_ERROR_BADARGS;
+    }
+    len = wh_Translate16(magic, src->len);
+    dest->len = len;
+    /* Data is not translated, so in place there is nothing to copy.
+     * Otherwise only the used bytes are copied */
+    if (dest != src) {
+        if (len > sizeof(dest->data)) {
+            len = sizeof(dest->data);
+        }
+        memcpy(dest->data, src->data, len);
+    }
+    return 0;
+}
+
+int wh_MessageComm_TranslateStatsRequest(uint16_t magic,
+        const whMessageCommStatsRequest* src,
+        whMessageCommStatsRequest* dest)
 {
     if (    (src == NULL) ||
             (dest == NULL)  ) {
         return WH_ERROR_BADARGS;
     }
-    dest->len = wh_Translate16(magic, src->len);
-    /* III Note that we can't use src->len to minimize this copy */
-    memcpy(dest->data, src->data, sizeof(dest->data));
+    dest->flags = wh_Translate32(magic, src->flags);
     return 0;
 }
 
+int wh_MessageComm_TranslateStatsResponse(uint16_t magic,
+        const whMessageCommStatsResponse* src,
+        whMessageCommStatsResponse* dest)
+{
+    const whStats* s = NULL;
+    whStats* d = NULL;
+    int i = 0;
+
+    if (    (src == NULL) ||
+            (dest == NULL)  ) {
+        return WH_ERROR_BADARGS;
+    }
+    s = &src->stats;
+    d = &dest->stats;
+    for (i = 0; i < WH_STATS_GROUP_COUNT; i++) {
+        d->requests[i] = wh_Translate32(magic, s->requests[i]);
+    }
+    d->notready_polls = wh_Translate32(magic, s->notready_polls);
+    d->comm_rx_bytes = wh_Translate32(magic, s->comm_rx_bytes);
+    d->comm_tx_bytes = wh_Translate32(magic, s->comm_tx_bytes);
+    d->flash_reads = wh_Translate32(magic, s->flash_reads);
+    d->flash_read_bytes = wh_Translate32(magic, s->flash_read_bytes);
+    d->flash_programs = wh_Translate32(magic, s->flash_programs);
+    d->flash_program_bytes = wh_Translate32(magic, s->flash_program_bytes);
+    d->flash_erases = wh_Translate32(magic, s->flash_erases);
+    d->flash_erase_bytes = wh_Translate32(magic, s->flash_erase_bytes);
+    d->flash_blankchecks = wh_Translate32(magic, s->flash_blankchecks);
+    d->flash_blankcheck_bytes = wh_Translate32(magic,
+            s->flash_blankcheck_bytes);
+    d->flash_verifies = wh_Translate32(magic, s->flash_verifies);
+    d->flash_verify_bytes = wh_Translate32(magic, s->flash_verify_bytes);
+    d->dir_lookups = wh_Translate32(magic, s->dir_lookups);
+    d->compactions = wh_Translate32(magic, s->compactions);
+    d->pad = 0;
+    d->compaction_cycles = wh_Translate64(magic, s->compaction_cycles);
+    d->request_cycles = wh_Translate64(magic, s->request_cycles);
+    return 0;
+}
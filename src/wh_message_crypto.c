@@ -0,0 +1,129 @@
+/*
+ * src/wh_message_crypto.c
+ */
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+
+#include "wolfhsm/wh_comm.h"
+#include "wolfhsm/wh_error.h"
+#include "wolfhsm/wh_message.h"
+#include "wolfhsm/wh_message_crypto.h"
+
+int wh_MessageCrypto_TranslateItem(uint16_t magic,
+        const whMessageCryptoItem* src,
+        whMessageCryptoItem* dest)
+{
+    if (    (src == NULL) ||
+            (dest == NULL)  ) {
+        return WH_ERROR_BADARGS;
+    }
+    dest->op = wh_Translate16(magic, src->op);
+    dest->len = wh_Translate16(magic, src->len);
+    return 0;
+}
+
+int wh_MessageCrypto_TranslateResult(uint16_t magic,
+        const whMessageCryptoResult* src,
+        whMessageCryptoResult* dest)
+{
+    if (    (src == NULL) ||
+            (dest == NULL)  ) {
+        return WH_ERROR_BADARGS;
+    }
+    dest->op = wh_Translate16(magic, src->op);
+    dest->len = wh_Translate16(magic, src->len);
+    dest->rc = (int32_t)wh_Translate32(magic, (uint32_t)src->rc);
+    return 0;
+}
+
+int wh_MessageCrypto_TranslateBatchRequest(uint16_t magic,
+        const whMessageCryptoBatchRequest* src,
+        whMessageCryptoBatchRequest* dest)
+{
+    if (    (src == NULL) ||
+            (dest == NULL)  ) {
+        return WH_ERROR_BADARGS;
+    }
+    dest->count = wh_Translate16(magic, src->count);
+    dest->pad = 0;
+    return 0;
+}
+
+int wh_MessageCrypto_TranslateBatchResponse(uint16_t magic,
+        const whMessageCryptoBatchResponse* src,
+        whMessageCryptoBatchResponse* dest)
+{
+    if (    (src == NULL) ||
+            (dest == NULL)  ) {
+        return WH_ERROR_BADARGS;
+    }
+    dest->rc = (int32_t)wh_Translate32(magic, (uint32_t)src->rc);
+    dest->count = wh_Translate16(magic, src->count);
+    dest->pad = 0;
+    return 0;
+}
+
+int wh_MessageCrypto_BatchAdd(whMessageCryptoBatchRequest* batch,
+        uint16_t* inout_size, uint16_t op, uint16_t len, const void* data)
+{
+    whMessageCryptoItem item = {0};
+    uint16_t size = 0;
+
+    if (    (batch == NULL) ||
+            (inout_size == NULL) ||
+            ((len > 0) && (data == NULL))) {
+        return WH_ERROR_BADARGS;
+    }
+    size = *inout_size;
+    if (    (size > sizeof(batch->items)) ||
+            (WOLFHSM_MESSAGE_CRYPTO_ITEM_SIZE(len) >
+                sizeof(batch->items) - size)) {
+        return WH_ERROR_NOSPACE;
+    }
+
+    item.op = op;
+    item.len = len;
+    memcpy(&batch->items[size], &item, sizeof(item));
+    size += sizeof(item);
+    if (len > 0) {
+        memcpy(&batch->items[size], data, len);
+    }
+    memset(&batch->items[size + len], 0,
+            WOLFHSM_MESSAGE_CRYPTO_ITEM_SIZE(len) - sizeof(item) - len);
+    *inout_size += WOLFHSM_MESSAGE_CRYPTO_ITEM_SIZE(len);
+    batch->count++;
+    return 0;
+}
+
+int wh_MessageCrypto_BatchNext(const whMessageCryptoBatchResponse* batch,
+        uint16_t size, uint16_t* inout_offset,
+        whMessageCryptoResult* out_result, const uint8_t** out_data)
+{
+    whMessageCryptoResult result = {0};
+    uint16_t offset = 0;
+
+    if (    (batch == NULL) ||
+            (inout_offset == NULL) ||
+            (size > sizeof(batch->results))) {
+        return WH_ERROR_BADARGS;
+    }
+    offset = *inout_offset;
+    if (offset >= size) {
+        return WH_ERROR_NOTFOUND;
+    }
+    if (sizeof(result) > (uint16_t)(size - offset)) {
+        return WH_ERROR_ABORTED;
+    }
+    memcpy(&result, &batch->results[offset], sizeof(result));
+    if (result.len > size - offset - sizeof(result)) {
+        return WH_ERROR_ABORTED;
+    }
+
+    if (out_result != NULL) *out_result = result;
+    if (out_data != NULL) *out_data = &batch->results[offset + sizeof(result)];
+    offset += WOLFHSM_MESSAGE_CRYPTO_RESULT_SIZE(result.len);
+    *inout_offset = (offset < size) ? offset : size;
+    return 0;
+}
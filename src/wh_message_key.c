@@ -0,0 +1,56 @@
+/*
+ * src/wh_message_key.c
+ */
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+
+#include "wolfhsm/wh_comm.h"
+#include "wolfhsm/wh_error.h"
+#include "wolfhsm/wh_message.h"
+#include "wolfhsm/wh_message_key.h"
+
+int wh_MessageKey_TranslateData(uint16_t magic,
+        const whMessageKeyData* src,
+        whMessageKeyData* dest)
+{
+    if (    (src == NULL) ||
+            (dest == NULL)  ) {
+        return WH_ERROR_BADARGS;
+    }
+    dest->id = wh_Translate16(magic, src->id);
+    dest->access = wh_Translate16(magic, src->access);
+    dest->flags = wh_Translate16(magic, src->flags);
+    dest->len = wh_Translate16(magic, src->len);
+    if (dest != src) {
+        memcpy(dest->label, src->label, sizeof(dest->label));
+    }
+    return 0;
+}
+
+int wh_MessageKey_TranslateIdRequest(uint16_t magic,
+        const whMessageKeyIdRequest* src,
+        whMessageKeyIdRequest* dest)
+{
+    if (    (src == NULL) ||
+            (dest == NULL)  ) {
+        return WH_ERROR_BADARGS;
+    }
+    dest->id = wh_Translate16(magic, src->id);
+    return 0;
+}
+
+int wh_MessageKey_TranslateResponse(uint16_t magic,
+        const whMessageKeyResponse* src,
+        whMessageKeyResponse* dest)
+{
+    if (    (src == NULL) ||
+            (dest == NULL)  ) {
+        return WH_ERROR_BADARGS;
+    }
+    dest->rc = (int32_t)wh_Translate32(magic, (uint32_t)src->rc);
+    dest->id = wh_Translate16(magic, src->id);
+    dest->pad = 0;
+    return 0;
+}
@@ -0,0 +1,218 @@
+/*
+ * src/wh_message_nvm.c
+ */
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+
+#include "wolfhsm/wh_comm.h"
+#include "wolfhsm/wh_error.h"
+#include "wolfhsm/wh_message.h"
+#include "wolfhsm/wh_message_nvm.h"
+
+int wh_MessageNvm_TranslateMetadata(uint16_t magic,
+        const whMessageNvmMetadata* src,
+        whMessageNvmMetadata* dest)
+{
+    if (    (src == NULL) ||
+            (dest == NULL)  ) {
+        return WH_ERROR_BADARGS;
+    }
+    dest->id = wh_Translate16(magic, src->id);
+    dest->access = wh_Translate16(magic, src->access);
+    dest->flags = wh_Translate16(magic, src->flags);
+    dest->pad = 0;
+    dest->len = wh_Translate32(magic, src->len);
+    if (dest != src) {
+        memcpy(dest->label, src->label, sizeof(dest->label));
+    }
+    return 0;
+}
+
+int wh_MessageNvm_TranslateResponse(uint16_t magic,
+        const whMessageNvmResponse* src,
+        whMessageNvmResponse* dest)
+{
+    if (    (src == NULL) ||
+            (dest == NULL)  ) {
+        return WH_ERROR_BADARGS;
+    }
+    dest->rc = (int32_t)wh_Translate32(magic, (uint32_t)src->rc);
+    return 0;
+}
+
+int wh_MessageNvm_TranslateGetAvailableResponse(uint16_t magic,
+        const whMessageNvmGetAvailableResponse* src,
+        whMessageNvmGetAvailableResponse* dest)
+{
+    if (    (src == NULL) ||
+            (dest == NULL)  ) {
+        return WH_ERROR_BADARGS;
+    }
+    dest->rc = (int32_t)wh_Translate32(magic, (uint32_t)src->rc);
+    dest->avail_size = wh_Translate32(magic, src->avail_size);
+    dest->reclaim_size = wh_Translate32(magic, src->reclaim_size);
+    dest->avail_objects = wh_Translate16(magic, src->avail_objects);
+    dest->reclaim_objects = wh_Translate16(magic, src->reclaim_objects);
+    return 0;
+}
+
+int wh_MessageNvm_TranslateListRequest(uint16_t magic,
+        const whMessageNvmListRequest* src,
+        whMessageNvmListRequest* dest)
+{
+    if (    (src == NULL) ||
+            (dest == NULL)  ) {
+        return WH_ERROR_BADARGS;
+    }
+    dest->access = wh_Translate16(magic, src->access);
+    dest->flags = wh_Translate16(magic, src->flags);
+    dest->start_id = wh_Translate16(magic, src->start_id);
+    dest->max_count = wh_Translate16(magic, src->max_count);
+    return 0;
+}
+
+int wh_MessageNvm_TranslateListResponse(uint16_t magic,
+        const whMessageNvmListResponse* src,
+        whMessageNvmListResponse* dest)
+{
+    if (    (src == NULL) ||
+            (dest == NULL)  ) {
+        return WH_ERROR_BADARGS;
+    }
+    dest->rc = (int32_t)wh_Translate32(magic, (uint32_t)src->rc);
+    dest->count = wh_Translate16(magic, src->count);
+    dest->id = wh_Translate16(magic, src->id);
+    return 0;
+}
+
+int wh_MessageNvm_TranslateIdRequest(uint16_t magic,
+        const whMessageNvmIdRequest* src,
+        whMessageNvmIdRequest* dest)
+{
+    if (    (src == NULL) ||
+            (dest == NULL)  ) {
+        return WH_ERROR_BADARGS;
+    }
+    dest->id = wh_Translate16(magic, src->id);
+    dest->pad = 0;
+    return 0;
+}
+
+int wh_MessageNvm_TranslateGetMetadataResponse(uint16_t magic,
+        const whMessageNvmGetMetadataResponse* src,
+        whMessageNvmGetMetadataResponse* dest)
+{
+    if (    (src == NULL) ||
+            (dest == NULL)  ) {
+        return WH_ERROR_BADARGS;
+    }
+    dest->rc = (int32_t)wh_Translate32(magic, (uint32_t)src->rc);
+    return wh_MessageNvm_TranslateMetadata(magic, &src->meta, &dest->meta);
+}
+
+int wh_MessageNvm_TranslateDestroyObjectsRequest(uint16_t magic,
+        const whMessageNvmDestroyObjectsRequest* src,
+        whMessageNvmDestroyObjectsRequest* dest)
+{
+    int i = 0;
+
+    if (    (src == NULL) ||
+            (dest == NULL)  ) {
+        return WH_ERROR_BADARGS;
+    }
+    dest->list_count = wh_Translate16(magic, src->list_count);
+    for (i = 0; i < WH_NVM_MAX_DESTROY_OBJECTS_COUNT; i++) {
+        dest->list[i] = wh_Translate16(magic, src->list[i]);
+    }
+    return 0;
+}
+
+int wh_MessageNvm_TranslateReadRequest(uint16_t magic,
+        const whMessageNvmReadRequest* src,
+        whMessageNvmReadRequest* dest)
+{
+    if (    (src == NULL) ||
+            (dest == NULL)  ) {
+        return WH_ERROR_BADARGS;
+    }
+    dest->id = wh_Translate16(magic, src->id);
+    dest->pad = 0;
+    dest->offset = wh_Translate32(magic, src->offset);
+    dest->len = wh_Translate32(magic, src->len);
+    return 0;
+}
+
+int wh_MessageNvm_TranslateReadResponse(uint16_t magic,
+        const whMessageNvmReadResponse* src,
+        whMessageNvmReadResponse* dest)
+{
+    if (    (src == NULL) ||
+            (dest == NULL)  ) {
+        return WH_ERROR_BADARGS;
+    }
+    dest->rc = (int32_t)wh_Translate32(magic, (uint32_t)src->rc);
+    dest->len = wh_Translate32(magic, src->len);
+    return 0;
+}
+
+int wh_MessageNvm_TranslateListMetadataResponse(uint16_t magic,
+        const whMessageNvmListMetadataResponse* src,
+        whMessageNvmListMetadataResponse* dest)
+{
+    if (    (src == NULL) ||
+            (dest == NULL)  ) {
+        return WH_ERROR_BADARGS;
+    }
+    dest->rc = (int32_t)wh_Translate32(magic, (uint32_t)src->rc);
+    dest->count = wh_Translate16(magic, src->count);
+    dest->remaining = wh_Translate16(magic, src->remaining);
+    return 0;
+}
+
+int wh_MessageNvm_TranslateReadMultiRequest(uint16_t magic,
+        const whMessageNvmReadMultiRequest* src,
+        whMessageNvmReadMultiRequest* dest)
+{
+    int i = 0;
+
+    if (    (src == NULL) ||
+            (dest == NULL)  ) {
+        return WH_ERROR_BADARGS;
+    }
+    dest->count = wh_Translate16(magic, src->count);
+    for (i = 0; i < WOLFHSM_MESSAGE_NVM_MULTI_COUNT; i++) {
+        dest->ids[i] = wh_Translate16(magic, src->ids[i]);
+    }
+    return 0;
+}
+
+int wh_MessageNvm_TranslateRecord(uint16_t magic,
+        const whMessageNvmRecord* src,
+        whMessageNvmRecord* dest)
+{
+    if (    (src == NULL) ||
+            (dest == NULL)  ) {
+        return WH_ERROR_BADARGS;
+    }
+    dest->id = wh_Translate16(magic, src->id);
+    dest->pad = 0;
+    dest->rc = (int32_t)wh_Translate32(magic, (uint32_t)src->rc);
+    dest->len = wh_Translate32(magic, src->len);
+    return 0;
+}
+
+int wh_MessageNvm_TranslateReadMultiResponse(uint16_t magic,
+        const whMessageNvmReadMultiResponse* src,
+        whMessageNvmReadMultiResponse* dest)
+{
+    if (    (src == NULL) ||
+            (dest == NULL)  ) {
+        return WH_ERROR_BADARGS;
+    }
+    dest->rc = (int32_t)wh_Translate32(magic, (uint32_t)src->rc);
+    dest->count = wh_Translate16(magic, src->count);
+    dest->pad = 0;
+    return 0;
+}
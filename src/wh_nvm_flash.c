@@ -14,9 +14,11 @@
 #include "wolfhsm/wh_flash_unit.h"
 #include "wolfhsm/wh_nvm.h"
 #include "wolfhsm/wh_nvm_flash.h"
+#include "wolfhsm/wh_stats.h"
 
 enum {
-    NF_COPY_OBJECT_BUFFER_LEN = 8 * WHFU_BYTES_PER_UNIT,
+    NF_COPY_OBJECT_BUFFER_LEN =
+            NF_COPY_OBJECT_BUFFER_UNITS * WHFU_BYTES_PER_UNIT,
 };
 
 /* On-flash layout of the state of an Object or Directory*/
@@ -53,32 +55,109 @@ typedef struct {
 #define NF_DIRECTORY_OBJECT_OFFSET(_n) \
                     (NF_DIRECTORY_OBJECTS_OFFSET + (NF_UNITS_PER_OBJECT * _n))
 
+#ifdef WOLFHSM_NVM_CHECKPOINT
+/* Value of nfCheckpoint.magic once programmed */
+#define NF_CHECKPOINT_MAGIC 0x4B43464Eul
+
+/* On-flash layout of the checkpoint of a compacted directory.  Its objects are
+ * all used, in order, with contiguous data from unit 0, so only the epoch and
+ * metadata of each are stored */
+typedef struct {
+    uint32_t magic;
+    uint32_t epoch;                 /* Epoch of the partition */
+    uint32_t object_count;          /* Objects in the checkpoint */
+    uint32_t next_free_data;
+    uint32_t reclaimable_entries;
+    uint32_t reclaimable_data;
+    int16_t id_index[NF_ID_INDEX_SIZE];
+    struct {
+        uint32_t epoch;
+        whNvmMetadata metadata;
+    } objects[NF_OBJECT_COUNT];
+    uint32_t crc;                   /* CRC-32 of the bytes before crc */
+} nfCheckpoint;
+#define NF_UNITS_PER_CHECKPOINT WHFU_BYTES2UNITS(sizeof(nfCheckpoint))
+
+typedef union {
+    whFlashUnit units[NF_UNITS_PER_CHECKPOINT];    /* Pad to units */
+    nfCheckpoint checkpoint;
+} nfCheckpointBuffer;
+#endif
+
 /* On-flash layout of a Partition */
 typedef struct {
     nfState state;
     nfDirectory directory;
+#ifdef WOLFHSM_NVM_CHECKPOINT
+    nfCheckpointBuffer checkpoint;
+#endif
 } nfPartition;
 #define NF_PARTITION_STATE_OFFSET WHFU_BYTES2UNITS(offsetof(nfPartition, state))
 #define NF_PARTITION_DIRECTORY_OFFSET WHFU_BYTES2UNITS(offsetof(nfPartition, directory))
+#ifdef WOLFHSM_NVM_CHECKPOINT
+#define NF_PARTITION_CHECKPOINT_OFFSET WHFU_BYTES2UNITS(offsetof(nfPartition, checkpoint))
+#endif
 #define NF_PARTITION_DATA_OFFSET WHFU_BYTES2UNITS(sizeof(nfPartition))
 
+/* Staging buffer to coalesce the data of consecutive objects into fewer
+ * program operations */
+typedef struct {
+    whNvmFlashContext* context;
+    int partition;
+    uint32_t offset;            /* Data unit where the buffer will be written */
+    uint32_t used;              /* Bytes pending in the buffer */
+    union {
+        whFlashUnit units[NF_COPY_OBJECT_BUFFER_UNITS];
+        uint8_t bytes[NF_COPY_OBJECT_BUFFER_LEN];
+    } buffer;
+} nfDataWriter;
+
 /** Local declarations */
+static nfStatus nfMemState_Status(int used_epoch, int used_start,
+        int used_count);
+static void nfMemState_Decode(whNvmFlashContext* context,
+        const nfState* buffer, nfMemState* state);
 static int nfMemState_Read(whNvmFlashContext* context, uint32_t offset,
         nfMemState* state);
+static void nfMemObject_Decode(whNvmFlashContext* context,
+        const nfObject* buffer, nfMemObject* object);
 static int nfMemObject_Read(whNvmFlashContext* context, uint32_t offset,
         nfMemObject* object);
 
+static uint32_t nfProgram_Flags(whNvmFlashContext* context, int partition,
+        int commit);
+static whNvmSize nfSize_Saturate(uint32_t size);
+
+static int nfWriteBuffer_Program(whNvmFlashContext* context, uint32_t offset,
+        uint32_t count, const uint8_t* data, uint32_t flags);
+static int nfWriteBuffer_Flush(whNvmFlashContext* context);
+static void nfWriteBuffer_Discard(whNvmFlashContext* context);
+static int nfWriteBuffer_Release(whNvmFlashContext* context, int partition);
+
 static uint32_t nfPartition_Offset(whNvmFlashContext* context, int partition);
+static uint32_t nfPartition_DataUnits(whNvmFlashContext* context);
 static uint32_t nfPartition_DataOffset(whNvmFlashContext* context,
         int partition);
 static int nfPartition_WriteLock(whNvmFlashContext* context, int partition);
 static int nfPartition_WriteUnlock(whNvmFlashContext* context, int partition);
 static int nfPartition_BlankCheck(whNvmFlashContext* context, int partition);
 static int nfPartition_Erase(whNvmFlashContext* context, int partition);
+static int nfPartition_SelectDestination(whNvmFlashContext* context);
+static int nfPartition_Sync(whNvmFlashContext* context, int partition);
 static int nfPartition_ReadMemState(whNvmFlashContext* context, int partition,
         nfMemState* state);
 static int nfPartition_ReadMemDirectory(whNvmFlashContext* context,
         int partition, nfMemDirectory* directory);
+#ifdef WOLFHSM_NVM_CHECKPOINT
+static uint32_t nfCheckpoint_Crc(const nfCheckpoint* checkpoint);
+static int nfPartition_ReadMemObjects(whNvmFlashContext* context,
+        int partition, nfMemDirectory* directory, int first);
+static int nfPartition_ReadCheckpoint(whNvmFlashContext* context,
+        int partition, uint32_t epoch, nfMemDirectory* directory);
+static int nfPartition_ProgramCheckpoint(whNvmFlashContext* context,
+        int partition, uint32_t epoch, const nfMemDirectory* directory);
+#endif
+static int nfPartition_LoadMemDirectory(whNvmFlashContext* context);
 static int nfPartition_ProgramEpoch(whNvmFlashContext* context, int partition,
         uint32_t epoch);
 static int nfPartition_ProgramStart(whNvmFlashContext* context, int partition,
@@ -89,8 +168,11 @@ static int nfPartition_ProgramInit(whNvmFlashContext* context, int partition);
 
 static uint32_t nfObject_Offset(whNvmFlashContext* context, int partition,
         int object_index);
+/* Program the epoch, the metadata unless meta is NULL, and the start */
 static int nfObject_ProgramBegin(whNvmFlashContext* context, int partition,
         int object_index, uint32_t epoch, uint32_t start, whNvmMetadata* meta);
+static int nfObject_ProgramMetadata(whNvmFlashContext* context, int partition,
+        int object_index, const whNvmMetadata* meta);
 static int nfObject_ProgramDataBytes(whNvmFlashContext* context, int partition,
         uint32_t offset, uint32_t byte_count, const uint8_t* data);
 static int nfObject_ProgramFinish(whNvmFlashContext* context, int partition,
@@ -101,13 +183,71 @@ static int nfObject_Program(whNvmFlashContext* context, int partition,
 static int nfObject_ReadDataBytes(whNvmFlashContext* context, int partition,
         int object_index, uint32_t byte_offset, uint32_t byte_count,
         uint8_t* out_data);
-static int nfObject_Copy(whNvmFlashContext* context, int object_index,
-        int partition, uint32_t *inout_next_object, uint32_t *inout_next_data);
+static int nfObject_CopyDataBytes(whNvmFlashContext* context,
+        int object_index, int partition, uint32_t dest_data,
+        uint32_t byte_offset, uint32_t byte_count);
+
+static void nfDataWriter_Init(nfDataWriter* w, whNvmFlashContext* context,
+        int partition, uint32_t offset);
+static int nfDataWriter_Flush(nfDataWriter* w);
+static int nfDataWriter_Write(nfDataWriter* w, uint32_t byte_count,
+        const uint8_t* data);
+
+static void nfMemDirectory_IndexClear(nfMemDirectory* d);
+static int nfMemDirectory_IndexFindSlot(nfMemDirectory* d, whNvmId id);
+static void nfMemDirectory_IndexInsert(nfMemDirectory* d, whNvmId id,
+        int object_index);
+static void nfMemDirectory_IndexRemove(nfMemDirectory* d, whNvmId id);
 
-static int nfMemDirectory_Parse(nfMemDirectory* d);
+static int nfMemDirectory_Parse(nfMemDirectory* d, uint32_t data_units);
+static int nfMemDirectory_ParseFrom(nfMemDirectory* d, uint32_t data_units);
+static void nfMemDirectory_Compact(nfMemDirectory* d);
+static void nfMemDirectory_AddEntry(nfMemDirectory* d,
+        const whNvmMetadata* meta, uint32_t epoch);
 static int nfMemDirectory_FindObjectIndexById(nfMemDirectory* d, whNvmId id,
         int *out_object_index);
 
+static int nfCompaction_Copy(whNvmFlashContext* context, uint32_t max_bytes);
+static int nfCompaction_Step(whNvmFlashContext* context, uint32_t max_bytes);
+
+static void nfStream_Recover(whNvmFlashContext* context);
+
+#if NF_CACHE_ENTRY_COUNT > 0
+static void nfCache_Zeroize(nfCacheEntry* entry);
+static void nfCache_Invalidate(whNvmFlashContext* context, whNvmId id);
+static int nfCache_Read(whNvmFlashContext* context, int object_index,
+        uint32_t offset, uint32_t data_len, uint8_t* out_data);
+#endif
+
+
+/* Compute status based on which state members are not blank */
+static nfStatus nfMemState_Status(int used_epoch, int used_start,
+        int used_count)
+{
+    if (used_epoch && used_start && used_count) {
+        /* Used */
+        return NF_STATUS_USED;
+    } else if (used_epoch && used_start) {
+        return NF_STATUS_DATA_BAD;
+    } else if (used_epoch) {
+        return NF_STATUS_META_BAD;
+    }
+    return NF_STATUS_FREE;
+}
+
+/* Compute the state from a buffer already read from flash, using the erased
+ * unit value rather than asking the flash to BlankCheck */
+static void nfMemState_Decode(whNvmFlashContext* context,
+        const nfState* buffer, nfMemState* state)
+{
+    state->epoch = buffer->epoch;
+    state->start = buffer->start;
+    state->count = buffer->count;
+    state->status = nfMemState_Status(
+            buffer->epoch != context->erased_unit,
+            buffer->start != context->erased_unit,
+            buffer->count != context->erased_unit);
+}
 
 static int nfMemState_Read(whNvmFlashContext* context, uint32_t offset,
         nfMemState* state)
@@ -125,6 +265,20 @@ static int nfMemState_Read(whNvmFlashContext* context, uint32_t offset,
     memset(state, 0, sizeof(*state));
     state->status = NF_STATUS_UNKNOWN;
 
+    if (context->bulk_mount != 0) {
+        /* Single read and compute blank state in memory */
+        ret = wh_FlashUnit_Read(
+                    context->cb,
+                    context->flash,
+                    offset,
+                    NF_UNITS_PER_STATE,
+                    (whFlashUnit*) &buffer);
+        if (ret == 0) {
+            nfMemState_Decode(context, &buffer, state);
+        }
+        return ret;
+    }
+
     blank_epoch = wh_FlashUnit_BlankCheck(
             context->cb,
             context->flash,
@@ -173,20 +327,26 @@ static int nfMemState_Read(whNvmFlashContext* context, uint32_t offset,
     state->count = buffer.count;
 
     /* Compute status based on which state members are blank */
-    if (    (blank_epoch == WH_ERROR_NOTBLANK) &&
-            (blank_start == WH_ERROR_NOTBLANK) &&
-            (blank_count == WH_ERROR_NOTBLANK)) {
-        /* Used */
-        state->status = NF_STATUS_USED;
-    } else  if (    (blank_epoch == WH_ERROR_NOTBLANK) &&
-                    (blank_start == WH_ERROR_NOTBLANK)){
-        state->status = NF_STATUS_DATA_BAD;
-    } else if (blank_epoch == WH_ERROR_NOTBLANK) {
-        state->status = NF_STATUS_META_BAD;
+    state->status = nfMemState_Status(
+            blank_epoch == WH_ERROR_NOTBLANK,
+            blank_start == WH_ERROR_NOTBLANK,
+            blank_count == WH_ERROR_NOTBLANK);
+    return ret;
+}
+
+static void nfMemObject_Decode(whNvmFlashContext* context,
+        const nfObject* buffer, nfMemObject* object)
+{
+    nfMemState_Decode(context, &buffer->state, &object->state);
+
+    /* Copy the metadata if it is intact, clear if not */
+    if (    (object->state.status == NF_STATUS_USED) ||
+            (object->state.status == NF_STATUS_DATA_BAD)) {
+        memcpy(&object->metadata, &buffer->u.metadata,
+                sizeof(object->metadata));
     } else {
-        state->status = NF_STATUS_FREE;
+        memset(&object->metadata, 0, sizeof(object->metadata));
     }
-    return ret;
 }
 
 static int nfMemObject_Read(whNvmFlashContext* context,
@@ -228,6 +388,166 @@ static int nfMemObject_Read(whNvmFlashContext* context,
     return rc;
 }
 
+/* Select the checks for programming partition.  The replication destination
+ * was blank checked or erased before it is programmed, so skip BlankCheck */
+static uint32_t nfProgram_Flags(whNvmFlashContext* context, int partition,
+        int commit)
+{
+    uint32_t flags = 0;
+    const nfCompaction* cp = &context->compaction;
+
+    if (    (cp->phase <= NF_COMPACT_ERASE) ||
+            (cp->partition != partition)) {
+        flags |= WHFU_PROGRAM_BLANKCHECK;
+    }
+    if (    (context->verify == NF_VERIFY_ALWAYS) ||
+            ((context->verify == NF_VERIFY_COMMIT) && (commit != 0))) {
+        flags |= WHFU_PROGRAM_VERIFY;
+    }
+    return flags;
+}
+
+/* Limit a byte count to whNvmSize, for partitions larger than 16 bits */
+static whNvmSize nfSize_Saturate(uint32_t size)
+{
+#ifndef WOLFHSM_NVM_LARGE_OBJECTS
+    if (size > WOLFHSM_NVM_MAX_OBJECT_SIZE) {
+        return (whNvmSize)WOLFHSM_NVM_MAX_OBJECT_SIZE;
+    }
+#endif
+    return (whNvmSize)size;
+}
+
+/* Program units through the write buffer.  Units within the same page and
+ * with the same flags are held until a different page is programmed or the
+ * buffer is flushed, so adjacent writes reach the flash as one Program */
+static int nfWriteBuffer_Program(whNvmFlashContext* context, uint32_t offset,
+        uint32_t count, const uint8_t* data, uint32_t flags)
+{
+    int ret = 0;
+#if NF_WRITE_BUFFER_SIZE > 0
+    nfWriteBuffer* wb = &context->write_buffer;
+    uint32_t base = 0;
+    uint32_t index = 0;
+    uint32_t this_count = 0;
+    uint32_t i = 0;
+
+    while ((wb->page_units != 0) && (count > 0) && (ret == 0)) {
+        base = offset & ~(wb->page_units - 1);
+        index = offset - base;
+        this_count = wb->page_units - index;
+        if (this_count > count) {
+            this_count = count;
+        }
+
+        if (    (wb->pending != 0) &&
+                ((wb->base != base) || (wb->flags != flags))) {
+            ret = nfWriteBuffer_Flush(context);
+        }
+        /* A unit programmed twice is left for the flash to reject */
+        for (i = index; (i < index + this_count) && (ret == 0); i++) {
+            if ((wb->dirty[i / 32] & (1ul << (i % 32))) != 0) {
+                ret = nfWriteBuffer_Flush(context);
+            }
+        }
+        if (ret != 0) break;
+
+        if ((wb->pending == 0) && (this_count == wb->page_units)) {
+            /* Whole pages go straight to the flash */
+            ret = wh_FlashUnit_ProgramEx(context->cb, context->flash,
+                    offset, this_count, (const whFlashUnit*)data, flags);
+        } else {
+            memcpy(&wb->units[index], data, this_count * WHFU_BYTES_PER_UNIT);
+            for (i = index; i < index + this_count; i++) {
+                wb->dirty[i / 32] |= (1ul << (i % 32));
+            }
+            wb->base = base;
+            wb->flags = flags;
+            wb->pending = 1;
+        }
+        offset += this_count;
+        count -= this_count;
+        data += this_count * WHFU_BYTES_PER_UNIT;
+    }
+#endif
+    if ((ret == 0) && (count > 0)) {
+        ret = wh_FlashUnit_ProgramEx(context->cb, context->flash,
+                offset, count, (const whFlashUnit*)data, flags);
+    }
+    return ret;
+}
+
+/* Program each contiguous run of buffered units in address order.  Units
+ * that were never written stay blank, such as an object count that is
+ * programmed only to commit.  The buffer is empty afterwards, even on error */
+static int nfWriteBuffer_Flush(whNvmFlashContext* context)
+{
+    int ret = 0;
+#if NF_WRITE_BUFFER_SIZE > 0
+    nfWriteBuffer* wb = &context->write_buffer;
+    uint32_t start = 0;
+    uint32_t end = 0;
+
+    while ((wb->pending != 0) && (start < wb->page_units) && (ret == 0)) {
+        if ((wb->dirty[start / 32] & (1ul << (start % 32))) == 0) {
+            start++;
+            continue;
+        }
+        end = start + 1;
+        while ( (end < wb->page_units) &&
+                ((wb->dirty[end / 32] & (1ul << (end % 32))) != 0)) {
+            end++;
+        }
+        ret = wh_FlashUnit_ProgramEx(context->cb, context->flash,
+                wb->base + start, end - start, &wb->units[start], wb->flags);
+        start = end;
+    }
+    nfWriteBuffer_Discard(context);
+#else
+    (void)context;
+#endif
+    return ret;
+}
+
+/* Prepare for erasing partition.  Units buffered for it are dropped, while
+ * units buffered for another partition, such as the destination of a
+ * replication or an open stream, are programmed first */
+static int nfWriteBuffer_Release(whNvmFlashContext* context, int partition)
+{
+#if NF_WRITE_BUFFER_SIZE > 0
+    nfWriteBuffer* wb = &context->write_buffer;
+    uint32_t start = nfPartition_Offset(context, partition);
+
+    if (wb->pending == 0) {
+        return 0;
+    }
+    if (    (wb->base >= start) &&
+            (wb->base < start + context->partition_units)) {
+        nfWriteBuffer_Discard(context);
+        return 0;
+    }
+    return nfWriteBuffer_Flush(context);
+#else
+    (void)context;
+    (void)partition;
+    return 0;
+#endif
+}
+
+/* Drop buffered units after a failure so they are not programmed later */
+static void nfWriteBuffer_Discard(whNvmFlashContext* context)
+{
+#if NF_WRITE_BUFFER_SIZE > 0
+    nfWriteBuffer* wb = &context->write_buffer;
+    if (wb->pending != 0) {
+        memset(wb->dirty, 0, sizeof(wb->dirty));
+        wb->pending = 0;
+    }
+#else
+    (void)context;
+#endif
+}
+
 static uint32_t nfPartition_Offset(whNvmFlashContext* context, int partition)
 {
     if (context == NULL) {
@@ -238,6 +558,16 @@ static uint32_t nfPartition_Offset(whNvmFlashContext* context, int partition)
     return context->partition_units * partition;
 }
 
+static uint32_t nfPartition_DataUnits(whNvmFlashContext* context)
+{
+    if (context == NULL) {
+        /* Invalid.  Have to return something */
+        return 0;
+    }
+
+    return context->partition_units - NF_PARTITION_DATA_OFFSET;
+}
+
 static uint32_t nfPartition_DataOffset(whNvmFlashContext* context, int partition)
 {
     if (context == NULL) {
@@ -289,15 +619,69 @@ static int nfPartition_BlankCheck(whNvmFlashContext* context, int partition)
 
 static int nfPartition_Erase(whNvmFlashContext* context, int partition)
 {
+    int ret = 0;
+
     if (context == NULL) {
         return WH_ERROR_BADARGS;
     }
 
-    return wh_FlashUnit_Erase(
-            context->cb,
-            context->flash,
+    ret = nfWriteBuffer_Release(context, partition);
+    if (ret == 0) {
+        ret = wh_FlashUnit_Erase(
+                context->cb,
+                context->flash,
+                nfPartition_Offset(context, partition),
+                context->partition_units);
+    }
+    if (ret == 0) {
+        context->erase_pending &= ~(1ul << partition);
+        context->erase_count[partition]++;
+    }
+    return ret;
+}
+
+/* Choose the partition to replicate into.  Prefer erased partitions, then the
+ * fewest erases since Init, then the next after the active partition.  With no
+ * erase history, such as after a reset, this rotates through all partitions */
+static int nfPartition_SelectDestination(whNvmFlashContext* context)
+{
+    int best = -1;
+    int partition = 0;
+    uint32_t pending = 0;
+    uint32_t best_pending = 0;
+    int i = 0;
+
+    for (i = 1; i < context->partition_count; i++) {
+        partition = (context->active + i) % context->partition_count;
+        pending = (context->erase_pending >> partition) & 1;
+        if (    (best < 0) ||
+                (pending < best_pending) ||
+                ((pending == best_pending) &&
+                 (context->erase_count[partition] <
+                    context->erase_count[best]))) {
+            best = partition;
+            best_pending = pending;
+        }
+    }
+    return best;
+}
+
+/* Make earlier programs to the partition durable using the optional Sync */
+static int nfPartition_Sync(whNvmFlashContext* context, int partition)
+{
+    int ret = 0;
+
+    if ((context == NULL) || (context->cb == NULL)) {
+        return WH_ERROR_BADARGS;
+    }
+
+    ret = nfWriteBuffer_Flush(context);
+    if ((ret != 0) || (context->cb->Sync == NULL)) {
+        return ret;
+    }
+    return context->cb->Sync(context->flash,
             nfPartition_Offset(context, partition),
-            context->partition_units);
+            context->partition_units * WHFU_BYTES_PER_UNIT);
 }
 
 static int nfPartition_ReadMemState(whNvmFlashContext* context, int partition,
@@ -331,6 +715,32 @@ static int nfPartition_ReadMemDirectory(whNvmFlashContext* context, int partitio
                 NF_PARTITION_DIRECTORY_OFFSET;
     memset(directory, 0, sizeof(*directory));
 
+    if (context->bulk_mount != 0) {
+        /* Read as many objects as possible per flash access */
+        nfObject buffer[NF_DIRECTORY_READ_COUNT];
+        int count = 0;
+        int i = 0;
+
+        for(index = 0; (index < NF_OBJECT_COUNT) && (ret == 0);
+                index += count) {
+            count = NF_OBJECT_COUNT - index;
+            if (count > NF_DIRECTORY_READ_COUNT) {
+                count = NF_DIRECTORY_READ_COUNT;
+            }
+            ret = wh_FlashUnit_Read(
+                    context->cb,
+                    context->flash,
+                    offset + NF_DIRECTORY_OBJECT_OFFSET(index),
+                    count * NF_UNITS_PER_OBJECT,
+                    (whFlashUnit*)buffer);
+            for (i = 0; (i < count) && (ret == 0); i++) {
+                nfMemObject_Decode(context, &buffer[i],
+                        &directory->objects[index + i]);
+            }
+        }
+        return ret;
+    }
+
     for(index = 0; (index < NF_OBJECT_COUNT) && (ret == 0); index++) {
         /* TODO: Handle errors better here.  Break out of loop? */
         ret = nfMemObject_Read(
@@ -341,6 +751,222 @@ static int nfPartition_ReadMemDirectory(whNvmFlashContext* context, int partitio
     return ret;
 }
 
+#ifdef WOLFHSM_NVM_CHECKPOINT
+/* CRC-32 (IEEE 802.3) of the checkpoint bytes before crc, 4 bits at a time */
+static uint32_t nfCheckpoint_Crc(const nfCheckpoint* checkpoint)
+{
+    static const uint32_t table[16] = {
+        0x00000000ul, 0x1DB71064ul, 0x3B6E20C8ul, 0x26D930ACul,
+        0x76DC4190ul, 0x6B6B51F4ul, 0x4DB26158ul, 0x5005713Cul,
+        0xEDB88320ul, 0xF00F9344ul, 0xD6D6A3E8ul, 0xCB61B38Cul,
+        0x9B64C2B0ul, 0x86D3D2D4ul, 0xA00AE278ul, 0xBDBDF21Cul,
+    };
+    const uint8_t* data = (const uint8_t*)checkpoint;
+    size_t len = offsetof(nfCheckpoint, crc);
+    uint32_t crc = 0xFFFFFFFFul;
+
+    while (len-- > 0) {
+        crc ^= *data++;
+        crc = (crc >> 4) ^ table[crc & 0xF];
+        crc = (crc >> 4) ^ table[crc & 0xF];
+    }
+    return ~crc;
+}
+
+/* Read the objects from first through the next free one.  Later objects are
+ * left as they are */
+static int nfPartition_ReadMemObjects(whNvmFlashContext* context,
+        int partition, nfMemDirectory* directory, int first)
+{
+    int ret = 0;
+    int index = first;
+    uint32_t offset = 0;
+
+    if ((context == NULL) || (directory == NULL)) {
+        return WH_ERROR_BADARGS;
+    }
+
+    offset = nfPartition_Offset(context, partition) +
+                NF_PARTITION_DIRECTORY_OFFSET;
+
+    if (context->bulk_mount != 0) {
+        nfObject buffer[NF_DIRECTORY_READ_COUNT];
+        int count = 0;
+        int i = 0;
+
+        while ((index < NF_OBJECT_COUNT) && (ret == 0)) {
+            count = NF_OBJECT_COUNT - index;
+            if (count > NF_DIRECTORY_READ_COUNT) {
+                count = NF_DIRECTORY_READ_COUNT;
+            }
+            ret = wh_FlashUnit_Read(
+                    context->cb,
+                    context->flash,
+                    offset + NF_DIRECTORY_OBJECT_OFFSET(index),
+                    count * NF_UNITS_PER_OBJECT,
+                    (whFlashUnit*)buffer);
+            for (i = 0; (i < count) && (ret == 0); i++, index++) {
+                nfMemObject_Decode(context, &buffer[i],
+                        &directory->objects[index]);
+                if (directory->objects[index].state.status ==
+                        NF_STATUS_FREE) {
+                    return 0;
+                }
+            }
+        }
+        return ret;
+    }
+
+    for (; (index < NF_OBJECT_COUNT) && (ret == 0); index++) {
+        ret = nfMemObject_Read(
+                context,
+                offset + NF_DIRECTORY_OBJECT_OFFSET(index),
+                &directory->objects[index]);
+        if (    (ret == 0) &&
+                (directory->objects[index].state.status == NF_STATUS_FREE)) {
+            break;
+        }
+    }
+    return ret;
+}
+
+/* Load the objects, free pointers and id index of the directory from the
+ * checkpoint in one read.  Returns WH_ERROR_NOTVERIFIED if the checkpoint is
+ * blank, damaged or not from epoch */
+static int nfPartition_ReadCheckpoint(whNvmFlashContext* context,
+        int partition, uint32_t epoch, nfMemDirectory* directory)
+{
+    nfCheckpointBuffer buffer;
+    const nfCheckpoint* cp = &buffer.checkpoint;
+    nfMemObject* obj = NULL;
+    uint32_t next_data = 0;
+    int ret = 0;
+    int i = 0;
+
+    if ((context == NULL) || (directory == NULL)) {
+        return WH_ERROR_BADARGS;
+    }
+
+    ret = wh_FlashUnit_Read(
+            context->cb,
+            context->flash,
+            nfPartition_Offset(context, partition) +
+                NF_PARTITION_CHECKPOINT_OFFSET,
+            NF_UNITS_PER_CHECKPOINT,
+            buffer.units);
+    if (ret != 0) {
+        return ret;
+    }
+    if (    (cp->magic != NF_CHECKPOINT_MAGIC) ||
+            (cp->epoch != epoch) ||
+            (cp->crc != nfCheckpoint_Crc(cp)) ||
+            (cp->object_count > NF_OBJECT_COUNT) ||
+            (cp->next_free_data > nfPartition_DataUnits(context))) {
+        return WH_ERROR_NOTVERIFIED;
+    }
+    for (i = 0; i < NF_ID_INDEX_SIZE; i++) {
+        if (    (cp->id_index[i] < NF_ID_INDEX_EMPTY) ||
+                (cp->id_index[i] >= (int)cp->object_count)) {
+            return WH_ERROR_NOTVERIFIED;
+        }
+    }
+
+    memset(directory, 0, sizeof(*directory));
+    for (i = 0; i < NF_OBJECT_COUNT; i++) {
+        obj = &directory->objects[i];
+        if (i >= (int)cp->object_count) {
+            obj->state.status = NF_STATUS_FREE;
+            continue;
+        }
+        obj->state.status = NF_STATUS_USED;
+        obj->state.epoch = cp->objects[i].epoch;
+        obj->state.start = next_data;
+        obj->state.count = WHFU_BYTES2UNITS(cp->objects[i].metadata.len);
+        memcpy(&obj->metadata, &cp->objects[i].metadata,
+                sizeof(obj->metadata));
+        next_data += obj->state.count;
+    }
+    if (next_data != cp->next_free_data) {
+        return WH_ERROR_NOTVERIFIED;
+    }
+    directory->next_free_object = cp->object_count;
+    directory->next_free_data = cp->next_free_data;
+    directory->reclaimable_entries = cp->reclaimable_entries;
+    directory->reclaimable_data = cp->reclaimable_data;
+    memcpy(directory->id_index, cp->id_index, sizeof(directory->id_index));
+    return 0;
+}
+
+/* Program the checkpoint of a compacted directory into the replication
+ * destination, ahead of the count that commits both */
+static int nfPartition_ProgramCheckpoint(whNvmFlashContext* context,
+        int partition, uint32_t epoch, const nfMemDirectory* directory)
+{
+    nfCheckpointBuffer buffer;
+    nfCheckpoint* cp = &buffer.checkpoint;
+    int i = 0;
+
+    if ((context == NULL) || (context->cb == NULL) || (directory == NULL)) {
+        return WH_ERROR_BADARGS;
+    }
+
+    memset(&buffer, 0, sizeof(buffer));
+    cp->magic = NF_CHECKPOINT_MAGIC;
+    cp->epoch = epoch;
+    cp->object_count = directory->next_free_object;
+    cp->next_free_data = directory->next_free_data;
+    cp->reclaimable_entries = directory->reclaimable_entries;
+    cp->reclaimable_data = directory->reclaimable_data;
+    memcpy(cp->id_index, directory->id_index, sizeof(cp->id_index));
+    for (i = 0; i < directory->next_free_object; i++) {
+        cp->objects[i].epoch = directory->objects[i].state.epoch;
+        memcpy(&cp->objects[i].metadata, &directory->objects[i].metadata,
+                sizeof(cp->objects[i].metadata));
+    }
+    cp->crc = nfCheckpoint_Crc(cp);
+
+    return nfWriteBuffer_Program(
+            context,
+            nfPartition_Offset(context, partition) +
+                NF_PARTITION_CHECKPOINT_OFFSET,
+            NF_UNITS_PER_CHECKPOINT,
+            (const uint8_t*)buffer.units,
+            nfProgram_Flags(context, partition, 0));
+}
+#endif
+
+/* Rebuild the cached directory of the active partition.  With a valid
+ * checkpoint, only the objects added after it are read and parsed */
+static int nfPartition_LoadMemDirectory(whNvmFlashContext* context)
+{
+    nfMemDirectory* d = &context->directory;
+    int ret = 0;
+
+#ifdef WOLFHSM_NVM_CHECKPOINT
+    context->checkpoint_mounted = 0;
+    if (context->state.status == NF_STATUS_USED) {
+        ret = nfPartition_ReadCheckpoint(context, context->active,
+                context->state.epoch, d);
+        if (ret == 0) {
+            ret = nfPartition_ReadMemObjects(context, context->active, d,
+                    d->next_free_object);
+        }
+        if (ret == 0) {
+            ret = nfMemDirectory_ParseFrom(d, nfPartition_DataUnits(context));
+        }
+        if (ret == 0) {
+            context->checkpoint_mounted = 1;
+            return 0;
+        }
+    }
+#endif
+
+    /* Read and parse every object */
+    ret = nfPartition_ReadMemDirectory(context, context->active, d);
+    ret = nfMemDirectory_Parse(d, nfPartition_DataUnits(context));
+    return ret;
+}
+
 static int nfPartition_ProgramEpoch(whNvmFlashContext* context,
         int partition, uint32_t epoch)
 {
@@ -350,13 +976,14 @@ static int nfPartition_ProgramEpoch(whNvmFlashContext* context,
         return WH_ERROR_BADARGS;
     }
 
-    return wh_FlashUnit_Program(
+    return wh_FlashUnit_ProgramEx(
             context->cb,
             context->flash,
             nfPartition_Offset(context, partition) +
                 NF_PARTITION_STATE_OFFSET + NF_STATE_EPOCH_OFFSET,
             1,
-            &unit);
+            &unit,
+            nfProgram_Flags(context, partition, 0));
 }
 
 static int nfPartition_ProgramStart(whNvmFlashContext* context,
@@ -368,31 +995,39 @@ static int nfPartition_ProgramStart(whNvmFlashContext* context,
         return WH_ERROR_BADARGS;
     }
 
-    return wh_FlashUnit_Program(
+    return wh_FlashUnit_ProgramEx(
             context->cb,
             context->flash,
             nfPartition_Offset(context, partition) +
                 NF_PARTITION_STATE_OFFSET + NF_STATE_START_OFFSET,
             1,
-            &unit);
+            &unit,
+            nfProgram_Flags(context, partition, 0));
 }
 
 static int nfPartition_ProgramCount(whNvmFlashContext* context,
         int partition, uint32_t count)
 {
     whFlashUnit unit = count;
+    int ret = 0;
 
     if ((context == NULL) || (context->cb == NULL)) {
         return WH_ERROR_BADARGS;
     }
 
-    return wh_FlashUnit_Program(
+    /* The count commits the partition, so everything before must be written */
+    ret = nfWriteBuffer_Flush(context);
+    if (ret != 0) {
+        return ret;
+    }
+    return wh_FlashUnit_ProgramEx(
             context->cb,
             context->flash,
             nfPartition_Offset(context, partition) +
                 NF_PARTITION_STATE_OFFSET + NF_STATE_COUNT_OFFSET,
             1,
-            &unit);
+            &unit,
+            nfProgram_Flags(context, partition, 1));
 
 }
 
@@ -423,8 +1058,14 @@ static int nfPartition_ProgramInit(whNvmFlashContext* context, int partition)
             ret = nfPartition_ProgramStart(context, partition,
                     init_state.start);
             if (ret == 0) {
-                ret = nfPartition_ProgramCount(context, partition,
-                        init_state.count);
+                ret = nfPartition_Sync(context, partition);
+                if (ret == 0) {
+                    ret = nfPartition_ProgramCount(context, partition,
+                            init_state.count);
+                }
+                if (ret == 0) {
+                    ret = nfPartition_Sync(context, partition);
+                }
                 if (ret == 0) {
                     context->state = init_state;
                 } else {
@@ -461,62 +1102,95 @@ static int nfObject_ProgramBegin(whNvmFlashContext* context, int partition,
     whFlashUnit state_epoch = epoch;
     whFlashUnit state_start = start;
 
-    if (    (context == NULL) ||
-            (context->cb == NULL) ||
-            (meta == NULL)) {
+    if ((context == NULL) || (context->cb == NULL)) {
         return WH_ERROR_BADARGS;
     }
 
     object_offset = nfObject_Offset(context, partition, object_index);
 
+    /* The write buffer may program these in address order.  That is safe as
+     * the metadata is only used once the count is programmed */
+
     /* Program the object epoch */
-    rc = wh_FlashUnit_Program(
-            context->cb,
-            context->flash,
+    rc = nfWriteBuffer_Program(
+            context,
             object_offset + NF_OBJECT_STATE_OFFSET + NF_STATE_EPOCH_OFFSET,
             1,
-            &state_epoch);
+            (const uint8_t*)&state_epoch,
+            nfProgram_Flags(context, partition, 0));
 
-    if (rc == 0) {
+    if ((rc == 0) && (meta != NULL)) {
         /* Program the object metadata */
-        rc = wh_FlashUnit_Program(
-                context->cb,
-                context->flash,
-                object_offset + NF_OBJECT_METADATA_OFFSET,
-                NF_UNITS_PER_METADATA,
-                (whFlashUnit*)meta);
+        rc = nfObject_ProgramMetadata(context, partition, object_index, meta);
+    }
 
-        if (rc == 0) {
-            /* Program the object start */
-            rc = wh_FlashUnit_Program(
-                    context->cb,
-                    context->flash,
-                    object_offset + NF_OBJECT_STATE_OFFSET + NF_STATE_START_OFFSET,
-                    1,
-                    &state_start);
-        }
+    if (rc == 0) {
+        /* Program the object start */
+        rc = nfWriteBuffer_Program(
+                context,
+                object_offset + NF_OBJECT_STATE_OFFSET + NF_STATE_START_OFFSET,
+                1,
+                (const uint8_t*)&state_start,
+                nfProgram_Flags(context, partition, 0));
     }
     return rc;
 }
 
+static int nfObject_ProgramMetadata(whNvmFlashContext* context, int partition,
+        int object_index, const whNvmMetadata* meta)
+{
+    if ((context == NULL) || (context->cb == NULL) || (meta == NULL)) {
+        return WH_ERROR_BADARGS;
+    }
+
+    return nfWriteBuffer_Program(
+            context,
+            nfObject_Offset(context, partition, object_index) +
+                NF_OBJECT_METADATA_OFFSET,
+            NF_UNITS_PER_METADATA,
+            (const uint8_t*)meta,
+            nfProgram_Flags(context, partition, 0));
+}
+
 static int nfObject_ProgramDataBytes(whNvmFlashContext* context, int partition,
         uint32_t offset, uint32_t byte_count, const uint8_t* data)
 {
     uint32_t data_offset = 0;
+    uint32_t count = byte_count / WHFU_BYTES_PER_UNIT;
+    uint32_t rem = byte_count % WHFU_BYTES_PER_UNIT;
+    uint32_t flags = 0;
+    whFlashUnitBuffer tail = {0};
+    int rc = 0;
 
     if ((context == NULL) || (context->cb == NULL)) {
         return WH_ERROR_BADARGS;
     }
 
     data_offset = nfPartition_DataOffset(context, partition) + offset;
+    flags = nfProgram_Flags(context, partition, 0);
 
-    /* Program the data */
-    return wh_FlashUnit_ProgramBytes(
-            context->cb,
-            context->flash,
-            data_offset * WHFU_BYTES_PER_UNIT,
-            byte_count,
-            data);
+#if NF_WRITE_BUFFER_SIZE > 0
+    if (context->write_buffer.page_units == 0)
+#endif
+    {
+        /* Program the data */
+        return wh_FlashUnit_ProgramBytesEx(
+                context->cb,
+                context->flash,
+                data_offset * WHFU_BYTES_PER_UNIT,
+                byte_count,
+                data,
+                flags);
+    }
+
+    /* Buffer the body and the zero filled final unit together */
+    rc = nfWriteBuffer_Program(context, data_offset, count, data, flags);
+    if ((rc == 0) && (rem != 0)) {
+        memcpy(tail.bytes, data + count * WHFU_BYTES_PER_UNIT, rem);
+        rc = nfWriteBuffer_Program(context, data_offset + count, 1,
+                tail.bytes, flags);
+    }
+    return rc;
 }
 
 static int nfObject_ProgramFinish(whNvmFlashContext* context, int partition,
@@ -524,6 +1198,7 @@ static int nfObject_ProgramFinish(whNvmFlashContext* context, int partition,
 {
     uint32_t object_offset = 0;
     whFlashUnit state_count = WHFU_BYTES2UNITS(byte_count);
+    int rc = 0;
 
     if ((context == NULL) || (context->cb == NULL)) {
         return WH_ERROR_BADARGS;
@@ -531,13 +1206,20 @@ static int nfObject_ProgramFinish(whNvmFlashContext* context, int partition,
 
     object_offset = nfObject_Offset(context, partition, object_index);
 
+    /* The count commits the object, so its header and data must be written */
+    rc = nfWriteBuffer_Flush(context);
+    if (rc != 0) {
+        return rc;
+    }
+
     /* Program the object flag->state_count */
-    return wh_FlashUnit_Program(
+    return wh_FlashUnit_ProgramEx(
             context->cb,
             context->flash,
             object_offset + NF_OBJECT_STATE_OFFSET + NF_STATE_COUNT_OFFSET,
             1,
-            &state_count);
+            &state_count,
+            nfProgram_Flags(context, partition, 1));
 }
 
 static int nfObject_Program(whNvmFlashContext* context, int partition,
@@ -556,10 +1238,20 @@ static int nfObject_Program(whNvmFlashContext* context, int partition,
     if (rc == 0) {
         rc = nfObject_ProgramDataBytes(context, partition,
                 start, meta->len, data);
+        if (rc == 0) {
+            /* Data and metadata must be durable before the commit */
+            rc = nfPartition_Sync(context, partition);
+        }
         if (rc == 0) {
             rc = nfObject_ProgramFinish(context, partition, object_index,
                     meta->len);
         }
+        if (rc == 0) {
+            rc = nfPartition_Sync(context, partition);
+        }
+    }
+    if (rc != 0) {
+        nfWriteBuffer_Discard(context);
     }
     return rc;
 }
@@ -586,41 +1278,37 @@ static int nfObject_ReadDataBytes(whNvmFlashContext* context, int partition,
             out_data);
 }
 
-static int nfObject_Copy(whNvmFlashContext* context, int object_index,
-        int partition, uint32_t *inout_next_object, uint32_t *inout_next_data)
+static int nfObject_CopyDataBytes(whNvmFlashContext* context,
+        int object_index, int partition, uint32_t dest_data,
+        uint32_t byte_offset, uint32_t byte_count)
 {
     int ret = 0;
-    uint32_t dest_object = 0;
-    uint32_t dest_data = 0;
-    nfMemDirectory* d = NULL;
-    uint32_t data_len = 0;
-    uint32_t data_offset = 0;
+    uint32_t copied = 0;
 
-    if (    (context == NULL) ||
-            (inout_next_object == NULL) ||
-            (inout_next_data == NULL)) {
+    if ((context == NULL) || (context->cb == NULL)) {
         return WH_ERROR_BADARGS;
     }
 
-    dest_object = *inout_next_object;
-    dest_data = *inout_next_data;
-    d = &context->directory;
-
-    data_len = d->objects[object_index].metadata.len;
-
-    /* Copy the object to the new partition */
-    ret = nfObject_ProgramBegin(context, partition, dest_object,
-            d->objects[object_index].state.epoch,
-            dest_data, &d->objects[object_index].metadata);
-    if (ret != 0) return ret;
+    if (context->cb->Copy != NULL) {
+        /* Let the flash move the data directly.  byte_offset is aligned */
+        return wh_FlashUnit_Copy(
+                context->cb,
+                context->flash,
+                nfPartition_DataOffset(context, partition) + dest_data,
+                nfPartition_DataOffset(context, context->active) +
+                    context->directory.objects[object_index].state.start +
+                    byte_offset / WHFU_BYTES_PER_UNIT,
+                WHFU_BYTES2UNITS(byte_count),
+                nfProgram_Flags(context, partition, 0));
+    }
 
     /* Loop through reading the old data into buffer */
-    while (data_offset < data_len) {
+    while (copied < byte_count) {
         uint8_t buffer[NF_COPY_OBJECT_BUFFER_LEN];
         uint32_t this_len = sizeof(buffer);
 
-        if((data_len - data_offset) < this_len) {
-            this_len = data_len - data_offset;
+        if((byte_count - copied) < this_len) {
+            this_len = byte_count - copied;
         }
 
         /* Read the data from the old object. */
@@ -628,7 +1316,7 @@ static int nfObject_Copy(whNvmFlashContext* context, int object_index,
                 context,
                 context->active,
                 object_index,
-                data_offset,
+                byte_offset + copied,
                 this_len,
                 buffer);
         if (ret != 0) return ret;
@@ -637,65 +1325,224 @@ static int nfObject_Copy(whNvmFlashContext* context, int object_index,
         ret = nfObject_ProgramDataBytes(
                 context,
                 partition,
-                dest_data,
+                dest_data + WHFU_BYTES2UNITS(copied),
                 this_len,
                 buffer);
         if (ret != 0) return ret;
 
-        data_offset += this_len;
-        dest_data += WHFU_BYTES2UNITS(this_len);
+        copied += this_len;
     }
-    ret = nfObject_ProgramFinish(context, partition, dest_object, data_len);
-    if (ret != 0) return ret;
-    dest_object++;
+    return ret;
+}
 
-    if (ret == 0) {
-        *inout_next_object = dest_object;
-        *inout_next_data = dest_data;
+
+static void nfDataWriter_Init(nfDataWriter* w, whNvmFlashContext* context,
+        int partition, uint32_t offset)
+{
+    w->context = context;
+    w->partition = partition;
+    w->offset = offset;
+    w->used = 0;
+}
+
+static int nfDataWriter_Flush(nfDataWriter* w)
+{
+    int ret = 0;
+
+    if (w->used > 0) {
+        ret = nfObject_ProgramDataBytes(w->context, w->partition,
+                w->offset, w->used, w->buffer.bytes);
+        w->offset += WHFU_BYTES2UNITS(w->used);
+        w->used = 0;
+    }
+    return ret;
+}
+
+/* Append the data of an object, padded to a whole unit.  Whole units are
+ * programmed directly from data when nothing is pending in the buffer */
+static int nfDataWriter_Write(nfDataWriter* w, uint32_t byte_count,
+        const uint8_t* data)
+{
+    int ret = 0;
+    uint32_t this_len = 0;
+
+    while ((ret == 0) && (byte_count > 0)) {
+        if ((w->used == 0) && (byte_count >= WHFU_BYTES_PER_UNIT)) {
+            this_len = byte_count - (byte_count % WHFU_BYTES_PER_UNIT);
+            ret = nfObject_ProgramDataBytes(w->context, w->partition,
+                    w->offset, this_len, data);
+            w->offset += this_len / WHFU_BYTES_PER_UNIT;
+        } else {
+            this_len = sizeof(w->buffer.bytes) - w->used;
+            if (this_len > byte_count) {
+                this_len = byte_count;
+            }
+            memcpy(&w->buffer.bytes[w->used], data, this_len);
+            w->used += this_len;
+            if (w->used == sizeof(w->buffer.bytes)) {
+                ret = nfDataWriter_Flush(w);
+            }
+        }
+        data += this_len;
+        byte_count -= this_len;
+    }
+
+    /* Short writes are filled with 0 as in wh_FlashUnit_ProgramBytes */
+    if ((ret == 0) && ((w->used % WHFU_BYTES_PER_UNIT) != 0)) {
+        this_len = WHFU_BYTES_PER_UNIT - (w->used % WHFU_BYTES_PER_UNIT);
+        memset(&w->buffer.bytes[w->used], 0, this_len);
+        w->used += this_len;
+        if (w->used == sizeof(w->buffer.bytes)) {
+            ret = nfDataWriter_Flush(w);
+        }
     }
     return ret;
 }
 
 
-static int nfMemDirectory_Parse(nfMemDirectory* d)
+/* Hash an id into a starting slot of the id index */
+#define NF_ID_INDEX_HASH(_id) \
+    ((((uint32_t)(_id) * 2654435761ul) >> 16) & (NF_ID_INDEX_SIZE - 1))
+
+static void nfMemDirectory_IndexClear(nfMemDirectory* d)
 {
-    int done=0;
+    int slot = 0;
+    for (slot = 0; slot < NF_ID_INDEX_SIZE; slot++) {
+        d->id_index[slot] = NF_ID_INDEX_EMPTY;
+    }
+}
+
+/* Return the slot that holds id, or the empty slot where it would be inserted.
+ * The index is always larger than the directory, so an empty slot exists. */
+static int nfMemDirectory_IndexFindSlot(nfMemDirectory* d, whNvmId id)
+{
+    int slot = NF_ID_INDEX_HASH(id);
 
+    while ( (d->id_index[slot] != NF_ID_INDEX_EMPTY) &&
+            (d->objects[d->id_index[slot]].metadata.id != id)) {
+        slot = (slot + 1) & (NF_ID_INDEX_SIZE - 1);
+    }
+    return slot;
+}
+
+/* Set id to refer to object_index, replacing any previous entry */
+static void nfMemDirectory_IndexInsert(nfMemDirectory* d, whNvmId id,
+        int object_index)
+{
+    d->id_index[nfMemDirectory_IndexFindSlot(d, id)] = object_index;
+}
+
+/* Remove id from the index, shifting back any entries that probed past it */
+static void nfMemDirectory_IndexRemove(nfMemDirectory* d, whNvmId id)
+{
+    int hole = nfMemDirectory_IndexFindSlot(d, id);
+    int slot = hole;
+
+    if (d->id_index[hole] == NF_ID_INDEX_EMPTY) {
+        /* Not present */
+        return;
+    }
+    d->id_index[hole] = NF_ID_INDEX_EMPTY;
+
+    slot = (slot + 1) & (NF_ID_INDEX_SIZE - 1);
+    while (d->id_index[slot] != NF_ID_INDEX_EMPTY) {
+        int home = NF_ID_INDEX_HASH(
+                d->objects[d->id_index[slot]].metadata.id);
+        /* Move this entry into the hole unless its home is cyclically
+         * within (hole, slot] */
+        if (((slot - home) & (NF_ID_INDEX_SIZE - 1)) >=
+                ((slot - hole) & (NF_ID_INDEX_SIZE - 1))) {
+            d->id_index[hole] = d->id_index[slot];
+            d->id_index[slot] = NF_ID_INDEX_EMPTY;
+            hole = slot;
+        }
+        slot = (slot + 1) & (NF_ID_INDEX_SIZE - 1);
+    }
+}
+
+static int nfMemDirectory_Parse(nfMemDirectory* d, uint32_t data_units)
+{
     if (d == NULL) {
         return WH_ERROR_BADARGS;
     }
 
+    nfMemDirectory_IndexClear(d);
+
     /* Compute next free unit and free entry based on metadata*/
+    d->next_free_object = 0;
     d->next_free_data = 0;
     d->reclaimable_data = 0;
     d->reclaimable_entries = 0;
-    for (   d->next_free_object = 0;
+    return nfMemDirectory_ParseFrom(d, data_units);
+}
+
+/* Parse the objects from next_free_object, with the index, free data and
+ * reclaimable totals already set for the earlier used objects */
+static int nfMemDirectory_ParseFrom(nfMemDirectory* d, uint32_t data_units)
+{
+    int done=0;
+    int entry = 0;
+    int slot = 0;
+    int bad_entry = -1;
+    nfMemState* bad = NULL;
+
+    if (d == NULL) {
+        return WH_ERROR_BADARGS;
+    }
+
+    for (   ;
             d->next_free_object < NF_OBJECT_COUNT;
             d->next_free_object++)
     {
-        switch(d->objects[d->next_free_object].state.status) {
+        entry = d->next_free_object;
+        switch(d->objects[entry].state.status) {
         case NF_STATUS_FREE:
             /* This must be the last. We are done */
             done = 1;
             break;
         case NF_STATUS_USED:
+            if (bad_entry >= 0) {
+                /* The earlier incomplete data ends where this data starts */
+                bad = &d->objects[bad_entry].state;
+                bad->count = (d->objects[entry].state.start > bad->start) ?
+                        d->objects[entry].state.start - bad->start : 0;
+                d->reclaimable_data += bad->count;
+                bad_entry = -1;
+            }
             /* Advance the data pointer to after this data and keep looking */
             d->next_free_data =
-                d->objects[d->next_free_object].state.start +
-                d->objects[d->next_free_object].state.count;
+                d->objects[entry].state.start +
+                d->objects[entry].state.count;
+
+            /* Later entries replace earlier ones with the same id.  Mark the
+             * older duplicate as reclaimable */
+            slot = nfMemDirectory_IndexFindSlot(d,
+                    d->objects[entry].metadata.id);
+            if (d->id_index[slot] != NF_ID_INDEX_EMPTY) {
+                int that_entry = d->id_index[slot];
+                d->reclaimable_entries++;
+                d->reclaimable_data += d->objects[that_entry].state.count;
+                d->objects[that_entry].state.status = NF_STATUS_DATA_BAD;
+            }
+            d->id_index[slot] = entry;
             break;
         case NF_STATUS_META_BAD:
             /* Metadata is incomplete.  Skip it*/
             d->reclaimable_entries++;
             break;
         case NF_STATUS_DATA_BAD:
-            /* Data is incomplete, but we must advance the pointer */
+            /* Data is incomplete and the count is blank, so how much data was
+             * programmed is unknown.  A later object bounds it, otherwise the
+             * rest of the partition is unusable until the next DestroyObjects */
+            if (bad_entry >= 0) {
+                bad = &d->objects[bad_entry].state;
+                bad->count = (d->objects[entry].state.start > bad->start) ?
+                        d->objects[entry].state.start - bad->start : 0;
+                d->reclaimable_data += bad->count;
+            }
+            bad_entry = entry;
             d->reclaimable_entries++;
-            d->reclaimable_data +=
-                d->objects[d->next_free_object].state.count;
-            d->next_free_data =
-                d->objects[d->next_free_object].state.start +
-                d->objects[d->next_free_object].state.count;
+            d->next_free_data = data_units;
             break;
         default:
             /* Unknown state.  Better barf */
@@ -703,48 +1550,179 @@ static int nfMemDirectory_Parse(nfMemDirectory* d)
         }
         if (done) break;
     }
+    if (bad_entry >= 0) {
+        bad = &d->objects[bad_entry].state;
+        bad->count = (data_units > bad->start) ? data_units - bad->start : 0;
+        d->reclaimable_data += bad->count;
+    }
+    return 0;
+}
 
-    /* Now walk through backwards and reclaim any duplicate meta->id data counts */
-    int this_entry, that_entry;
-    for (this_entry = NF_OBJECT_COUNT - 1; this_entry >= 0; this_entry --) {
-        if (d->objects[this_entry].state.status == NF_STATUS_USED) {
-            whNvmId this_id = d->objects[this_entry].metadata.id;
-            for (that_entry = this_entry - 1; that_entry >= 0; that_entry --) {
-                if (    (d->objects[that_entry].state.status == NF_STATUS_USED) &&
-                        (d->objects[that_entry].metadata.id == this_id)) {
-                    /* Found duplicate.  Mark it as reclaimable and break out of this loop */
-                    d->reclaimable_entries++;
-                    d->reclaimable_data += d->objects[that_entry].state.count;
-                    d->objects[that_entry].state.status = NF_STATUS_DATA_BAD;
-                }
-            }
+/* Record a newly programmed object at the next free entry and data, replacing
+ * any existing object with the same id */
+static void nfMemDirectory_AddEntry(nfMemDirectory* d,
+        const whNvmMetadata* meta, uint32_t epoch)
+{
+    int oldentry = -1;
+    nfMemObject* obj = &d->objects[d->next_free_object];
+
+    (void)nfMemDirectory_FindObjectIndexById(d, meta->id, &oldentry);
+
+    /* Update directory with new object */
+    obj->state.status = NF_STATUS_USED;
+    obj->state.epoch = epoch;
+    obj->state.start = d->next_free_data;
+    obj->state.count = WHFU_BYTES2UNITS(meta->len);
+    memcpy(&obj->metadata, meta, sizeof(*meta));
+    nfMemDirectory_IndexInsert(d, meta->id, d->next_free_object);
+    d->next_free_data += obj->state.count;
+    d->next_free_object++;
+
+    /* Update directory to reclaim old entry */
+    if (oldentry >= 0) {
+        d->objects[oldentry].state.status = NF_STATUS_DATA_BAD;
+        d->reclaimable_entries++;
+        d->reclaimable_data += d->objects[oldentry].state.count;
+    }
+}
+
+/* Update the directory to match a replication of its used objects, which are
+ * written in order with contiguous data starting at unit 0 */
+static void nfMemDirectory_Compact(nfMemDirectory* d)
+{
+    int entry = 0;
+    int dest = 0;
+    uint32_t next_data = 0;
+
+    nfMemDirectory_IndexClear(d);
+    for (entry = 0; entry < NF_OBJECT_COUNT; entry++) {
+        if (d->objects[entry].state.status != NF_STATUS_USED) {
+            continue;
+        }
+        if (dest != entry) {
+            d->objects[dest] = d->objects[entry];
         }
+        d->objects[dest].state.start = next_data;
+        next_data += d->objects[dest].state.count;
+        nfMemDirectory_IndexInsert(d, d->objects[dest].metadata.id, dest);
+        dest++;
+    }
+
+    d->next_free_object = dest;
+    d->next_free_data = next_data;
+    d->reclaimable_entries = 0;
+    d->reclaimable_data = 0;
+    for (entry = dest; entry < NF_OBJECT_COUNT; entry++) {
+        memset(&d->objects[entry], 0, sizeof(d->objects[entry]));
+        d->objects[entry].state.status = NF_STATUS_FREE;
     }
-    return 0;
 }
 
 static int nfMemDirectory_FindObjectIndexById(nfMemDirectory* d, whNvmId id,
         int *out_object_index)
 {
     int index = 0;
-    int ret = WH_ERROR_NOTFOUND;
 
     if (d == NULL) {
         return WH_ERROR_BADARGS;
     }
 
-    /* Find first used index that matches the id. */
-    for (index = 0; index< d->next_free_object; index++) {
-        if ((d->objects[index].state.status == NF_STATUS_USED) &&
-                (d->objects[index].metadata.id == id)) {
-            if (out_object_index != NULL) *out_object_index = index;
-            ret = 0;
-            break;
+    WH_STATS_INC(dir_lookups);
+    index = d->id_index[nfMemDirectory_IndexFindSlot(d, id)];
+    if (    (index == NF_ID_INDEX_EMPTY) ||
+            (d->objects[index].state.status != NF_STATUS_USED)) {
+        return WH_ERROR_NOTFOUND;
+    }
+    if (out_object_index != NULL) *out_object_index = index;
+    return 0;
+}
+
+
+
+#if NF_CACHE_ENTRY_COUNT > 0
+/* Clear an entry, using volatile so the clear is not optimized out */
+static void nfCache_Zeroize(nfCacheEntry* entry)
+{
+    volatile uint8_t* p = (volatile uint8_t*)entry;
+    size_t i = 0;
+
+    for (i = 0; i < sizeof(*entry); i++) {
+        p[i] = 0;
+    }
+}
+
+/* Drop any cached data for id.  Called whenever id is added or destroyed */
+static void nfCache_Invalidate(whNvmFlashContext* context, whNvmId id)
+{
+    int i = 0;
+
+    for (i = 0; i < NF_CACHE_ENTRY_COUNT; i++) {
+        if (    (context->cache.entries[i].used != 0) &&
+                (context->cache.entries[i].id == id)) {
+            nfCache_Zeroize(&context->cache.entries[i]);
         }
     }
-    return ret;
 }
 
+/* Serve a read from the cache, loading the entire object into the least
+ * recently used entry on a miss.  Returns WH_ERROR_NOTFOUND if the object
+ * cannot be cached so the caller reads from flash */
+static int nfCache_Read(whNvmFlashContext* context, int object_index,
+        uint32_t offset, uint32_t data_len, uint8_t* out_data)
+{
+    nfCache* cache = &context->cache;
+    nfMemObject* obj = &context->directory.objects[object_index];
+    nfCacheEntry* entry = NULL;
+    int ret = 0;
+    int i = 0;
+
+    if (    ((obj->metadata.flags & WOLFHSM_NVM_FLAGS_NOCACHE) != 0) ||
+            (obj->metadata.len > NF_CACHE_ENTRY_SIZE) ||
+            (offset + data_len > obj->metadata.len)) {
+        return WH_ERROR_NOTFOUND;
+    }
+
+    for (i = 0; i < NF_CACHE_ENTRY_COUNT; i++) {
+        if (    (cache->entries[i].used != 0) &&
+                (cache->entries[i].id == obj->metadata.id) &&
+                (cache->entries[i].epoch == obj->state.epoch)) {
+            entry = &cache->entries[i];
+            break;
+        }
+    }
+
+    if (entry != NULL) {
+        cache->hits++;
+    } else {
+        cache->misses++;
+
+        /* Evict an unused or the least recently used entry */
+        entry = &cache->entries[0];
+        for (i = 0; (i < NF_CACHE_ENTRY_COUNT) && (entry->used != 0); i++) {
+            if (    (cache->entries[i].used == 0) ||
+                    (cache->entries[i].last_use < entry->last_use)) {
+                entry = &cache->entries[i];
+            }
+        }
+        nfCache_Zeroize(entry);
+
+        ret = nfObject_ReadDataBytes(context, context->active, object_index,
+                0, obj->metadata.len, entry->data);
+        if (ret != 0) {
+            nfCache_Zeroize(entry);
+            return ret;
+        }
+        entry->used = 1;
+        entry->id = obj->metadata.id;
+        entry->len = obj->metadata.len;
+        entry->epoch = obj->state.epoch;
+    }
+
+    entry->last_use = ++cache->tick;
+    memcpy(out_data, &entry->data[offset], data_len);
+    return 0;
+}
+#endif
 
 
 /*************  WolfHSM NVM Interfaces  ***********/
@@ -754,12 +1732,29 @@ int wh_NvmFlash_Init(void* c, const void* cf)
     whNvmFlashContext* context = c;
     const whNvmFlashConfig* config = cf;
     int ret = 0;
+    int i = 0;
 
     if (    (context == NULL) ||
             (config == NULL) ||
-            (config->cb == NULL)) {
+            (config->cb == NULL) ||
+            (config->partition_count < 0) ||
+            (config->partition_count == 1) ||
+            (config->partition_count > NF_PARTITION_COUNT)) {
+        return WH_ERROR_BADARGS;
+    }
+#if NF_WRITE_BUFFER_SIZE > 0
+    if (    (config->write_page_size != 0) &&
+            (   (config->write_page_size < WHFU_BYTES_PER_UNIT) ||
+                (config->write_page_size > NF_WRITE_BUFFER_SIZE) ||
+                ((config->write_page_size &
+                    (config->write_page_size - 1)) != 0))) {
         return WH_ERROR_BADARGS;
     }
+#else
+    if (config->write_page_size != 0) {
+        return WH_ERROR_BADARGS;
+    }
+#endif
 
     if (config->cb->Init != NULL) {
         ret = config->cb->Init(config->context, config->config);
@@ -769,6 +1764,14 @@ int wh_NvmFlash_Init(void* c, const void* cf)
         memset(context, 0, sizeof(*context));
         context->cb = config->cb;
         context->flash = config->context;
+        context->bulk_mount = config->bulk_mount;
+        context->verify = config->verify;
+#if NF_WRITE_BUFFER_SIZE > 0
+        context->write_buffer.page_units =
+                config->write_page_size / WHFU_BYTES_PER_UNIT;
+#endif
+        memset(&context->erased_unit, config->erased_byte,
+                sizeof(context->erased_unit));
 
         /* Get partition size from flash device */
         if (context->cb->PartitionSize != NULL) {
@@ -777,44 +1780,53 @@ int wh_NvmFlash_Init(void* c, const void* cf)
                     WHFU_BYTES_PER_UNIT;
         }
 
-        /* Unlock the both partitions */
-        nfPartition_WriteUnlock(context, 0);
-        nfPartition_WriteUnlock(context, 1);
+        context->partition_count = (config->partition_count != 0) ?
+                config->partition_count : 2;
 
-        nfMemState part_states[2];
+        /* Unlock all of the partitions */
+        for (i = 0; i < context->partition_count; i++) {
+            nfPartition_WriteUnlock(context, i);
+        }
 
-        /* Recover the partition states to determine which should be active */
-        nfPartition_ReadMemState(context, 0 , &part_states[0]);
-        nfPartition_ReadMemState(context, 1 , &part_states[1]);
+        nfMemState part_states[NF_PARTITION_COUNT];
+        int used = -1;
+        int all_free = 1;
+
+        /* Recover the partition states.  The used partition with the largest
+         * epoch is active.  Other partitions were retired or interrupted */
+        for (i = 0; i < context->partition_count; i++) {
+            nfPartition_ReadMemState(context, i, &part_states[i]);
+            if (part_states[i].status == NF_STATUS_USED) {
+                if (    (used < 0) ||
+                        (part_states[i].epoch > part_states[used].epoch)) {
+                    used = i;
+                }
+            }
+            if (part_states[i].status != NF_STATUS_FREE) {
+                all_free = 0;
+            }
+        }
 
         /* Decide which directory should be active */
-        if (        (part_states[0].status == NF_STATUS_USED) &&
-                    (part_states[1].status != NF_STATUS_USED)) {
-            context->active = 0;
-            context->state = part_states[context->active];
-        } else if ( (part_states[0].status != NF_STATUS_USED) &&
-                    (part_states[1].status == NF_STATUS_USED)) {
-            context->active = 1;
+        if (used >= 0) {
+            context->active = used;
             context->state = part_states[context->active];
-        } else if ( (part_states[0].status == NF_STATUS_USED) &&
-                    (part_states[1].status == NF_STATUS_USED)) {
-            /* Check which has larger epoch */
-            context->active =
-                    (part_states[1].epoch > part_states[0].epoch);
-            context->state = part_states[context->active];
-        } else if ( (part_states[0].status == NF_STATUS_FREE) &&
-                    (part_states[1].status == NF_STATUS_FREE)) {
-            /* Both are blank.  Set active to 0 and initialize */
+        } else if (all_free != 0) {
+            /* All are blank.  Set active to 0 and initialize */
             context->active = 0;
             nfPartition_ProgramInit(context,
                     context->active);
         }
 
-        ret = nfPartition_ReadMemDirectory(
-                context,
-                context->active,
-                &context->directory);
-        ret = nfMemDirectory_Parse(&context->directory);
+        /* Erase the retired and interrupted partitions when idle */
+        for (i = 0; i < context->partition_count; i++) {
+            if (    (i != context->active) &&
+                    (part_states[i].status != NF_STATUS_FREE)) {
+                context->erase_pending |= (1ul << i);
+            }
+        }
+
+        ret = nfPartition_LoadMemDirectory(context);
 
         context->initialized = 1;
         return 0;
@@ -826,6 +1838,7 @@ int wh_NvmFlash_Cleanup(void* c)
 {
     whNvmFlashContext* context = c;
     int rc = 0;
+    int i = 0;
     if (context == NULL) {
         return WH_ERROR_BADARGS;
     }
@@ -835,9 +1848,16 @@ int wh_NvmFlash_Cleanup(void* c)
         return 0;
     }
 
+#if NF_CACHE_ENTRY_COUNT > 0
+    for (i = 0; i < NF_CACHE_ENTRY_COUNT; i++) {
+        nfCache_Zeroize(&context->cache.entries[i]);
+    }
+#endif
+
     /* Ignore errors here */
-    (void)nfPartition_WriteLock(context, 0);
-    (void)nfPartition_WriteLock(context, 1);
+    for (i = 0; i < context->partition_count; i++) {
+        (void)nfPartition_WriteLock(context, i);
+    }
 
     if (context->cb->Cleanup != NULL) {
         rc = context->cb->Cleanup(context->flash);
@@ -918,16 +1938,18 @@ int wh_NvmFlash_GetAvailable(void* c,
         return WH_ERROR_BADARGS;
     }
     nfMemDirectory *d = &context->directory;
+    uint32_t size = 0;
     if (out_size != NULL) {
-        *out_size = (context->partition_units -
-                NF_PARTITION_DATA_OFFSET - d->next_free_data) *
+        size = (nfPartition_DataUnits(context) - d->next_free_data) *
                 WHFU_BYTES_PER_UNIT;
+        *out_size = nfSize_Saturate(size);
     }
     if (out_count != NULL) {
         *out_count = NF_OBJECT_COUNT - d->next_free_object;
     }
     if (out_reclaim_size != NULL) {
-            *out_reclaim_size = (d->reclaimable_data) * WHFU_BYTES_PER_UNIT;
+            size = (d->reclaimable_data) * WHFU_BYTES_PER_UNIT;
+            *out_reclaim_size = nfSize_Saturate(size);
         }
         if (out_reclaim_count != NULL) {
             *out_reclaim_count = d->reclaimable_entries;
@@ -970,10 +1992,15 @@ int wh_NvmFlash_AddObject(void* c, whNvmMetadata *meta,
         return WH_ERROR_BADARGS;
     }
 
+    if (    (context->compaction.phase != NF_COMPACT_IDLE) ||
+            (context->stream.open != 0)) {
+        return WH_ERROR_NOTREADY;
+    }
+
     d = &context->directory;
     if (    (d->next_free_object == NF_OBJECT_COUNT) ||
-            (d->next_free_data * WHFU_BYTES_PER_UNIT + data_len >
-                context->partition_units * WHFU_BYTES_PER_UNIT) ) {
+            (d->next_free_data + WHFU_BYTES2UNITS(data_len) >
+                nfPartition_DataUnits(context)) ) {
         return WH_ERROR_NOSPACE;
     }
 
@@ -981,7 +2008,6 @@ int wh_NvmFlash_AddObject(void* c, whNvmMetadata *meta,
     int oldentry = -1;
     int ret = 0;
     uint32_t epoch = 0;
-    uint32_t count = 0;
     ret = nfMemDirectory_FindObjectIndexById(d, meta->id, &oldentry);
     if (oldentry >= 0) {
         epoch = d->objects[oldentry].state.epoch + 1;
@@ -989,7 +2015,10 @@ int wh_NvmFlash_AddObject(void* c, whNvmMetadata *meta,
 
     /* Update meta with data size */
     meta->len = data_len;
-    count = WHFU_BYTES2UNITS(meta->len);
+
+#if NF_CACHE_ENTRY_COUNT > 0
+    nfCache_Invalidate(context, meta->id);
+#endif
 
     ret = nfObject_Program(context,
             context->active,
@@ -1000,107 +2029,594 @@ int wh_NvmFlash_AddObject(void* c, whNvmMetadata *meta,
             data);
 
     if (ret == 0) {
-        /* Update directory with new object */
-        d->objects[d->next_free_object].state.status = NF_STATUS_USED;
-        d->objects[d->next_free_object].state.epoch = epoch;
-        d->objects[d->next_free_object].state.start = d->next_free_data;
-        d->objects[d->next_free_object].state.count = count;
-        memcpy(&d->objects[d->next_free_object].metadata, meta, sizeof(*meta));
-        d->next_free_data += count;
-        d->next_free_object++;
-
-        /* Update directory to reclaim old entry */
-        if (oldentry >= 0) {
-            d->objects[oldentry].state.status = NF_STATUS_DATA_BAD;
-            d->reclaimable_entries++;
-            d->reclaimable_data += d->objects[oldentry].state.count;
+        nfMemDirectory_AddEntry(d, meta, epoch);
+    }
+    return ret;
+}
+
+/* Add a batch of objects.  The objects are begun in order, their data is
+ * programmed contiguously from next_free_data through a staging buffer, and
+ * then each object count is programmed.
+ */
+int wh_NvmFlash_AddObjects(void* c, whNvmId count, whNvmMetadata* meta_list,
+        const whNvmSize* len_list, const uint8_t* const* data_list)
+{
+    whNvmFlashContext* context = c;
+    nfMemDirectory* d = NULL;
+    nfDataWriter writer;
+    uint32_t epochs[NF_OBJECT_COUNT];
+    uint32_t units = 0;
+    uint32_t start = 0;
+    int entry = 0;
+    int i = 0;
+    int j = 0;
+    int ret = 0;
+
+    if (    (context == NULL) ||
+            ((count > 0) &&
+             ((meta_list == NULL) || (len_list == NULL) ||
+              (data_list == NULL))) ) {
+        return WH_ERROR_BADARGS;
+    }
+    for (i = 0; i < count; i++) {
+        if ((len_list[i] > 0) && (data_list[i] == NULL)) {
+            return WH_ERROR_BADARGS;
+        }
+        units += WHFU_BYTES2UNITS(len_list[i]);
+    }
+
+    if (    (context->compaction.phase != NF_COMPACT_IDLE) ||
+            (context->stream.open != 0)) {
+        return WH_ERROR_NOTREADY;
+    }
+
+    /* Check the entire batch fits before programming anything */
+    d = &context->directory;
+    if (    (count > NF_OBJECT_COUNT - d->next_free_object) ||
+            (units > nfPartition_DataUnits(context) - d->next_free_data) ) {
+        return WH_ERROR_NOSPACE;
+    }
+
+    /* Program the epoch, metadata and start of each object */
+    start = d->next_free_data;
+    for (i = 0; (i < count) && (ret == 0); i++) {
+        /* Increment past the existing object or earlier duplicate in batch */
+        epochs[i] = 0;
+        entry = -1;
+        for (j = i - 1; j >= 0; j--) {
+            if (meta_list[j].id == meta_list[i].id) break;
+        }
+        if (j >= 0) {
+            epochs[i] = epochs[j] + 1;
+        } else if (nfMemDirectory_FindObjectIndexById(d, meta_list[i].id,
+                &entry) == 0) {
+            epochs[i] = d->objects[entry].state.epoch + 1;
+        }
+
+        /* Update meta with data size */
+        meta_list[i].len = len_list[i];
+#if NF_CACHE_ENTRY_COUNT > 0
+        nfCache_Invalidate(context, meta_list[i].id);
+#endif
+        ret = nfObject_ProgramBegin(context, context->active,
+                d->next_free_object + i, epochs[i], start, &meta_list[i]);
+        start += WHFU_BYTES2UNITS(len_list[i]);
+    }
+
+    /* Program all of the data */
+    nfDataWriter_Init(&writer, context, context->active, d->next_free_data);
+    for (i = 0; (i < count) && (ret == 0); i++) {
+        ret = nfDataWriter_Write(&writer, len_list[i], data_list[i]);
+    }
+    if (ret == 0) {
+        ret = nfDataWriter_Flush(&writer);
+    }
+    if (ret == 0) {
+        ret = nfPartition_Sync(context, context->active);
+    }
+
+    /* Commit each object */
+    for (i = 0; (i < count) && (ret == 0); i++) {
+        ret = nfObject_ProgramFinish(context, context->active,
+                d->next_free_object + i, len_list[i]);
+    }
+    if (ret == 0) {
+        ret = nfPartition_Sync(context, context->active);
+    }
+
+    if (ret == 0) {
+        for (i = 0; i < count; i++) {
+            nfMemDirectory_AddEntry(d, &meta_list[i], epochs[i]);
         }
+    } else {
+        /* Partially programmed.  Recover the directory from flash */
+        nfWriteBuffer_Discard(context);
+        nfPartition_LoadMemDirectory(context);
     }
     return ret;
 }
 
+int wh_NvmFlash_AddObjectBegin(void* c, const whNvmMetadata* meta)
+{
+    whNvmFlashContext* context = c;
+    nfMemDirectory* d = NULL;
+    nfStream* s = NULL;
+    int entry = -1;
+    int ret = 0;
+
+    if ((context == NULL) || (meta == NULL)) {
+        return WH_ERROR_BADARGS;
+    }
+    if (    (context->compaction.phase != NF_COMPACT_IDLE) ||
+            (context->stream.open != 0)) {
+        return WH_ERROR_NOTREADY;
+    }
+
+    d = &context->directory;
+    if (d->next_free_object == NF_OBJECT_COUNT) {
+        return WH_ERROR_NOSPACE;
+    }
+
+    s = &context->stream;
+    memset(s, 0, sizeof(*s));
+    memcpy(&s->meta, meta, sizeof(s->meta));
+    s->meta.len = 0;
+    if (nfMemDirectory_FindObjectIndexById(d, meta->id, &entry) == 0) {
+        s->epoch = d->objects[entry].state.epoch + 1;
+    }
+#if NF_CACHE_ENTRY_COUNT > 0
+    nfCache_Invalidate(context, meta->id);
+#endif
+
+    /* The start must be on flash before any data so that a reset while the
+     * object is open does not reuse the programmed data */
+    ret = nfObject_ProgramBegin(context, context->active, d->next_free_object,
+            s->epoch, d->next_free_data, NULL);
+    if (ret == 0) {
+        ret = nfPartition_Sync(context, context->active);
+    }
+    if (ret == 0) {
+        s->open = 1;
+    } else {
+        nfStream_Recover(context);
+    }
+    return ret;
+}
+
+int wh_NvmFlash_AddObjectAppend(void* c, whNvmSize data_len,
+        const uint8_t* data)
+{
+    whNvmFlashContext* context = c;
+    nfMemDirectory* d = NULL;
+    nfStream* s = NULL;
+    uint32_t this_len = 0;
+    uint32_t offset = 0;
+    int ret = 0;
+
+    if (    (context == NULL) ||
+            ((data_len > 0) && (data == NULL)) ||
+            (context->stream.open == 0)) {
+        return WH_ERROR_BADARGS;
+    }
+
+    d = &context->directory;
+    s = &context->stream;
+    if (    (data_len > WOLFHSM_NVM_MAX_OBJECT_SIZE - s->meta.len) ||
+            (WHFU_BYTES2UNITS((uint32_t)s->meta.len + data_len) >
+                nfPartition_DataUnits(context) - d->next_free_data)) {
+        /* The object stays open with the data appended so far */
+        return WH_ERROR_NOSPACE;
+    }
+
+    /* Complete a partial unit from the previous Append */
+    if (s->tail_len > 0) {
+        this_len = WHFU_BYTES_PER_UNIT - s->tail_len;
+        if (this_len > data_len) {
+            this_len = data_len;
+        }
+        memcpy(&s->tail.bytes[s->tail_len], data, this_len);
+        s->tail_len += this_len;
+        s->meta.len += this_len;
+        data += this_len;
+        data_len -= this_len;
+        if (s->tail_len == WHFU_BYTES_PER_UNIT) {
+            offset = d->next_free_data + s->meta.len / WHFU_BYTES_PER_UNIT - 1;
+            ret = nfObject_ProgramDataBytes(context, context->active, offset,
+                    WHFU_BYTES_PER_UNIT, s->tail.bytes);
+            s->tail_len = 0;
+        }
+    }
+
+    /* Program whole units and keep the remainder for the next Append */
+    this_len = data_len - (data_len % WHFU_BYTES_PER_UNIT);
+    if ((ret == 0) && (this_len > 0)) {
+        offset = d->next_free_data + s->meta.len / WHFU_BYTES_PER_UNIT;
+        ret = nfObject_ProgramDataBytes(context, context->active, offset,
+                this_len, data);
+        s->meta.len += this_len;
+        data += this_len;
+        data_len -= this_len;
+    }
+    if ((ret == 0) && (data_len > 0)) {
+        memset(&s->tail, 0, sizeof(s->tail));
+        memcpy(s->tail.bytes, data, data_len);
+        s->tail_len = data_len;
+        s->meta.len += data_len;
+    }
+
+    if (ret != 0) {
+        nfStream_Recover(context);
+    }
+    return ret;
+}
+
+int wh_NvmFlash_AddObjectFinish(void* c)
+{
+    whNvmFlashContext* context = c;
+    nfMemDirectory* d = NULL;
+    nfStream* s = NULL;
+    int ret = 0;
+
+    if ((context == NULL) || (context->stream.open == 0)) {
+        return WH_ERROR_BADARGS;
+    }
+
+    d = &context->directory;
+    s = &context->stream;
+    if (s->tail_len > 0) {
+        ret = nfObject_ProgramDataBytes(context, context->active,
+                d->next_free_data + s->meta.len / WHFU_BYTES_PER_UNIT,
+                s->tail_len, s->tail.bytes);
+    }
+    if (ret == 0) {
+        ret = nfObject_ProgramMetadata(context, context->active,
+                d->next_free_object, &s->meta);
+    }
+    if (ret == 0) {
+        /* Data and metadata must be durable before the commit */
+        ret = nfPartition_Sync(context, context->active);
+    }
+    if (ret == 0) {
+        ret = nfObject_ProgramFinish(context, context->active,
+                d->next_free_object, s->meta.len);
+    }
+    if (ret == 0) {
+        ret = nfPartition_Sync(context, context->active);
+    }
+
+    if (ret == 0) {
+        nfMemDirectory_AddEntry(d, &s->meta, s->epoch);
+        s->open = 0;
+    } else {
+        nfStream_Recover(context);
+    }
+    return ret;
+}
+
+int wh_NvmFlash_AddObjectAbort(void* c)
+{
+    whNvmFlashContext* context = c;
+    nfMemDirectory* d = NULL;
+    nfStream* s = NULL;
+    nfMemObject* obj = NULL;
+
+    if (context == NULL) {
+        return WH_ERROR_BADARGS;
+    }
+
+    d = &context->directory;
+    s = &context->stream;
+    if (s->open == 0) {
+        return 0;
+    }
+
+    /* Nothing more is programmed.  Skip the incomplete entry and the data
+     * appended so far, which DestroyObjects reclaims */
+    nfWriteBuffer_Discard(context);
+    obj = &d->objects[d->next_free_object];
+    memset(obj, 0, sizeof(*obj));
+    obj->state.status = NF_STATUS_DATA_BAD;
+    obj->state.epoch = s->epoch;
+    obj->state.start = d->next_free_data;
+    obj->state.count = WHFU_BYTES2UNITS(s->meta.len);
+    d->next_free_object++;
+    d->next_free_data += obj->state.count;
+    d->reclaimable_entries++;
+    d->reclaimable_data += obj->state.count;
+    s->open = 0;
+    return 0;
+}
+
 /* Destroy a list of objects by replicating the current state without the id's
  * in the provided list.  Id's in the list that are not present do not cause an
  * error.
  */
 int wh_NvmFlash_DestroyObjects(void* c, whNvmId list_count,
         const whNvmId* id_list)
+{
+    int ret = wh_NvmFlash_DestroyObjectsBegin(c, list_count, id_list);
+    if (ret == 0) {
+        ret = wh_NvmFlash_DestroyObjectsFinish(c);
+    }
+    return ret;
+}
+
+/* Mark the listed id's as bad and prepare to replicate the remaining objects
+ * to the inactive partition.  No flash is modified until the first Step.
+ */
+int wh_NvmFlash_DestroyObjectsBegin(void* c, whNvmId list_count,
+        const whNvmId* id_list)
 {
     whNvmFlashContext* context = c;
     nfMemDirectory* d = NULL;
+    nfCompaction* cp = NULL;
     if (    (context == NULL) ||
             ((list_count > 0) && (id_list == NULL)) ) {
         return WH_ERROR_BADARGS;
     }
 
     d = &context->directory;
+    cp = &context->compaction;
+    if ((cp->phase != NF_COMPACT_IDLE) || (context->stream.open != 0)) {
+        return WH_ERROR_NOTREADY;
+    }
 
     /* Go through the current directory and mark the listed id's as bad */
     int list_entry = 0;
     int entry = 0;
-    int ret = 0;
     for (list_entry = 0; list_entry < list_count; list_entry++) {
-        /* Mark all matching ids as bad.  Should only be 1. */
-        do {
-            entry = -1;
-            ret = nfMemDirectory_FindObjectIndexById(d, id_list[list_entry], &entry);
-            if (entry >= 0) {
-                d->objects[entry].state.status = NF_STATUS_DATA_BAD;
-            }
-        } while (entry >=0);
+        /* Parse leaves at most 1 used entry per id */
+        entry = -1;
+        (void)nfMemDirectory_FindObjectIndexById(d, id_list[list_entry],
+                &entry);
+        if (entry >= 0) {
+            d->objects[entry].state.status = NF_STATUS_DATA_BAD;
+            nfMemDirectory_IndexRemove(d, id_list[list_entry]);
+        }
+#if NF_CACHE_ENTRY_COUNT > 0
+        nfCache_Invalidate(context, id_list[list_entry]);
+#endif
     }
 
-    uint32_t dest_object = 0;
-    uint32_t dest_data = 0;
-    int old_part = context->active;
-    int dest_partition = !context->active;
+    memset(cp, 0, sizeof(*cp));
+    cp->partition = nfPartition_SelectDestination(context);
+    cp->state.status = NF_STATUS_FREE;
+    cp->state.epoch = context->state.epoch + 1;
+    cp->state.start = context->state.start;
+    cp->state.count = context->state.count;
+    cp->phase = NF_COMPACT_ERASE;
+    return 0;
+}
 
-    nfMemState new_state=
-        {
-            .status = NF_STATUS_FREE,
-            .epoch = context->state.epoch + 1,
-            .start = context->state.start,
-            .count = context->state.count,
-        };
+/* Copy used objects to the destination partition until at least max_bytes of
+ * data have been copied or all objects are done.
+ */
+static int nfCompaction_Copy(whNvmFlashContext* context, uint32_t max_bytes)
+{
+    int ret = 0;
+    nfMemDirectory* d = &context->directory;
+    nfCompaction* cp = &context->compaction;
+    uint32_t copied = 0;
 
-    /* Blank check the inactive partition and erase if not blank */
-    ret = nfPartition_BlankCheck(context, dest_partition);
-    if (ret == WH_ERROR_NOTBLANK) {
-        ret = nfPartition_Erase(context, dest_partition);
+    /* Always make progress */
+    if (max_bytes < NF_COPY_OBJECT_BUFFER_LEN) {
+        max_bytes = NF_COPY_OBJECT_BUFFER_LEN;
     }
-    if (ret != 0) return ret;
-    ret = nfPartition_ProgramEpoch(context, dest_partition, new_state.epoch);
 
-    if (ret != 0) return ret;
+    while ((cp->entry < NF_OBJECT_COUNT) && (copied < max_bytes)) {
+        nfMemObject* obj = &d->objects[cp->entry];
+        uint32_t this_len = 0;
 
-    /* Write partition start */
-    ret = nfPartition_ProgramStart(context, dest_partition, new_state.start);
-    if (ret != 0) return ret;
+        if (obj->state.status != NF_STATUS_USED) {
+            cp->entry++;
+            continue;
+        }
 
-    /* Write each used object to new partition */
-    for (entry = 0; entry < NF_OBJECT_COUNT; entry++) {
-        if (d->objects[entry].state.status == NF_STATUS_USED) {
-            /* TODO: Handle errors here better. Break out of loop? */
-            ret = nfObject_Copy(context, entry,
-                    dest_partition, &dest_object, &dest_data);
+        this_len = obj->metadata.len - cp->data_offset;
+        if (this_len > max_bytes - copied) {
+            /* Stay a multiple of the copy buffer to keep offsets aligned */
+            this_len = max_bytes - copied;
+            this_len -= this_len % NF_COPY_OBJECT_BUFFER_LEN;
+            if (this_len == 0) break;
+        }
+
+        if (cp->data_offset == 0) {
+            ret = nfObject_ProgramBegin(context, cp->partition,
+                    cp->next_object, obj->state.epoch, cp->next_data,
+                    &obj->metadata);
+            if (ret != 0) return ret;
+        }
+
+        ret = nfObject_CopyDataBytes(context, cp->entry, cp->partition,
+                cp->next_data + WHFU_BYTES2UNITS(cp->data_offset),
+                cp->data_offset, this_len);
+        if (ret != 0) return ret;
+        cp->data_offset += this_len;
+        copied += this_len;
+
+        if (cp->data_offset == obj->metadata.len) {
+            ret = nfObject_ProgramFinish(context, cp->partition,
+                    cp->next_object, obj->metadata.len);
+            if (ret != 0) return ret;
+            cp->next_object++;
+            cp->next_data += WHFU_BYTES2UNITS(obj->metadata.len);
+            cp->data_offset = 0;
+            cp->entry++;
         }
     }
+    return ret;
+}
 
-    /* Write partition count */
-    ret = nfPartition_ProgramCount(context, dest_partition, new_state.count);
+/* Close the open object after a failed program.  Rebuild the directory from
+ * flash, where the object is incomplete and so is never visible */
+static void nfStream_Recover(whNvmFlashContext* context)
+{
+    nfWriteBuffer_Discard(context);
+    context->stream.open = 0;
+    nfPartition_LoadMemDirectory(context);
+}
 
-    if (ret != 0) return ret;
+/* Perform the next phase of the replication */
+static int nfCompaction_Step(whNvmFlashContext* context, uint32_t max_bytes)
+{
+    nfCompaction* cp = &context->compaction;
+    int ret = 0;
+    int old_part = 0;
+
+    switch (cp->phase) {
+    case NF_COMPACT_IDLE:
+        return 0;
+
+    case NF_COMPACT_ERASE:
+        /* Erase a retired destination, else erase it only if not blank */
+        ret = WH_ERROR_NOTBLANK;
+        if ((context->erase_pending & (1ul << cp->partition)) == 0) {
+            ret = nfPartition_BlankCheck(context, cp->partition);
+        }
+        if (ret == WH_ERROR_NOTBLANK) {
+            ret = nfPartition_Erase(context, cp->partition);
+        }
+        if (ret == 0) {
+            cp->phase = NF_COMPACT_BEGIN;
+        }
+        break;
+
+    case NF_COMPACT_BEGIN:
+        ret = nfPartition_ProgramEpoch(context, cp->partition,
+                cp->state.epoch);
+        if (ret == 0) {
+            /* Write partition start */
+            ret = nfPartition_ProgramStart(context, cp->partition,
+                    cp->state.start);
+        }
+        if (ret == 0) {
+            cp->phase = NF_COMPACT_COPY;
+        }
+        break;
+
+    case NF_COMPACT_COPY:
+        ret = nfCompaction_Copy(context, max_bytes);
+        if ((ret == 0) && (cp->entry == NF_OBJECT_COUNT)) {
+            cp->phase = NF_COMPACT_COMMIT;
+        }
+        break;
+
+    case NF_COMPACT_COMMIT:
+        /* The copy wrote exactly the used objects, so compact the cached
+         * directory rather than re-read it.  A failure below restores it
+         * from the active partition */
+        nfMemDirectory_Compact(&context->directory);
+#ifdef WOLFHSM_NVM_CHECKPOINT
+        ret = nfPartition_ProgramCheckpoint(context, cp->partition,
+                cp->state.epoch, &context->directory);
+#endif
+        /* Write partition count once the copied objects are durable */
+        if (ret == 0) {
+            ret = nfPartition_Sync(context, cp->partition);
+        }
+        if (ret == 0) {
+            ret = nfPartition_ProgramCount(context, cp->partition,
+                    cp->state.count);
+        }
+        if (ret == 0) {
+            ret = nfPartition_Sync(context, cp->partition);
+        }
+        if (ret == 0) {
+            /* Set new directory as active */
+            old_part = context->active;
+            context->active = cp->partition;
+            cp->state.status = NF_STATUS_USED;
+            context->state = cp->state;
+            cp->phase = NF_COMPACT_IDLE;
+
+            /* Defer erasing the old partition to wh_NvmFlash_Idle */
+            context->erase_pending |= (1ul << old_part);
+            return 0;
+        }
+        break;
 
-    /* Set new directory as active. Read and parse */
-    context->active = dest_partition;
-    new_state.status = NF_STATUS_USED;
-    context->state = new_state;
-    nfPartition_ReadMemDirectory(context, context->active, &context->directory);
-    nfMemDirectory_Parse(&context->directory);
+    default:
+        return WH_ERROR_ABORTED;
+    }
 
-    /* Erase the old directory */
-    ret = nfPartition_Erase(context, old_part);
+    if (ret != 0) {
+        /* Abandon the replication and restore the active directory */
+        nfWriteBuffer_Discard(context);
+        if (cp->phase > NF_COMPACT_ERASE) {
+            context->erase_pending |= (1ul << cp->partition);
+        }
+        cp->phase = NF_COMPACT_IDLE;
+        nfPartition_LoadMemDirectory(context);
+        return ret;
+    }
+    return WH_ERROR_NOTREADY;
+}
 
+int wh_NvmFlash_DestroyObjectsStep(void* c, uint32_t max_bytes)
+{
+    whNvmFlashContext* context = c;
+    int ret = 0;
+
+    if (context == NULL) {
+        return WH_ERROR_BADARGS;
+    }
+    if (context->compaction.phase == NF_COMPACT_IDLE) {
+        return 0;
+    }
+
+    WH_STATS_TIMER_START(start);
+    ret = nfCompaction_Step(context, max_bytes);
+    WH_STATS_TIMER_ADD(compaction_cycles, start);
+    if (ret == 0) {
+        WH_STATS_INC(compactions);
+    }
+    return ret;
+}
+
+int wh_NvmFlash_Idle(void* c)
+{
+    whNvmFlashContext* context = c;
+    int ret = 0;
+    int i = 0;
+
+    if (context == NULL) {
+        return WH_ERROR_BADARGS;
+    }
+    /* Erasing modifies the NVM, so wait for the replication or stream */
+    if (    (context->compaction.phase != NF_COMPACT_IDLE) ||
+            (context->stream.open != 0)) {
+        return WH_ERROR_NOTREADY;
+    }
+
+    for (i = 0; i < context->partition_count; i++) {
+        if (    ((context->erase_pending & (1ul << i)) == 0) ||
+                (i == context->active)) {
+            continue;
+        }
+        ret = nfPartition_Erase(context, i);
+        if (ret != 0) {
+            return ret;
+        }
+        break;
+    }
+
+    /* Report whether another call has work to do */
+    for (i = 0; i < context->partition_count; i++) {
+        if (    ((context->erase_pending & (1ul << i)) != 0) &&
+                (i != context->active)) {
+            return WH_ERROR_NOTREADY;
+        }
+    }
+    return 0;
+}
+
+/* Complete any remaining phases of the replication */
+int wh_NvmFlash_DestroyObjectsFinish(void* c)
+{
+    int ret = 0;
+    do {
+        ret = wh_NvmFlash_DestroyObjectsStep(c, UINT32_MAX);
+    } while (ret == WH_ERROR_NOTREADY);
     return ret;
 }
 
@@ -1111,11 +2627,27 @@ int wh_NvmFlash_Read(void* c, whNvmId id, whNvmSize offset,
     whNvmFlashContext* context = c;
     int ret = 0;
     int object_index;
+    if (context == NULL) {
+        return WH_ERROR_BADARGS;
+    }
     ret = nfMemDirectory_FindObjectIndexById(
             &context->directory,
             id,
             &object_index);
+    if (    (ret == 0) &&
+            ((offset > context->directory.objects[object_index].metadata.len) ||
+             (data_len > context->directory.objects[object_index].metadata.len -
+                offset))) {
+        /* Outside of the object data */
+        ret = WH_ERROR_BADARGS;
+    }
     if (ret == 0) {
+#if NF_CACHE_ENTRY_COUNT > 0
+        ret = nfCache_Read(context, object_index, offset, data_len, out_data);
+        if (ret != WH_ERROR_NOTFOUND) {
+            return ret;
+        }
+#endif
         ret = nfObject_ReadDataBytes(
                 context,
                 context->active,
@@ -1126,3 +2658,23 @@ int wh_NvmFlash_Read(void* c, whNvmId id, whNvmSize offset,
     }
     return ret;
 }
+
+int wh_NvmFlash_GetCacheStats(void* c, uint32_t* out_hits,
+        uint32_t* out_misses)
+{
+    whNvmFlashContext* context = c;
+    uint32_t hits = 0;
+    uint32_t misses = 0;
+
+    if (context == NULL) {
+        return WH_ERROR_BADARGS;
+    }
+
+#if NF_CACHE_ENTRY_COUNT > 0
+    hits = context->cache.hits;
+    misses = context->cache.misses;
+#endif
+    if (out_hits != NULL) *out_hits = hits;
+    if (out_misses != NULL) *out_misses = misses;
+    return 0;
+}
@@ -1,6 +1,7 @@
 
 /* System libraries */
 #include <stdint.h>
+#include <stddef.h>  /* For offsetof */
 #include <stdlib.h>  /* For NULL */
 #include <string.h>  /* For memset, memcpy */
 
@@ -28,19 +29,50 @@
 
 #include "wolfhsm/wh_message.h"
 #include "wolfhsm/wh_message_comm.h"
+#include "wolfhsm/wh_message_crypto.h"
+#include "wolfhsm/wh_message_key.h"
+#include "wolfhsm/wh_message_nvm.h"
+#include "wolfhsm/wh_server_keycache.h"
 #include "wolfhsm/wh_server.h"
+#include "wolfhsm/wh_stats.h"
 
 int wh_Server_Init(whServer* server, whServerConfig* config)
 {
     int rc = 0;
-    if (server == NULL) {
+    int i = 0;
+    int count = 0;
+    whKeyCacheConfig keycache_config = {0};
+    if (    (server == NULL) ||
+            (config == NULL)) {
+        return WH_ERROR_BADARGS;
+    }
+
+    count = (config->comm_count != 0) ? config->comm_count : 1;
+    if ((count < 0) || (count > WH_SERVER_COMM_COUNT)) {
         return WH_ERROR_BADARGS;
     }
 
     memset(server, 0, sizeof(*server));
+    server->nvm_cb = config->nvm_cb;
+    server->nvm_context = config->nvm_context;
+    server->crypto_cb = config->crypto_cb;
+    server->crypto_context = config->crypto_context;
+    keycache_config.nvm_cb = config->nvm_cb;
+    keycache_config.nvm_context = config->nvm_context;
+    (void)wh_KeyCache_Init(&server->keycache, &keycache_config);
+
+    for (i = 0; i < count; i++) {
+        server->weight[i] = ((config->comm_weights != NULL) &&
+                (config->comm_weights[i] != 0)) ? config->comm_weights[i] : 1;
+        rc = wh_CommServer_Init(&server->comm[i], &config->comm[i]);
+        if (rc != 0) {
+            break;
+        }
+        server->comm_count++;
+    }
     if (
 /*            ((rc = wh_Nvm_Init(server->nvm_device, config->nvm_device)) == 0) && */
-        ((rc = wh_CommServer_Init(server->comm, config->comm)) == 0) &&
+        (rc == 0) &&
 /*        ((rc = wh_NvmServer_Init(server->nvm, config->nvm)) == 0)*/
         1) {
         /* All good */
@@ -59,18 +91,39 @@ static int _wh_Server_HandleCommRequest(whServer* server,
     switch (type) {
     case WOLFHSM_MESSAGE_TYPE_COMM_ECHO:
     {
-        whMessageCommLenData req;
-        whMessageCommLenData resp;
-        wh_MessageComm_TranslateLenData(magic,
-                (whMessageCommLenData*)req_packet, &req);
+        const whMessageCommLenData* req = req_packet;
+        whMessageCommLenData* resp = resp_packet;
+        uint16_t len = wh_Translate16(magic, req->len);
+
+        if (len > sizeof(resp->data)) {
+            len = sizeof(resp->data);
+        }
+        /* Request and response may be the same buffer */
+        if ((void*)resp != (const void*)req) {
+            memcpy(resp->data, req->data, len);
+        }
+        resp->len = wh_Translate16(magic, len);
+        *out_resp_size = sizeof(*resp);
+    }; break;
 
-        resp.len = req.len;
-        memcpy(resp.data, req.data, resp.len);
+#ifdef WOLFHSM_STATS
+    case WOLFHSM_MESSAGE_TYPE_COMM_STATS:
+    {
+        whMessageCommStatsRequest req = {0};
+        whMessageCommStatsResponse resp = {0};
 
-        wh_MessageComm_TranslateLenData(magic,
-                &resp, (whMessageCommLenData*)resp_packet);
+        /* The flags are optional */
+        if (req_size >= sizeof(req)) {
+            (void)wh_MessageComm_TranslateStatsRequest(magic, req_packet,
+                    &req);
+        }
+        wh_Stats_Get(&resp.stats,
+                (req.flags & WOLFHSM_MESSAGE_COMM_STATS_RESET) != 0);
+        (void)wh_MessageComm_TranslateStatsResponse(magic, &resp,
+                resp_packet);
         *out_resp_size = sizeof(resp);
     }; break;
+#endif
 
     default:
         /* Unknown request. Respond with empty packet */
@@ -79,62 +132,868 @@ static int _wh_Server_HandleCommRequest(whServer* server,
     return 0;
 }
 
-int wh_Server_HandleRequestMessage(whServer* server)
+/* Send the response written in place, waiting while the transport is busy */
+static int _wh_Server_SendResponse(whCommServer* comm, uint16_t magic,
+        uint16_t type, uint16_t seq, uint16_t size)
+{
+    int rc = 0;
+    uint32_t polls = 0;
+
+    do {
+        rc = wh_CommServer_SendResponseInPlace(comm, magic, type, seq, size);
+    } while (   (rc == WH_ERROR_NOTREADY) &&
+                ((rc = wh_CommServer_Wait(comm, &polls)) == 0));
+    return rc;
+}
+
+/* Answer the DESTROYOBJECTS whose replication ended with status rc.  Only now
+ * are its objects reported destroyed, as the new partition is committed */
+static void _wh_Server_NvmDestroyDone(whServer* server, int rc)
+{
+    whServerDeferred* d = &server->nvm_destroy;
+    whMessageNvmResponse* resp = d->resp_data;
+
+    server->nvm_compacting = 0;
+    if (d->comm == NULL) {
+        return;
+    }
+    resp->rc = rc;
+    (void)wh_MessageNvm_TranslateResponse(d->magic, resp, resp);
+    rc = _wh_Server_SendResponse(d->comm, d->magic, d->type, d->seq,
+            sizeof(*resp));
+    if (rc != 0) {
+        server->error[d->comm - server->comm] = rc;
+    }
+    memset(d, 0, sizeof(*d));
+}
+
+/* Complete a running incremental DestroyObjects so the NVM can be modified.
+ * Its status goes to the DESTROYOBJECTS, not to the request calling this */
+static void _wh_Server_NvmFinish(whServer* server)
+{
+    int rc = 0;
+
+    if (server->nvm_compacting != 0) {
+        do {
+            rc = server->nvm_cb->DestroyObjectsStep(server->nvm_context,
+                    UINT32_MAX);
+        } while (rc == WH_ERROR_NOTREADY);
+        _wh_Server_NvmDestroyDone(server, rc);
+    }
+}
+
+/* Reclaim the NVM space of destroyed and older objects after a cached key did
+ * not fit, so later commits of the uncommitted keys can succeed.  Runs in the
+ * idle passes when the NVM supports it.  Returns WH_ERROR_NOSPACE if there is
+ * nothing to reclaim */
+static int _wh_Server_NvmReclaim(whServer* server)
+{
+    const whNvmCb* cb = server->nvm_cb;
+    whNvmId reclaim_count = 0;
+    int rc = 0;
+
+    if (server->nvm_compacting != 0) {
+        return 0;
+    }
+    server->keycache.nvm_full = 0;
+    rc = cb->GetAvailable(server->nvm_context, NULL, NULL, NULL,
+            &reclaim_count);
+    if ((rc == 0) && (reclaim_count == 0)) {
+        rc = WH_ERROR_NOSPACE;
+    }
+    if (rc != 0) {
+        return rc;
+    }
+    if ((cb->DestroyObjectsBegin != NULL) && (cb->DestroyObjectsStep != NULL)) {
+        rc = cb->DestroyObjectsBegin(server->nvm_context, 0, NULL);
+        if (rc == 0) {
+            server->nvm_compacting = 1;
+        }
+    } else {
+        rc = cb->DestroyObjects(server->nvm_context, 0, NULL);
+    }
+    return rc;
+}
+
+static int _wh_Server_HandleKeyRequest(whServer* server,
+        uint16_t magic, uint16_t type, uint16_t seq,
+        uint16_t req_size, const void* req_packet,
+        uint16_t *out_resp_size, void* resp_packet)
+{
+    whMessageKeyResponse* resp = resp_packet;
+    whMessageKeyIdRequest id_req = {0};
+    whMessageKeyData key = {0};
+    whNvmMetadata meta = {0};
+    const whNvmMetadata* cached_meta = NULL;
+    const uint8_t* cached_data = NULL;
+    int rc = 0;
+
+    /* Request and response may be the same buffer, so the request is fully
+     * consumed before the response is written */
+    switch (type) {
+    case WOLFHSM_MESSAGE_TYPE_KEY_CACHE:
+    {
+        const whMessageKeyData* req = req_packet;
+
+        if (req_size < offsetof(whMessageKeyData, data)) {
+            rc = WH_ERROR_BADARGS;
+            break;
+        }
+        (void)wh_MessageKey_TranslateData(magic, req, &key);
+        if (    (key.len > sizeof(key.data)) ||
+                (req_size < offsetof(whMessageKeyData, data) + key.len)) {
+            rc = WH_ERROR_BADARGS;
+            break;
+        }
+        meta.id = key.id;
+        meta.access = key.access;
+        meta.flags = key.flags;
+        meta.len = key.len;
+        memcpy(meta.label, key.label, sizeof(meta.label));
+        id_req.id = key.id;
+        /* Evicting to make room may write the NVM */
+        _wh_Server_NvmFinish(server);
+        rc = wh_KeyCache_Cache(&server->keycache, &meta, req->data);
+    }; break;
+
+    case WOLFHSM_MESSAGE_TYPE_KEY_EVICT:
+    case WOLFHSM_MESSAGE_TYPE_KEY_COMMIT:
+    case WOLFHSM_MESSAGE_TYPE_KEY_EXPORT:
+    case WOLFHSM_MESSAGE_TYPE_KEY_ERASE:
+    {
+        if (req_size < sizeof(id_req)) {
+            rc = WH_ERROR_BADARGS;
+            break;
+        }
+        (void)wh_MessageKey_TranslateIdRequest(magic, req_packet, &id_req);
+        /* These may write the NVM.  Exporting a key that is not cached
+         * may evict an uncommitted one */
+        _wh_Server_NvmFinish(server);
+        if (type == WOLFHSM_MESSAGE_TYPE_KEY_EVICT) {
+            rc = wh_KeyCache_Evict(&server->keycache, id_req.id);
+        } else if (type == WOLFHSM_MESSAGE_TYPE_KEY_COMMIT) {
+            rc = wh_KeyCache_Commit(&server->keycache, id_req.id);
+        } else if (type == WOLFHSM_MESSAGE_TYPE_KEY_ERASE) {
+            rc = wh_KeyCache_Erase(&server->keycache, id_req.id);
+        } else {
+            rc = wh_KeyCache_Acquire(&server->keycache, id_req.id,
+                    &cached_meta, &cached_data);
+        }
+    }; break;
+
+    default:
+        /* Unknown request. Respond with empty packet */
+        *out_resp_size = 0;
+        return 0;
+    }
+    if ((rc == WH_ERROR_NOSPACE) && (server->keycache.nvm_full != 0)) {
+        /* The key stays uncommitted until the idle passes reclaim space */
+        (void)_wh_Server_NvmReclaim(server);
+    }
+
+    memset(resp, 0, sizeof(*resp));
+    resp->rc = rc;
+    resp->id = id_req.id;
+    *out_resp_size = sizeof(*resp);
+    if ((type == WOLFHSM_MESSAGE_TYPE_KEY_EXPORT) && (rc == 0)) {
+        whMessageKeyData* out = &((whMessageKeyExportResponse*)resp_packet)->key;
+
+        if (cached_meta->len <= sizeof(out->data)) {
+            out->id = cached_meta->id;
+            out->access = cached_meta->access;
+            out->flags = cached_meta->flags;
+            out->len = cached_meta->len;
+            memcpy(out->label, cached_meta->label, sizeof(out->label));
+            memcpy(out->data, cached_data, cached_meta->len);
+            (void)wh_MessageKey_TranslateData(magic, out, out);
+            *out_resp_size = offsetof(whMessageKeyExportResponse, key.data) +
+                    cached_meta->len;
+        } else {
+            resp->rc = WH_ERROR_NOSPACE;
+        }
+        (void)wh_KeyCache_Release(&server->keycache, id_req.id);
+    }
+    (void)wh_MessageKey_TranslateResponse(magic, resp, resp);
+    return 0;
+}
+
+static void _wh_Server_NvmMetaToWire(uint16_t magic, const whNvmMetadata* meta,
+        whMessageNvmMetadata* wire)
+{
+    wire->id = meta->id;
+    wire->access = meta->access;
+    wire->flags = meta->flags;
+    wire->len = meta->len;
+    memcpy(wire->label, meta->label, sizeof(wire->label));
+    (void)wh_MessageNvm_TranslateMetadata(magic, wire, wire);
+}
+
+/* Pack the metadata of the objects following start_id into resp */
+static int _wh_Server_NvmListMetadata(whServer* server, uint16_t magic,
+        const whMessageNvmListRequest* req,
+        whMessageNvmListMetadataResponse* resp)
+{
+    int rc = 0;
+    uint16_t max = req->max_count;
+    whNvmId id = req->start_id;
+    whNvmId avail = 0;
+    whNvmId next = 0;
+    whNvmMetadata meta = {0};
+
+    if ((max == 0) || (max > WOLFHSM_MESSAGE_NVM_LIST_COUNT)) {
+        max = WOLFHSM_MESSAGE_NVM_LIST_COUNT;
+    }
+    resp->count = 0;
+    resp->remaining = 0;
+    while (resp->count < max) {
+        rc = server->nvm_cb->List(server->nvm_context, req->access, req->flags,
+                id, &avail, &next);
+        if ((rc != 0) || (avail == 0)) {
+            break;
+        }
+        rc = server->nvm_cb->GetMetadata(server->nvm_context, next, &meta);
+        if (rc != 0) {
+            break;
+        }
+        _wh_Server_NvmMetaToWire(magic, &meta, &resp->entries[resp->count]);
+        resp->count++;
+        resp->remaining = avail - 1;
+        if (resp->remaining == 0) {
+            break;
+        }
+        id = next;
+    }
+    if (rc != 0) {
+        resp->count = 0;
+        resp->remaining = 0;
+    }
+    return rc;
+}
+
+/* Pack a record for each id into resp until the next one does not fit.
+ * Returns the bytes of records used */
+static uint16_t _wh_Server_NvmReadMulti(whServer* server, uint16_t magic,
+        const whMessageNvmReadMultiRequest* req,
+        whMessageNvmReadMultiResponse* resp)
+{
+    uint16_t used = 0;
+    uint16_t size = 0;
+    uint16_t i = 0;
+    whNvmMetadata meta = {0};
+    whMessageNvmRecord rec = {0};
+    uint8_t* data = NULL;
+
+    resp->count = 0;
+    for (i = 0; i < req->count; i++) {
+        rec.id = req->ids[i];
+        rec.len = 0;
+        rec.rc = server->nvm_cb->GetMetadata(server->nvm_context, rec.id,
+                &meta);
+        if (rec.rc == 0) {
+            if (WOLFHSM_MESSAGE_NVM_RECORD_SIZE(meta.len) >
+                    sizeof(resp->records)) {
+                rec.rc = WH_ERROR_NOSPACE;
+            } else {
+                rec.len = meta.len;
+            }
+        }
+        if (used + WOLFHSM_MESSAGE_NVM_RECORD_SIZE(rec.len) >
+                sizeof(resp->records)) {
+            /* Left for the next request */
+            break;
+        }
+        data = &resp->records[used + sizeof(rec)];
+        if (rec.len != 0) {
+            rec.rc = server->nvm_cb->Read(server->nvm_context, rec.id, 0,
+                    rec.len, data);
+            if (rec.rc != 0) {
+                rec.len = 0;
+            }
+        }
+        size = WOLFHSM_MESSAGE_NVM_RECORD_SIZE(rec.len);
+        memset(data + rec.len, 0, size - sizeof(rec) - rec.len);
+        (void)wh_MessageNvm_TranslateRecord(magic, &rec, &rec);
+        memcpy(&resp->records[used], &rec, sizeof(rec));
+        used += size;
+        resp->count++;
+    }
+    return used;
+}
+
+static int _wh_Server_HandleNvmRequest(whServer* server,
+        uint16_t magic, uint16_t type, uint16_t seq,
+        uint16_t req_size, const void* req_packet,
+        uint16_t *out_resp_size, void* resp_packet)
+{
+    const whNvmCb* cb = server->nvm_cb;
+    void* nvm = server->nvm_context;
+    whMessageNvmResponse* resp = resp_packet;
+    uint16_t resp_size = 0;
+    int rc = 0;
+
+    if (    (type <= WOLFHSM_MESSAGE_TYPE_NVM_NONE) ||
+            (type > WOLFHSM_MESSAGE_TYPE_NVM_READMULTI)) {
+        /* Unknown request. Respond with empty packet */
+        *out_resp_size = 0;
+        return 0;
+    }
+    if (cb == NULL) {
+        /* No NVM configured */
+        type = WOLFHSM_MESSAGE_TYPE_NVM_NONE;
+        rc = WH_ERROR_BADARGS;
+    }
+
+    /* Request and response may be the same buffer, so the request is fully
+     * consumed before the response is written.  Requests that fail before
+     * their response is built get a whMessageNvmResponse */
+    switch (type) {
+    case WOLFHSM_MESSAGE_TYPE_NVM_GETAVAILABLE:
+    {
+        whMessageNvmGetAvailableResponse* out = resp_packet;
+        whNvmSize avail_size = 0;
+        whNvmSize reclaim_size = 0;
+        whNvmId avail_objects = 0;
+        whNvmId reclaim_objects = 0;
+
+        rc = cb->GetAvailable(nvm, &avail_size, &avail_objects,
+                &reclaim_size, &reclaim_objects);
+        memset(out, 0, sizeof(*out));
+        out->rc = rc;
+        out->avail_size = avail_size;
+        out->reclaim_size = reclaim_size;
+        out->avail_objects = avail_objects;
+        out->reclaim_objects = reclaim_objects;
+        (void)wh_MessageNvm_TranslateGetAvailableResponse(magic, out, out);
+        resp_size = sizeof(*out);
+    }; break;
+
+    case WOLFHSM_MESSAGE_TYPE_NVM_ADDOBJECT:
+    {
+        const whMessageNvmAddObjectRequest* req = req_packet;
+        whMessageNvmMetadata wire = {0};
+        whNvmMetadata meta = {0};
+
+        if (req_size < offsetof(whMessageNvmAddObjectRequest, data)) {
+            rc = WH_ERROR_BADARGS;
+            break;
+        }
+        (void)wh_MessageNvm_TranslateMetadata(magic, &req->meta, &wire);
+        if (    (wire.len > sizeof(req->data)) ||
+                (req_size < offsetof(whMessageNvmAddObjectRequest, data) +
+                        wire.len)) {
+            rc = WH_ERROR_BADARGS;
+            break;
+        }
+        meta.id = wire.id;
+        meta.access = wire.access;
+        meta.flags = wire.flags;
+        meta.len = (whNvmSize)wire.len;
+        memcpy(meta.label, wire.label, sizeof(meta.label));
+        _wh_Server_NvmFinish(server);
+        rc = cb->AddObject(nvm, &meta, meta.len, req->data);
+    }; break;
+
+    case WOLFHSM_MESSAGE_TYPE_NVM_LIST:
+    case WOLFHSM_MESSAGE_TYPE_NVM_LISTMETADATA:
+    {
+        whMessageNvmListRequest req = {0};
+
+        if (req_size < sizeof(req)) {
+            rc = WH_ERROR_BADARGS;
+            break;
+        }
+        (void)wh_MessageNvm_TranslateListRequest(magic, req_packet, &req);
+        if (type == WOLFHSM_MESSAGE_TYPE_NVM_LIST) {
+            whMessageNvmListResponse* out = resp_packet;
+            whNvmId count = 0;
+            whNvmId id = 0;
+
+            rc = cb->List(nvm, req.access, req.flags, req.start_id,
+                    &count, &id);
+            out->rc = rc;
+            out->count = count;
+            out->id = id;
+            (void)wh_MessageNvm_TranslateListResponse(magic, out, out);
+            resp_size = sizeof(*out);
+        } else {
+            whMessageNvmListMetadataResponse* out = resp_packet;
+
+            out->rc = _wh_Server_NvmListMetadata(server, magic, &req, out);
+            resp_size = offsetof(whMessageNvmListMetadataResponse, entries) +
+                    out->count * sizeof(out->entries[0]);
+            (void)wh_MessageNvm_TranslateListMetadataResponse(magic, out,
+                    out);
+        }
+    }; break;
+
+    case WOLFHSM_MESSAGE_TYPE_NVM_GETMETADATA:
+    {
+        whMessageNvmIdRequest req = {0};
+        whMessageNvmGetMetadataResponse* out = resp_packet;
+        whNvmMetadata meta = {0};
+
+        if (req_size < sizeof(req)) {
+            rc = WH_ERROR_BADARGS;
+            break;
+        }
+        (void)wh_MessageNvm_TranslateIdRequest(magic, req_packet, &req);
+        rc = cb->GetMetadata(nvm, req.id, &meta);
+        memset(out, 0, sizeof(*out));
+        out->rc = (int32_t)wh_Translate32(magic, (uint32_t)rc);
+        if (rc == 0) {
+            _wh_Server_NvmMetaToWire(magic, &meta, &out->meta);
+        }
+        resp_size = sizeof(*out);
+    }; break;
+
+    case WOLFHSM_MESSAGE_TYPE_NVM_DESTROYOBJECTS:
+    {
+        whMessageNvmDestroyObjectsRequest req = {0};
+        whNvmId list[WH_NVM_MAX_DESTROY_OBJECTS_COUNT] = {0};
+        int i = 0;
+
+        if (req_size < sizeof(req)) {
+            rc = WH_ERROR_BADARGS;
+            break;
+        }
+        (void)wh_MessageNvm_TranslateDestroyObjectsRequest(magic, req_packet,
+                &req);
+        if (req.list_count > WH_NVM_MAX_DESTROY_OBJECTS_COUNT) {
+            rc = WH_ERROR_BADARGS;
+            break;
+        }
+        for (i = 0; i < req.list_count; i++) {
+            list[i] = req.list[i];
+        }
+        _wh_Server_NvmFinish(server);
+        if ((cb->DestroyObjectsBegin != NULL) &&
+                (cb->DestroyObjectsStep != NULL)) {
+            /* The replication runs in the idle passes of
+             * wh_Server_HandleRequestMessage.  A reset or failure before it
+             * commits restores the objects, so respond once it has */
+            rc = cb->DestroyObjectsBegin(nvm, req.list_count, list);
+            if (rc == 0) {
+                server->nvm_compacting = 1;
+                server->defer_response = 1;
+            }
+        } else {
+            rc = cb->DestroyObjects(nvm, req.list_count, list);
+        }
+    }; break;
+
+    case WOLFHSM_MESSAGE_TYPE_NVM_READ:
+    {
+        whMessageNvmReadRequest req = {0};
+        whMessageNvmReadResponse* out = resp_packet;
+
+        if (req_size < sizeof(req)) {
+            rc = WH_ERROR_BADARGS;
+            break;
+        }
+        (void)wh_MessageNvm_TranslateReadRequest(magic, req_packet, &req);
+        /* The wire offset is wider than a whNvmSize by default */
+        if (    (req.len > sizeof(out->data)) ||
+                ((uint64_t)req.offset + req.len >
+                    WOLFHSM_NVM_MAX_OBJECT_SIZE)) {
+            rc = WH_ERROR_BADARGS;
+            break;
+        }
+        rc = cb->Read(nvm, req.id, (whNvmSize)req.offset, (whNvmSize)req.len,
+                out->data);
+        out->rc = rc;
+        out->len = (rc == 0) ? req.len : 0;
+        resp_size = offsetof(whMessageNvmReadResponse, data) + out->len;
+        (void)wh_MessageNvm_TranslateReadResponse(magic, out, out);
+    }; break;
+
+    case WOLFHSM_MESSAGE_TYPE_NVM_READMULTI:
+    {
+        whMessageNvmReadMultiRequest req = {0};
+        whMessageNvmReadMultiResponse* out = resp_packet;
+        uint16_t used = 0;
+
+        if (req_size < sizeof(req)) {
+            rc = WH_ERROR_BADARGS;
+            break;
+        }
+        (void)wh_MessageNvm_TranslateReadMultiRequest(magic, req_packet, &req);
+        if (req.count > WOLFHSM_MESSAGE_NVM_MULTI_COUNT) {
+            rc = WH_ERROR_BADARGS;
+            break;
+        }
+        used = _wh_Server_NvmReadMulti(server, magic, &req, out);
+        out->rc = 0;
+        out->pad = 0;
+        resp_size = offsetof(whMessageNvmReadMultiResponse, records) + used;
+        (void)wh_MessageNvm_TranslateReadMultiResponse(magic, out, out);
+    }; break;
+
+    default:
+        break;
+    }
+
+    if (resp_size == 0) {
+        resp->rc = rc;
+        (void)wh_MessageNvm_TranslateResponse(magic, resp, resp);
+        resp_size = sizeof(*resp);
+    }
+    *out_resp_size = resp_size;
+    return 0;
+}
+
+/* Execute the items of a batch in order, packing their results until the
+ * output of the next one does not fit */
+static int _wh_Server_HandleCryptoRequest(whServer* server,
+        uint16_t magic, uint16_t type, uint16_t seq,
+        uint16_t req_size, const void* req_packet,
+        uint16_t *out_resp_size, void* resp_packet)
+{
+    const whMessageCryptoBatchRequest* req = req_packet;
+    whMessageCryptoBatchResponse* resp = resp_packet;
+    whMessageCryptoBatchRequest hdr = {0};
+    whMessageCryptoItem item = {0};
+    whMessageCryptoResult result = {0};
+    uint16_t items_size = 0;
+    uint16_t in_offset = 0;
+    uint16_t out_offset = 0;
+    uint16_t avail = 0;
+    uint16_t done = 0;
+    uint8_t* out = NULL;
+    int rc = 0;
+
+    if (type != WOLFHSM_MESSAGE_TYPE_CRYPTO_BATCH) {
+        /* Unknown request. Respond with empty packet */
+        *out_resp_size = 0;
+        return 0;
+    }
+
+    if (    (req_size < offsetof(whMessageCryptoBatchRequest, items)) ||
+            (req_size > sizeof(*req))) {
+        rc = WH_ERROR_BADARGS;
+    } else {
+        (void)wh_MessageCrypto_TranslateBatchRequest(magic, req, &hdr);
+        items_size = req_size - offsetof(whMessageCryptoBatchRequest, items);
+        if ((const void*)req == (const void*)resp) {
+            /* Results would overwrite the items not yet executed */
+            memcpy(server->crypto_batch, req_packet, req_size);
+            req = (const whMessageCryptoBatchRequest*)server->crypto_batch;
+        }
+    }
+
+    while ((rc == 0) && (done < hdr.count)) {
+        if (sizeof(item) > (uint16_t)(items_size - in_offset)) {
+            rc = WH_ERROR_BADARGS;
+            break;
+        }
+        memcpy(&item, &req->items[in_offset], sizeof(item));
+        (void)wh_MessageCrypto_TranslateItem(magic, &item, &item);
+        if (item.len > items_size - in_offset - sizeof(item)) {
+            rc = WH_ERROR_BADARGS;
+            break;
+        }
+        if (sizeof(result) > sizeof(resp->results) - out_offset) {
+            /* Left for the next batch */
+            break;
+        }
+
+        out = &resp->results[out_offset + sizeof(result)];
+        avail = sizeof(resp->results) - out_offset - sizeof(result);
+        result.op = item.op;
+        result.len = avail;
+        if (server->crypto_cb == NULL) {
+            result.rc = WH_ERROR_BADARGS;
+        } else {
+            result.rc = server->crypto_cb(server->crypto_context, item.op,
+                    item.len, &req->items[in_offset + sizeof(item)],
+                    &result.len, out);
+        }
+        if ((result.rc == WH_ERROR_NOSPACE) && (done > 0)) {
+            /* Left for the next batch */
+            break;
+        }
+        if ((result.rc != 0) || (result.len > avail)) {
+            result.len = 0;
+        }
+        memset(out + result.len, 0, WOLFHSM_MESSAGE_CRYPTO_RESULT_SIZE(
+                result.len) - sizeof(result) - result.len);
+        out_offset += WOLFHSM_MESSAGE_CRYPTO_RESULT_SIZE(result.len);
+        (void)wh_MessageCrypto_TranslateResult(magic, &result, &result);
+        memcpy(out - sizeof(result), &result, sizeof(result));
+
+        in_offset += WOLFHSM_MESSAGE_CRYPTO_ITEM_SIZE(item.len);
+        if (in_offset > items_size) {
+            /* Padding of the last item may be omitted */
+            in_offset = items_size;
+        }
+        done++;
+    }
+
+    resp->rc = rc;
+    resp->count = done;
+    resp->pad = 0;
+    (void)wh_MessageCrypto_TranslateBatchResponse(magic, resp, resp);
+    *out_resp_size = offsetof(whMessageCryptoBatchResponse, results) +
+            out_offset;
+    return 0;
+}
+
+/* Dispatch a request to the handler of its group */
+static int _wh_Server_DispatchRequest(whServer* server, uint16_t magic,
+        uint16_t type, uint16_t seq,
+        uint16_t req_size, const void* req_data,
+        uint16_t* out_resp_size, void* resp_data)
+{
+    uint16_t group = type & WOLFHSM_MESSAGE_GROUP_MASK;
+    int rc = 0;
+
+#ifdef WOLFHSM_COMM_NATIVE_ONLY
+    if (    (magic & WH_COMM_MAGIC_ENDIAN_MASK) !=
+            (WH_COMM_MAGIC_NATIVE & WH_COMM_MAGIC_ENDIAN_MASK)) {
+        /* Fields of the other endianness cannot be translated in this build.
+         * Respond with an empty packet */
+        return 0;
+    }
+#endif
+    WH_STATS_TIMER_START(start);
+    switch (group) {
+    case WOLFHSM_MESSAGE_GROUP_COMM: {
+        rc = _wh_Server_HandleCommRequest(server, magic, type, seq,
+                req_size, req_data,
+                out_resp_size, resp_data);
+    }; break;
+    case WOLFHSM_MESSAGE_GROUP_NVM: {
+        rc = _wh_Server_HandleNvmRequest(server, magic, type, seq,
+                req_size, req_data,
+                out_resp_size, resp_data);
+    }; break;
+    case WOLFHSM_MESSAGE_GROUP_KEY: {
+        rc = _wh_Server_HandleKeyRequest(server, magic, type, seq,
+                req_size, req_data,
+                out_resp_size, resp_data);
+    }; break;
+    case WOLFHSM_MESSAGE_GROUP_CRYPTO: {
+        rc = _wh_Server_HandleCryptoRequest(server, magic, type, seq,
+                req_size, req_data,
+                out_resp_size, resp_data);
+    }; break;
+    case WOLFHSM_MESSAGE_GROUP_PKCS11: {
+
+    }; break;
+    case WOLFHSM_MESSAGE_GROUP_SHE: {
+
+    }; break;
+    case WOLFHSM_MESSAGE_GROUP_CUSTOM: {
+
+    }; break;
+    default:
+        /* Unknown type. Respond with error flag */
+        rc = WH_ERROR_NOTREADY;
+    }
+    WH_STATS_INC(requests[WH_STATS_GROUP_INDEX(group)]);
+    WH_STATS_TIMER_ADD(request_cycles, start);
+    return rc;
+}
+
+static int _wh_Server_HandleCommMessage(whServer* server, whCommServer* comm)
 {
     uint16_t type, magic, seq, size;
-    uint8_t data[WOLFHSM_COMM_MTU];
+    const void* req_data = NULL;
+    void* resp_data = NULL;
+    uint32_t polls = 0;
 
-    if (server == NULL) {
-        return WH_ERROR_BADARGS;
+    /* Handlers read the request and write the response in the transport's
+     * buffers without any intermediate copy */
+    int rc = wh_CommServer_RecvRequestInPlace(comm, &magic, &type,
+            &seq, &size, &req_data);
+    if (rc == 0) {
+        do {
+            rc = wh_CommServer_GetResponseBuffer(comm, NULL,
+                    &resp_data);
+        } while (   (rc == WH_ERROR_NOTREADY) &&
+                    ((rc = wh_CommServer_Wait(comm, &polls)) == 0));
     }
-    int rc = wh_CommServer_RecvRequest(server->comm, &magic, &type, &seq,
-            &size, data);
     /* Got a packet? */
     if (rc == 0) {
-        uint16_t group = type & WOLFHSM_MESSAGE_GROUP_MASK;
-        switch (group) {
-        case WOLFHSM_MESSAGE_GROUP_COMM: {
-            rc = _wh_Server_HandleCommRequest(server, magic, type, seq,
-                    size, data,
-                    &size, data);
-        }; break;
-        case WOLFHSM_MESSAGE_GROUP_NVM: {
-/*            rc = wh_NvmServer_Handle(server->comm,
-                    &type, &flags, &seq, &size, server->comm->packet);
-                    */
-        }; break;
-        case WOLFHSM_MESSAGE_GROUP_KEY: {
-
-        }; break;
-        case WOLFHSM_MESSAGE_GROUP_CRYPTO: {
-
-        }; break;
-        case WOLFHSM_MESSAGE_GROUP_PKCS11: {
-
-        }; break;
-        case WOLFHSM_MESSAGE_GROUP_SHE: {
-
-        }; break;
-        case WOLFHSM_MESSAGE_GROUP_CUSTOM: {
-
-        }; break;
-        default:
-            /* Unknown type. Respond with error flag */
-            rc = WH_ERROR_NOTREADY;
-        }
+        uint16_t req_size = size;
+        /* Respond with an empty packet unless handled */
+        size = 0;
+        server->defer_response = 0;
+        rc = _wh_Server_DispatchRequest(server, magic, type, seq,
+                req_size, req_data, &size, resp_data);
+    }
+    if ((rc == 0) && (server->defer_response != 0)) {
+        /* Keep the response buffer until the DestroyObjects completes */
+        server->defer_response = 0;
+        server->nvm_destroy.comm = comm;
+        server->nvm_destroy.resp_data = resp_data;
+        server->nvm_destroy.magic = magic;
+        server->nvm_destroy.type = type;
+        server->nvm_destroy.seq = seq;
+        return rc;
     }
     /* Send a response */
     if (rc == 0) {
-        do {
-            rc = wh_CommServer_SendResponse(server->comm, magic, type, seq,
-                size, data);
-        } while (rc == WH_ERROR_NOTREADY);
+        rc = _wh_Server_SendResponse(comm, magic, type, seq, size);
     }
     return rc;
 }
 
+int wh_Server_HandleRequestMessage(whServer* server)
+{
+    int rc = WH_ERROR_NOTREADY;
+    int failed = 0;
+    int i = 0;
+    int index = 0;
+
+    if (server == NULL) {
+        return WH_ERROR_BADARGS;
+    }
+
+    for (i = 0; i < server->comm_count; i++) {
+        index = (server->next_comm + i) % server->comm_count;
+        if (&server->comm[index] == server->nvm_destroy.comm) {
+            /* Waiting for its DestroyObjects to be committed */
+            rc = WH_ERROR_NOTREADY;
+            continue;
+        }
+        rc = _wh_Server_HandleCommMessage(server, &server->comm[index]);
+        if (rc == WH_ERROR_NOTREADY) {
+            /* Nothing pending on this endpoint */
+            continue;
+        }
+        server->error[index] = rc;
+        if (rc != 0) {
+            /* Keep serving the other clients */
+            failed++;
+            continue;
+        }
+        server->handled[index]++;
+        if (index != server->next_comm) {
+            server->next_comm = index;
+            server->served = 0;
+        }
+        if (++server->served >= server->weight[index]) {
+            /* Used its turn. Poll the next endpoint first */
+            server->next_comm = (index + 1) % server->comm_count;
+            server->served = 0;
+        }
+        break;
+    }
+    if (rc == 0) {
+        return rc;
+    }
+    if (failed == server->comm_count) {
+        /* No endpoint left to serve */
+        return rc;
+    }
+
+    if (server->nvm_compacting != 0) {
+        /* Nothing pending, so continue the replication */
+        rc = server->nvm_cb->DestroyObjectsStep(server->nvm_context,
+                WH_SERVER_NVM_STEP_BYTES);
+        if (rc != WH_ERROR_NOTREADY) {
+            _wh_Server_NvmDestroyDone(server, rc);
+        }
+    } else {
+        /* Nothing pending, so commit a cached key in the background.  Once
+         * all are committed, erase storage the NVM retired */
+        rc = wh_KeyCache_Idle(&server->keycache);
+        if (server->keycache.nvm_full != 0) {
+            /* Retry the commit on a later pass, once space is reclaimed */
+            (void)_wh_Server_NvmReclaim(server);
+        } else if ( (rc == 0) &&
+                    (server->nvm_cb != NULL) &&
+                    (server->nvm_cb->Idle != NULL)) {
+            (void)server->nvm_cb->Idle(server->nvm_context);
+        }
+    }
+    return WH_ERROR_NOTREADY;
+}
+
+int wh_Server_Wait(whServer* server, uint32_t* inout_polls)
+{
+    int rc = 0;
+    int i = 0;
+    int count = 0;
+    whCommServer* comm = NULL;
+
+    if (    (server == NULL) ||
+            (inout_polls == NULL)) {
+        return WH_ERROR_BADARGS;
+    }
+
+    if (server->nvm_compacting != 0) {
+        /* The idle passes have work to do */
+        return 0;
+    }
+    if (server->comm_count == 1) {
+        return wh_CommServer_Wait(&server->comm[0], inout_polls);
+    }
+
+    WH_STATS_INC(notready_polls);
+    if (*inout_polls < server->comm[0].wait_spins) {
+        /* Still spinning */
+        (*inout_polls)++;
+        return 0;
+    }
+
+    /* Split the timeout between the endpoints that can wait.  Failed
+     * endpoints are skipped, as their transport may report ready at once */
+    for (i = 0; i < server->comm_count; i++) {
+        comm = &server->comm[i];
+        if (    (server->error[i] == 0) &&
+                (comm->transport_cb != NULL) &&
+                (comm->transport_cb->Wait != NULL)) {
+            count++;
+        }
+    }
+    for (i = 0; i < server->comm_count; i++) {
+        comm = &server->comm[i];
+        if (    (server->error[i] != 0) ||
+                (comm->transport_cb == NULL) ||
+                (comm->transport_cb->Wait == NULL)) {
+            continue;
+        }
+        rc = comm->transport_cb->Wait(comm->transport_context,
+                (comm->wait_timeout_us + count - 1) / count);
+        if (rc == 0) {
+            /* Ready */
+            break;
+        }
+        if (rc != WH_ERROR_NOTREADY) {
+            server->error[i] = rc;
+        }
+    }
+    /* Ready, timed out, or failed.  Poll again */
+    return 0;
+}
+
+int wh_Server_GetClientInfo(whServer* server, int index,
+        uint32_t* out_client_id, uint16_t* out_depth, uint32_t* out_handled,
+        int* out_error)
+{
+    uint16_t depth = 0;
+
+    if (    (server == NULL) ||
+            (index < 0) ||
+            (index >= server->comm_count)) {
+        return WH_ERROR_BADARGS;
+    }
+
+    if (wh_CommServer_GetQueueDepth(&server->comm[index], &depth) != 0) {
+        depth = WH_SERVER_DEPTH_UNKNOWN;
+    }
+    if (out_client_id != NULL) *out_client_id = server->comm[index].client_id;
+    if (out_depth != NULL) *out_depth = depth;
+    if (out_handled != NULL) *out_handled = server->handled[index];
+    if (out_error != NULL) *out_error = server->error[index];
+    return 0;
+}
+
 int wh_Server_Cleanup(whServer* server)
 {
+    int rc = 0;
+    int i = 0;
     if (server ==NULL) {
          return WH_ERROR_BADARGS;
      }
@@ -143,7 +1002,21 @@ int wh_Server_Cleanup(whServer* server)
          /*(void)wh_Nvm_Cleanup(server->nvm);*/
      }
 #endif
-     (void)wh_CommServer_Cleanup(server->comm);
+     /* Answer a running DestroyObjects before disconnecting */
+     _wh_Server_NvmFinish(server);
+     for (i = 0; i < server->comm_count; i++) {
+         (void)wh_CommServer_Cleanup(&server->comm[i]);
+     }
+     /* Commit the cached keys, reclaiming NVM space while that helps */
+     do {
+         rc = wh_KeyCache_Idle(&server->keycache);
+         if (   (server->keycache.nvm_full != 0) &&
+                (_wh_Server_NvmReclaim(server) == 0)) {
+             _wh_Server_NvmFinish(server);
+             rc = WH_ERROR_NOTREADY;
+         }
+     } while (rc == WH_ERROR_NOTREADY);
+     (void)wh_KeyCache_Cleanup(&server->keycache);
      memset(server, 0, sizeof(*server));
      return 0;
 }
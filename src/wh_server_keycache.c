@@ -0,0 +1,371 @@
+/*
+ * src/wh_server_keycache.c
+ *
+ * Server RAM key cache backed by NVM objects
+ */
+
+#include <stdint.h>
+#include <stddef.h>     /* For NULL */
+#include <string.h>     /* For memset, memcpy */
+
+#include "wolfhsm/wh_common.h"
+#include "wolfhsm/wh_error.h"
+#include "wolfhsm/wh_nvm.h"
+#include "wolfhsm/wh_server_keycache.h"
+
+/** Local declarations */
+static int whKeyCache_IsNvm(whKeyId id);
+static int whKeyCache_Find(whKeyCache* cache, whKeyId id);
+static void whKeyCache_Zeroize(whKeyCacheSlot* slot);
+static void whKeyCache_Touch(whKeyCache* cache, whKeyCacheSlot* slot);
+static int whKeyCache_CommitSlot(whKeyCache* cache, whKeyCacheSlot* slot);
+static int whKeyCache_Allocate(whKeyCache* cache, int* out_index);
+
+/** Local implementations */
+static int whKeyCache_IsNvm(whKeyId id)
+{
+    return (id & WOLFHSM_KEYID_MASK) == WOLFHSM_KEYID_NVM;
+}
+
+static int whKeyCache_Find(whKeyCache* cache, whKeyId id)
+{
+    int i = 0;
+    for (i = 0; i < WOLFHSM_NUM_RAMKEYS; i++) {
+        if (    (cache->slots[i].used != 0) &&
+                (cache->slots[i].meta.id == id)) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+/* Clear key material in a way the compiler will not remove */
+static void whKeyCache_Zeroize(whKeyCacheSlot* slot)
+{
+    volatile uint8_t* p = (volatile uint8_t*)slot;
+    size_t i = 0;
+
+    for (i = 0; i < sizeof(*slot); i++) {
+        p[i] = 0;
+    }
+}
+
+static void whKeyCache_Touch(whKeyCache* cache, whKeyCacheSlot* slot)
+{
+    slot->last_use = ++cache->tick;
+}
+
+/* Add the slot as the newest version of its NVM object.  If the NVM is full
+ * the slot stays uncommitted and nvm_full is set for the owner to reclaim the
+ * space of older versions */
+static int whKeyCache_CommitSlot(whKeyCache* cache, whKeyCacheSlot* slot)
+{
+    int rc = 0;
+    whNvmMetadata meta = slot->meta;
+
+    if (cache->nvm_cb == NULL) {
+        return WH_ERROR_BADARGS;
+    }
+    /* NOCACHE is a read cache policy, not an attribute of the object */
+    meta.flags &= ~WOLFHSM_NVM_FLAGS_NOCACHE;
+    rc = cache->nvm_cb->AddObject(cache->nvm_context, &meta, meta.len,
+            slot->data);
+    if (rc == WH_ERROR_NOSPACE) {
+        cache->nvm_full = 1;
+    }
+    if (rc == 0) {
+        slot->dirty = 0;
+        cache->nvm_full = 0;
+    }
+    return rc;
+}
+
+/* Find a free slot, else evict the least recently used NVM key that is not
+ * pinned.  Committed keys are evicted before uncommitted ones */
+static int whKeyCache_Allocate(whKeyCache* cache, int* out_index)
+{
+    int rc = 0;
+    int best = -1;
+    int i = 0;
+    whKeyCacheSlot* slot = NULL;
+
+    for (i = 0; i < WOLFHSM_NUM_RAMKEYS; i++) {
+        slot = &cache->slots[i];
+        if (slot->used == 0) {
+            *out_index = i;
+            return 0;
+        }
+        if ((slot->pins != 0) || (whKeyCache_IsNvm(slot->meta.id) == 0)) {
+            /* Pinned, or a RAM key that would be lost */
+            continue;
+        }
+        if (    (best < 0) ||
+                (slot->dirty < cache->slots[best].dirty) ||
+                ((slot->dirty == cache->slots[best].dirty) &&
+                 (slot->last_use < cache->slots[best].last_use))) {
+            best = i;
+        }
+    }
+    if (best < 0) {
+        /* Every slot is pinned or holds a RAM key */
+        return WH_ERROR_NOSPACE;
+    }
+
+    slot = &cache->slots[best];
+    if (slot->dirty != 0) {
+        rc = whKeyCache_CommitSlot(cache, slot);
+        if (rc != 0) {
+            return rc;
+        }
+    }
+    whKeyCache_Zeroize(slot);
+    cache->evictions++;
+    *out_index = best;
+    return 0;
+}
+
+int wh_KeyCache_Init(whKeyCache* cache, const whKeyCacheConfig* config)
+{
+    if (cache == NULL) {
+        return WH_ERROR_BADARGS;
+    }
+
+    memset(cache, 0, sizeof(*cache));
+    if (config != NULL) {
+        cache->nvm_cb = config->nvm_cb;
+        cache->nvm_context = config->nvm_context;
+    }
+    return 0;
+}
+
+int wh_KeyCache_Cleanup(whKeyCache* cache)
+{
+    int i = 0;
+
+    if (cache == NULL) {
+        return WH_ERROR_BADARGS;
+    }
+
+    for (i = 0; i < WOLFHSM_NUM_RAMKEYS; i++) {
+        if (cache->slots[i].dirty != 0) {
+            /* Ignore errors here */
+            (void)whKeyCache_CommitSlot(cache, &cache->slots[i]);
+        }
+        whKeyCache_Zeroize(&cache->slots[i]);
+    }
+    memset(cache, 0, sizeof(*cache));
+    return 0;
+}
+
+int wh_KeyCache_Cache(whKeyCache* cache, const whNvmMetadata* meta,
+        const uint8_t* data)
+{
+    int rc = 0;
+    int index = 0;
+    int is_nvm = 0;
+    whKeyCacheSlot* slot = NULL;
+
+    if (    (cache == NULL) ||
+            (meta == NULL) ||
+            ((data == NULL) && (meta->len != 0)) ||
+            (meta->len > WH_KEYCACHE_BUFSIZE)) {
+        return WH_ERROR_BADARGS;
+    }
+    is_nvm = whKeyCache_IsNvm(meta->id);
+    if (    ((meta->id & WOLFHSM_KEYID_MASK) != WOLFHSM_KEYID_RAM) &&
+            ((is_nvm == 0) || (cache->nvm_cb == NULL))) {
+        return WH_ERROR_BADARGS;
+    }
+
+    index = whKeyCache_Find(cache, meta->id);
+    if (index >= 0) {
+        if (cache->slots[index].pins != 0) {
+            return WH_ERROR_NOTREADY;
+        }
+        /* The new version replaces any uncommitted one */
+        whKeyCache_Zeroize(&cache->slots[index]);
+    } else {
+        rc = whKeyCache_Allocate(cache, &index);
+        if (rc != 0) {
+            return rc;
+        }
+    }
+
+    slot = &cache->slots[index];
+    slot->used = 1;
+    slot->dirty = (uint16_t)is_nvm;
+    slot->meta = *meta;
+    if (meta->len != 0) {
+        memcpy(slot->data, data, meta->len);
+    }
+    whKeyCache_Touch(cache, slot);
+    return 0;
+}
+
+int wh_KeyCache_Acquire(whKeyCache* cache, whKeyId id,
+        const whNvmMetadata** out_meta, const uint8_t** out_data)
+{
+    int rc = 0;
+    int index = 0;
+    whNvmMetadata meta;
+    whKeyCacheSlot* slot = NULL;
+
+    if (cache == NULL) {
+        return WH_ERROR_BADARGS;
+    }
+
+    index = whKeyCache_Find(cache, id);
+    if (index < 0) {
+        /* Load NVM keys on first use */
+        if ((whKeyCache_IsNvm(id) == 0) || (cache->nvm_cb == NULL)) {
+            return WH_ERROR_NOTFOUND;
+        }
+        rc = cache->nvm_cb->GetMetadata(cache->nvm_context, id, &meta);
+        if (rc != 0) {
+            return rc;
+        }
+        if (meta.len > WH_KEYCACHE_BUFSIZE) {
+            return WH_ERROR_NOSPACE;
+        }
+        rc = whKeyCache_Allocate(cache, &index);
+        if (rc != 0) {
+            return rc;
+        }
+        slot = &cache->slots[index];
+        rc = cache->nvm_cb->Read(cache->nvm_context, id, 0, meta.len,
+                slot->data);
+        if (rc != 0) {
+            whKeyCache_Zeroize(slot);
+            return rc;
+        }
+        slot->used = 1;
+        slot->meta = meta;
+        cache->loads++;
+    }
+
+    slot = &cache->slots[index];
+    slot->pins++;
+    whKeyCache_Touch(cache, slot);
+    if (out_meta != NULL) *out_meta = &slot->meta;
+    if (out_data != NULL) *out_data = slot->data;
+    return 0;
+}
+
+int wh_KeyCache_Release(whKeyCache* cache, whKeyId id)
+{
+    int index = 0;
+
+    if (cache == NULL) {
+        return WH_ERROR_BADARGS;
+    }
+    index = whKeyCache_Find(cache, id);
+    if (index < 0) {
+        return WH_ERROR_NOTFOUND;
+    }
+    if (cache->slots[index].pins == 0) {
+        return WH_ERROR_BADARGS;
+    }
+    cache->slots[index].pins--;
+    return 0;
+}
+
+int wh_KeyCache_Commit(whKeyCache* cache, whKeyId id)
+{
+    int index = 0;
+
+    if ((cache == NULL) || (whKeyCache_IsNvm(id) == 0)) {
+        return WH_ERROR_BADARGS;
+    }
+    index = whKeyCache_Find(cache, id);
+    if (index < 0) {
+        return WH_ERROR_NOTFOUND;
+    }
+    if (cache->slots[index].dirty == 0) {
+        return 0;
+    }
+    return whKeyCache_CommitSlot(cache, &cache->slots[index]);
+}
+
+int wh_KeyCache_Evict(whKeyCache* cache, whKeyId id)
+{
+    int rc = 0;
+    int index = 0;
+
+    if (cache == NULL) {
+        return WH_ERROR_BADARGS;
+    }
+    index = whKeyCache_Find(cache, id);
+    if (index < 0) {
+        return WH_ERROR_NOTFOUND;
+    }
+    if (cache->slots[index].pins != 0) {
+        return WH_ERROR_NOTREADY;
+    }
+    if (cache->slots[index].dirty != 0) {
+        rc = whKeyCache_CommitSlot(cache, &cache->slots[index]);
+        if (rc != 0) {
+            return rc;
+        }
+    }
+    whKeyCache_Zeroize(&cache->slots[index]);
+    return 0;
+}
+
+int wh_KeyCache_Erase(whKeyCache* cache, whKeyId id)
+{
+    int rc = WH_ERROR_NOTFOUND;
+    int index = 0;
+    whNvmMetadata meta;
+
+    if (cache == NULL) {
+        return WH_ERROR_BADARGS;
+    }
+    index = whKeyCache_Find(cache, id);
+    if (index >= 0) {
+        if (cache->slots[index].pins != 0) {
+            return WH_ERROR_NOTREADY;
+        }
+        whKeyCache_Zeroize(&cache->slots[index]);
+        rc = 0;
+    }
+
+    /* Only replicate the NVM if it holds the key */
+    if (    (whKeyCache_IsNvm(id) != 0) &&
+            (cache->nvm_cb != NULL) &&
+            (cache->nvm_cb->GetMetadata(cache->nvm_context, id, &meta) == 0)) {
+        rc = cache->nvm_cb->DestroyObjects(cache->nvm_context, 1, &id);
+    }
+    return rc;
+}
+
+int wh_KeyCache_Idle(whKeyCache* cache)
+{
+    int rc = 0;
+    int oldest = -1;
+    int remaining = 0;
+    int i = 0;
+
+    if (cache == NULL) {
+        return WH_ERROR_BADARGS;
+    }
+
+    for (i = 0; i < WOLFHSM_NUM_RAMKEYS; i++) {
+        if (cache->slots[i].dirty == 0) {
+            continue;
+        }
+        remaining++;
+        if (    (oldest < 0) ||
+                (cache->slots[i].last_use < cache->slots[oldest].last_use)) {
+            oldest = i;
+        }
+    }
+    if (oldest < 0) {
+        return 0;
+    }
+
+    rc = whKeyCache_CommitSlot(cache, &cache->slots[oldest]);
+    if (rc != 0) {
+        return rc;
+    }
+    return (remaining > 1) ? WH_ERROR_NOTREADY : 0;
+}
@@ -0,0 +1,27 @@
+/*
+ * src/wh_stats.c
+ *
+ * Storage of the hot path statistics
+ */
+
+#include <stdint.h>
+#include <stddef.h>     /* For NULL */
+#include <string.h>     /* For memset, memcpy */
+
+#include "wolfhsm/wh_stats.h"
+
+#ifdef WOLFHSM_STATS
+
+whStats whStatsCounters;
+
+void wh_Stats_Get(whStats* out_stats, int reset)
+{
+    if (out_stats != NULL) {
+        memcpy(out_stats, &whStatsCounters, sizeof(*out_stats));
+    }
+    if (reset != 0) {
+        memset(&whStatsCounters, 0, sizeof(whStatsCounters));
+    }
+}
+
+#endif /* WOLFHSM_STATS */
@@ -12,6 +12,30 @@
 #include "wolfhsm/wh_transport.h"
 #include "wolfhsm/wh_transport_mem.h"
 
+/* Ring the partner's doorbell, if any, after writing csr */
+static void _wh_TransportMem_Notify(whTransportMemContext* context,
+        volatile whTransportMemCsr* csr)
+{
+    if (    (context->notify_cb != NULL) &&
+            (context->notify_cb->Notify != NULL)) {
+        (void)context->notify_cb->Notify(context->notify_context, csr);
+    }
+}
+
+/* Block on the doorbell, if any, until csr may differ from expected */
+static int _wh_TransportMem_Wait(whTransportMemContext* context,
+        volatile whTransportMemCsr* csr, uint64_t expected,
+        uint32_t timeout_us)
+{
+    if (    (context->notify_cb == NULL) ||
+            (context->notify_cb->Wait == NULL)) {
+        /* Nothing to block on.  Poll again */
+        return 0;
+    }
+    return context->notify_cb->Wait(context->notify_context, csr, expected,
+            timeout_us);
+}
+
 int wh_TransportMem_Init(void* c, const void* cf)
 {
     whTransportMemContext* context = c;
@@ -34,6 +58,9 @@ int wh_TransportMem_Init(void* c, const void* cf)
     context->resp_size  = config->resp_size;
     context->resp_data  = (void*)(context->resp + 1);
 
+    context->notify_cb      = config->notify_cb;
+    context->notify_context = config->notify_context;
+
     context->initialized = 1;
     return 0;
 }
@@ -90,6 +117,7 @@ int wh_TransportMem_SendRequest(void* c, uint16_t len, const void* data)
 
     /* Write the new CSR's */
     context->req->u64 = req.u64;
+    _wh_TransportMem_Notify(context, context->req);
 
     return 0;
 }
@@ -125,6 +153,21 @@ int wh_TransportMem_RecvRequest(void* c, uint16_t *out_len, void* data)
 }
 
 int wh_TransportMem_SendResponse(void* c, uint16_t len, const void* data)
+{
+    whTransportMemContext* context = c;
+
+    if (    (context == NULL) ||
+            (context->initialized == 0)) {
+        return WH_ERROR_BADARGS;
+    }
+
+    if ((data != NULL) && (len != 0)) {
+        memcpy(context->resp_data, data, len);
+    }
+    return wh_TransportMem_SendResponseInPlace(c, len);
+}
+
+int wh_TransportMem_RecvResponse(void* c, uint16_t *out_len, void* data)
 {
     whTransportMemContext* context = c;
     whTransportMemCsr req;
@@ -139,20 +182,99 @@ int wh_TransportMem_SendResponse(void* c, uint16_t len, const void* data)
     req.u64 = context->req->u64;
     resp.u64 = context->resp->u64;
 
-    if ((data != NULL) && (len != 0)) {
-        memcpy(context->resp_data, data, len);
-        /* TODO: Cache flush resp_data for len bytes */
+    /* Check to see if the current response is the different than the request */
+    if(resp.s.notify != req.s.notify) {
+        return WH_ERROR_NOTREADY;
+    }
+
+    if ((data != NULL) && (resp.s.len != 0)) {
+        /* TODO: Cache invalidate resp_data for resp.s.len bytes */
+        memcpy(data, context->resp_data, resp.s.len);
+    }
+
+    if (out_len != NULL) {
+        *out_len = resp.s.len;
+    }
+
+    return 0;
+}
+
+int wh_TransportMem_RecvRequestInPlace(void* c, uint16_t *out_len,
+        void** out_data)
+{
+    whTransportMemContext* context = c;
+    whTransportMemCsr req;
+    whTransportMemCsr resp;
+
+    if (    (context == NULL) ||
+            (context->initialized == 0) ||
+            (out_data == NULL)) {
+        return WH_ERROR_BADARGS;
+    }
+
+    /* Read current request CSR's */
+    req.u64 = context->req->u64;
+    resp.u64 = context->resp->u64;
+
+    /* Check to see if a new request has arrived */
+    if(req.s.notify == resp.s.notify) {
+        return WH_ERROR_NOTREADY;
+    }
+
+    /* TODO: Cache invalidate req_data for req.s.len bytes */
+    *out_data = context->req_data;
+    if (out_len != NULL) {
+        *out_len = req.s.len;
+    }
+
+    return 0;
+}
+
+int wh_TransportMem_GetResponseBuffer(void* c, uint16_t *out_size,
+        void** out_data)
+{
+    whTransportMemContext* context = c;
+
+    if (    (context == NULL) ||
+            (context->initialized == 0) ||
+            (out_size == NULL) ||
+            (out_data == NULL)) {
+        return WH_ERROR_BADARGS;
+    }
+
+    *out_data = context->resp_data;
+    *out_size = (context->resp_size > sizeof(whTransportMemCsr)) ?
+            context->resp_size - sizeof(whTransportMemCsr) : 0;
+    return 0;
+}
+
+int wh_TransportMem_SendResponseInPlace(void* c, uint16_t len)
+{
+    whTransportMemContext* context = c;
+    whTransportMemCsr req;
+    whTransportMemCsr resp;
+
+    if (    (context == NULL) ||
+            (context->initialized == 0)) {
+        return WH_ERROR_BADARGS;
     }
+
+    /* Read both CSR's */
+    req.u64 = context->req->u64;
+    resp.u64 = context->resp->u64;
+
+    /* TODO: Cache flush resp_data for len bytes */
     resp.s.len = len;
     resp.s.notify = req.s.notify;
 
     /* Write the new CSR's */
     context->resp->u64 = resp.u64;
+    _wh_TransportMem_Notify(context, context->resp);
 
     return 0;
 }
 
-int wh_TransportMem_RecvResponse(void* c, uint16_t *out_len, void* data)
+int wh_TransportMem_ClientWait(void* c, uint32_t timeout_us)
 {
     whTransportMemContext* context = c;
     whTransportMemCsr req;
@@ -167,19 +289,380 @@ int wh_TransportMem_RecvResponse(void* c, uint16_t *out_len, void* data)
     req.u64 = context->req->u64;
     resp.u64 = context->resp->u64;
 
-    /* Check to see if the current response is the different than the request */
-    if(resp.s.notify != req.s.notify) {
+    /* Response ready and request buffer free */
+    if (resp.s.notify == req.s.notify) {
+        return 0;
+    }
+    return _wh_TransportMem_Wait(context, context->resp, resp.u64, timeout_us);
+}
+
+int wh_TransportMem_ServerWait(void* c, uint32_t timeout_us)
+{
+    whTransportMemContext* context = c;
+    whTransportMemCsr req;
+    whTransportMemCsr resp;
+
+    if (    (context == NULL) ||
+            (context->initialized == 0)) {
+        return WH_ERROR_BADARGS;
+    }
+
+    /* Read both CSR's */
+    req.u64 = context->req->u64;
+    resp.u64 = context->resp->u64;
+
+    /* Request pending */
+    if (req.s.notify != resp.s.notify) {
+        return 0;
+    }
+    return _wh_TransportMem_Wait(context, context->req, req.u64, timeout_us);
+}
+
+int wh_TransportMem_GetQueueDepth(void* c, uint16_t* out_depth)
+{
+    whTransportMemContext* context = c;
+    whTransportMemCsr req;
+    whTransportMemCsr resp;
+
+    if (    (context == NULL) ||
+            (context->initialized == 0) ||
+            (out_depth == NULL)) {
+        return WH_ERROR_BADARGS;
+    }
+
+    /* Read both CSR's */
+    req.u64 = context->req->u64;
+    resp.u64 = context->resp->u64;
+
+    *out_depth = (req.s.notify != resp.s.notify) ? 1 : 0;
+    return 0;
+}
+
+/** Ring mode */
+
+/* Get the CSR of slot index in the data area after a top CSR */
+static volatile whTransportMemCsr* _wh_TransportMemRing_Slot(
+        whTransportMemContext* context, void* data, uint16_t index)
+{
+    return (volatile whTransportMemCsr*)((uint8_t*)data +
+            (size_t)(index & (context->slot_count - 1)) * context->slot_size);
+}
+
+int wh_TransportMemRing_Init(void* c, const void* cf)
+{
+    whTransportMemContext* context = c;
+    const whTransportMemConfig* config = cf;
+    uint16_t req_slot = 0;
+    uint16_t resp_slot = 0;
+    int rc = 0;
+
+    if (    (context == NULL) ||
+            (config == NULL) ||
+            (config->slot_count == 0) ||
+            ((config->slot_count & (config->slot_count - 1)) != 0) ||
+            (config->req_size <= sizeof(whTransportMemCsr)) ||
+            (config->resp_size <= sizeof(whTransportMemCsr))) {
+        return WH_ERROR_BADARGS;
+    }
+
+    /* Slots are a multiple of the CSR size to keep each CSR aligned */
+    req_slot = ((config->req_size - sizeof(whTransportMemCsr)) /
+            config->slot_count) & ~(sizeof(whTransportMemCsr) - 1);
+    resp_slot = ((config->resp_size - sizeof(whTransportMemCsr)) /
+            config->slot_count) & ~(sizeof(whTransportMemCsr) - 1);
+    if (    (req_slot <= sizeof(whTransportMemCsr)) ||
+            (resp_slot <= sizeof(whTransportMemCsr))) {
+        return WH_ERROR_BADARGS;
+    }
+
+    rc = wh_TransportMem_Init(c, cf);
+    if (rc == 0) {
+        context->slot_count = config->slot_count;
+        context->slot_size = (req_slot < resp_slot) ? req_slot : resp_slot;
+    }
+    return rc;
+}
+
+int wh_TransportMemRing_InitClear(void* c, const void* cf)
+{
+    whTransportMemContext* context = c;
+    int rc = wh_TransportMemRing_Init(c, cf);
+    if (rc == 0) {
+        /* Zero the buffers */
+        memset((void*)context->req, 0, context->req_size);
+        memset((void*)context->resp, 0, context->resp_size);
+    }
+    return rc;
+}
+
+int wh_TransportMemRing_SendRequest(void* c, uint16_t len, const void* data)
+{
+    whTransportMemContext* context = c;
+    whTransportMemCsr req;
+    whTransportMemCsr slot;
+    volatile whTransportMemCsr* slot_csr = NULL;
+
+    if (    (context == NULL) ||
+            (context->initialized == 0) ||
+            (context->slot_count == 0) ||
+            (len > context->slot_size - sizeof(whTransportMemCsr))) {
+        return WH_ERROR_BADARGS;
+    }
+
+    /* Read current CSR.  Only the client writes the request CSR */
+    req.u64 = context->req->u64;
+
+    /* Is there a free slot for another outstanding request */
+    if ((uint16_t)(req.s.notify - req.s.ack) >= context->slot_count) {
         return WH_ERROR_NOTREADY;
     }
 
-    if ((data != NULL) && (resp.s.len != 0)) {
-        /* TODO: Cache invalidate resp_data for resp.s.len bytes */
-        memcpy(data, context->resp_data, resp.s.len);
+    slot_csr = _wh_TransportMemRing_Slot(context, context->req_data,
+            req.s.notify);
+    if ((data != NULL) && (len != 0)) {
+        memcpy((void*)(slot_csr + 1), data, len);
     }
+    slot.u64 = 0;
+    slot.s.notify = req.s.notify;
+    slot.s.len = len;
+    slot_csr->u64 = slot.u64;
+
+    /* Publish the request */
+    req.s.notify++;
+    context->req->u64 = req.u64;
+    _wh_TransportMem_Notify(context, context->req);
+
+    return 0;
+}
 
+int wh_TransportMemRing_RecvRequestInPlace(void* c, uint16_t *out_len,
+        void** out_data)
+{
+    whTransportMemContext* context = c;
+    whTransportMemCsr req;
+    whTransportMemCsr resp;
+    whTransportMemCsr slot;
+    volatile whTransportMemCsr* slot_csr = NULL;
+
+    if (    (context == NULL) ||
+            (context->initialized == 0) ||
+            (context->slot_count == 0) ||
+            (out_data == NULL)) {
+        return WH_ERROR_BADARGS;
+    }
+
+    /* Read current request CSR's */
+    req.u64 = context->req->u64;
+    resp.u64 = context->resp->u64;
+
+    /* Check to see if a new request has arrived */
+    if (req.s.notify == resp.s.notify) {
+        return WH_ERROR_NOTREADY;
+    }
+
+    /* Oldest unhandled request */
+    slot_csr = _wh_TransportMemRing_Slot(context, context->req_data,
+            resp.s.notify);
+    slot.u64 = slot_csr->u64;
+    if (    (slot.s.notify != resp.s.notify) ||
+            (slot.s.len > context->slot_size - sizeof(whTransportMemCsr))) {
+        /* Slot does not hold the expected request */
+        return WH_ERROR_ABORTED;
+    }
+
+    /* TODO: Cache invalidate the slot data for slot.s.len bytes */
+    *out_data = (void*)(slot_csr + 1);
     if (out_len != NULL) {
-        *out_len = resp.s.len;
+        *out_len = slot.s.len;
+    }
+    return 0;
+}
+
+int wh_TransportMemRing_RecvRequest(void* c, uint16_t *out_len, void* data)
+{
+    void* slot_data = NULL;
+    uint16_t len = 0;
+    int rc = wh_TransportMemRing_RecvRequestInPlace(c, &len, &slot_data);
+
+    if (rc == 0) {
+        if ((data != NULL) && (len != 0)) {
+            memcpy(data, slot_data, len);
+        }
+        if (out_len != NULL) {
+            *out_len = len;
+        }
+    }
+    return rc;
+}
+
+int wh_TransportMemRing_GetResponseBuffer(void* c, uint16_t *out_size,
+        void** out_data)
+{
+    whTransportMemContext* context = c;
+    whTransportMemCsr resp;
+
+    if (    (context == NULL) ||
+            (context->initialized == 0) ||
+            (context->slot_count == 0) ||
+            (out_size == NULL) ||
+            (out_data == NULL)) {
+        return WH_ERROR_BADARGS;
+    }
+
+    /* The response to the current request uses the same slot index, which the
+     * client has freed before sending the request */
+    resp.u64 = context->resp->u64;
+    *out_data = (void*)(_wh_TransportMemRing_Slot(context, context->resp_data,
+            resp.s.notify) + 1);
+    *out_size = context->slot_size - sizeof(whTransportMemCsr);
+    return 0;
+}
+
+int wh_TransportMemRing_SendResponseInPlace(void* c, uint16_t len)
+{
+    whTransportMemContext* context = c;
+    whTransportMemCsr req;
+    whTransportMemCsr resp;
+    whTransportMemCsr slot;
+    volatile whTransportMemCsr* slot_csr = NULL;
+
+    if (    (context == NULL) ||
+            (context->initialized == 0) ||
+            (context->slot_count == 0) ||
+            (len > context->slot_size - sizeof(whTransportMemCsr))) {
+        return WH_ERROR_BADARGS;
     }
 
+    /* Read both CSR's */
+    req.u64 = context->req->u64;
+    resp.u64 = context->resp->u64;
+
+    /* Only respond to a received request */
+    if (req.s.notify == resp.s.notify) {
+        return WH_ERROR_BADARGS;
+    }
+
+    /* TODO: Cache flush the slot data for len bytes */
+    slot_csr = _wh_TransportMemRing_Slot(context, context->resp_data,
+            resp.s.notify);
+    slot.u64 = 0;
+    slot.s.notify = resp.s.notify;
+    slot.s.len = len;
+    slot_csr->u64 = slot.u64;
+
+    /* Publish the response, which also frees the request slot */
+    resp.s.notify++;
+    context->resp->u64 = resp.u64;
+    _wh_TransportMem_Notify(context, context->resp);
+
+    return 0;
+}
+
+int wh_TransportMemRing_SendResponse(void* c, uint16_t len, const void* data)
+{
+    void* slot_data = NULL;
+    uint16_t size = 0;
+    int rc = wh_TransportMemRing_GetResponseBuffer(c, &size, &slot_data);
+
+    if (rc == 0) {
+        if (len > size) {
+            return WH_ERROR_BADARGS;
+        }
+        if ((data != NULL) && (len != 0)) {
+            memcpy(slot_data, data, len);
+        }
+        rc = wh_TransportMemRing_SendResponseInPlace(c, len);
+    }
+    return rc;
+}
+
+int wh_TransportMemRing_RecvResponse(void* c, uint16_t *out_len, void* data)
+{
+    whTransportMemContext* context = c;
+    whTransportMemCsr req;
+    whTransportMemCsr resp;
+    whTransportMemCsr slot;
+    volatile whTransportMemCsr* slot_csr = NULL;
+
+    if (    (context == NULL) ||
+            (context->initialized == 0) ||
+            (context->slot_count == 0)) {
+        return WH_ERROR_BADARGS;
+    }
+
+    /* Read both CSR's */
+    req.u64 = context->req->u64;
+    resp.u64 = context->resp->u64;
+
+    /* Check to see if any response has not been received yet */
+    if (req.s.ack == resp.s.notify) {
+        return WH_ERROR_NOTREADY;
+    }
+
+    slot_csr = _wh_TransportMemRing_Slot(context, context->resp_data,
+            req.s.ack);
+    slot.u64 = slot_csr->u64;
+    if (    (slot.s.notify != req.s.ack) ||
+            (slot.s.len > context->slot_size - sizeof(whTransportMemCsr))) {
+        /* Slot does not hold the expected response */
+        return WH_ERROR_ABORTED;
+    }
+
+    if ((data != NULL) && (slot.s.len != 0)) {
+        /* TODO: Cache invalidate the slot data for slot.s.len bytes */
+        memcpy(data, (void*)(slot_csr + 1), slot.s.len);
+    }
+    if (out_len != NULL) {
+        *out_len = slot.s.len;
+    }
+
+    /* Free the slot */
+    req.s.ack++;
+    context->req->u64 = req.u64;
+
+    return 0;
+}
+
+int wh_TransportMemRing_ClientWait(void* c, uint32_t timeout_us)
+{
+    whTransportMemContext* context = c;
+    whTransportMemCsr req;
+    whTransportMemCsr resp;
+
+    if (    (context == NULL) ||
+            (context->initialized == 0) ||
+            (context->slot_count == 0)) {
+        return WH_ERROR_BADARGS;
+    }
+
+    /* Read both CSR's */
+    req.u64 = context->req->u64;
+    resp.u64 = context->resp->u64;
+
+    /* A response is ready, which also frees a slot once received */
+    if (req.s.ack != resp.s.notify) {
+        return 0;
+    }
+    return _wh_TransportMem_Wait(context, context->resp, resp.u64, timeout_us);
+}
+
+int wh_TransportMemRing_GetQueueDepth(void* c, uint16_t* out_depth)
+{
+    whTransportMemContext* context = c;
+    whTransportMemCsr req;
+    whTransportMemCsr resp;
+
+    if (    (context == NULL) ||
+            (context->initialized == 0) ||
+            (context->slot_count == 0) ||
+            (out_depth == NULL)) {
+        return WH_ERROR_BADARGS;
+    }
+
+    /* Read both CSR's */
+    req.u64 = context->req->u64;
+    resp.u64 = context->resp->u64;
+
+    *out_depth = (uint16_t)(req.s.notify - resp.s.notify);
     return 0;
 }
@@ -0,0 +1,1228 @@
+/*
+ * test/wh_bench.c
+ *
+ * Benchmarks of wolfHSM components using the POSIX ports
+ *
+ * The latency benches print one "bench key=value ..." line per result, with
+ * p50 and p99 latency and ops per second, for scripts to compare across runs.
+ */
+
+/* For clock_gettime and usleep under -std=c99 */
+#define _XOPEN_SOURCE 600
+
+#include <stdint.h>
+#include <stddef.h> /* For offsetof */
+#include <stdio.h>  /* For printf */
+#include <stdlib.h> /* For qsort */
+#include <string.h> /* For memset, memcpy */
+#include <time.h>   /* For clock_gettime */
+#include <unistd.h> /* For usleep */
+#include <errno.h>  /* For ETIMEDOUT */
+
+#include <pthread.h> /* For pthread_create/join/_t, mutex and cond */
+
+#include "wolfhsm/wh_error.h"
+#include "wolfhsm/wh_flash.h"
+#include "wolfhsm/wh_flash_unit.h"
+#include "wolfhsm/wh_nvm.h"
+#include "wolfhsm/wh_nvm_flash.h"
+#include "wolfhsm/wh_counter.h"
+#include "wolfhsm/wh_counter_flash.h"
+#include "wolfhsm/wh_image.h"
+#include "wolfhsm/wh_comm.h"
+#include "wolfhsm/wh_message_comm.h"
+#include "wolfhsm/wh_message_crypto.h"
+#include "wolfhsm/wh_transport_mem.h"
+#include "wolfhsm/wh_server.h"
+#include "wolfhsm/wh_client.h"
+
+#include "port/posix/posix_flash_file.h"
+#include "port/posix/posix_transport_tcp.h"
+
+enum {
+    BENCH_NVM_OBJECT_COUNT = 16,
+    BENCH_NVM_OBJECT_SIZE = 256,
+    BENCH_NVM_SMALL_SIZE = 20,
+    BENCH_NVM_ROUNDS = 4,
+    BENCH_MOUNT_ROUNDS = 16,
+    BENCH_ROTATE_ROUNDS = 8,
+    BENCH_COUNTER_INCREMENTS = 64,
+    BENCH_BATCH_FRAME_LEN = 16,
+    BENCH_BATCH_COUNT = 48,                 /* Frames per batch */
+    BENCH_BATCH_ROUNDS = 2000,
+    BENCH_ECHO_LEN = 64,
+    BENCH_ECHO_ROUNDS = 100000,
+    BENCH_LAT_SAMPLES = 4096,               /* Most samples per result */
+    BENCH_LAT_ECHO_ROUNDS = 2000,
+    BENCH_LAT_WARMUP = 16,
+    BENCH_LAT_NVM_ROUNDS = 4,
+    BENCH_LAT_NVM_READS = 8,                /* Reads of each object a round */
+    BENCH_LAT_NVM_MAX_SIZE = 1024,
+    BENCH_IMAGE_SIZE = 64 * 1024,
+    BENCH_MEM_CHUNK = 64,
+    BENCH_MEM_MAX_SIZE = 1024 * 1024,
+    BENCH_MEM_BYTES = 256 * 1024 * 1024,    /* Bytes scanned per result */
+};
+
+/* Flash wrapper counting the callbacks made to the POSIX flash file */
+typedef struct {
+    uint32_t reads;
+    uint32_t programs;
+    uint32_t verifies;
+    uint32_t blankchecks;
+    uint32_t erases;
+    uint32_t bytes;         /* Total bytes read, programmed or checked */
+} benchFlashStats;
+
+static posixFlashFileContext benchFlashContext[1];
+static benchFlashStats benchStats[1];
+static const whFlashCb benchPosixCb[1] = {POSIX_FLASH_FILE_CB};
+
+static int _benchFlash_Init(void* c, const void* cf)
+{
+    return benchPosixCb->Init(c, cf);
+}
+
+static int _benchFlash_Cleanup(void* c)
+{
+    return benchPosixCb->Cleanup(c);
+}
+
+static uint32_t _benchFlash_PartitionSize(void* c)
+{
+    return benchPosixCb->PartitionSize(c);
+}
+
+static int _benchFlash_WriteLock(void* c, uint32_t offset, uint32_t size)
+{
+    return benchPosixCb->WriteLock(c, offset, size);
+}
+
+static int _benchFlash_WriteUnlock(void* c, uint32_t offset, uint32_t size)
+{
+    return benchPosixCb->WriteUnlock(c, offset, size);
+}
+
+static int _benchFlash_Read(void* c, uint32_t offset, uint32_t size,
+        uint8_t* data)
+{
+    benchStats->reads++;
+    benchStats->bytes += size;
+    return benchPosixCb->Read(c, offset, size, data);
+}
+
+static int _benchFlash_Program(void* c, uint32_t offset, uint32_t size,
+        const uint8_t* data)
+{
+    benchStats->programs++;
+    benchStats->bytes += size;
+    return benchPosixCb->Program(c, offset, size, data);
+}
+
+static int _benchFlash_Erase(void* c, uint32_t offset, uint32_t size)
+{
+    benchStats->erases++;
+    return benchPosixCb->Erase(c, offset, size);
+}
+
+static int _benchFlash_Verify(void* c, uint32_t offset, uint32_t size,
+        const uint8_t* data)
+{
+    benchStats->verifies++;
+    benchStats->bytes += size;
+    return benchPosixCb->Verify(c, offset, size, data);
+}
+
+static int _benchFlash_BlankCheck(void* c, uint32_t offset, uint32_t size)
+{
+    benchStats->blankchecks++;
+    benchStats->bytes += size;
+    return benchPosixCb->BlankCheck(c, offset, size);
+}
+
+static int _benchFlash_Sync(void* c, uint32_t offset, uint32_t size)
+{
+    return benchPosixCb->Sync(c, offset, size);
+}
+
+static const whFlashCb benchFlashCb[1] = {{
+    .Init = _benchFlash_Init,
+    .Cleanup = _benchFlash_Cleanup,
+    .PartitionSize = _benchFlash_PartitionSize,
+    .WriteLock = _benchFlash_WriteLock,
+    .WriteUnlock = _benchFlash_WriteUnlock,
+    .Read = _benchFlash_Read,
+    .Program = _benchFlash_Program,
+    .Erase = _benchFlash_Erase,
+    .Verify = _benchFlash_Verify,
+    .BlankCheck = _benchFlash_BlankCheck,
+    .Sync = _benchFlash_Sync,
+}};
+
+static posixFlashFileConfig benchFlashConfig[1] = {{
+        .filename       = "myBench.bin",
+        .partition_size = 16384,
+        .erased_byte    = (~(uint8_t)0),
+}};
+
+static uint64_t _benchNowUs(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000ull + (uint64_t)ts.tv_nsec / 1000;
+}
+
+static uint64_t _benchNowNs(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+/* Latencies of one operation, reported as one line per result of the form
+ * "bench layer=... variant=... op=... size=... count=... samples=... rc=...
+ * p50_ns=... p99_ns=... ops_per_sec=..." for scripts tracking regressions */
+typedef struct {
+    uint32_t samples;
+    uint64_t total_ns;
+    uint32_t ns[BENCH_LAT_SAMPLES];
+} benchLatency;
+
+static void _benchLatency_Add(benchLatency* lat, uint64_t start_ns)
+{
+    uint64_t ns = _benchNowNs() - start_ns;
+
+    lat->total_ns += ns;
+    if (lat->samples < BENCH_LAT_SAMPLES) {
+        lat->ns[lat->samples++] = (ns > UINT32_MAX) ? UINT32_MAX : (uint32_t)ns;
+    }
+}
+
+static int _benchLatency_Compare(const void* a, const void* b)
+{
+    uint32_t x = *(const uint32_t*)a;
+    uint32_t y = *(const uint32_t*)b;
+    return (x > y) - (x < y);
+}
+
+static void _benchLatency_Report(benchLatency* lat, const char* layer,
+        const char* variant, const char* op, uint32_t size, uint32_t count,
+        int rc)
+{
+    uint32_t p50 = 0;
+    uint32_t p99 = 0;
+    double ops = 0;
+
+    if (lat->samples > 0) {
+        qsort(lat->ns, lat->samples, sizeof(lat->ns[0]),
+                _benchLatency_Compare);
+        p50 = lat->ns[(lat->samples - 1) * 50 / 100];
+        p99 = lat->ns[(lat->samples - 1) * 99 / 100];
+    }
+    if (lat->total_ns > 0) {
+        ops = (double)lat->samples * 1e9 / (double)lat->total_ns;
+    }
+    printf("bench layer=%s variant=%s op=%s size=%u count=%u samples=%u "
+            "rc=%d p50_ns=%u p99_ns=%u ops_per_sec=%.1f\n",
+            layer, variant, op, (unsigned)size, (unsigned)count,
+            (unsigned)lat->samples, rc, (unsigned)p50, (unsigned)p99, ops);
+    memset(lat, 0, sizeof(*lat));
+}
+
+/* Add and then reclaim a set of objects using the verify policy */
+static void wh_Bench_NvmVerify(nfVerifyMode mode, const char* name)
+{
+    const whNvmCb cb[1] = {WH_NVM_FLASH_CB};
+    whNvmFlashContext context[1] = {0};
+    whNvmFlashConfig config = {
+            .cb = benchFlashCb,
+            .context = benchFlashContext,
+            .config = benchFlashConfig,
+            .verify = mode,
+    };
+    uint8_t data[BENCH_NVM_OBJECT_SIZE];
+    whNvmMetadata meta = {0};
+    uint64_t start = 0;
+    uint64_t add_us = 0;
+    uint64_t destroy_us = 0;
+    int round = 0;
+    int i = 0;
+    int rc = 0;
+
+    memset(data, 0x5A, sizeof(data));
+    if (cb->Init(context, &config) != 0) {
+        printf("Failed to initialize NVM\n");
+        return;
+    }
+    memset(benchStats, 0, sizeof(*benchStats));
+
+    for (round = 0; (round < BENCH_NVM_ROUNDS) && (rc == 0); round++) {
+        start = _benchNowUs();
+        for (i = 0; (i < BENCH_NVM_OBJECT_COUNT) && (rc == 0); i++) {
+            meta.id = 1 + i;
+            rc = cb->AddObject(context, &meta, sizeof(data), data);
+        }
+        add_us += _benchNowUs() - start;
+
+        /* Reclaim the previous round's objects */
+        start = _benchNowUs();
+        if (rc == 0) {
+            rc = cb->DestroyObjects(context, 0, NULL);
+        }
+        destroy_us += _benchNowUs() - start;
+    }
+
+    printf("NVM verify %-6s rc:%d add:%8llu us destroy:%8llu us "
+            "read:%u program:%u verify:%u blankcheck:%u erase:%u "
+            "bytes:%u\n",
+            name, rc,
+            (unsigned long long)add_us, (unsigned long long)destroy_us,
+            benchStats->reads, benchStats->programs, benchStats->verifies,
+            benchStats->blankchecks, benchStats->erases, benchStats->bytes);
+
+    for (i = 0; i < BENCH_NVM_OBJECT_COUNT; i++) {
+        whNvmId id = 1 + i;
+        cb->DestroyObjects(context, 1, &id);
+    }
+    cb->Cleanup(context);
+}
+
+/* Mount a populated NVM repeatedly using pread or mmap flash access */
+static void wh_Bench_NvmMount(int use_mmap, const char* name)
+{
+    const whNvmCb cb[1] = {WH_NVM_FLASH_CB};
+    whNvmFlashContext context[1] = {0};
+    whNvmFlashConfig config = {
+            .cb = benchFlashCb,
+            .context = benchFlashContext,
+            .config = benchFlashConfig,
+    };
+    uint8_t data[BENCH_NVM_OBJECT_SIZE];
+    whNvmMetadata meta = {0};
+    uint64_t start = 0;
+    uint64_t mount_us = 0;
+    int round = 0;
+    int i = 0;
+    int rc = 0;
+
+    benchFlashConfig->use_mmap = use_mmap;
+    memset(data, 0x5A, sizeof(data));
+    rc = cb->Init(context, &config);
+    for (i = 0; (i < BENCH_NVM_OBJECT_COUNT) && (rc == 0); i++) {
+        meta.id = 1 + i;
+        rc = cb->AddObject(context, &meta, sizeof(data), data);
+    }
+    cb->Cleanup(context);
+    memset(benchStats, 0, sizeof(*benchStats));
+
+    for (round = 0; (round < BENCH_MOUNT_ROUNDS) && (rc == 0); round++) {
+        start = _benchNowUs();
+        rc = cb->Init(context, &config);
+        mount_us += _benchNowUs() - start;
+        if (rc == 0) {
+            cb->Cleanup(context);
+        }
+    }
+
+    printf("NVM mount  %-6s rc:%d mount:%8llu us read:%u blankcheck:%u "
+            "bytes:%u\n",
+            name, rc, (unsigned long long)mount_us,
+            benchStats->reads, benchStats->blankchecks, benchStats->bytes);
+
+    if (cb->Init(context, &config) == 0) {
+        for (i = 0; i < BENCH_NVM_OBJECT_COUNT; i++) {
+            whNvmId id = 1 + i;
+            cb->DestroyObjects(context, 1, &id);
+        }
+        cb->Cleanup(context);
+    }
+    benchFlashConfig->use_mmap = 0;
+}
+
+/* Add small objects one at a time and as one batch with the write buffer set
+ * to page_size */
+static void wh_Bench_NvmWriteBuffer(uint32_t page_size)
+{
+    const whNvmCb cb[1] = {WH_NVM_FLASH_CB};
+    whNvmFlashContext context[1] = {0};
+    whNvmFlashConfig config = {
+            .cb = benchFlashCb,
+            .context = benchFlashContext,
+            .config = benchFlashConfig,
+            .verify = NF_VERIFY_COMMIT,
+            .write_page_size = page_size,
+    };
+    uint8_t data[BENCH_NVM_SMALL_SIZE];
+    whNvmMetadata metas[BENCH_NVM_OBJECT_COUNT] = {{0}};
+    whNvmSize lens[BENCH_NVM_OBJECT_COUNT];
+    const uint8_t* datas[BENCH_NVM_OBJECT_COUNT];
+    uint32_t add_programs = 0;
+    uint32_t batch_programs = 0;
+    uint64_t start = 0;
+    uint64_t add_us = 0;
+    uint64_t batch_us = 0;
+    int i = 0;
+    int rc = 0;
+
+    memset(data, 0x5A, sizeof(data));
+    for (i = 0; i < BENCH_NVM_OBJECT_COUNT; i++) {
+        metas[i].id = 1 + i;
+        lens[i] = sizeof(data);
+        datas[i] = data;
+    }
+    if (cb->Init(context, &config) != 0) {
+        printf("Failed to initialize NVM\n");
+        return;
+    }
+
+    memset(benchStats, 0, sizeof(*benchStats));
+    start = _benchNowUs();
+    for (i = 0; (i < BENCH_NVM_OBJECT_COUNT) && (rc == 0); i++) {
+        rc = cb->AddObject(context, &metas[i], sizeof(data), data);
+    }
+    add_us = _benchNowUs() - start;
+    add_programs = benchStats->programs;
+
+    memset(benchStats, 0, sizeof(*benchStats));
+    start = _benchNowUs();
+    if (rc == 0) {
+        rc = cb->AddObjects(context, BENCH_NVM_OBJECT_COUNT, metas, lens,
+                datas);
+    }
+    batch_us = _benchNowUs() - start;
+    batch_programs = benchStats->programs;
+
+    printf("NVM write page %4u rc:%d add:%6llu us programs:%3u "
+            "batch:%6llu us programs:%3u\n",
+            page_size, rc, (unsigned long long)add_us, add_programs,
+            (unsigned long long)batch_us, batch_programs);
+
+    for (i = 0; i < BENCH_NVM_OBJECT_COUNT; i++) {
+        whNvmId id = 1 + i;
+        cb->DestroyObjects(context, 1, &id);
+    }
+    cb->Cleanup(context);
+}
+
+/* Reclaim repeatedly, leaving retired partitions to Idle, and show the
+ * resulting spread of erases across the partitions */
+static void wh_Bench_NvmRotation(int partition_count)
+{
+    const whNvmCb cb[1] = {WH_NVM_FLASH_CB};
+    whNvmFlashContext context[1] = {0};
+    posixFlashFileConfig flash_config = benchFlashConfig[0];
+    whNvmFlashConfig config = {
+            .cb = benchFlashCb,
+            .context = benchFlashContext,
+            .config = &flash_config,
+            .verify = NF_VERIFY_COMMIT,
+            .partition_count = partition_count,
+    };
+    uint8_t data[BENCH_NVM_SMALL_SIZE];
+    whNvmMetadata meta = {.id = 1};
+    uint32_t reclaim_erases = 0;
+    uint32_t idle_erases = 0;
+    uint32_t min_erases = UINT32_MAX;
+    uint32_t max_erases = 0;
+    uint64_t start = 0;
+    uint64_t reclaim_us = 0;
+    uint64_t idle_us = 0;
+    int i = 0;
+    int rc = 0;
+
+    memset(data, 0x5A, sizeof(data));
+    flash_config.partition_count = partition_count;
+    if (cb->Init(context, &config) != 0) {
+        printf("Failed to initialize NVM\n");
+        return;
+    }
+    /* Start from erased partitions */
+    while (cb->Idle(context) == WH_ERROR_NOTREADY);
+    memset(context->erase_count, 0, sizeof(context->erase_count));
+
+    for (i = 0; (i < BENCH_ROTATE_ROUNDS) && (rc == 0); i++) {
+        rc = cb->AddObject(context, &meta, sizeof(data), data);
+        memset(benchStats, 0, sizeof(*benchStats));
+        start = _benchNowUs();
+        if (rc == 0) {
+            rc = cb->DestroyObjects(context, 0, NULL);
+        }
+        reclaim_us += _benchNowUs() - start;
+        reclaim_erases += benchStats->erases;
+
+        memset(benchStats, 0, sizeof(*benchStats));
+        start = _benchNowUs();
+        while ((rc == 0) && (cb->Idle(context) == WH_ERROR_NOTREADY));
+        idle_us += _benchNowUs() - start;
+        idle_erases += benchStats->erases;
+    }
+    for (i = 0; i < context->partition_count; i++) {
+        if (context->erase_count[i] < min_erases) {
+            min_erases = context->erase_count[i];
+        }
+        if (context->erase_count[i] > max_erases) {
+            max_erases = context->erase_count[i];
+        }
+    }
+
+    printf("NVM partitions %d rc:%d reclaim:%6llu us erases:%3u "
+            "idle:%6llu us erases:%3u wear:%u-%u\n",
+            partition_count, rc, (unsigned long long)reclaim_us,
+            reclaim_erases, (unsigned long long)idle_us, idle_erases,
+            min_erases, max_erases);
+
+    cb->DestroyObjects(context, 1, &meta.id);
+    cb->Cleanup(context);
+}
+
+/* Bump a counter using the counter store, then by adding an NVM object with
+ * the new value each time, reclaiming when the NVM is full */
+static void wh_Bench_Counter(void)
+{
+    const whCounterCb ccb[1] = {WH_COUNTER_FLASH_CB};
+    whCounterFlashContext counter[1] = {0};
+    whCounterFlashConfig counter_config = {
+            .cb = benchFlashCb,
+            .context = benchFlashContext,
+            .config = benchFlashConfig,
+    };
+    const whNvmCb ncb[1] = {WH_NVM_FLASH_CB};
+    whNvmFlashContext nvm[1] = {0};
+    whNvmFlashConfig nvm_config = {
+            .cb = benchFlashCb,
+            .context = benchFlashContext,
+            .config = benchFlashConfig,
+            .verify = NF_VERIFY_COMMIT,
+    };
+    whNvmMetadata meta = {.id = 1};
+    benchFlashStats counter_stats = {0};
+    uint32_t value = 0;
+    uint64_t start = 0;
+    uint64_t counter_us = 0;
+    uint64_t nvm_us = 0;
+    int i = 0;
+    int rc = 0;
+
+    /* Both use the same flash file, so start each from erased partitions */
+    if (benchPosixCb->Init(benchFlashContext, benchFlashConfig) == 0) {
+        benchPosixCb->Erase(benchFlashContext, 0,
+                2 * benchPosixCb->PartitionSize(benchFlashContext));
+        benchPosixCb->Cleanup(benchFlashContext);
+    }
+
+    rc = ccb->Init(counter, &counter_config);
+    memset(benchStats, 0, sizeof(*benchStats));
+    start = _benchNowUs();
+    for (i = 0; (i < BENCH_COUNTER_INCREMENTS) && (rc == 0); i++) {
+        rc = ccb->Increment(counter, 0, &value);
+    }
+    counter_us = _benchNowUs() - start;
+    counter_stats = *benchStats;
+    ccb->Cleanup(counter);
+    printf("Counter store  rc:%d increments:%d %8llu us program:%u erase:%u\n",
+            rc, BENCH_COUNTER_INCREMENTS, (unsigned long long)counter_us,
+            counter_stats.programs, counter_stats.erases);
+
+    if (benchPosixCb->Init(benchFlashContext, benchFlashConfig) == 0) {
+        benchPosixCb->Erase(benchFlashContext, 0,
+                2 * benchPosixCb->PartitionSize(benchFlashContext));
+        benchPosixCb->Cleanup(benchFlashContext);
+    }
+
+    rc = ncb->Init(nvm, &nvm_config);
+    memset(benchStats, 0, sizeof(*benchStats));
+    start = _benchNowUs();
+    for (i = 0; (i < BENCH_COUNTER_INCREMENTS) && (rc == 0); i++) {
+        value = i + 1;
+        rc = ncb->AddObject(nvm, &meta, sizeof(value), (uint8_t*)&value);
+        if (rc == WH_ERROR_NOSPACE) {
+            rc = ncb->DestroyObjects(nvm, 0, NULL);
+            if (rc == 0) {
+                rc = ncb->AddObject(nvm, &meta, sizeof(value),
+                        (uint8_t*)&value);
+            }
+        }
+    }
+    nvm_us = _benchNowUs() - start;
+    printf("Counter object rc:%d increments:%d %8llu us program:%u erase:%u\n",
+            rc, BENCH_COUNTER_INCREMENTS, (unsigned long long)nvm_us,
+            benchStats->programs, benchStats->erases);
+
+    ncb->DestroyObjects(nvm, 1, &meta.id);
+    ncb->Cleanup(nvm);
+}
+
+static uint8_t benchMemFlash[BENCH_MEM_MAX_SIZE];
+static uint8_t benchMemData[BENCH_MEM_MAX_SIZE];
+
+/* Blank check as the POSIX pread path did, comparing each chunk to a buffer of
+ * erased bytes */
+static int _benchMem_ChunkBlankCheck(const uint8_t* data, uint32_t size,
+        uint8_t erased_byte)
+{
+    uint8_t erased[BENCH_MEM_CHUNK];
+    uint32_t this_size = 0;
+
+    memset(erased, erased_byte, sizeof(erased));
+    while (size > 0) {
+        this_size = (size < sizeof(erased)) ? size : sizeof(erased);
+        if (memcmp(erased, data, this_size) != 0) {
+            return WH_ERROR_NOTBLANK;
+        }
+        data += this_size;
+        size -= this_size;
+    }
+    return 0;
+}
+
+/* Blank check and verify partition sized regions of erased memory */
+static void wh_Bench_FlashMem(uint32_t size)
+{
+    const uint8_t erased = (~(uint8_t)0);
+    uint32_t rounds = BENCH_MEM_BYTES / size;
+    uint64_t chunk_us = 0;
+    uint64_t blank_us = 0;
+    uint64_t verify_us = 0;
+    uint64_t start = 0;
+    uint32_t i = 0;
+    int rc = 0;
+
+    memset(benchMemFlash, erased, size);
+    memset(benchMemData, erased, size);
+
+    start = _benchNowUs();
+    for (i = 0; (i < rounds) && (rc == 0); i++) {
+        rc = _benchMem_ChunkBlankCheck(benchMemFlash, size, erased);
+    }
+    chunk_us = _benchNowUs() - start;
+
+    start = _benchNowUs();
+    for (i = 0; (i < rounds) && (rc == 0); i++) {
+        rc = wh_FlashUnit_MemBlankCheck(benchMemFlash, size, erased);
+    }
+    blank_us = _benchNowUs() - start;
+
+    start = _benchNowUs();
+    for (i = 0; (i < rounds) && (rc == 0); i++) {
+        rc = wh_FlashUnit_MemVerify(benchMemFlash, size, benchMemData);
+    }
+    verify_us = _benchNowUs() - start;
+
+    printf("Flash mem %7u bytes rc:%d chunk blankcheck:%6llu us "
+            "blankcheck:%6llu us verify:%6llu us for %u MB\n",
+            size, rc, (unsigned long long)chunk_us,
+            (unsigned long long)blank_us, (unsigned long long)verify_us,
+            BENCH_MEM_BYTES / (1024 * 1024));
+}
+
+/* Echo round trips through a ring with messages of the given endianness */
+static void wh_Bench_CommEcho(uint16_t magic, const char* name)
+{
+    static uint64_t req_ring[(sizeof(whTransportMemCsr) +
+            2 * (sizeof(whTransportMemCsr) + WOLFHSM_COMM_MTU)) / 8 + 1];
+    static uint64_t resp_ring[sizeof(req_ring) / 8];
+    whTransportMemConfig tmcf[1] = {{
+            .req = (whTransportMemCsr*)req_ring,
+            .req_size = sizeof(req_ring),
+            .resp = (whTransportMemCsr*)resp_ring,
+            .resp_size = sizeof(resp_ring),
+            .slot_count = 2,
+    }};
+    whTransportClientCb tmccb[1] = {WH_TRANSPORT_MEM_RING_CLIENT_CB};
+    whTransportMemClientContext tmcc[1] = {0};
+    whCommClientConfig cc_conf[1] = {{
+            .transport_cb = tmccb,
+            .transport_context = (void*)tmcc,
+            .transport_config = (void*)tmcf,
+            .client_id = 1,
+    }};
+    static whCommClient client[1];
+    whTransportServerCb tmscb[1] = {WH_TRANSPORT_MEM_RING_SERVER_CB};
+    whTransportMemServerContext tmsc[1] = {0};
+    whCommServerConfig cs_conf[1] = {{
+            .transport_cb = tmscb,
+            .transport_context = (void*)tmsc,
+            .transport_config = (void*)tmcf,
+            .server_id = 2,
+    }};
+    whServerConfig s_conf[1] = {{
+            .comm = cs_conf,
+    }};
+    static whServer server[1];
+    static whMessageCommLenData msg;
+    static whMessageCommLenData resp;
+    static whMessageCommLenData out;
+    uint16_t type = WOLFHSM_MESSAGE_TYPE_COMM_ECHO;
+    uint16_t resp_magic = 0;
+    uint16_t seq = 0;
+    uint16_t size = 0;
+    uint32_t trips = 0;
+    uint64_t start = 0;
+    uint64_t elapsed_us = 0;
+    int rc = 0;
+
+    rc = wh_CommClient_Init(client, cc_conf);
+    if (rc == 0) {
+        rc = wh_Server_Init(server, s_conf);
+    }
+    memset(msg.data, 0x5A, BENCH_ECHO_LEN);
+    msg.len = wh_Translate16(magic, BENCH_ECHO_LEN);
+
+    start = _benchNowUs();
+    while ((rc == 0) && (trips < BENCH_ECHO_ROUNDS)) {
+        rc = wh_CommClient_SendRequest(client, magic, type, &seq,
+                offsetof(whMessageCommLenData, data) + BENCH_ECHO_LEN, &msg);
+        if (rc == 0) {
+            rc = wh_Server_HandleRequestMessage(server);
+        }
+        if (rc == 0) {
+            rc = wh_CommClient_RecvResponse(client, &resp_magic, &type, &seq,
+                    &size, &resp);
+        }
+        if (rc == 0) {
+            if (size == 0) {
+                /* Not served in this build */
+                break;
+            }
+            rc = wh_MessageComm_TranslateLenData(resp_magic, &resp, &out);
+        }
+        if ((rc == 0) && (out.len != BENCH_ECHO_LEN)) {
+            rc = WH_ERROR_ABORTED;
+        }
+        trips++;
+    }
+    elapsed_us = _benchNowUs() - start;
+    printf("Comm echo %-6s rc:%d round trips:%6u %8llu us %5llu ns/trip\n",
+            name, rc, (unsigned)trips, (unsigned long long)elapsed_us,
+            (unsigned long long)((trips != 0) ?
+                elapsed_us * 1000 / trips : 0));
+
+    wh_Server_Cleanup(server);
+    wh_CommClient_Cleanup(client);
+}
+
+/* Crypto operation for the batch bench: a byte sum of the frame */
+static int _benchCrypto_Sum(void* context, uint16_t op,
+        uint16_t in_len, const uint8_t* in,
+        uint16_t* inout_out_len, uint8_t* out)
+{
+    uint32_t sum = 0;
+    uint16_t i = 0;
+
+    (void)context; (void)op;
+    if (*inout_out_len < sizeof(sum)) {
+        return WH_ERROR_NOSPACE;
+    }
+    for (i = 0; i < in_len; i++) {
+        sum += in[i];
+    }
+    memcpy(out, &sum, sizeof(sum));
+    *inout_out_len = sizeof(sum);
+    return 0;
+}
+
+/* Send frames through a ring with batch_count crypto items per request */
+static void wh_Bench_CryptoBatch(uint16_t batch_count)
+{
+    static uint64_t req_ring[(sizeof(whTransportMemCsr) +
+            2 * (sizeof(whTransportMemCsr) + WOLFHSM_COMM_MTU)) / 8 + 1];
+    static uint64_t resp_ring[sizeof(req_ring) / 8];
+    whTransportMemConfig tmcf[1] = {{
+            .req = (whTransportMemCsr*)req_ring,
+            .req_size = sizeof(req_ring),
+            .resp = (whTransportMemCsr*)resp_ring,
+            .resp_size = sizeof(resp_ring),
+            .slot_count = 2,
+    }};
+    whTransportClientCb tmccb[1] = {WH_TRANSPORT_MEM_RING_CLIENT_CB};
+    whTransportMemClientContext tmcc[1] = {0};
+    whCommClientConfig cc_conf[1] = {{
+            .transport_cb = tmccb,
+            .transport_context = (void*)tmcc,
+            .transport_config = (void*)tmcf,
+            .client_id = 1,
+    }};
+    static whCommClient client[1];
+    whTransportServerCb tmscb[1] = {WH_TRANSPORT_MEM_RING_SERVER_CB};
+    whTransportMemServerContext tmsc[1] = {0};
+    whCommServerConfig cs_conf[1] = {{
+            .transport_cb = tmscb,
+            .transport_context = (void*)tmsc,
+            .transport_config = (void*)tmcf,
+            .server_id = 2,
+    }};
+    whServerConfig s_conf[1] = {{
+            .comm = cs_conf,
+            .crypto_cb = _benchCrypto_Sum,
+    }};
+    static whServer server[1];
+    static whMessageCryptoBatchRequest batch;
+    static whMessageCryptoBatchResponse resp;
+    uint8_t frame[BENCH_BATCH_FRAME_LEN] = {0};
+    uint32_t frames = BENCH_BATCH_COUNT * BENCH_BATCH_ROUNDS;
+    uint32_t sent = 0;
+    uint32_t trips = 0;
+    uint16_t batch_size = 0;
+    uint16_t magic = WH_COMM_MAGIC_NATIVE;
+    uint16_t type = WOLFHSM_MESSAGE_TYPE_CRYPTO_BATCH;
+    uint16_t seq = 0;
+    uint16_t size = 0;
+    uint64_t start = 0;
+    uint64_t elapsed_us = 0;
+    uint16_t i = 0;
+    int rc = 0;
+
+    rc = wh_CommClient_Init(client, cc_conf);
+    if (rc == 0) {
+        rc = wh_Server_Init(server, s_conf);
+    }
+
+    start = _benchNowUs();
+    while ((rc == 0) && (sent < frames)) {
+        memset(&batch, 0, offsetof(whMessageCryptoBatchRequest, items));
+        batch_size = 0;
+        for (i = 0; (rc == 0) && (i < batch_count); i++) {
+            frame[0] = (uint8_t)(sent + i);
+            rc = wh_MessageCrypto_BatchAdd(&batch, &batch_size, 1,
+                    sizeof(frame), frame);
+        }
+        if (rc == 0) {
+            rc = wh_CommClient_SendRequest(client, magic, type, &seq,
+                    offsetof(whMessageCryptoBatchRequest, items) + batch_size,
+                    &batch);
+        }
+        if (rc == 0) {
+            rc = wh_Server_HandleRequestMessage(server);
+        }
+        if (rc == 0) {
+            rc = wh_CommClient_RecvResponse(client, &magic, &type, &seq,
+                    &size, &resp);
+        }
+        if ((rc == 0) && ((resp.rc != 0) || (resp.count != batch_count))) {
+            rc = WH_ERROR_ABORTED;
+        }
+        sent += batch_count;
+        trips++;
+    }
+    elapsed_us = _benchNowUs() - start;
+    printf("Crypto batch of %2u rc:%d frames:%u round trips:%6u %8llu us "
+            "%5llu ns/frame\n", batch_count, rc, (unsigned)sent,
+            (unsigned)trips, (unsigned long long)elapsed_us,
+            (unsigned long long)((sent != 0) ? elapsed_us * 1000 / sent : 0));
+
+    wh_Server_Cleanup(server);
+    wh_CommClient_Cleanup(client);
+}
+
+/* Byte sum standing in for the image CMAC */
+static int _benchImageMac_Init(void* c)
+{
+    memset(c, 0, WOLFHSM_MANIFEST_CMAC_LEN);
+    return 0;
+}
+
+static int _benchImageMac_Update(void* c, const uint8_t* data, uint32_t len)
+{
+    uint8_t* state = c;
+    uint32_t i = 0;
+    for (i = 0; i < len; i++) {
+        state[i % WOLFHSM_MANIFEST_CMAC_LEN] += data[i];
+    }
+    return 0;
+}
+
+static int _benchImageMac_Final(void* c, uint8_t* out_mac)
+{
+    memcpy(out_mac, c, WOLFHSM_MANIFEST_CMAC_LEN);
+    return 0;
+}
+
+/* Verify WOLFHSM_NUM_MANIFESTS images, then again as a warm boot that finds
+ * them recorded as verified at the same epoch */
+static void wh_Bench_Image(void)
+{
+    static uint8_t payloads[WOLFHSM_NUM_MANIFESTS][BENCH_IMAGE_SIZE];
+    static whImageContext image[1];
+    static whManifest_ex list[WOLFHSM_NUM_MANIFESTS];
+    uint8_t mac[WOLFHSM_MANIFEST_CMAC_LEN];
+    const whImageCmacCb mac_cb[1] = {{
+            .Init = _benchImageMac_Init,
+            .Update = _benchImageMac_Update,
+            .Final = _benchImageMac_Final,
+    }};
+    const whNvmCb ncb[1] = {WH_NVM_FLASH_CB};
+    whNvmFlashContext nvm[1] = {0};
+    whNvmFlashConfig nvm_config = {
+            .cb = benchFlashCb,
+            .context = benchFlashContext,
+            .config = benchFlashConfig,
+    };
+    whImageConfig config = {
+            .cmac_cb = mac_cb,
+            .cmac_context = mac,
+            .nvm_cb = ncb,
+            .nvm_context = nvm,
+            .cache_id = 1,
+    };
+    uint32_t verified = 0;
+    uint64_t start = 0;
+    uint64_t cold_us = 0;
+    uint64_t warm_us = 0;
+    uint32_t cold_chunks = 0;
+    int i = 0;
+    int rc = 0;
+
+    for (i = 0; i < WOLFHSM_NUM_MANIFESTS; i++) {
+        memset(payloads[i], i, BENCH_IMAGE_SIZE);
+        memset(&list[i], 0, sizeof(list[i]));
+        list[i].payload_start = payloads[i];
+        list[i].payload_len = BENCH_IMAGE_SIZE;
+        _benchImageMac_Init(mac);
+        _benchImageMac_Update(mac, payloads[i], BENCH_IMAGE_SIZE);
+        _benchImageMac_Final(mac, list[i].payload_cmac);
+        _benchImageMac_Init(mac);
+        _benchImageMac_Update(mac, (const uint8_t*)&list[i],
+                offsetof(whManifest_ex, manifest_cmac));
+        _benchImageMac_Final(mac, list[i].manifest_cmac);
+    }
+
+    rc = ncb->Init(nvm, &nvm_config);
+    if (rc == 0) {
+        rc = ncb->DestroyObjects(nvm, 1, &config.cache_id);
+    }
+    if (rc == 0) {
+        rc = wh_Image_Init(image, &config);
+    }
+    start = _benchNowUs();
+    if (rc == 0) {
+        rc = wh_Image_Verify(image, list, WOLFHSM_NUM_MANIFESTS, 1,
+                &verified);
+    }
+    cold_us = _benchNowUs() - start;
+    cold_chunks = image->chunks;
+
+    wh_Image_Cleanup(image);
+    if (rc == 0) {
+        rc = wh_Image_Init(image, &config);
+    }
+    start = _benchNowUs();
+    if (rc == 0) {
+        rc = wh_Image_Verify(image, list, WOLFHSM_NUM_MANIFESTS, 1,
+                &verified);
+    }
+    warm_us = _benchNowUs() - start;
+    printf("Image verify rc:%d images:%d of %u bytes cold:%6llu us "
+            "chunks:%u warm:%6llu us chunks:%u hits:%u\n", rc,
+            WOLFHSM_NUM_MANIFESTS, BENCH_IMAGE_SIZE,
+            (unsigned long long)cold_us, (unsigned)cold_chunks,
+            (unsigned long long)warm_us, (unsigned)image->chunks,
+            (unsigned)image->cache_hits);
+
+    wh_Image_Cleanup(image);
+    ncb->DestroyObjects(nvm, 1, &config.cache_id);
+    ncb->Cleanup(nvm);
+}
+
+/* Doorbell for the memory transport, so a thread waiting on its partner
+ * sleeps instead of spinning through its time slice */
+typedef struct {
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+} benchDoorbell;
+
+static int _benchDoorbell_Notify(void* c, volatile whTransportMemCsr* csr)
+{
+    benchDoorbell* db = c;
+    (void)csr;
+
+    pthread_mutex_lock(&db->mutex);
+    pthread_cond_broadcast(&db->cond);
+    pthread_mutex_unlock(&db->mutex);
+    return 0;
+}
+
+static int _benchDoorbell_Wait(void* c, volatile whTransportMemCsr* csr,
+        uint64_t expected, uint32_t timeout_us)
+{
+    benchDoorbell* db = c;
+    struct timespec ts;
+    int rc = 0;
+
+    clock_gettime(CLOCK_REALTIME, &ts);
+    ts.tv_sec += timeout_us / 1000000;
+    ts.tv_nsec += (long)(timeout_us % 1000000) * 1000;
+    if (ts.tv_nsec >= 1000000000) {
+        ts.tv_sec++;
+        ts.tv_nsec -= 1000000000;
+    }
+
+    pthread_mutex_lock(&db->mutex);
+    if (csr->u64 == expected) {
+        rc = pthread_cond_timedwait(&db->cond, &db->mutex, &ts);
+    }
+    pthread_mutex_unlock(&db->mutex);
+    return (rc == ETIMEDOUT) ? WH_ERROR_NOTREADY : 0;
+}
+
+static const whTransportMemNotifyCb benchDoorbellCb[1] = {{
+        .Notify = _benchDoorbell_Notify,
+        .Wait = _benchDoorbell_Wait,
+}};
+
+/* Server thread handling requests until stop is set.  ready is set once the
+ * server is initialized, so a client may connect */
+typedef struct {
+    whServerConfig* config;
+    volatile int ready;
+    volatile int stop;
+    int rc;
+} benchServerTask;
+
+static void* _benchServerTask(void* arg)
+{
+    benchServerTask* task = arg;
+    static whServer server[1];
+    uint32_t polls = 0;
+    int rc = wh_Server_Init(server, task->config);
+
+    task->ready = 1;
+    while (rc == 0) {
+        polls = 0;
+        do {
+            rc = wh_Server_HandleRequestMessage(server);
+        } while (   (rc == WH_ERROR_NOTREADY) &&
+                    (task->stop == 0) &&
+                    ((rc = wh_Server_Wait(server, &polls)) == 0));
+    }
+    /* A transport may fail once the client disconnects after stop */
+    task->rc = ((rc == WH_ERROR_NOTREADY) || (task->stop != 0)) ? 0 : rc;
+    wh_Server_Cleanup(server);
+    return NULL;
+}
+
+/* Echo latency of a transport with a server thread, for each payload size */
+static void wh_Bench_EchoLatency(const char* variant,
+        whCommClientConfig* cc_conf, whCommServerConfig* cs_conf)
+{
+    static const uint16_t sizes[] = {16, 256, 1024};
+    whClientConfig c_conf[1] = {{
+            .comm = cc_conf,
+    }};
+    whServerConfig s_conf[1] = {{
+            .comm = cs_conf,
+    }};
+    benchServerTask task = {
+            .config = s_conf,
+    };
+    static whClient client[1];
+    static benchLatency lat;
+    static uint8_t data[1024];
+    static uint8_t out[WOLFHSM_COMM_DATA_LEN];
+    pthread_t thread;
+    uint64_t start = 0;
+    uint16_t out_size = 0;
+    size_t n = 0;
+    int i = 0;
+    int rc = 0;
+
+    memset(data, 0x5A, sizeof(data));
+    if (pthread_create(&thread, NULL, _benchServerTask, &task) != 0) {
+        printf("Failed to start the server thread\n");
+        return;
+    }
+    while (task.ready == 0) {
+        usleep(1000);
+    }
+    rc = wh_Client_Init(client, c_conf);
+
+    for (n = 0; (rc == 0) && (n < sizeof(sizes) / sizeof(sizes[0])); n++) {
+        for (i = 0; (rc == 0) &&
+                (i < BENCH_LAT_WARMUP + BENCH_LAT_ECHO_ROUNDS); i++) {
+            start = _benchNowNs();
+            rc = wh_Client_Echo(client, sizes[n], data, &out_size, out);
+            if ((rc == 0) && (out_size != sizes[n])) {
+                rc = WH_ERROR_ABORTED;
+            }
+            if (i >= BENCH_LAT_WARMUP) {
+                _benchLatency_Add(&lat, start);
+            }
+        }
+        _benchLatency_Report(&lat, "comm", variant, "echo", sizes[n], 1, rc);
+    }
+
+    /* Disconnect first, as a socket server may be blocked reading */
+    task.stop = 1;
+    wh_Client_Cleanup(client);
+    pthread_join(thread, NULL);
+    if (task.rc != 0) {
+        printf("Echo %s server rc:%d\n", variant, task.rc);
+    }
+}
+
+static void wh_Bench_EchoLatencyMem(void)
+{
+    static benchDoorbell db[1] = {{
+            .mutex = PTHREAD_MUTEX_INITIALIZER,
+            .cond = PTHREAD_COND_INITIALIZER,
+    }};
+    static uint64_t req_buf[(sizeof(whTransportMemCsr) +
+            WOLFHSM_COMM_MTU) / 8 + 1];
+    static uint64_t resp_buf[sizeof(req_buf) / 8];
+    whTransportMemConfig tmcf[1] = {{
+            .req = (whTransportMemCsr*)req_buf,
+            .req_size = sizeof(req_buf),
+            .resp = (whTransportMemCsr*)resp_buf,
+            .resp_size = sizeof(resp_buf),
+            .notify_cb = benchDoorbellCb,
+            .notify_context = db,
+    }};
+    whTransportClientCb tmccb[1] = {WH_TRANSPORT_MEM_CLIENT_CB};
+    whTransportMemClientContext tmcc[1] = {0};
+    whCommClientConfig cc_conf[1] = {{
+            .transport_cb = tmccb,
+            .transport_context = (void*)tmcc,
+            .transport_config = (void*)tmcf,
+            .client_id = 1,
+    }};
+    whTransportServerCb tmscb[1] = {WH_TRANSPORT_MEM_SERVER_CB};
+    whTransportMemServerContext tmsc[1] = {0};
+    whCommServerConfig cs_conf[1] = {{
+            .transport_cb = tmscb,
+            .transport_context = (void*)tmsc,
+            .transport_config = (void*)tmcf,
+            .server_id = 2,
+    }};
+
+    wh_Bench_EchoLatency("mem", cc_conf, cs_conf);
+}
+
+static void wh_Bench_EchoLatencyTcp(void)
+{
+    posixTransportTcpConfig tcf[1] = {{
+            .server_ip_string = "127.0.0.1",
+            .server_port = 23460,
+            .nodelay = 1,
+    }};
+    whTransportClientCb pttccb[1] = {PTT_CLIENT_CB};
+    static posixTransportTcpClientContext tcc[1];
+    whCommClientConfig cc_conf[1] = {{
+            .transport_cb = pttccb,
+            .transport_context = (void*)tcc,
+            .transport_config = (void*)tcf,
+            .client_id = 1,
+    }};
+    whTransportServerCb pttscb[1] = {PTT_SERVER_CB};
+    static posixTransportTcpServerContext tsc[1];
+    whCommServerConfig cs_conf[1] = {{
+            .transport_cb = pttscb,
+            .transport_context = (void*)tsc,
+            .transport_config = (void*)tcf,
+            .server_id = 2,
+    }};
+
+    wh_Bench_EchoLatency("tcp", cc_conf, cs_conf);
+}
+
+/* AddObject, Read and DestroyObjects latency for count objects of size bytes
+ * on the POSIX flash file, using pread or mmap accesses */
+static void wh_Bench_NvmLatency(int use_mmap, uint32_t size, int count)
+{
+    const char* variant = use_mmap ? "posix_flash_file_mmap" :
+            "posix_flash_file";
+    static posixFlashFileContext flash[1];
+    posixFlashFileConfig flash_config = {
+            .filename       = "myBenchLatency.bin",
+            .partition_size = 64 * 1024,
+            .erased_byte    = (~(uint8_t)0),
+            .use_mmap       = use_mmap,
+    };
+    const whNvmCb cb[1] = {WH_NVM_FLASH_CB};
+    static whNvmFlashContext context[1];
+    whNvmFlashConfig config = {
+            .cb = benchPosixCb,
+            .context = flash,
+            .config = &flash_config,
+    };
+    static benchLatency add;
+    static benchLatency read;
+    static benchLatency destroy;
+    static uint8_t data[BENCH_LAT_NVM_MAX_SIZE];
+    whNvmMetadata meta = {0};
+    whNvmId id = 0;
+    uint64_t start = 0;
+    int round = 0;
+    int i = 0;
+    int j = 0;
+    int rc = 0;
+
+    memset(data, 0x5A, sizeof(data));
+    if (cb->Init(context, &config) != 0) {
+        printf("Failed to initialize NVM\n");
+        return;
+    }
+
+    for (round = 0; (round < BENCH_LAT_NVM_ROUNDS) && (rc == 0); round++) {
+        for (i = 0; (i < count) && (rc == 0); i++) {
+            meta.id = 1 + i;
+            meta.len = size;
+            start = _benchNowNs();
+            rc = cb->AddObject(context, &meta, size, data);
+            _benchLatency_Add(&add, start);
+        }
+        for (j = 0; (j < BENCH_LAT_NVM_READS) && (rc == 0); j++) {
+            for (i = 0; (i < count) && (rc == 0); i++) {
+                start = _benchNowNs();
+                rc = cb->Read(context, 1 + i, 0, size, data);
+                _benchLatency_Add(&read, start);
+            }
+        }
+        for (i = 0; (i < count) && (rc == 0); i++) {
+            id = 1 + i;
+            start = _benchNowNs();
+            rc = cb->DestroyObjects(context, 1, &id);
+            _benchLatency_Add(&destroy, start);
+        }
+    }
+
+    _benchLatency_Report(&add, "nvm", variant, "add", size, count, rc);
+    _benchLatency_Report(&read, "nvm", variant, "read", size, count, rc);
+    _benchLatency_Report(&destroy, "nvm", variant, "destroy", size, count,
+            rc);
+    cb->Cleanup(context);
+}
+
+int main(int argc, char** argv)
+{
+    (void)argc; (void)argv;
+
+    wh_Bench_NvmVerify(NF_VERIFY_ALWAYS, "always");
+    wh_Bench_NvmVerify(NF_VERIFY_COMMIT, "commit");
+    wh_Bench_NvmVerify(NF_VERIFY_NONE, "none");
+    wh_Bench_NvmMount(0, "pread");
+    wh_Bench_NvmMount(1, "mmap");
+    wh_Bench_NvmWriteBuffer(0);
+    wh_Bench_NvmWriteBuffer(256);
+    wh_Bench_NvmRotation(2);
+#if NF_PARTITION_COUNT >= 4
+    wh_Bench_NvmRotation(4);
+#endif
+    wh_Bench_Counter();
+    wh_Bench_Image();
+    wh_Bench_CommEcho(WH_COMM_MAGIC_NATIVE, "native");
+    wh_Bench_CommEcho(WH_COMM_MAGIC_SWAP, "swap");
+    wh_Bench_CryptoBatch(1);
+    wh_Bench_CryptoBatch(BENCH_BATCH_COUNT);
+    wh_Bench_FlashMem(16384);
+    wh_Bench_FlashMem(BENCH_MEM_MAX_SIZE);
+    wh_Bench_EchoLatencyMem();
+    wh_Bench_EchoLatencyTcp();
+    /* Each O_SYNC compaction is slow, so pread mode gets a single point */
+    wh_Bench_NvmLatency(0, 32, 4);
+    wh_Bench_NvmLatency(1, 32, 4);
+    wh_Bench_NvmLatency(1, 32, 16);
+    wh_Bench_NvmLatency(1, 256, 4);
+    wh_Bench_NvmLatency(1, 256, 16);
+    wh_Bench_NvmLatency(1, BENCH_LAT_NVM_MAX_SIZE, 4);
+    wh_Bench_NvmLatency(1, BENCH_LAT_NVM_MAX_SIZE, 16);
+    return 0;
+}
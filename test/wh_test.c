@@ -3,12 +3,18 @@
  *
  */
 
+/* For clock_gettime and usleep under -std=c99 */
+#define _XOPEN_SOURCE 600
+
 #include <stdint.h>
 #include <stdio.h>  /* For printf */
 #include <string.h> /* For memset, memcpy */
 #include <unistd.h> /* For sleep */
 
 #include <pthread.h> /* For pthread_create/cancel/join/_t */
+#include <time.h>   /* For clock_gettime */
+#include <errno.h>  /* For ETIMEDOUT */
+#include <fcntl.h>  /* For fcntl */
 
 #if 0
 #ifndef WOLFSSL_USER_SETTINGS
@@ -22,16 +28,26 @@
 
 #include "wolfhsm/wh_nvm.h"
 #include "wolfhsm/wh_nvm_flash.h"
+#include "wolfhsm/wh_counter.h"
+#include "wolfhsm/wh_counter_flash.h"
+#include "wolfhsm/wh_image.h"
 #include "wolfhsm/wh_comm.h"
 #include "wolfhsm/wh_message.h"
-
+#include "wolfhsm/wh_message_comm.h"
+#include "wolfhsm/wh_message_crypto.h"
+#include "wolfhsm/wh_message_key.h"
+#include "wolfhsm/wh_message_nvm.h"
 
 #include "wolfhsm/wh_transport_mem.h"
 
 #include "port/posix/posix_transport_tcp.h"
+#include "port/posix/posix_transport_unix.h"
+#include "port/posix/posix_transport_shm.h"
 #include "port/posix/posix_flash_file.h"
 
 #include "wolfhsm/wh_server.h"
+#include "wolfhsm/wh_server_keycache.h"
+#include "wolfhsm/wh_stats.h"
 #include "wolfhsm/wh_client.h"
 
 
@@ -140,35 +156,98 @@ static void _ShowList(const whNvmCb* cb, void* context)
 
             if (rc == 0) {
 
-                uint8_t data[WOLFHSM_NVM_MAX_OBJECT_SIZE];
+                uint8_t data[256];
+                whNvmSize offset = 0;
+                whNvmSize this_len = 0;
                 memset(&data, 0, sizeof(data));
 
                 printf("-Id:%04hX\n-Label:%.*s\n"
-                        "-Access:%04hX\n-Flags:%04hX\n-Len:%d\n",
+                        "-Access:%04hX\n-Flags:%04hX\n-Len:%u\n",
                         myMetadata.id,
                         (int)sizeof(myMetadata.label),
                         myMetadata.label,
                         myMetadata.access,
                         myMetadata.flags,
-                        myMetadata.len);
-
-                /* Read the data from this object */
-                rc = cb->Read(
-                        context,
-                        id,
-                        0,
-                        myMetadata.len,
-                        data);
-
-                if (rc == 0) {
-                    /* Show the data from this object */
-                    _HexDump((const char*)data, (int)(myMetadata.len));
+                        (unsigned int)myMetadata.len);
+
+                /* Read the data from this object a buffer at a time */
+                while ((rc == 0) && (offset < myMetadata.len)) {
+                    this_len = myMetadata.len - offset;
+                    if (this_len > sizeof(data)) {
+                        this_len = sizeof(data);
+                    }
+                    rc = cb->Read(
+                            context,
+                            id,
+                            offset,
+                            this_len,
+                            data);
+
+                    if (rc == 0) {
+                        /* Show the data from this object */
+                        _HexDump((const char*)data, this_len);
+                    }
+                    offset += this_len;
                 }
             }
         } else break;
     } while (listCount > 0);
 }
 
+/* Check the flash memory kernels at every alignment and mismatch position */
+void wh_FlashUnit_MemTest(void)
+{
+    enum { MEM_TEST_SIZE = 256, MEM_TEST_ALIGN = 16 };
+    const uint8_t erased = (~(uint8_t)0);
+    uint8_t flash[MEM_TEST_SIZE + MEM_TEST_ALIGN];
+    uint8_t data[MEM_TEST_SIZE + MEM_TEST_ALIGN];
+    uint32_t align = 0;
+    uint32_t size = 0;
+    uint32_t pos = 0;
+    int failures = 0;
+    int checks = 0;
+
+    for (align = 0; align < MEM_TEST_ALIGN; align++) {
+        for (size = 0; size + align <= MEM_TEST_SIZE; size += 13) {
+            memset(flash, erased, sizeof(flash));
+            for (pos = 0; pos < sizeof(data); pos++) {
+                data[pos] = (uint8_t)(pos * 7);
+            }
+            checks++;
+            if (wh_FlashUnit_MemBlankCheck(flash + align, size, erased) != 0) {
+                failures++;
+            }
+            memcpy(flash + align, data + align, size);
+            checks++;
+            if (wh_FlashUnit_MemVerify(flash + align, size,
+                    data + align) != 0) {
+                failures++;
+            }
+
+            for (pos = 0; pos < size; pos++) {
+                /* A single differing byte must be found */
+                data[align + pos] ^= 0x10;
+                checks++;
+                if (wh_FlashUnit_MemVerify(flash + align, size,
+                        data + align) != WH_ERROR_NOTVERIFIED) {
+                    failures++;
+                }
+                data[align + pos] ^= 0x10;
+
+                memset(flash, erased, sizeof(flash));
+                flash[align + pos] = 0;
+                checks++;
+                if (wh_FlashUnit_MemBlankCheck(flash + align, size,
+                        erased) != WH_ERROR_NOTBLANK) {
+                    failures++;
+                }
+                memcpy(flash + align, data + align, size);
+            }
+        }
+    }
+    printf("--Flash memory kernels checks:%d failures:%d\n", checks, failures);
+}
+
 void wh_Nvm_UnitTest(void)
 {
     int rc = 0;
@@ -245,455 +324,3492 @@ void wh_Nvm_UnitTest(void)
     }
 }
 
-/* Transport memory configuration */
-static uint8_t req[BUFFER_SIZE];
-static uint8_t resp[BUFFER_SIZE];
-whTransportMemConfig tmcf[1] = {{
-        .req = (whTransportMemCsr*)req,
-        .req_size = sizeof(req),
-        .resp = (whTransportMemCsr*)resp,
-        .resp_size = sizeof(resp),
-}};
+void wh_Nvm_BulkMountTest(void)
+{
+    int rc = 0;
+    const whNvmCb cb[1] = {WH_NVM_FLASH_CB};
+    whNvmFlashContext context[1] = {0};
+    whNvmFlashContext bulk_context[1] = {0};
+    posixFlashFileContext bulk_flash[1] = {0};
+    whNvmFlashConfig bulk_config = myNvmConfig;
+
+    bulk_config.context = bulk_flash;
+    bulk_config.bulk_mount = 1;
+    bulk_config.erased_byte = myHalFlashConfig->erased_byte;
+
+    unsigned char data1[] = "BulkData1";
+    unsigned char data2[] = "BulkData2";
+    whNvmMetadata meta1 = {.id = 10, .label = "Bulk1"};
+    whNvmMetadata meta2 = {.id = 20, .label = "Bulk2"};
+
+    rc = cb->Init(context, &myNvmConfig);
+    if (rc != 0) {
+        printf("Failed to initialize NVM\n");
+        return;
+    }
+    cb->AddObject(context, &meta1, sizeof(data1), data1);
+    cb->AddObject(context, &meta2, sizeof(data2), data2);
+    cb->AddObject(context, &meta1, sizeof(data2), data2);
+    cb->Cleanup(context);
 
-void wh_CommClientServer_Test(void)
+    /* Mount the same flash using BlankCheck and using bulk reads */
+    memset(context, 0, sizeof(*context));
+    rc = cb->Init(context, &myNvmConfig);
+    if (rc == 0) {
+        rc = cb->Init(bulk_context, &bulk_config);
+    }
+    printf("--Bulk mount init:%d, directories match:%d\n", rc,
+            memcmp( &context->directory,
+                    &bulk_context->directory,
+                    sizeof(context->directory)) == 0);
+    _ShowAvailable(cb, bulk_context);
+
+    whNvmId ids[] = {meta1.id, meta2.id};
+    cb->DestroyObjects(context, sizeof(ids)/sizeof(ids[0]), ids);
+    cb->Cleanup(bulk_context);
+    cb->Cleanup(context);
+}
+
+/* Share the same flash file between pread and mmap access */
+void wh_Nvm_MmapTest(void)
 {
-    /* Client configuration/contexts */
-    whTransportClientCb tccb[1] = {WH_TRANSPORT_MEM_CLIENT_CB};
-    whTransportMemClientContext tmcc[1] = {0};
-    whCommClientConfig c_conf[1] = {{
-            .transport_cb = tccb,
-            .transport_context = (void*)tmcc,
-            .transport_config = (void*)tmcf,
-            .client_id = 1234,
-    }};
-    whCommClient client[1] = {0};
+    int rc = 0;
+    const whNvmCb cb[1] = {WH_NVM_FLASH_CB};
+    whNvmFlashContext context[1] = {0};
+    whNvmFlashContext mmap_context[1] = {0};
+    posixFlashFileContext mmap_flash[1] = {0};
+    posixFlashFileConfig mmap_flash_config = myHalFlashConfig[0];
+    whNvmFlashConfig mmap_config = myNvmConfig;
+
+    unsigned char data1[] = "MmapData1";
+    unsigned char data2[] = "MmapData2";
+    unsigned char buffer[sizeof(data2)] = {0};
+    whNvmMetadata meta1 = {.id = 50, .label = "Mmap1"};
+    whNvmMetadata meta2 = {.id = 60, .label = "Mmap2"};
+    whNvmId ids[] = {meta1.id, meta2.id};
+
+    mmap_flash_config.use_mmap = 1;
+    mmap_config.context = mmap_flash;
+    mmap_config.config = &mmap_flash_config;
+
+    rc = cb->Init(context, &myNvmConfig);
+    if (rc != 0) {
+        printf("Failed to initialize NVM\n");
+        return;
+    }
+    cb->AddObject(context, &meta1, sizeof(data1), data1);
+    cb->Cleanup(context);
 
-    /* Server configuration/contexts */
-    whTransportServerCb tscb[1] = {WH_TRANSPORT_MEM_SERVER_CB};
-    whTransportMemServerContext tmsc[1] = {0};
-    whCommServerConfig s_conf[1] = {{
-            .transport_cb = tscb,
-            .transport_context = (void*)tmsc,
-            .transport_config = (void*)tmcf,
-            .server_id = 5678,
-    }};
-    whCommServer server[1] = {0};
+    /* Mount the same flash using pread and using mmap */
+    memset(context, 0, sizeof(*context));
+    rc = cb->Init(context, &myNvmConfig);
+    if (rc == 0) {
+        rc = cb->Init(mmap_context, &mmap_config);
+    }
+    printf("--Mmap mount init:%d, directories match:%d\n", rc,
+            memcmp( &context->directory,
+                    &mmap_context->directory,
+                    sizeof(context->directory)) == 0);
+    cb->Cleanup(context);
+
+    /* Modify through the mapping, then read back using pread */
+    rc = cb->AddObject(mmap_context, &meta2, sizeof(data2), data2);
+    if (rc == 0) {
+        rc = cb->DestroyObjects(mmap_context, 0, NULL);
+    }
+    printf("--Mmap add and reclaim:%d\n", rc);
+    cb->Cleanup(mmap_context);
 
-    int ret = 0;
-    ret = wh_CommClient_Init(client, c_conf);
-    printf("CommClientInit:%d\n", ret);
+    memset(context, 0, sizeof(*context));
+    rc = cb->Init(context, &myNvmConfig);
+    if (rc == 0) {
+        rc = cb->Read(context, meta2.id, 0, sizeof(buffer), buffer);
+    }
+    printf("--Mmap read back:%d, data match:%d\n", rc,
+            memcmp(buffer, data2, sizeof(data2)) == 0);
+    _ShowAvailable(cb, context);
 
-    ret = wh_CommServer_Init(server, s_conf);
-    printf("CommServerInit:%d\n", ret);
+    cb->DestroyObjects(context, sizeof(ids)/sizeof(ids[0]), ids);
+    cb->Cleanup(context);
+}
 
-    int counter = 1;
+void wh_Nvm_IncrementalDestroyTest(void)
+{
+    int rc = 0;
+    const whNvmCb cb[1] = {WH_NVM_FLASH_CB};
+    whNvmFlashContext context[1] = {0};
+
+    uint8_t big[2048];
+    unsigned char keep[] = "KeepData";
+    uint8_t out[sizeof(keep)] = {0};
+    whNvmMetadata meta_big = {.id = 50, .label = "Big"};
+    whNvmMetadata meta_keep = {.id = 60, .label = "Keep"};
+    whNvmMetadata meta_add = {.id = 70, .label = "Add"};
+    whNvmId ids[] = {meta_big.id};
+    int steps = 0;
+    int read_ok = 1;
+    int add_blocked = 1;
+
+    memset(big, 0xA5, sizeof(big));
+
+    rc = cb->Init(context, &myNvmConfig);
+    if (rc != 0) {
+        printf("Failed to initialize NVM\n");
+        return;
+    }
+    cb->AddObject(context, &meta_big, sizeof(big), big);
+    cb->AddObject(context, &meta_keep, sizeof(keep), keep);
+    cb->AddObject(context, &meta_big, sizeof(big), big);
+
+    /* Reclaim the old copy of big in small steps */
+    rc = cb->DestroyObjectsBegin(context, 0, NULL);
+    while (rc == 0) {
+        rc = cb->DestroyObjectsStep(context, 64);
+        if (rc != WH_ERROR_NOTREADY) break;
+        steps++;
+        if (    (cb->Read(context, meta_keep.id, 0, sizeof(out), out) != 0) ||
+                (memcmp(out, keep, sizeof(keep)) != 0)) {
+            read_ok = 0;
+        }
+        if (cb->AddObject(context, &meta_add, sizeof(keep), keep) !=
+                WH_ERROR_NOTREADY) {
+            add_blocked = 0;
+        }
+        rc = 0;
+    }
+    printf("--Incremental reclaim rc:%d steps:%d reads ok:%d adds blocked:%d\n",
+            rc, steps, read_ok, add_blocked);
+    _ShowAvailable(cb, context);
 
-    uint8_t  tx_req[REQ_SIZE] = {0};
-    uint16_t tx_req_len = 0;
-    uint16_t tx_req_flags = WH_COMM_MAGIC_NATIVE;
-    uint16_t tx_req_type = 0;
-    uint16_t tx_req_seq = 0;
+    /* Destroy using the blocking wrapper */
+    rc = cb->DestroyObjectsBegin(context, sizeof(ids)/sizeof(ids[0]), ids);
+    if (rc == 0) {
+        rc = cb->DestroyObjectsFinish(context);
+    }
+    printf("--Incremental destroy rc:%d, big found:%d\n", rc,
+            cb->GetMetadata(context, meta_big.id, &meta_add) == 0);
 
-    uint8_t  rx_req[REQ_SIZE] = {0};
-    uint16_t rx_req_len = 0;
-    uint16_t rx_req_flags = 0;
-    uint16_t rx_req_type = 0;
-    uint16_t rx_req_seq = 0;
+    ids[0] = meta_keep.id;
+    cb->DestroyObjects(context, sizeof(ids)/sizeof(ids[0]), ids);
+    cb->Cleanup(context);
+}
 
-    uint8_t  tx_resp[REQ_SIZE] = {0};
-    uint16_t tx_resp_len = 0;
+/* Replicate with and without the flash Copy callback, so the buffered copy
+ * runs, and check both leave the same objects */
+void wh_Nvm_CopyFallbackTest(void)
+{
+    enum { COPY_OBJECTS = 3, COPY_MAX = 700 };
+    int rc = 0;
+    int i = 0;
+    int j = 0;
+    int match = 1;
+    const whNvmCb cb[1] = {WH_NVM_FLASH_CB};
+    whNvmFlashContext context[1] = {0};
+    whFlashCb nocopy_cb[1] = {POSIX_FLASH_FILE_CB};
+    const whFlashCb* flash_cbs[2] = {myCb, nocopy_cb};
+    const char* filenames[2] = {"myCopy.bin", "myNoCopy.bin"};
+    posixFlashFileContext copy_flash[1] = {0};
+    posixFlashFileConfig copy_flash_config = myHalFlashConfig[0];
+    whNvmFlashConfig copy_config = myNvmConfig;
+
+    static uint8_t data[COPY_OBJECTS][COPY_MAX];
+    static uint8_t out[2][COPY_OBJECTS][COPY_MAX];
+    /* Larger than the copy buffer, shorter than a unit, and unaligned */
+    const whNvmSize sizes[COPY_OBJECTS] = {COPY_MAX, 13, 301};
+    whNvmMetadata meta[COPY_OBJECTS] = {
+            {.id = 90, .label = "CopyLarge"},
+            {.id = 91, .label = "CopyGone"},
+            {.id = 92, .label = "CopyOdd"},
+    };
+    whNvmId destroy[] = {meta[1].id};
+    whNvmId ids[] = {meta[0].id, meta[2].id};
+    whNvmSize free_space[2] = {0};
+
+    nocopy_cb->Copy = NULL;
+    for (i = 0; i < COPY_OBJECTS; i++) {
+        for (j = 0; j < COPY_MAX; j++) {
+            data[i][j] = (uint8_t)(i * 37 + j);
+        }
+    }
 
-    uint8_t  rx_resp[REQ_SIZE] = {0};
-    uint16_t rx_resp_len = 0;
-    uint16_t rx_resp_flags = 0;
-    uint16_t rx_resp_type = 0;
-    uint16_t rx_resp_seq = 0;
+    for (j = 0; j < 2; j++) {
+        copy_flash_config.filename = filenames[j];
+        copy_config.cb = flash_cbs[j];
+        copy_config.context = copy_flash;
+        copy_config.config = &copy_flash_config;
+        memset(copy_flash, 0, sizeof(copy_flash));
+        memset(context, 0, sizeof(context));
+
+        rc = cb->Init(context, &copy_config);
+        if (rc != 0) {
+            printf("Failed to initialize NVM\n");
+            return;
+        }
+        for (i = 0; i < COPY_OBJECTS; i++) {
+            cb->AddObject(context, &meta[i], sizes[i], data[i]);
+        }
+        /* Replicates the objects kept */
+        rc = cb->DestroyObjects(context, sizeof(destroy)/sizeof(destroy[0]),
+                destroy);
+        for (i = 0; (rc == 0) && (i < COPY_OBJECTS); i++) {
+            if (i == 1) continue;
+            rc = cb->Read(context, meta[i].id, 0, sizes[i], out[j][i]);
+            if (memcmp(out[j][i], data[i], sizes[i]) != 0) {
+                match = 0;
+            }
+        }
+        (void)cb->GetAvailable(context, &free_space[j], NULL, NULL, NULL);
+        printf("--CopyFallback %s rc:%d free:%u\n",
+                (copy_config.cb->Copy != NULL) ? "copy" : "buffered", rc,
+                (unsigned)free_space[j]);
 
-    /* Check that neither side is ready to recv */
-    ret = wh_CommServer_RecvRequest(server,
-            &rx_req_flags, &rx_req_type, &rx_req_seq,
-            &rx_req_len, rx_req);
-    printf("Server initial RecvRequest:%d\n", ret);
+        cb->DestroyObjects(context, sizeof(ids)/sizeof(ids[0]), ids);
+        cb->Cleanup(context);
+    }
+    printf("--CopyFallback match:%d\n", match &&
+            (memcmp(out[0], out[1], sizeof(out[0])) == 0) &&
+            (free_space[0] == free_space[1]));
+}
 
-    for(counter = 0; counter < REPEAT_COUNT; counter++)
-    {
-        sprintf((char*)tx_req,"Request:%u",counter);
-        tx_req_len = strlen((char*)tx_req);
-        tx_req_type = counter*2;
-        ret = wh_CommClient_SendRequest(client,
-                tx_req_flags, tx_req_type, &tx_req_seq,
-                tx_req_len, tx_req);
-        printf("Client SendRequest:%d, flags %x, type:%x, seq:%d, len:%d, %s\n",
-                ret, tx_req_flags, tx_req_type, tx_req_seq, tx_req_len, tx_req);
+void wh_Nvm_AddObjectsTest(void)
+{
+    int rc = 0;
+    const whNvmCb cb[1] = {WH_NVM_FLASH_CB};
+    whNvmFlashContext context[1] = {0};
+
+    unsigned char data1[] = "BatchData1";
+    unsigned char data2[] = "BatchData2fdsafdsafdsa";
+    unsigned char data3[] = "BatchData3";
+    uint8_t out[sizeof(data2)] = {0};
+    whNvmMetadata metas[] = {
+            {.id = 80, .label = "Batch1"},
+            {.id = 81, .label = "Batch2"},
+            {.id = 80, .label = "Batch3"},
+    };
+    const whNvmSize lens[] = {sizeof(data1), sizeof(data2), sizeof(data3)};
+    const uint8_t* datas[] = {data1, data2, data3};
+    whNvmId count = sizeof(metas) / sizeof(metas[0]);
+    whNvmSize avail_size = 0;
+    whNvmId avail_count = 0;
+    whNvmSize new_size = 0;
+    whNvmId new_count = 0;
+
+    rc = cb->Init(context, &myNvmConfig);
+    if (rc != 0) {
+        printf("Failed to initialize NVM\n");
+        return;
+    }
 
-        if (counter == 0) {
-            ret = wh_CommClient_RecvResponse(client,
-                    &rx_resp_flags, &rx_resp_type, &rx_resp_seq,
-                    &rx_resp_len, rx_resp);
-            printf("Client initial RecvResponse:%d\n", ret);
-            ret = wh_CommClient_SendRequest(client,
-                    tx_req_flags, tx_req_type, &tx_req_seq,
-                    tx_req_len, tx_req);
-            printf("Client duplicate SendRequest:%d\n",ret);
-        }
+    /* Batch including a duplicate id.  The last one wins */
+    rc = cb->AddObjects(context, count, metas, lens, datas);
+    printf("--Add batch of %d rc:%d\n", count, rc);
+    _ShowAvailable(cb, context);
+    rc = cb->Read(context, metas[2].id, 0, sizeof(data3), out);
+    printf("--Batch read rc:%d match:%d\n", rc,
+            memcmp(out, data3, sizeof(data3)) == 0);
+
+    /* A batch larger than the directory must not change the NVM */
+    whNvmMetadata big_metas[NF_OBJECT_COUNT + 1];
+    whNvmSize big_lens[NF_OBJECT_COUNT + 1];
+    const uint8_t* big_datas[NF_OBJECT_COUNT + 1];
+    int i = 0;
+    for (i = 0; i < NF_OBJECT_COUNT + 1; i++) {
+        memset(&big_metas[i], 0, sizeof(big_metas[i]));
+        big_metas[i].id = 100 + i;
+        big_lens[i] = sizeof(data1);
+        big_datas[i] = data1;
+    }
+    cb->GetAvailable(context, &avail_size, &avail_count, NULL, NULL);
+    rc = cb->AddObjects(context, avail_count + 1, big_metas, big_lens,
+            big_datas);
+    cb->GetAvailable(context, &new_size, &new_count, NULL, NULL);
+    printf("--Oversize batch rc:%d unchanged:%d\n", rc,
+            (new_size == avail_size) && (new_count == avail_count));
+
+    whNvmId ids[] = {metas[0].id, metas[1].id};
+    cb->DestroyObjects(context, sizeof(ids)/sizeof(ids[0]), ids);
+    cb->Cleanup(context);
+}
 
-        ret = wh_CommServer_RecvRequest(server,
-                &rx_req_flags, &rx_req_type, &rx_req_seq,
-                &rx_req_len, rx_req);
-        printf("Server RecvRequest:%d, flags %x, type:%x, seq:%d, len:%d, %s\n",
-                        ret, rx_req_flags, rx_req_type, rx_req_seq, rx_req_len, rx_req);
+/* Stream objects larger than 16 bits in the large object mode */
+#ifdef WOLFHSM_NVM_LARGE_OBJECTS
+#define STREAM_PARTITION_SIZE (128 * 1024)
+#define STREAM_OBJECT_SIZE (70000)
+#else
+#define STREAM_PARTITION_SIZE (16384)
+#define STREAM_OBJECT_SIZE (3000)
+#endif
 
-        sprintf((char*)tx_resp,"Response:%s",rx_req);
-        tx_resp_len = strlen((char*)tx_resp);
-        ret = wh_CommServer_SendResponse(server,
-                rx_req_flags, rx_req_type, rx_req_seq,
-                tx_resp_len, tx_resp);
-        printf("Server SendResponse:%d, flags %x, type:%x, seq:%d, len:%d, %s\n",
-                        ret, rx_req_flags, rx_req_type, rx_req_seq, tx_resp_len, tx_resp);
+/* Add objects a piece at a time, abort one, and recover one left open */
+void wh_Nvm_StreamTest(void)
+{
+    int rc = 0;
+    const whNvmCb cb[1] = {WH_NVM_FLASH_CB};
+    whNvmFlashContext context[1] = {0};
+    posixFlashFileContext flash[1] = {0};
+    posixFlashFileConfig flash_config = *myHalFlashConfig;
+    whNvmFlashConfig config = myNvmConfig;
+
+    static uint8_t pattern[STREAM_OBJECT_SIZE];
+    static const whNvmSize pieces[] = {7, 13, 1024, 1, 300, 8};
+    uint8_t out[100];
+    whNvmMetadata meta = {.id = 95, .label = "Stream"};
+    whNvmMetadata meta_abort = {.id = 96, .label = "Aborted"};
+    whNvmMetadata meta_open = {.id = 97, .label = "Open"};
+    whNvmMetadata out_meta = {0};
+    whNvmSize offset = 0;
+    whNvmSize this_len = 0;
+    whNvmSize avail_size = 0;
+    whNvmId reclaim_count = 0;
+    uint32_t i = 0;
+    int add_blocked = 0;
+    int read_ok = 1;
+
+    for (i = 0; i < sizeof(pattern); i++) {
+        pattern[i] = (uint8_t)(i * 7 + (i >> 8));
+    }
+    flash_config.filename = "myStream.bin";
+    flash_config.partition_size = STREAM_PARTITION_SIZE;
+    config.context = flash;
+    config.config = &flash_config;
 
-        ret = wh_CommClient_RecvResponse(client,
-                &rx_resp_flags, &rx_resp_type, &rx_resp_seq,
-                &rx_resp_len, rx_resp);
-        printf("Client RecvResponse:%d, flags %x, type:%x, seq:%d, len:%d, %s\n",
-                        ret, rx_resp_flags, rx_resp_type, rx_resp_seq, rx_resp_len, rx_resp);
+    rc = cb->Init(context, &config);
+    if (rc != 0) {
+        printf("Failed to initialize NVM\n");
+        return;
+    }
 
+    /* Append unaligned pieces, repeating the list until the object is full */
+    rc = cb->AddObjectBegin(context, &meta);
+    add_blocked = (cb->AddObject(context, &meta_abort, sizeof(out), out) ==
+            WH_ERROR_NOTREADY);
+    i = 0;
+    while ((rc == 0) && (offset < sizeof(pattern))) {
+        this_len = pieces[i++ % (sizeof(pieces) / sizeof(pieces[0]))];
+        if (this_len > sizeof(pattern) - offset) {
+            this_len = sizeof(pattern) - offset;
+        }
+        rc = cb->AddObjectAppend(context, this_len, pattern + offset);
+        offset += this_len;
+    }
+    if (rc == 0) {
+        rc = cb->AddObjectFinish(context);
+    }
+    printf("--Stream add rc:%d appends:%u adds blocked:%d\n", rc,
+            (unsigned int)i, add_blocked);
+
+    /* Read back in pieces, and past the end */
+    rc = cb->GetMetadata(context, meta.id, &out_meta);
+    for (offset = 0; (rc == 0) && (offset < out_meta.len); offset += this_len) {
+        this_len = out_meta.len - offset;
+        if (this_len > sizeof(out)) {
+            this_len = sizeof(out);
+        }
+        rc = cb->Read(context, meta.id, offset, this_len, out);
+        read_ok &= (rc == 0) && (memcmp(out, pattern + offset, this_len) == 0);
     }
+    printf("--Stream read rc:%d len ok:%d reads ok:%d past end rc:%d\n", rc,
+            out_meta.len == sizeof(pattern), read_ok,
+            cb->Read(context, meta.id, out_meta.len - 1, 2, out));
 
-    ret = wh_CommServer_Cleanup(server);
-    printf("CommServerCleanup:%d\n", ret);
+    /* An aborted object is never visible and is reclaimable */
+    rc = cb->AddObjectBegin(context, &meta_abort);
+    if (rc == 0) {
+        rc = cb->AddObjectAppend(context, sizeof(out), pattern);
+    }
+    if (rc == 0) {
+        rc = cb->AddObjectAbort(context);
+    }
+    cb->GetAvailable(context, NULL, NULL, NULL, &reclaim_count);
+    printf("--Stream abort rc:%d found:%d reclaimable:%d\n", rc,
+            cb->GetMetadata(context, meta_abort.id, &out_meta) == 0,
+            reclaim_count);
 
-    ret = wh_CommClient_Cleanup(client);
-    printf("CommClientCleanup:%d\n", ret);
+    /* Leave an object open across a remount */
+    rc = cb->AddObjectBegin(context, &meta_open);
+    if (rc == 0) {
+        rc = cb->AddObjectAppend(context, sizeof(out), pattern);
+    }
+    cb->Cleanup(context);
+    memset(context, 0, sizeof(*context));
+    rc = cb->Init(context, &config);
+    cb->GetAvailable(context, &avail_size, NULL, NULL, NULL);
+    printf("--Stream remount rc:%d found:%d free:%d\n", rc,
+            cb->GetMetadata(context, meta_open.id, &out_meta) == 0,
+            (int)avail_size);
+    rc = cb->DestroyObjects(context, 0, NULL);
+    printf("--Stream reclaim rc:%d stream found:%d\n", rc,
+            cb->GetMetadata(context, meta.id, &out_meta) == 0);
+    _ShowAvailable(cb, context);
+
+    cb->DestroyObjects(context, 1, &meta.id);
+    cb->Cleanup(context);
 }
 
+/* Keyed mixing standing in for AES-CMAC.  The result does not depend on how
+ * the data is split across Updates */
+typedef struct {
+    uint8_t state[WOLFHSM_MANIFEST_CMAC_LEN];
+    uint32_t pos;
+} testImageMac;
 
+static int _testImageMac_Init(void* c)
+{
+    testImageMac* mac = c;
+    memset(mac, 0x5A, sizeof(*mac));
+    mac->pos = 0;
+    return 0;
+}
 
+static int _testImageMac_Update(void* c, const uint8_t* data, uint32_t len)
+{
+    testImageMac* mac = c;
+    uint32_t i = 0;
+    for (i = 0; i < len; i++, mac->pos++) {
+        uint8_t* s = &mac->state[mac->pos % sizeof(mac->state)];
+        *s = (uint8_t)((*s * 31) + data[i] + (mac->pos >> 4));
+    }
+    return 0;
+}
 
+static int _testImageMac_Final(void* c, uint8_t* out_mac)
+{
+    testImageMac* mac = c;
+    memcpy(out_mac, mac->state, sizeof(mac->state));
+    return 0;
+}
 
-static void* _whCommClientTask(void *cf)
+static void _testImageMac(const uint8_t* data, uint32_t len, uint8_t* out_mac)
 {
-    whCommClientConfig* config = (whCommClientConfig*)cf;
-    int ret = 0;
-    whCommClient client[1];
-    int counter = 1;
+    testImageMac mac;
+    _testImageMac_Init(&mac);
+    _testImageMac_Update(&mac, data, len);
+    _testImageMac_Final(&mac, out_mac);
+}
 
-    uint8_t  tx_req[REQ_SIZE] = {0};
-    uint16_t tx_req_len = 0;
-    uint16_t tx_req_flags = WH_COMM_MAGIC_NATIVE;
-    uint16_t tx_req_type = 0;
-    uint16_t tx_req_seq = 0;
+/* Copy that completes in ReadWait, like a DMA, counting the CMAC updates
+ * made while a copy is outstanding */
+typedef struct {
+    const uint8_t* src;
+    uint8_t* dst;
+    uint32_t len;
+    int pending;
+    int reads;
+    int overlaps;
+    testImageMac mac;
+} testImageDma;
+
+static int _testImageDma_ReadStart(void* c, const uint8_t* src, uint32_t len,
+        uint8_t* dst)
+{
+    testImageDma* dma = c;
+    if (dma->pending != 0) {
+        return WH_ERROR_ABORTED;
+    }
+    dma->src = src;
+    dma->dst = dst;
+    dma->len = len;
+    dma->pending = 1;
+    dma->reads++;
+    return 0;
+}
 
-    uint8_t  rx_resp[RESP_SIZE] = {0};
-    uint16_t rx_resp_len = 0;
-    uint16_t rx_resp_flags = 0;
-    uint16_t rx_resp_type = 0;
-    uint16_t rx_resp_seq = 0;
+static int _testImageDma_ReadWait(void* c)
+{
+    testImageDma* dma = c;
+    if (dma->pending != 0) {
+        memcpy(dma->dst, dma->src, dma->len);
+        dma->pending = 0;
+    }
+    return 0;
+}
 
-    if (config == NULL) {
-        return NULL;
+/* The CMAC context of the DMA test.  Counts updates that overlap a copy */
+static int _testImageDma_Update(void* c, const uint8_t* data, uint32_t len)
+{
+    testImageDma* dma = (testImageDma*)((uint8_t*)c -
+            offsetof(testImageDma, mac));
+    if (dma->pending != 0) {
+        dma->overlaps++;
     }
+    return _testImageMac_Update(c, data, len);
+}
 
-    ret = wh_CommClient_Init(client, config);
-    printf("CommClientInit:%d\n", ret);
+static void _testImageManifest(whManifest_ex* m, uint8_t* payload,
+        uint32_t len)
+{
+    memset(m, 0, sizeof(*m));
+    m->address = payload;
+    m->payload_start = payload;
+    m->payload_len = len;
+    _testImageMac(payload, len, m->payload_cmac);
+    _testImageMac((const uint8_t*)m, offsetof(whManifest_ex, manifest_cmac),
+            m->manifest_cmac);
+}
 
-    for(counter = 0; counter < REPEAT_COUNT; counter++)
-    {
-        sprintf((char*)tx_req,"Request:%u",counter);
-        tx_req_len = strlen((char*)tx_req);
-        tx_req_type = counter*2;
-        do {
-            ret = wh_CommClient_SendRequest(client,
-                    tx_req_flags, tx_req_type, &tx_req_seq,
-                    tx_req_len, tx_req);
-            printf("Client SendRequest:%d, flags %x, type:%x, seq:%d, len:%d, %s\n",
-                    ret, tx_req_flags, tx_req_type, tx_req_seq, tx_req_len, tx_req);
-        } while ((ret == WH_ERROR_NOTREADY) && (usleep(ONE_MS)==0));
+/* Verify 3 images streamed through double buffers, then after a warm boot
+ * with the same epoch, and after tampering */
+void wh_Image_VerifyTest(void)
+{
+    enum {
+        IMAGE_COUNT = 3,
+        IMAGE_CHUNKS = (10000 + WH_IMAGE_CHUNK_SIZE - 1) / WH_IMAGE_CHUNK_SIZE +
+                1 + 1,
+    };
+    static uint8_t payload0[10000];
+    static uint8_t payload1[WH_IMAGE_CHUNK_SIZE];
+    static uint8_t payload2[100];
+    static whImageContext image[1];
+    const whImageCmacCb mac_cb[1] = {{
+            .Init = _testImageMac_Init,
+            .Update = _testImageMac_Update,
+            .Final = _testImageMac_Final,
+    }};
+    const whImageCmacCb dma_mac_cb[1] = {{
+            .Init = _testImageMac_Init,
+            .Update = _testImageDma_Update,
+            .Final = _testImageMac_Final,
+    }};
+    const whImageReadCb read_cb[1] = {{
+            .ReadStart = _testImageDma_ReadStart,
+            .ReadWait = _testImageDma_ReadWait,
+    }};
+    testImageDma dma = {0};
+    testImageMac mac = {0};
+
+    const whNvmCb nvm_cb[1] = {WH_NVM_FLASH_CB};
+    whNvmFlashContext nvm[1] = {0};
+    posixFlashFileContext image_flash[1] = {0};
+    posixFlashFileConfig image_flash_config = myHalFlashConfig[0];
+    whNvmFlashConfig nvm_config = myNvmConfig;
+    whNvmId cache_id = 0x0100;
+    whImageConfig config = {
+            .cmac_cb = dma_mac_cb,
+            .cmac_context = &dma.mac,
+            .read_cb = read_cb,
+            .read_context = &dma,
+            .nvm_cb = nvm_cb,
+            .nvm_context = nvm,
+            .cache_id = cache_id,
+    };
+    whManifest_ex list[IMAGE_COUNT];
+    whNvmMetadata record_meta = {0};
+    uint8_t record[256];
+    uint8_t saved = 0;
+    uint32_t verified = 0;
+    uint32_t i = 0;
+    int rc = 0;
+
+    for (i = 0; i < sizeof(payload0); i++) payload0[i] = (uint8_t)(i * 7);
+    for (i = 0; i < sizeof(payload1); i++) payload1[i] = (uint8_t)(i >> 3);
+    for (i = 0; i < sizeof(payload2); i++) payload2[i] = (uint8_t)~i;
+    _testImageManifest(&list[0], payload0, sizeof(payload0));
+    _testImageManifest(&list[1], payload1, sizeof(payload1));
+    _testImageManifest(&list[2], payload2, sizeof(payload2));
+
+    image_flash_config.filename = "myImage.bin";
+    nvm_config.context = image_flash;
+    nvm_config.config = &image_flash_config;
+    rc = nvm_cb->Init(nvm, &nvm_config);
+    if (rc == 0) {
+        /* Start without a record from a previous run */
+        rc = nvm_cb->DestroyObjects(nvm, 1, &cache_id);
+    }
+    if (rc == 0) {
+        rc = wh_Image_Init(image, &config);
+    }
+    printf("Image init:%d\n", rc);
+
+    /* One pipeline of the chunks of all 3 payloads, each read before the
+     * previous one is in the CMAC */
+    rc = wh_Image_Verify(image, list, IMAGE_COUNT, 1, &verified);
+    printf("Image cold verify:%d verified:%x chunks:%u reads:%d "
+            "overlaps:%d ok:%d\n", rc, (unsigned)verified,
+            (unsigned)image->chunks, dma.reads, dma.overlaps,
+            (rc == 0) && (verified == 0x7) &&
+                (image->chunks == IMAGE_CHUNKS) &&
+                (dma.reads == IMAGE_CHUNKS) &&
+                (dma.overlaps == IMAGE_CHUNKS - 1));
+
+    /* A warm boot with the same epoch skips the payloads */
+    wh_Image_Cleanup(image);
+    memset(&dma, 0, sizeof(dma));
+    rc = wh_Image_Init(image, &config);
+    if (rc == 0) {
+        rc = wh_Image_Verify(image, list, IMAGE_COUNT, 1, &verified);
+    }
+    printf("Image warm verify:%d verified:%x hits:%u chunks:%u ok:%d\n", rc,
+            (unsigned)verified, (unsigned)image->cache_hits,
+            (unsigned)image->chunks,
+            (rc == 0) && (verified == 0x7) && (image->cache_hits == 3) &&
+                (image->chunks == 0) && (dma.reads == 0));
+
+    /* A new epoch rechecks the payloads */
+    saved = payload2[50];
+    payload2[50] ^= 1;
+    rc = wh_Image_Verify(image, list, IMAGE_COUNT, 2, &verified);
+    printf("Image tampered payload:%d verified:%x ok:%d\n", rc,
+            (unsigned)verified,
+            (rc == WH_ERROR_NOTVERIFIED) && (verified == 0x3));
+    payload2[50] = saved;
+
+    /* A changed manifest is not verified even at a recorded epoch */
+    rc = wh_Image_Verify(image, list, IMAGE_COUNT, 3, &verified);
+    if (rc == 0) {
+        list[0].payload_len--;
+        rc = wh_Image_Verify(image, list, IMAGE_COUNT, 3, &verified);
+        list[0].payload_len++;
+    }
+    printf("Image tampered manifest:%d verified:%x ok:%d\n", rc,
+            (unsigned)verified,
+            (rc == WH_ERROR_NOTVERIFIED) && (verified == 0x6));
+
+    /* A record rewritten through the NVM to mark a tampered payload as
+     * verified fails its CMAC and is ignored.  The record begins with the
+     * epoch, the verified bits and then the manifest_cmac of each entry */
+    memset(record, 0, sizeof(record));
+    rc = nvm_cb->GetMetadata(nvm, cache_id, &record_meta);
+    if ((rc == 0) && (record_meta.len <= sizeof(record))) {
+        rc = nvm_cb->Read(nvm, cache_id, 0, record_meta.len, record);
+    }
+    if (rc == 0) {
+        memset(record + 4, 0, 4);
+        record[4] = 0x7;
+        memcpy(record + 8, list[0].manifest_cmac, WOLFHSM_MANIFEST_CMAC_LEN);
+        rc = nvm_cb->AddObject(nvm, &record_meta, record_meta.len, record);
+    }
+    saved = payload0[10];
+    payload0[10] ^= 1;
+    image->cache_hits = 0;
+    if (rc == 0) {
+        rc = wh_Image_Verify(image, list, IMAGE_COUNT, 3, &verified);
+    }
+    payload0[10] = saved;
+    printf("Image forged record:%d verified:%x hits:%u ok:%d\n", rc,
+            (unsigned)verified, (unsigned)image->cache_hits,
+            (rc == WH_ERROR_NOTVERIFIED) && (verified == 0x6) &&
+                (image->cache_hits == 0));
+    wh_Image_Cleanup(image);
+
+    /* Memory mapped payloads are fed to the CMAC in place */
+    config.cmac_cb = mac_cb;
+    config.cmac_context = &mac;
+    config.read_cb = NULL;
+    config.nvm_cb = NULL;
+    rc = wh_Image_Init(image, &config);
+    if (rc == 0) {
+        rc = wh_Image_Verify(image, list, IMAGE_COUNT, 1, &verified);
+    }
+    printf("Image mapped verify:%d verified:%x chunks:%u ok:%d\n", rc,
+            (unsigned)verified, (unsigned)image->chunks,
+            (rc == 0) && (verified == 0x7) &&
+                (image->chunks == IMAGE_CHUNKS));
+
+    wh_Image_Cleanup(image);
+    nvm_cb->Cleanup(nvm);
+}
+
+/* Cache, pin, evict and reload keys backed by NVM */
+void wh_Server_KeyCacheTest(void)
+{
+    int rc = 0;
+    const whNvmCb nvm_cb[1] = {WH_NVM_FLASH_CB};
+    whNvmFlashContext nvm[1] = {0};
+    posixFlashFileContext key_flash[1] = {0};
+    posixFlashFileConfig key_flash_config = myHalFlashConfig[0];
+    whNvmFlashConfig nvm_config = myNvmConfig;
+    whKeyCacheConfig config = {
+            .nvm_cb = nvm_cb,
+            .nvm_context = nvm,
+    };
+    whKeyCache cache[1];
+
+    unsigned char nvm_key[] = "NvmKeyMaterial";
+    unsigned char ram_key[] = "RamKeyMaterial";
+    whNvmMetadata meta = {0};
+    const whNvmMetadata* out_meta = NULL;
+    const uint8_t* out_data = NULL;
+    whKeyId nvm_id = MAKE_WOLFHSM_KEYID(WOLFHSM_KEYID_NVM, 1);
+    whKeyId ram_id = MAKE_WOLFHSM_KEYID(WOLFHSM_KEYID_RAM, 1);
+    int i = 0;
+
+    key_flash_config.filename = "myKeys.bin";
+    nvm_config.context = key_flash;
+    nvm_config.config = &key_flash_config;
+    rc = nvm_cb->Init(nvm, &nvm_config);
+    if (rc == 0) {
+        rc = wh_KeyCache_Init(cache, &config);
+    }
+    if (rc != 0) {
+        printf("Failed to initialize key cache\n");
+        return;
+    }
+
+    /* NVM keys are committed in the background, RAM keys never are */
+    meta.id = nvm_id;
+    meta.flags = WOLFHSM_NVM_FLAGS_NOCACHE;
+    meta.len = sizeof(nvm_key);
+    memcpy(meta.label, "NvmKey", sizeof("NvmKey"));
+    rc = wh_KeyCache_Cache(cache, &meta, nvm_key);
+    if (rc == 0) {
+        meta.flags = 0;
+        meta.id = ram_id;
+        meta.len = sizeof(ram_key);
+        rc = wh_KeyCache_Cache(cache, &meta, ram_key);
+    }
+    printf("--KeyCache cache rc:%d in nvm before idle:%d\n", rc,
+            nvm_cb->GetMetadata(nvm, nvm_id, &meta) == 0);
+    rc = wh_KeyCache_Idle(cache);
+    printf("--KeyCache idle rc:%d in nvm:%d ram key in nvm:%d\n", rc,
+            nvm_cb->GetMetadata(nvm, nvm_id, &meta) == 0,
+            nvm_cb->GetMetadata(nvm, ram_id, &meta) == 0);
+    /* The cache policy flag is not stored with the object */
+    rc = nvm_cb->GetMetadata(nvm, nvm_id, &meta);
+    printf("--KeyCache stored flags rc:%d ok:%d\n", rc,
+            (rc == 0) && ((meta.flags & WOLFHSM_NVM_FLAGS_NOCACHE) == 0));
+
+    /* Pin the NVM key and fill the other slots with RAM keys */
+    rc = wh_KeyCache_Acquire(cache, nvm_id, &out_meta, &out_data);
+    for (i = 2; (i < WOLFHSM_NUM_RAMKEYS) && (rc == 0); i++) {
+        meta.id = MAKE_WOLFHSM_KEYID(WOLFHSM_KEYID_RAM, i);
+        rc = wh_KeyCache_Cache(cache, &meta, ram_key);
+    }
+    meta.id = MAKE_WOLFHSM_KEYID(WOLFHSM_KEYID_RAM, i);
+    printf("--KeyCache fill rc:%d, full cache rc:%d, evict pinned rc:%d\n",
+            rc, wh_KeyCache_Cache(cache, &meta, ram_key),
+            wh_KeyCache_Evict(cache, nvm_id));
+    printf("--KeyCache pinned data match:%d\n",
+            (out_meta->len == sizeof(nvm_key)) &&
+            (memcmp(out_data, nvm_key, sizeof(nvm_key)) == 0));
+    wh_KeyCache_Release(cache, nvm_id);
+
+    /* Evicting zeroizes the slot, and the next Acquire reloads from NVM */
+    rc = wh_KeyCache_Evict(cache, nvm_id);
+    if (rc == 0) {
+        rc = wh_KeyCache_Acquire(cache, nvm_id, &out_meta, &out_data);
+    }
+    printf("--KeyCache reload rc:%d loads:%u data match:%d\n", rc,
+            cache->loads, (rc == 0) &&
+                (memcmp(out_data, nvm_key, sizeof(nvm_key)) == 0));
+    wh_KeyCache_Release(cache, nvm_id);
+
+    rc = wh_KeyCache_Erase(cache, nvm_id);
+    printf("--KeyCache erase rc:%d acquire:%d\n", rc,
+            wh_KeyCache_Acquire(cache, nvm_id, &out_meta, &out_data));
+    wh_KeyCache_Cleanup(cache);
+    nvm_cb->Cleanup(nvm);
+}
+
+/* Increment through several log rotations and check a remount matches */
+void wh_Counter_FlashTest(void)
+{
+    int rc = 0;
+    const whCounterCb cb[1] = {WH_COUNTER_FLASH_CB};
+    whCounterFlashContext context[1] = {0};
+    posixFlashFileContext counter_flash[1] = {0};
+    posixFlashFileConfig counter_flash_config = {
+            .filename       = "myCounter.bin",
+            .partition_size = 1024,
+            .erased_byte    = (~(uint8_t)0),
+    };
+    whCounterFlashConfig config = {
+            .cb = myCb,
+            .context = counter_flash,
+            .config = &counter_flash_config,
+    };
+    uint32_t before[WOLFHSM_NUM_COUNTERS] = {0};
+    uint32_t value = 0;
+    int epoch = 0;
+    int match = 1;
+    int i = 0;
+
+    rc = cb->Init(context, &config);
+    if (rc != 0) {
+        printf("Failed to initialize counters\n");
+        return;
+    }
+    for (i = 0; i < WOLFHSM_NUM_COUNTERS; i++) {
+        cb->Read(context, i, &before[i]);
+    }
+    epoch = context->epoch;
+
+    /* Each partition logs about 120 increments before rotating */
+    for (i = 0; (i < 300) && (rc == 0); i++) {
+        rc = cb->Increment(context, 0, &value);
+    }
+    if (rc == 0) {
+        rc = cb->Increment(context, WOLFHSM_NUM_COUNTERS - 1, NULL);
+    }
+    printf("--Counter increment rc:%d value ok:%d rotations:%d\n", rc,
+            value == before[0] + 300, (int)(context->epoch - epoch));
+    printf("--Counter bad id read:%d increment:%d\n",
+            cb->Read(context, WOLFHSM_NUM_COUNTERS, &value),
+            cb->Increment(context, WOLFHSM_NUM_COUNTERS, NULL));
+    cb->Cleanup(context);
+
+    /* Rebuild the values from the bases and the log */
+    memset(context, 0, sizeof(*context));
+    rc = cb->Init(context, &config);
+    for (i = 0; (i < WOLFHSM_NUM_COUNTERS) && (rc == 0); i++) {
+        rc = cb->Read(context, i, &value);
+        if (value != before[i] + ((i == 0) ? 300 :
+                (i == WOLFHSM_NUM_COUNTERS - 1) ? 1 : 0)) {
+            match = 0;
+        }
+    }
+    printf("--Counter remount rc:%d values match:%d\n", rc, match);
+    cb->Cleanup(context);
+}
+
+#if NF_PARTITION_COUNT >= 4
+/* Reclaim across four partitions, deferring the erases to Idle */
+void wh_Nvm_RotationTest(void)
+{
+    int rc = 0;
+    const whNvmCb cb[1] = {WH_NVM_FLASH_CB};
+    whNvmFlashContext context[1] = {0};
+    posixFlashFileContext rot_flash[1] = {0};
+    posixFlashFileConfig rot_flash_config = myHalFlashConfig[0];
+    whNvmFlashConfig rot_config = myNvmConfig;
+
+    unsigned char data[] = "RotateData";
+    uint8_t out[sizeof(data)] = {0};
+    whNvmMetadata meta = {.id = 80, .label = "Rotate"};
+    whNvmId ids[] = {meta.id};
+    int visited = 0;
+    int idle_steps = 0;
+    int i = 0;
+
+    rot_flash_config.filename = "myRotate.bin";
+    rot_flash_config.partition_count = 4;
+    rot_config.context = rot_flash;
+    rot_config.config = &rot_flash_config;
+
+    /* A single partition cannot be replicated */
+    rot_config.partition_count = 1;
+    rc = cb->Init(context, &rot_config);
+    printf("--Rotation 1 partition init:%d\n", rc);
+
+    rot_config.partition_count = 4;
+    rc = cb->Init(context, &rot_config);
+    if (rc != 0) {
+        printf("Failed to initialize NVM\n");
+        return;
+    }
+
+    /* Each reclaim moves to another partition and leaves the old for Idle */
+    for (i = 0; i < 8; i++) {
+        cb->AddObject(context, &meta, sizeof(data), data);
+        rc = cb->DestroyObjects(context, 0, NULL);
+        if (rc != 0) break;
+        visited |= 1 << context->active;
+        while (((i & 1) == 0) && (cb->Idle(context) == WH_ERROR_NOTREADY)) {
+            idle_steps++;
+        }
+    }
+    printf("--Rotation reclaim rc:%d partitions visited:%x idle steps:%d\n",
+            rc, visited, idle_steps);
+    cb->Cleanup(context);
+
+    /* Remount, which finds the newest partition and the retired ones */
+    memset(context, 0, sizeof(*context));
+    rc = cb->Init(context, &rot_config);
+    if (rc == 0) {
+        rc = cb->Read(context, meta.id, 0, sizeof(out), out);
+    }
+    printf("--Rotation remount:%d active:%d pending:%x, data match:%d\n",
+            rc, context->active, (unsigned)context->erase_pending,
+            memcmp(out, data, sizeof(data)) == 0);
+    do {
+        rc = cb->Idle(context);
+    } while (rc == WH_ERROR_NOTREADY);
+    printf("--Rotation idle rc:%d pending:%x\n", rc,
+            (unsigned)context->erase_pending);
+    _ShowAvailable(cb, context);
+
+    cb->DestroyObjects(context, sizeof(ids)/sizeof(ids[0]), ids);
+    cb->Cleanup(context);
+}
+#endif
+
+#if (NF_PARTITION_COUNT >= 4) && (NF_WRITE_BUFFER_SIZE > 0)
+/* Call Idle with retired partitions to erase between the Steps of a
+ * replication and between Appends, with programs held in the write buffer */
+void wh_Nvm_IdleInterleaveTest(void)
+{
+    int rc = 0;
+    int idle_rc = 0;
+    const whNvmCb cb[1] = {WH_NVM_FLASH_CB};
+    whNvmFlashContext context[1] = {0};
+    whNvmFlashContext plain_context[1] = {0};
+    posixFlashFileContext idle_flash[1] = {0};
+    posixFlashFileConfig idle_flash_config = myHalFlashConfig[0];
+    whNvmFlashConfig idle_config = myNvmConfig;
+    whNvmFlashConfig plain_config = myNvmConfig;
+
+    uint8_t big[600];
+    uint8_t out[sizeof(big)] = {0};
+    whNvmMetadata meta_big = {.id = 85, .label = "IdleBig"};
+    whNvmMetadata meta_stream = {.id = 86, .label = "IdleStream"};
+    whNvmId ids[] = {meta_big.id, meta_stream.id};
+    uint32_t pending = 0;
+    int waits = 0;
+    int read_ok = 1;
+    int i = 0;
+
+    memset(big, 0x5A, sizeof(big));
+    idle_flash_config.filename = "myIdle.bin";
+    idle_flash_config.partition_count = 4;
+    idle_config.context = idle_flash;
+    idle_config.config = &idle_flash_config;
+    idle_config.partition_count = 4;
+    idle_config.write_page_size = NF_WRITE_BUFFER_SIZE;
+
+    rc = cb->Init(context, &idle_config);
+    if (rc != 0) {
+        printf("Failed to initialize NVM\n");
+        return;
+    }
+
+    /* Retire two partitions without erasing them */
+    for (i = 0; (i < 2) && (rc == 0); i++) {
+        cb->AddObject(context, &meta_big, sizeof(big), big);
+        rc = cb->DestroyObjects(context, 0, NULL);
+    }
+    pending = context->erase_pending;
+
+    /* Idle must not erase while the copy is buffered for the destination */
+    if (rc == 0) {
+        rc = cb->DestroyObjectsBegin(context, 0, NULL);
+    }
+    while (rc == 0) {
+        rc = cb->DestroyObjectsStep(context, 64);
+        if (rc != WH_ERROR_NOTREADY) break;
+        idle_rc = cb->Idle(context);
+        if ((idle_rc == WH_ERROR_NOTREADY) &&
+                (context->erase_pending == pending)) {
+            waits++;
+        }
+        rc = 0;
+    }
+    printf("--Idle between steps rc:%d idle waits:%d\n", rc, waits);
+
+    /* Likewise while appending an object */
+    waits = 0;
+    if (rc == 0) {
+        rc = cb->AddObjectBegin(context, &meta_stream);
+    }
+    for (i = 0; (i < 6) && (rc == 0); i++) {
+        rc = cb->AddObjectAppend(context, 100, big + 100 * i);
+        idle_rc = cb->Idle(context);
+        if (idle_rc == WH_ERROR_NOTREADY) {
+            waits++;
+        }
+    }
+    if (rc == 0) {
+        rc = cb->AddObjectFinish(context);
+    }
+    printf("--Idle between appends rc:%d idle waits:%d\n", rc, waits);
+    do {
+        idle_rc = cb->Idle(context);
+    } while (idle_rc == WH_ERROR_NOTREADY);
+
+    /* Mount the same flash without the buffer */
+    plain_config.context = idle_flash;
+    plain_config.config = &idle_flash_config;
+    plain_config.partition_count = 4;
+    cb->Cleanup(context);
+    rc = cb->Init(plain_context, &plain_config);
+    if (rc == 0) {
+        rc = cb->Read(plain_context, meta_big.id, 0, sizeof(big), out);
+        read_ok &= (rc == 0) && (memcmp(out, big, sizeof(big)) == 0);
+        memset(out, 0, sizeof(out));
+        rc = cb->Read(plain_context, meta_stream.id, 0, sizeof(big), out);
+        read_ok &= (rc == 0) && (memcmp(out, big, sizeof(big)) == 0);
+    }
+    printf("--Idle remount idle rc:%d pending:%x, reads ok:%d\n", idle_rc,
+            (unsigned)plain_context->erase_pending, read_ok);
+
+    cb->DestroyObjects(plain_context, sizeof(ids)/sizeof(ids[0]), ids);
+    cb->Cleanup(plain_context);
+}
+#endif
+
+#if NF_WRITE_BUFFER_SIZE > 0
+/* Program through the write buffer and check a plain mount sees the result */
+void wh_Nvm_WriteBufferTest(void)
+{
+    int rc = 0;
+    const whNvmCb cb[1] = {WH_NVM_FLASH_CB};
+    whNvmFlashContext context[1] = {0};
+    whNvmFlashContext plain_context[1] = {0};
+    whNvmFlashConfig config = myNvmConfig;
+
+    uint8_t big[700];
+    unsigned char data1[] = "Buffered1";
+    unsigned char data2[] = "Buffered2 is longer";
+    uint8_t out[sizeof(big)] = {0};
+    whNvmMetadata meta_big = {.id = 90, .label = "WbBig"};
+    whNvmMetadata metas[] = {
+            {.id = 91, .label = "Wb1"},
+            {.id = 92, .label = "Wb2"},
+    };
+    const whNvmSize lens[] = {sizeof(data1), sizeof(data2)};
+    const uint8_t* datas[] = {data1, data2};
+    whNvmId ids[] = {meta_big.id, metas[0].id, metas[1].id};
+    whNvmSize avail_size = 0;
+    whNvmId avail_count = 0;
+    whNvmSize plain_size = 0;
+    whNvmId plain_count = 0;
+    int read_ok = 1;
+
+    memset(big, 0x3C, sizeof(big));
+
+    /* Page sizes that are not a power of 2 or too large are rejected */
+    config.write_page_size = 96;
+    rc = cb->Init(context, &config);
+    printf("--Write buffer bad page rc:%d\n", rc);
+    config.write_page_size = NF_WRITE_BUFFER_SIZE * 2;
+    rc = cb->Init(context, &config);
+    printf("--Write buffer big page rc:%d\n", rc);
+
+    config.write_page_size = NF_WRITE_BUFFER_SIZE;
+    rc = cb->Init(context, &config);
+    if (rc != 0) {
+        printf("Failed to initialize NVM\n");
+        return;
+    }
+    cb->AddObject(context, &meta_big, sizeof(big), big);
+    cb->AddObject(context, &metas[0], sizeof(data2), data2);
+    rc = cb->AddObjects(context, sizeof(metas) / sizeof(metas[0]), metas,
+            lens, datas);
+    printf("--Write buffer add batch rc:%d\n", rc);
+    /* Replicate through the buffer, dropping the first copy of Wb1 */
+    rc = cb->DestroyObjects(context, 0, NULL);
+    printf("--Write buffer reclaim rc:%d\n", rc);
+    _ShowAvailable(cb, context);
+
+    /* Mount the same flash without the buffer */
+    rc = cb->Init(plain_context, &myNvmConfig);
+    if (rc == 0) {
+        rc = cb->Read(plain_context, meta_big.id, 0, sizeof(big), out);
+        read_ok &= (rc == 0) && (memcmp(out, big, sizeof(big)) == 0);
+        rc = cb->Read(plain_context, metas[0].id, 0, sizeof(data1), out);
+        read_ok &= (rc == 0) && (memcmp(out, data1, sizeof(data1)) == 0);
+        rc = cb->Read(plain_context, metas[1].id, 0, sizeof(data2), out);
+        read_ok &= (rc == 0) && (memcmp(out, data2, sizeof(data2)) == 0);
+    }
+    cb->GetAvailable(context, &avail_size, &avail_count, NULL, NULL);
+    cb->GetAvailable(plain_context, &plain_size, &plain_count, NULL, NULL);
+    printf("--Write buffer plain mount rc:%d, reads ok:%d, "
+            "available match:%d\n", rc, read_ok,
+            (avail_size == plain_size) && (avail_count == plain_count));
+    cb->Cleanup(plain_context);
+
+    cb->DestroyObjects(context, sizeof(ids)/sizeof(ids[0]), ids);
+    cb->Cleanup(context);
+}
+#endif
+
+#if NF_CACHE_ENTRY_COUNT > 0
+void wh_Nvm_CacheTest(void)
+{
+    int rc = 0;
+    const whNvmCb cb[1] = {WH_NVM_FLASH_CB};
+    whNvmFlashContext context[1] = {0};
+
+    unsigned char data1[] = "CacheData1";
+    unsigned char data2[] = "CacheData2";
+    unsigned char secret[] = "Secret";
+    uint8_t out[sizeof(data1)] = {0};
+    whNvmMetadata meta1 = {.id = 90, .label = "Cache1"};
+    whNvmMetadata meta2 = {.id = 91, .label = "Secret",
+            .flags = WOLFHSM_NVM_FLAGS_NOCACHE};
+    uint32_t hits = 0;
+    uint32_t misses = 0;
+    int i = 0;
+    int match = 1;
+
+    rc = cb->Init(context, &myNvmConfig);
+    if (rc != 0) {
+        printf("Failed to initialize NVM\n");
+        return;
+    }
+    cb->AddObject(context, &meta1, sizeof(data1), data1);
+    cb->AddObject(context, &meta2, sizeof(secret), secret);
+
+    /* One miss to load, then hits.  The NOCACHE object is not counted */
+    for (i = 0; i < 4; i++) {
+        cb->Read(context, meta1.id, 0, sizeof(data1), out);
+        match &= (memcmp(out, data1, sizeof(data1)) == 0);
+        cb->Read(context, meta2.id, 0, sizeof(secret), out);
+    }
+    wh_NvmFlash_GetCacheStats(context, &hits, &misses);
+    printf("--Cache hits:%u misses:%u match:%d\n", hits, misses, match);
+
+    /* Replacing the object invalidates the cached copy */
+    cb->AddObject(context, &meta1, sizeof(data2), data2);
+    cb->Read(context, meta1.id, 0, sizeof(data2), out);
+    wh_NvmFlash_GetCacheStats(context, &hits, &misses);
+    printf("--Cache after update hits:%u misses:%u match:%d\n", hits, misses,
+            memcmp(out, data2, sizeof(data2)) == 0);
+
+    whNvmId ids[] = {meta1.id, meta2.id};
+    cb->DestroyObjects(context, sizeof(ids)/sizeof(ids[0]), ids);
+    cb->Cleanup(context);
+}
+#endif
+
+#ifdef WOLFHSM_NVM_CHECKPOINT
+/* Compare the parts of two directories that a mount recovers */
+static int _NvmDirectoryMatch(const nfMemDirectory* a, const nfMemDirectory* b)
+{
+    int i = 0;
+
+    if (    (a->next_free_object != b->next_free_object) ||
+            (a->next_free_data != b->next_free_data) ||
+            (a->reclaimable_entries != b->reclaimable_entries) ||
+            (a->reclaimable_data != b->reclaimable_data) ||
+            (memcmp(a->id_index, b->id_index, sizeof(a->id_index)) != 0)) {
+        return 0;
+    }
+    for (i = 0; i < a->next_free_object; i++) {
+        if (    (memcmp(&a->objects[i].state, &b->objects[i].state,
+                    sizeof(a->objects[i].state)) != 0) ||
+                (memcmp(&a->objects[i].metadata, &b->objects[i].metadata,
+                    sizeof(a->objects[i].metadata)) != 0)) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+/* Mount from the checkpoint written by DestroyObjects and the objects added
+ * after it, and compare with the directory before the remount */
+void wh_Nvm_CheckpointTest(void)
+{
+    int rc = 0;
+    const whNvmCb cb[1] = {WH_NVM_FLASH_CB};
+    whNvmFlashContext context[1] = {0};
+    posixFlashFileContext cp_flash[1] = {0};
+    posixFlashFileConfig cp_flash_config = myHalFlashConfig[0];
+    whNvmFlashConfig cp_config = myNvmConfig;
+    static nfMemDirectory before;
+
+    unsigned char data1[] = "Checkpoint1";
+    unsigned char data2[] = "Checkpoint2";
+    unsigned char data3[] = "Checkpoint3";
+    uint8_t out[sizeof(data1)] = {0};
+    whNvmMetadata meta1 = {.id = 100, .label = "Check1"};
+    whNvmMetadata meta2 = {.id = 101, .label = "Check2"};
+    whNvmMetadata meta3 = {.id = 102, .label = "Check3"};
+    whNvmId ids[] = {meta1.id, meta2.id, meta3.id};
+    int i = 0;
+
+    cp_flash_config.filename = "myCheckpoint.bin";
+    cp_config.context = cp_flash;
+    cp_config.config = &cp_flash_config;
+    cp_config.erased_byte = myHalFlashConfig->erased_byte;
+
+    rc = cb->Init(context, &cp_config);
+    if (rc != 0) {
+        printf("Failed to initialize NVM\n");
+        return;
+    }
+    /* A newly formatted partition has no checkpoint */
+    printf("--Checkpoint format checkpoint:%d\n",
+            context->checkpoint_mounted);
+
+    cb->AddObject(context, &meta1, sizeof(data1), data1);
+    cb->AddObject(context, &meta2, sizeof(data2), data2);
+    cb->AddObject(context, &meta1, sizeof(data2), data2);
+    rc = cb->DestroyObjects(context, 0, NULL);
+
+    /* Objects after the checkpoint, one replacing an object within it */
+    cb->AddObject(context, &meta3, sizeof(data3), data3);
+    cb->AddObject(context, &meta2, sizeof(data1), data1);
+    memcpy(&before, &context->directory, sizeof(before));
+    cb->Cleanup(context);
+    printf("--Checkpoint reclaim:%d\n", rc);
+
+    /* Mount using BlankCheck and using bulk reads */
+    for (i = 0; i < 2; i++) {
+        cp_config.bulk_mount = i;
+        memset(context, 0, sizeof(*context));
+        memset(out, 0, sizeof(out));
+        rc = cb->Init(context, &cp_config);
+        if (rc == 0) {
+            rc = cb->Read(context, meta2.id, 0, sizeof(out), out);
+        }
+        printf("--Checkpoint bulk:%d mount:%d checkpoint:%d "
+                "directories match:%d data match:%d\n",
+                i, rc, context->checkpoint_mounted,
+                _NvmDirectoryMatch(&before, &context->directory),
+                memcmp(out, data1, sizeof(data1)) == 0);
+        if (i == 0) {
+            cb->Cleanup(context);
+        }
+    }
+    _ShowAvailable(cb, context);
+
+    cb->DestroyObjects(context, sizeof(ids)/sizeof(ids[0]), ids);
+    cb->Cleanup(context);
+}
+#endif
+
+/* Transport memory configuration */
+static uint8_t req[BUFFER_SIZE];
+static uint8_t resp[BUFFER_SIZE];
+whTransportMemConfig tmcf[1] = {{
+        .req = (whTransportMemCsr*)req,
+        .req_size = sizeof(req),
+        .resp = (whTransportMemCsr*)resp,
+        .resp_size = sizeof(resp),
+}};
+
+/* Byte swaps of the other endianness, and native fields left as they are */
+void wh_Comm_TranslateTest(void)
+{
+    static whMessageCommLenData src;
+    static whMessageCommLenData dest;
+    uint16_t magic = WH_COMM_MAGIC_NATIVE;
+    int ok = 1;
+
+    ok &= (wh_Translate16(magic, 0x1122) == 0x1122);
+    ok &= (wh_Translate32(magic, 0x11223344ul) == 0x11223344ul);
+    ok &= (wh_Translate64(magic, 0x1122334455667788ull) ==
+            0x1122334455667788ull);
+#ifndef WOLFHSM_COMM_NATIVE_ONLY
+    magic = WH_COMM_MAGIC_SWAP;
+    ok &= (wh_Translate16(magic, 0x1122) == 0x2211);
+    ok &= (wh_Translate32(magic, 0x11223344ul) == 0x44332211ul);
+    ok &= (wh_Translate64(magic, 0x1122334455667788ull) ==
+            0x8877665544332211ull);
+#endif
+    printf("--Translate ok:%d\n", ok);
+
+    /* Only len bytes are copied, and nothing in place */
+    memset(&src, 0xAA, sizeof(src));
+    memset(&dest, 0, sizeof(dest));
+    src.len = wh_Translate16(magic, 5);
+    wh_MessageComm_TranslateLenData(magic, &src, &dest);
+    ok = (dest.len == 5) && (memcmp(dest.data, src.data, 5) == 0) &&
+            (dest.data[5] == 0);
+    wh_MessageComm_TranslateLenData(magic, &src, &src);
+    ok &= (src.len == 5) && (src.data[0] == 0xAA);
+    printf("--Translate LenData ok:%d\n", ok);
+}
+
+void wh_CommClientServer_Test(void)
+{
+    /* Client configuration/contexts */
+    whTransportClientCb tccb[1] = {WH_TRANSPORT_MEM_CLIENT_CB};
+    whTransportMemClientContext tmcc[1] = {0};
+    whCommClientConfig c_conf[1] = {{
+            .transport_cb = tccb,
+            .transport_context = (void*)tmcc,
+            .transport_config = (void*)tmcf,
+            .client_id = 1234,
+    }};
+    whCommClient client[1] = {0};
+
+    /* Server configuration/contexts */
+    whTransportServerCb tscb[1] = {WH_TRANSPORT_MEM_SERVER_CB};
+    whTransportMemServerContext tmsc[1] = {0};
+    whCommServerConfig s_conf[1] = {{
+            .transport_cb = tscb,
+            .transport_context = (void*)tmsc,
+            .transport_config = (void*)tmcf,
+            .server_id = 5678,
+    }};
+    whCommServer server[1] = {0};
+
+    int ret = 0;
+    ret = wh_CommClient_Init(client, c_conf);
+    printf("CommClientInit:%d\n", ret);
+
+    ret = wh_CommServer_Init(server, s_conf);
+    printf("CommServerInit:%d\n", ret);
+
+    int counter = 1;
+
+    uint8_t  tx_req[REQ_SIZE] = {0};
+    uint16_t tx_req_len = 0;
+    uint16_t tx_req_flags = WH_COMM_MAGIC_NATIVE;
+    uint16_t tx_req_type = 0;
+    uint16_t tx_req_seq = 0;
+
+    uint8_t  rx_req[REQ_SIZE] = {0};
+    uint16_t rx_req_len = 0;
+    uint16_t rx_req_flags = 0;
+    uint16_t rx_req_type = 0;
+    uint16_t rx_req_seq = 0;
+
+    uint8_t  tx_resp[REQ_SIZE] = {0};
+    uint16_t tx_resp_len = 0;
+
+    uint8_t  rx_resp[REQ_SIZE] = {0};
+    uint16_t rx_resp_len = 0;
+    uint16_t rx_resp_flags = 0;
+    uint16_t rx_resp_type = 0;
+    uint16_t rx_resp_seq = 0;
+
+    /* Check that neither side is ready to recv */
+    ret = wh_CommServer_RecvRequest(server,
+            &rx_req_flags, &rx_req_type, &rx_req_seq,
+            &rx_req_len, rx_req);
+    printf("Server initial RecvRequest:%d\n", ret);
+
+    for(counter = 0; counter < REPEAT_COUNT; counter++)
+    {
+        sprintf((char*)tx_req,"Request:%u",counter);
+        tx_req_len = strlen((char*)tx_req);
+        tx_req_type = counter*2;
+        ret = wh_CommClient_SendRequest(client,
+                tx_req_flags, tx_req_type, &tx_req_seq,
+                tx_req_len, tx_req);
+        printf("Client SendRequest:%d, flags %x, type:%x, seq:%d, len:%d, %s\n",
+                ret, tx_req_flags, tx_req_type, tx_req_seq, tx_req_len, tx_req);
+
+        if (counter == 0) {
+            ret = wh_CommClient_RecvResponse(client,
+                    &rx_resp_flags, &rx_resp_type, &rx_resp_seq,
+                    &rx_resp_len, rx_resp);
+            printf("Client initial RecvResponse:%d\n", ret);
+            ret = wh_CommClient_SendRequest(client,
+                    tx_req_flags, tx_req_type, &tx_req_seq,
+                    tx_req_len, tx_req);
+            printf("Client duplicate SendRequest:%d\n",ret);
+        }
+
+        ret = wh_CommServer_RecvRequest(server,
+                &rx_req_flags, &rx_req_type, &rx_req_seq,
+                &rx_req_len, rx_req);
+        printf("Server RecvRequest:%d, flags %x, type:%x, seq:%d, len:%d, %s\n",
+                        ret, rx_req_flags, rx_req_type, rx_req_seq, rx_req_len, rx_req);
+
+        sprintf((char*)tx_resp,"Response:%s",rx_req);
+        tx_resp_len = strlen((char*)tx_resp);
+        ret = wh_CommServer_SendResponse(server,
+                rx_req_flags, rx_req_type, rx_req_seq,
+                tx_resp_len, tx_resp);
+        printf("Server SendResponse:%d, flags %x, type:%x, seq:%d, len:%d, %s\n",
+                        ret, rx_req_flags, rx_req_type, rx_req_seq, tx_resp_len, tx_resp);
+
+        ret = wh_CommClient_RecvResponse(client,
+                &rx_resp_flags, &rx_resp_type, &rx_resp_seq,
+                &rx_resp_len, rx_resp);
+        printf("Client RecvResponse:%d, flags %x, type:%x, seq:%d, len:%d, %s\n",
+                        ret, rx_resp_flags, rx_resp_type, rx_resp_seq, rx_resp_len, rx_resp);
+
+    }
+
+    ret = wh_CommServer_Cleanup(server);
+    printf("CommServerCleanup:%d\n", ret);
+
+    ret = wh_CommClient_Cleanup(client);
+    printf("CommClientCleanup:%d\n", ret);
+}
+
+
+
+
+
+static void* _whCommClientTask(void *cf)
+{
+    whCommClientConfig* config = (whCommClientConfig*)cf;
+    int ret = 0;
+    whCommClient client[1];
+    int counter = 1;
+
+    uint8_t  tx_req[REQ_SIZE] = {0};
+    uint16_t tx_req_len = 0;
+    uint16_t tx_req_flags = WH_COMM_MAGIC_NATIVE;
+    uint16_t tx_req_type = 0;
+    uint16_t tx_req_seq = 0;
+
+    uint8_t  rx_resp[RESP_SIZE] = {0};
+    uint16_t rx_resp_len = 0;
+    uint16_t rx_resp_flags = 0;
+    uint16_t rx_resp_type = 0;
+    uint16_t rx_resp_seq = 0;
+
+    if (config == NULL) {
+        return NULL;
+    }
+
+    ret = wh_CommClient_Init(client, config);
+    printf("CommClientInit:%d\n", ret);
+
+    for(counter = 0; counter < REPEAT_COUNT; counter++)
+    {
+        sprintf((char*)tx_req,"Request:%u",counter);
+        tx_req_len = strlen((char*)tx_req);
+        tx_req_type = counter*2;
+        do {
+            ret = wh_CommClient_SendRequest(client,
+                    tx_req_flags, tx_req_type, &tx_req_seq,
+                    tx_req_len, tx_req);
+            printf("Client SendRequest:%d, flags %x, type:%x, seq:%d, len:%d, %s\n",
+                    ret, tx_req_flags, tx_req_type, tx_req_seq, tx_req_len, tx_req);
+        } while ((ret == WH_ERROR_NOTREADY) && (usleep(ONE_MS)==0));
+
+        if (ret != 0) {
+            printf("Client had failure. Exiting\n");
+            break;
+        }
+
+        do {
+        ret = wh_CommClient_RecvResponse(client,
+                &rx_resp_flags, &rx_resp_type, &rx_resp_seq,
+                &rx_resp_len, rx_resp);
+        printf("Client RecvResponse:%d, flags %x, type:%x, seq:%d, len:%d, %s\n",
+                        ret, rx_resp_flags, rx_resp_type, rx_resp_seq, rx_resp_len, rx_resp);
+        } while ((ret == WH_ERROR_NOTREADY) && (usleep(ONE_MS)==0));
+
+        if (ret != 0) {
+            printf("Client had failure. Exiting\n");
+            break;
+        }
+
+    }
+
+    ret = wh_CommClient_Cleanup(client);
+    printf("CommClientCleanup:%d\n", ret);
+    return NULL;
+}
+
+static void* _whCommServerTask(void* cf)
+{
+    whCommServerConfig* config = (whCommServerConfig*)cf;
+    int ret = 0;
+    whCommServer server[1];
+    int counter = 1;
+
+    ret = wh_CommServer_Init(server, config);
+    printf("CommServerInit:%d\n", ret);
+
+    uint8_t  rx_req[REQ_SIZE] = {0};
+    uint16_t rx_req_len = 0;
+    uint16_t rx_req_flags = 0;
+    uint16_t rx_req_type = 0;
+    uint16_t rx_req_seq = 0;
+
+    uint8_t  tx_resp[RESP_SIZE] = {0};
+    uint16_t tx_resp_len = 0;
+
+    for(counter = 0; counter < REPEAT_COUNT; counter++)
+    {
+        do {
+            ret = wh_CommServer_RecvRequest(server,
+                    &rx_req_flags, &rx_req_type, &rx_req_seq,
+                    &rx_req_len, rx_req);
+            printf("Server RecvRequest:%d, flags %x, type:%x, seq:%d, len:%d, %s\n",
+                            ret, rx_req_flags, rx_req_type, rx_req_seq, rx_req_len, rx_req);
+        } while ((ret == WH_ERROR_NOTREADY) && (usleep(ONE_MS)==0));
+
+        if (ret != 0) {
+            printf("Server had failure. Exiting\n");
+            break;
+        }
+
+        do {
+            sprintf((char*)tx_resp,"Response:%s",rx_req);
+            tx_resp_len = strlen((char*)tx_resp);
+            ret = wh_CommServer_SendResponse(server,
+                    rx_req_flags, rx_req_type, rx_req_seq,
+                    tx_resp_len, tx_resp);
+            printf("Server SendResponse:%d, flags %x, type:%x, seq:%d, len:%d, %s\n",
+                            ret, rx_req_flags, rx_req_type, rx_req_seq, tx_resp_len, tx_resp);
+        } while ((ret == WH_ERROR_NOTREADY) && (usleep(ONE_MS)==0));
+
+        if (ret != 0) {
+            printf("Server had failure. Exiting\n");
+            break;
+        }
+    }
+
+    ret = wh_CommServer_Cleanup(server);
+    printf("CommServerCleanup:%d\n", ret);
+
+    return NULL;
+}
+
+static void _whCommClientServerThreadTest( whCommClientConfig* c_conf,
+                                    whCommServerConfig* s_conf)
+{
+    pthread_t cthread;
+    pthread_t sthread;
+
+    void* retval;
+    int rc = 0;
+
+    rc = pthread_create(&sthread, NULL, _whCommServerTask, s_conf);
+    printf("Server thread create:%d\n", rc);
+    if (rc == 0) {
+        rc = pthread_create(&cthread, NULL, _whCommClientTask, c_conf);
+        printf("Client thread create:%d\n", rc);
+        if (rc == 0) {
+            /* All good. Block on joining */
+
+            pthread_join(cthread, &retval);
+            pthread_join(sthread, &retval);
+        } else {
+            /* Cancel the server thread */
+            pthread_cancel(sthread);
+            pthread_join(sthread, &retval);
+
+        }
+    }
+}
+
+void wh_CommClientServer_MemThreadTest(void)
+{
+    /* Client configuration/contexts */
+    whTransportClientCb tmccb[1] = {WH_TRANSPORT_MEM_CLIENT_CB};
+    whTransportMemClientContext csc[1] = {};
+    whCommClientConfig c_conf[1] = {{
+            .transport_cb = tmccb,
+            .transport_context = (void*)csc,
+            .transport_config = (void*)tmcf,
+            .client_id = 1234,
+    }};
+
+    /* Server configuration/contexts */
+    whTransportServerCb tmscb[1] = {WH_TRANSPORT_MEM_SERVER_CB};
+    whTransportMemServerContext css[1] = {};
+    whCommServerConfig s_conf[1] = {{
+            .transport_cb = tmscb,
+            .transport_context = (void*)css,
+            .transport_config = (void*)tmcf,
+            .server_id = 5678,
+    }};
+
+    _whCommClientServerThreadTest(c_conf, s_conf);
+}
+
+posixTransportTcpConfig mytcpconfig[1] = {{
+        .server_ip_string = "127.0.0.1",
+        .server_port = 23456,
+}};
+
+void wh_CommClientServer_TcpThreadTest(void)
+{
+    /* Client configuration/contexts */
+    whTransportClientCb pttccb[1] = {PTT_CLIENT_CB};
+    posixTransportTcpClientContext tcc[1] = {};
+    whCommClientConfig c_conf[1] = {{
+            .transport_cb = pttccb,
+            .transport_context = (void*)tcc,
+            .transport_config = (void*)mytcpconfig,
+            .client_id = 1234,
+    }};
+
+    /* Server configuration/contexts */
+    whTransportServerCb pttscb[1] = {PTT_SERVER_CB};
+
+    posixTransportTcpServerContext tss[1] = {};
+    whCommServerConfig s_conf[1] = {{
+            .transport_cb = pttscb,
+            .transport_context = (void*)tss,
+            .transport_config = (void*)mytcpconfig,
+            .server_id = 5678,
+    }};
+
+    _whCommClientServerThreadTest(c_conf, s_conf);
+}
+
+posixTransportTcpConfig mytcppartialconfig[1] = {{
+        .server_ip_string = "127.0.0.1",
+        .server_port = 23459,
+}};
+
+/* Size and fill byte of the seq'th request of the partial send test */
+static uint16_t _whTcpPartialFill(uint8_t* req, uint32_t seq)
+{
+    uint16_t size = (uint16_t)(PTT_PACKET_MAX_SIZE - (seq % 16));
+    memset(req, (uint8_t)seq, size);
+    memcpy(req, &seq, sizeof(seq));
+    return size;
+}
+
+/* Serve one request if available and check it is the recvd'th request */
+static int _whTcpPartialServe(posixTransportTcpServerContext* tss,
+        posixTransportTcpClientContext* tcc, uint32_t* recvd, int* match)
+{
+    static uint8_t rx[PTT_PACKET_MAX_SIZE];
+    static uint8_t expect[PTT_PACKET_MAX_SIZE];
+    uint16_t rx_size = 0;
+    uint16_t size = 0;
+    int ret = 0;
+
+    ret = posixTransportTcp_RecvRequest(tss, &rx_size, rx);
+    if (ret != 0) {
+        return ret;
+    }
+    size = _whTcpPartialFill(expect, *recvd);
+    if ((rx_size != size) || (memcmp(rx, expect, size) != 0)) {
+        *match = 0;
+    }
+    (*recvd)++;
+    do {
+        ret = posixTransportTcp_SendResponse(tss, 1, rx);
+    } while (ret == WH_ERROR_NOTREADY);
+    /* Keep the responses from filling the client's socket */
+    (void)posixTransportTcp_RecvResponse(tcc, &rx_size, rx);
+    return ret;
+}
+
+/* A request cut short by a full socket is finished from the transport's own
+ * copy, even though the caller has reused its buffer in the meantime */
+void wh_CommClientServer_TcpPartialSendTest(void)
+{
+    static uint8_t req[PTT_PACKET_MAX_SIZE];
+    posixTransportTcpClientContext tcc[1] = {};
+    posixTransportTcpServerContext tss[1] = {};
+    uint16_t size = 0;
+    uint32_t sent = 0;
+    uint32_t recvd = 0;
+    int partial = 0;
+    int resize = 0;
+    int match = 1;
+    int ret = 0;
+    int i = 0;
+
+    ret = posixTransportTcp_InitListen(tss, mytcppartialconfig);
+    printf("TcpPartial InitListen:%d\n", ret);
+    ret = posixTransportTcp_InitConnect(tcc, mytcppartialconfig);
+    printf("TcpPartial InitConnect:%d\n", ret);
+
+    /* Serve the first request to accept the connection.  The accepted socket
+     * may block, so make it non-blocking to serve from this thread */
+    size = _whTcpPartialFill(req, sent);
+    for (i = 0; i < 1000; i++) {
+        ret = posixTransportTcp_SendRequest(tcc, size, req);
+        if (ret != WH_ERROR_NOTREADY) {
+            break;
+        }
+        usleep(1000);
+    }
+    if (ret == 0) {
+        sent++;
+        (void)_whTcpPartialServe(tss, tcc, &recvd, &match);
+    }
+    if (tss->accept_fd_p1 != 0) {
+        ret = fcntl(tss->accept_fd_p1 - 1, F_GETFL, 0);
+        (void)fcntl(tss->accept_fd_p1 - 1, F_SETFL, ret | O_NONBLOCK);
+    }
+
+    /* Send without serving until a request is only partly written */
+    for (i = 0; (i < 100000) && (partial == 0); i++) {
+        size = _whTcpPartialFill(req, sent);
+        ret = posixTransportTcp_SendRequest(tcc, size, req);
+        if (ret == 0) {
+            sent++;
+        } else if (ret != WH_ERROR_NOTREADY) {
+            break;
+        } else if (tcc->send_offset != 0) {
+            partial = 1;
+        } else {
+            /* Full at a frame boundary.  Make room and try again */
+            (void)_whTcpPartialServe(tss, tcc, &recvd, &match);
+        }
+    }
+
+    /* Reuse the caller's buffer.  A different size must be rejected */
+    memset(req, 0xFF, sizeof(req));
+    ret = posixTransportTcp_SendRequest(tcc, size - 1, req);
+    resize = (ret == WH_ERROR_BADARGS);
+
+    /* Serve everything while retrying the cut request */
+    for (i = 0; (i < 100000) && (partial != 0) &&
+            ((tcc->send_offset != 0) || (recvd < sent)); i++) {
+        if (tcc->send_offset != 0) {
+            ret = posixTransportTcp_SendRequest(tcc, size, req);
+            if (ret == 0) {
+                sent++;
+            }
+        }
+        (void)_whTcpPartialServe(tss, tcc, &recvd, &match);
+    }
+    printf("TcpPartial partial ok:%d resize ok:%d sent:%u recvd:%u match:%d\n",
+            partial, resize, (unsigned)sent, (unsigned)recvd,
+            match && (recvd == sent));
+
+    (void)posixTransportTcp_CleanupConnect(tcc);
+    (void)posixTransportTcp_CleanupListen(tss);
+}
+
+posixTransportUnixConfig myunixconfig[1] = {{
+        .socket_path = "/tmp/wh_test.sock",
+}};
+
+void wh_CommClientServer_UnixThreadTest(void)
+{
+    /* Client configuration/contexts */
+    whTransportClientCb ptuccb[1] = {PTU_CLIENT_CB};
+    posixTransportUnixClientContext tuc[1] = {};
+    whCommClientConfig c_conf[1] = {{
+            .transport_cb = ptuccb,
+            .transport_context = (void*)tuc,
+            .transport_config = (void*)myunixconfig,
+            .client_id = 1234,
+    }};
+
+    /* Server configuration/contexts */
+    whTransportServerCb ptuscb[1] = {PTU_SERVER_CB};
+    posixTransportUnixServerContext tus[1] = {};
+    whCommServerConfig s_conf[1] = {{
+            .transport_cb = ptuscb,
+            .transport_context = (void*)tus,
+            .transport_config = (void*)myunixconfig,
+            .server_id = 5678,
+    }};
+
+    _whCommClientServerThreadTest(c_conf, s_conf);
+}
+
+posixTransportShmConfig myshmconfig[1] = {{
+        .name = "/wh_test_shm",
+        .req_size = BUFFER_SIZE,
+        .resp_size = BUFFER_SIZE,
+}};
+
+void wh_CommClientServer_ShmThreadTest(void)
+{
+    /* Client configuration/contexts */
+    whTransportClientCb ptshmccb[1] = {PTSHM_CLIENT_CB};
+    posixTransportShmContext tshmc[1] = {};
+    whCommClientConfig c_conf[1] = {{
+            .transport_cb = ptshmccb,
+            .transport_context = (void*)tshmc,
+            .transport_config = (void*)myshmconfig,
+            .client_id = 1234,
+    }};
+
+    /* Server configuration/contexts */
+    whTransportServerCb ptshmscb[1] = {PTSHM_SERVER_CB};
+    posixTransportShmContext tshms[1] = {};
+    whCommServerConfig s_conf[1] = {{
+            .transport_cb = ptshmscb,
+            .transport_context = (void*)tshms,
+            .transport_config = (void*)myshmconfig,
+            .server_id = 5678,
+    }};
+
+    _whCommClientServerThreadTest(c_conf, s_conf);
+}
+
+static void* _whClientTask(void *cf)
+{
+    whClientConfig* config = (whClientConfig*)cf;
+    int ret = 0;
+    whClient client[1];
+    int counter = 1;
+
+    uint8_t  tx_req[REQ_SIZE] = {0};
+    uint16_t tx_req_len = 0;
+
+    uint8_t  rx_resp[RESP_SIZE] = {0};
+    uint16_t rx_resp_len = 0;
+    uint32_t polls = 0;
+
+    if (config == NULL) {
+        return NULL;
+    }
+
+    ret = wh_Client_Init(client, config);
+    printf("wh_Client_Init:%d\n", ret);
+
+    for(counter = 0; counter < REPEAT_COUNT; counter++)
+    {
+        sprintf((char*)tx_req,"Request:%u",counter);
+        tx_req_len = strlen((char*)tx_req);
+        polls = 0;
+        do {
+            ret = wh_Client_EchoRequest(client,
+                    tx_req_len, tx_req);
+            printf("Client EchoRequest:%d, len:%d, %s\n",
+                    ret, tx_req_len, tx_req);
+        } while (   (ret == WH_ERROR_NOTREADY) &&
+                    (wh_CommClient_Wait(client->comm, &polls) == 0));
+
+        if (ret != 0) {
+            printf("Client had failure. Exiting\n");
+            break;
+        }
+
+        rx_resp_len = 0;
+        memset(rx_resp, 0, sizeof(rx_resp));
+
+        polls = 0;
+        do {
+            ret = wh_Client_EchoResponse(client,
+                    &rx_resp_len, rx_resp);
+            if (ret != WH_ERROR_NOTREADY) {
+                printf("Client EchoResponse:%d, len:%d, %s\n",
+                        ret, rx_resp_len, rx_resp);
+            }
+        } while (   (ret == WH_ERROR_NOTREADY) &&
+                    (wh_CommClient_Wait(client->comm, &polls) == 0));
+
+        if (ret != 0) {
+            printf("Client had failure. Exiting\n");
+            break;
+        }
+    }
+
+    ret = wh_Client_Cleanup(client);
+    printf("wh_Client_Cleanup:%d\n", ret);
+    return NULL;
+}
+
+static void* _whServerTask(void* cf)
+{
+    whServerConfig* config = (whServerConfig*)cf;
+    int ret = 0;
+    whServer server[1];
+    int counter = 1;
+    uint32_t polls = 0;
+
+    if (config == NULL) {
+        return NULL;
+    }
+
+    ret = wh_Server_Init(server, config);
+    printf("wh_Server_Init:%d\n", ret);
+
+    for(counter = 0; counter < REPEAT_COUNT; counter++)
+    {
+        polls = 0;
+        do {
+            ret = wh_Server_HandleRequestMessage(server);
+            if (ret != WH_ERROR_NOTREADY) {
+                printf("Server HandleRequestMessage:%d\n",ret);
+            }
+        } while (   (ret == WH_ERROR_NOTREADY) &&
+                    (wh_Server_Wait(server, &polls) == 0));
+
+        if (ret != 0) {
+            printf("Server had failure. Exiting\n");
+            break;
+        } else {
+            printf("Server processed message %d of %d\n", counter, REPEAT_COUNT);
+        }
+    }
+    ret = wh_Server_Cleanup(server);
+    printf("ServerCleanup:%d\n", ret);
+
+    return NULL;
+}
+
+static void _whClientServerThreadTest(  whClientConfig* c_conf,
+                                whServerConfig* s_conf)
+{
+    pthread_t cthread;
+    pthread_t sthread;
+
+    void* retval;
+    int rc = 0;
+
+    rc = pthread_create(&sthread, NULL, _whServerTask, s_conf);
+    printf(" WH Server thread create:%d\n", rc);
+    if (rc == 0) {
+        rc = pthread_create(&cthread, NULL, _whClientTask, c_conf);
+        printf("WH Client thread create:%d\n", rc);
+        if (rc == 0) {
+            /* All good. Block on joining */
+
+            pthread_join(cthread, &retval);
+            pthread_join(sthread, &retval);
+        } else {
+            /* Cancel the server thread */
+            pthread_cancel(sthread);
+            pthread_join(sthread, &retval);
 
-        if (ret != 0) {
-            printf("Client had failure. Exiting\n");
-            break;
         }
+    }
+}
+
+void wh_ClientServer_TcpThreadTest(void)
+{
+    /* Client configuration/contexts */
+    whTransportClientCb pttccb[1] = {PTT_CLIENT_CB};
+    posixTransportTcpClientContext tcc[1] = {};
+    whCommClientConfig cc_conf[1] = {{
+            .transport_cb = pttccb,
+            .transport_context = (void*)tcc,
+            .transport_config = (void*)mytcpconfig,
+            .client_id = 1234,
+    }};
+    whClientConfig c_conf[1] = {{
+            .comm = cc_conf,
+            /*.nvm = NULL, */
+    }};
+
+    /* Server configuration/contexts */
+    whTransportServerCb pttscb[1] = {PTT_SERVER_CB};
+    posixTransportTcpServerContext tsc[1] = {};
+    whCommServerConfig cs_conf[1] = {{
+            .transport_cb = pttscb,
+            .transport_context = (void*)tsc,
+            .transport_config = (void*)mytcpconfig,
+            .server_id = 5678,
+    }};
+    whServerConfig s_conf[1] = {{
+            .comm = cs_conf,
+            /*.nvm = NULL, */
+    }};
+
+    _whClientServerThreadTest(c_conf, s_conf);
+
+}
+
+enum {
+    TCP_MULTI_CLIENT_COUNT = 3,
+};
+
+posixTransportTcpConfig mytcpmulticonfig[1] = {{
+        .server_ip_string = "127.0.0.1",
+        .server_port = 23457,
+}};
+
+static void* _whServerMultiTask(void* cf)
+{
+    whServerConfig* config = (whServerConfig*)cf;
+    int ret = 0;
+    whServer server[1];
+    int counter = 0;
+    uint32_t polls = 0;
+
+    ret = wh_Server_Init(server, config);
+    printf("Multi TCP wh_Server_Init:%d\n", ret);
+
+    for (counter = 0; (ret == 0) &&
+            (counter < TCP_MULTI_CLIENT_COUNT * REPEAT_COUNT); counter++) {
+        polls = 0;
+        do {
+            ret = wh_Server_HandleRequestMessage(server);
+        } while (   (ret == WH_ERROR_NOTREADY) &&
+                    (wh_Server_Wait(server, &polls) == 0));
+    }
+    printf("Multi TCP server handled:%d of %d, ret:%d\n",
+            counter, TCP_MULTI_CLIENT_COUNT * REPEAT_COUNT, ret);
+
+    ret = wh_Server_Cleanup(server);
+    printf("Multi TCP ServerCleanup:%d\n", ret);
+    return NULL;
+}
 
-        do {
-        ret = wh_CommClient_RecvResponse(client,
-                &rx_resp_flags, &rx_resp_type, &rx_resp_seq,
-                &rx_resp_len, rx_resp);
-        printf("Client RecvResponse:%d, flags %x, type:%x, seq:%d, len:%d, %s\n",
-                        ret, rx_resp_flags, rx_resp_type, rx_resp_seq, rx_resp_len, rx_resp);
-        } while ((ret == WH_ERROR_NOTREADY) && (usleep(ONE_MS)==0));
+/* Several clients served concurrently by the multi-connection TCP server */
+void wh_ClientServer_TcpMultiThreadTest(void)
+{
+    whTransportClientCb pttccb[1] = {PTT_CLIENT_CB};
+    posixTransportTcpClientContext tcc[TCP_MULTI_CLIENT_COUNT] = {};
+    whCommClientConfig cc_conf[TCP_MULTI_CLIENT_COUNT] = {};
+    whClientConfig c_conf[TCP_MULTI_CLIENT_COUNT] = {};
 
-        if (ret != 0) {
-            printf("Client had failure. Exiting\n");
+    whTransportServerCb pttmscb[1] = {PTT_MULTI_SERVER_CB};
+    posixTransportTcpMultiServerContext tmsc[1] = {};
+    whCommServerConfig cs_conf[1] = {{
+            .transport_cb = pttmscb,
+            .transport_context = (void*)tmsc,
+            .transport_config = (void*)mytcpmulticonfig,
+            .server_id = 5678,
+    }};
+    whServerConfig s_conf[1] = {{
+            .comm = cs_conf,
+    }};
+
+    pthread_t sthread;
+    pthread_t cthread[TCP_MULTI_CLIENT_COUNT];
+    void* retval;
+    int i = 0;
+    int rc = 0;
+
+    rc = pthread_create(&sthread, NULL, _whServerMultiTask, s_conf);
+    printf("Multi TCP server thread create:%d\n", rc);
+    if (rc != 0) {
+        return;
+    }
+    for (i = 0; i < TCP_MULTI_CLIENT_COUNT; i++) {
+        cc_conf[i].transport_cb = pttccb;
+        cc_conf[i].transport_context = (void*)&tcc[i];
+        cc_conf[i].transport_config = (void*)mytcpmulticonfig;
+        cc_conf[i].client_id = 100 + i;
+        c_conf[i].comm = &cc_conf[i];
+        rc = pthread_create(&cthread[i], NULL, _whClientTask, &c_conf[i]);
+        printf("Multi TCP client thread create:%d\n", rc);
+        if (rc != 0) {
             break;
         }
+    }
+    if (rc != 0) {
+        /* Cancel the server thread */
+        pthread_cancel(sthread);
+    }
+    while (i > 0) {
+        pthread_join(cthread[--i], &retval);
+    }
+    pthread_join(sthread, &retval);
+}
+
+/* Memory transport doorbell using a POSIX condition variable */
+typedef struct {
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+    uint32_t notifies;
+} testDoorbell;
+
+static int _testDoorbell_Notify(void* c, volatile whTransportMemCsr* csr)
+{
+    testDoorbell* db = c;
+    (void)csr;
 
+    pthread_mutex_lock(&db->mutex);
+    db->notifies++;
+    pthread_cond_broadcast(&db->cond);
+    pthread_mutex_unlock(&db->mutex);
+    return 0;
+}
+
+static int _testDoorbell_Wait(void* c, volatile whTransportMemCsr* csr,
+        uint64_t expected, uint32_t timeout_us)
+{
+    testDoorbell* db = c;
+    struct timespec ts;
+    int rc = 0;
+
+    clock_gettime(CLOCK_REALTIME, &ts);
+    ts.tv_sec += timeout_us / 1000000;
+    ts.tv_nsec += (long)(timeout_us % 1000000) * 1000;
+    if (ts.tv_nsec >= 1000000000) {
+        ts.tv_sec++;
+        ts.tv_nsec -= 1000000000;
     }
 
-    ret = wh_CommClient_Cleanup(client);
-    printf("CommClientCleanup:%d\n", ret);
-    return NULL;
+    pthread_mutex_lock(&db->mutex);
+    if (csr->u64 == expected) {
+        rc = pthread_cond_timedwait(&db->cond, &db->mutex, &ts);
+    }
+    pthread_mutex_unlock(&db->mutex);
+    return (rc == ETIMEDOUT) ? WH_ERROR_NOTREADY : 0;
 }
 
-static void* _whCommServerTask(void* cf)
+static const whTransportMemNotifyCb testDoorbellCb[1] = {{
+        .Notify = _testDoorbell_Notify,
+        .Wait = _testDoorbell_Wait,
+}};
+
+/* Server requests are handled in place in the shared memory buffers, and both
+ * sides block on a doorbell instead of polling */
+void wh_ClientServer_MemThreadTest(void)
 {
-    whCommServerConfig* config = (whCommServerConfig*)cf;
-    int ret = 0;
-    whCommServer server[1];
-    int counter = 1;
+    testDoorbell db[1] = {{
+            .mutex = PTHREAD_MUTEX_INITIALIZER,
+            .cond = PTHREAD_COND_INITIALIZER,
+    }};
+    whTransportMemConfig tmncf[1] = {{
+            .req = (whTransportMemCsr*)req,
+            .req_size = sizeof(req),
+            .resp = (whTransportMemCsr*)resp,
+            .resp_size = sizeof(resp),
+            .notify_cb = testDoorbellCb,
+            .notify_context = db,
+    }};
 
-    ret = wh_CommServer_Init(server, config);
-    printf("CommServerInit:%d\n", ret);
+    /* Client configuration/contexts */
+    whTransportClientCb tmccb[1] = {WH_TRANSPORT_MEM_CLIENT_CB};
+    whTransportMemClientContext tmcc[1] = {};
+    whCommClientConfig cc_conf[1] = {{
+            .transport_cb = tmccb,
+            .transport_context = (void*)tmcc,
+            .transport_config = (void*)tmncf,
+            .client_id = 1234,
+            .wait_spins = 10,
+    }};
+    whClientConfig c_conf[1] = {{
+            .comm = cc_conf,
+    }};
 
-    uint8_t  rx_req[REQ_SIZE] = {0};
-    uint16_t rx_req_len = 0;
-    uint16_t rx_req_flags = 0;
-    uint16_t rx_req_type = 0;
-    uint16_t rx_req_seq = 0;
+    /* Server configuration/contexts */
+    whTransportServerCb tmscb[1] = {WH_TRANSPORT_MEM_SERVER_CB};
+    whTransportMemServerContext tmsc[1] = {};
+    whCommServerConfig cs_conf[1] = {{
+            .transport_cb = tmscb,
+            .transport_context = (void*)tmsc,
+            .transport_config = (void*)tmncf,
+            .server_id = 5678,
+            .wait_spins = 10,
+    }};
+    whServerConfig s_conf[1] = {{
+            .comm = cs_conf,
+    }};
 
-    uint8_t  tx_resp[RESP_SIZE] = {0};
-    uint16_t tx_resp_len = 0;
+    _whClientServerThreadTest(c_conf, s_conf);
+    printf("Doorbell notifies:%u\n", db->notifies);
+}
 
-    for(counter = 0; counter < REPEAT_COUNT; counter++)
-    {
-        do {
-            ret = wh_CommServer_RecvRequest(server,
-                    &rx_req_flags, &rx_req_type, &rx_req_seq,
-                    &rx_req_len, rx_req);
-            printf("Server RecvRequest:%d, flags %x, type:%x, seq:%d, len:%d, %s\n",
-                            ret, rx_req_flags, rx_req_type, rx_req_seq, rx_req_len, rx_req);
-        } while ((ret == WH_ERROR_NOTREADY) && (usleep(ONE_MS)==0));
+/* Ring mode memory configuration with slots holding a full packet */
+enum {
+    RING_SLOT_COUNT = 4,
+    RING_BUFFER_SIZE = sizeof(whTransportMemCsr) +
+            RING_SLOT_COUNT * (sizeof(whTransportMemCsr) + WOLFHSM_COMM_MTU),
+};
+static uint64_t ring_req[RING_BUFFER_SIZE / sizeof(uint64_t)];
+static uint64_t ring_resp[RING_BUFFER_SIZE / sizeof(uint64_t)];
+whTransportMemConfig tmrcf[1] = {{
+        .req = (whTransportMemCsr*)ring_req,
+        .req_size = sizeof(ring_req),
+        .resp = (whTransportMemCsr*)ring_resp,
+        .resp_size = sizeof(ring_resp),
+        .slot_count = RING_SLOT_COUNT,
+}};
 
-        if (ret != 0) {
-            printf("Server had failure. Exiting\n");
+/* Pipeline echo requests through the ring before the server drains them */
+void wh_ClientServer_MemRingTest(void)
+{
+    /* Client configuration/contexts */
+    whTransportClientCb tmrccb[1] = {WH_TRANSPORT_MEM_RING_CLIENT_CB};
+    whTransportMemClientContext tmrcc[1] = {};
+    whCommClientConfig cc_conf[1] = {{
+            .transport_cb = tmrccb,
+            .transport_context = (void*)tmrcc,
+            .transport_config = (void*)tmrcf,
+            .client_id = 1234,
+    }};
+    whCommClient client[1] = {0};
+
+    /* Server configuration/contexts */
+    whTransportServerCb tmrscb[1] = {WH_TRANSPORT_MEM_RING_SERVER_CB};
+    whTransportMemServerContext tmrsc[1] = {};
+    whCommServerConfig cs_conf[1] = {{
+            .transport_cb = tmrscb,
+            .transport_context = (void*)tmrsc,
+            .transport_config = (void*)tmrcf,
+            .server_id = 5678,
+    }};
+    whServerConfig s_conf[1] = {{
+            .comm = cs_conf,
+    }};
+    whServer server[1];
+
+    whMessageCommLenData msg;
+    uint16_t magic = WH_COMM_MAGIC_NATIVE;
+    uint16_t type = WOLFHSM_MESSAGE_TYPE_COMM_ECHO;
+    uint16_t seq = 0;
+    uint16_t size = 0;
+    int counter = 0;
+    int ret = 0;
+
+    ret = wh_CommClient_Init(client, cc_conf);
+    printf("Ring CommClientInit:%d\n", ret);
+    ret = wh_Server_Init(server, s_conf);
+    printf("Ring wh_Server_Init:%d\n", ret);
+
+    for (counter = 0; counter < RING_SLOT_COUNT; counter++) {
+        memset(&msg, 0, sizeof(msg));
+        msg.len = sprintf((char*)msg.data, "Request:%u", counter);
+        ret = wh_CommClient_SendRequest(client, magic, type, &seq,
+                sizeof(msg), &msg);
+        printf("Ring Client SendRequest:%d, seq:%d, %s\n", ret, seq, msg.data);
+    }
+    ret = wh_CommClient_SendRequest(client, magic, type, &seq,
+            sizeof(msg), &msg);
+    printf("Ring Client SendRequest with full ring:%d\n", ret);
+
+    for (counter = 0; counter < RING_SLOT_COUNT; counter++) {
+        ret = wh_Server_HandleRequestMessage(server);
+        printf("Ring Server HandleRequestMessage:%d\n", ret);
+    }
+    ret = wh_Server_HandleRequestMessage(server);
+    printf("Ring Server HandleRequestMessage with empty ring:%d\n", ret);
+
+    for (counter = 0; counter < RING_SLOT_COUNT; counter++) {
+        memset(&msg, 0, sizeof(msg));
+        ret = wh_CommClient_RecvResponse(client, &magic, &type, &seq,
+                &size, &msg);
+        printf("Ring Client RecvResponse:%d, type:%x, seq:%d, len:%d, %s\n",
+                ret, type, seq, msg.len, msg.data);
+    }
+
+    ret = wh_Server_Cleanup(server);
+    printf("Ring ServerCleanup:%d\n", ret);
+    ret = wh_CommClient_Cleanup(client);
+    printf("Ring CommClientCleanup:%d\n", ret);
+}
+
+/* Send one request through the ring and have the server handle it */
+static int _whRingMessage(whCommClient* client, whServer* server,
+        uint16_t type, uint16_t req_size, const void* req, uint16_t* out_size,
+        void* resp)
+{
+    uint16_t magic = WH_COMM_MAGIC_NATIVE;
+    uint16_t seq = 0;
+    int passes = 0;
+    int ret = wh_CommClient_SendRequest(client, magic, type, &seq, req_size,
+            req);
+    if (ret == 0) {
+        ret = wh_Server_HandleRequestMessage(server);
+    }
+    while (ret == 0) {
+        ret = wh_CommClient_RecvResponse(client, &magic, &type, &seq,
+                out_size, resp);
+        if ((ret != WH_ERROR_NOTREADY) || (++passes > 1000)) {
             break;
         }
+        /* A DESTROYOBJECTS is answered by a later pass */
+        (void)wh_Server_HandleRequestMessage(server);
+        ret = 0;
+    }
+    return ret;
+}
 
-        do {
-            sprintf((char*)tx_resp,"Response:%s",rx_req);
-            tx_resp_len = strlen((char*)tx_resp);
-            ret = wh_CommServer_SendResponse(server,
-                    rx_req_flags, rx_req_type, rx_req_seq,
-                    tx_resp_len, tx_resp);
-            printf("Server SendResponse:%d, flags %x, type:%x, seq:%d, len:%d, %s\n",
-                            ret, rx_req_flags, rx_req_type, rx_req_seq, tx_resp_len, tx_resp);
-        } while ((ret == WH_ERROR_NOTREADY) && (usleep(ONE_MS)==0));
+/* Cache a key by message, let the idle server commit it, then evict it and
+ * export it back from NVM.  Then commit until the NVM is full */
+void wh_ClientServer_KeyMessageTest(void)
+{
+    whTransportClientCb tmrccb[1] = {WH_TRANSPORT_MEM_RING_CLIENT_CB};
+    whTransportMemClientContext tmrcc[1] = {};
+    whCommClientConfig cc_conf[1] = {{
+            .transport_cb = tmrccb,
+            .transport_context = (void*)tmrcc,
+            .transport_config = (void*)tmrcf,
+            .client_id = 1234,
+    }};
+    whCommClient client[1] = {0};
 
-        if (ret != 0) {
-            printf("Server had failure. Exiting\n");
+    const whNvmCb nvm_cb[1] = {WH_NVM_FLASH_CB};
+    whNvmFlashContext nvm[1] = {0};
+    posixFlashFileContext key_flash[1] = {0};
+    posixFlashFileConfig key_flash_config = myHalFlashConfig[0];
+    whNvmFlashConfig nvm_config = myNvmConfig;
+
+    whTransportServerCb tmrscb[1] = {WH_TRANSPORT_MEM_RING_SERVER_CB};
+    whTransportMemServerContext tmrsc[1] = {};
+    whCommServerConfig cs_conf[1] = {{
+            .transport_cb = tmrscb,
+            .transport_context = (void*)tmrsc,
+            .transport_config = (void*)tmrcf,
+            .server_id = 5678,
+    }};
+    whServerConfig s_conf[1] = {{
+            .comm = cs_conf,
+            .nvm_cb = nvm_cb,
+            .nvm_context = nvm,
+    }};
+    whServer server[1];
+
+    static whMessageKeyData key;
+    static whMessageKeyExportResponse resp;
+    unsigned char data[] = "MessageKey";
+    whMessageKeyIdRequest id_req = {
+            .id = MAKE_WOLFHSM_KEYID(WOLFHSM_KEYID_NVM, 3),
+    };
+    whNvmMetadata meta = {0};
+    uint16_t size = 0;
+    uint8_t first = 0;
+    int compacting = 0;
+    int passes = 0;
+    int ret = 0;
+    int i = 0;
+
+    key_flash_config.filename = "myKeys.bin";
+    nvm_config.context = key_flash;
+    nvm_config.config = &key_flash_config;
+    ret = nvm_cb->Init(nvm, &nvm_config);
+    if (ret == 0) {
+        ret = wh_CommClient_Init(client, cc_conf);
+    }
+    if (ret == 0) {
+        ret = wh_Server_Init(server, s_conf);
+    }
+    printf("Key message init:%d\n", ret);
+
+    memset(&key, 0, sizeof(key));
+    key.id = id_req.id;
+    key.len = sizeof(data);
+    memcpy(key.label, "MsgKey", sizeof("MsgKey"));
+    memcpy(key.data, data, sizeof(data));
+    ret = _whRingMessage(client, server, WOLFHSM_MESSAGE_TYPE_KEY_CACHE,
+            offsetof(whMessageKeyData, data) + key.len, &key, &size, &resp);
+    printf("Key message cache:%d rc:%d\n", ret, (int)resp.result.rc);
+
+    ret = wh_Server_HandleRequestMessage(server);
+    printf("Key message idle:%d committed:%d\n", ret,
+            nvm_cb->GetMetadata(nvm, id_req.id, &meta) == 0);
+
+    ret = _whRingMessage(client, server, WOLFHSM_MESSAGE_TYPE_KEY_EVICT,
+            sizeof(id_req), &id_req, &size, &resp);
+    printf("Key message evict:%d rc:%d\n", ret, (int)resp.result.rc);
+
+    memset(&resp, 0, sizeof(resp));
+    ret = _whRingMessage(client, server, WOLFHSM_MESSAGE_TYPE_KEY_EXPORT,
+            sizeof(id_req), &id_req, &size, &resp);
+    printf("Key message export:%d rc:%d len:%d label:%s data match:%d\n",
+            ret, (int)resp.result.rc, resp.key.len, resp.key.label,
+            (resp.key.len == sizeof(data)) &&
+                (memcmp(resp.key.data, data, sizeof(data)) == 0));
+
+    ret = _whRingMessage(client, server, WOLFHSM_MESSAGE_TYPE_KEY_ERASE,
+            sizeof(id_req), &id_req, &size, &resp);
+    printf("Key message erase:%d rc:%d in nvm:%d\n", ret,
+            (int)resp.result.rc,
+            nvm_cb->GetMetadata(nvm, id_req.id, &meta) == 0);
+
+    /* Commit new versions until the NVM is full.  The last stays cached and
+     * is committed by the idle passes once they reclaim the older versions */
+    key.len = WH_KEYCACHE_BUFSIZE;
+    for (i = 0; (ret == 0) && (i < 1000); i++) {
+        key.data[0] = (uint8_t)i;
+        ret = _whRingMessage(client, server, WOLFHSM_MESSAGE_TYPE_KEY_CACHE,
+                offsetof(whMessageKeyData, data) + key.len, &key, &size,
+                &resp);
+        if (ret == 0) {
+            ret = _whRingMessage(client, server,
+                    WOLFHSM_MESSAGE_TYPE_KEY_COMMIT, sizeof(id_req), &id_req,
+                    &size, &resp);
+        }
+        if (resp.result.rc != 0) {
             break;
         }
     }
+    compacting = server->nvm_compacting;
+    first = key.data[0] + 1;
+    while ((ret == 0) && (passes < 1000) && ((server->nvm_compacting != 0) ||
+            (first != key.data[0]))) {
+        (void)wh_Server_HandleRequestMessage(server);
+        passes++;
+        (void)nvm_cb->Read(nvm, id_req.id, 0, 1, &first);
+    }
+    printf("Key message full:%d rc:%d compacting:%d passes:%d ok:%d\n", ret,
+            (int)resp.result.rc, compacting, passes,
+            (resp.result.rc == WH_ERROR_NOSPACE) && (compacting != 0) &&
+                (passes > 1) && (first == key.data[0]));
+
+    wh_Server_Cleanup(server);
+    wh_CommClient_Cleanup(client);
+    nvm_cb->Cleanup(nvm);
+}
 
-    ret = wh_CommServer_Cleanup(server);
-    printf("CommServerCleanup:%d\n", ret);
+/* Number of flash programs to fail, to test recovery from a failed write */
+static int _whFlashFailPrograms = 0;
 
-    return NULL;
+static int _whFailingFlashProgram(void* c, uint32_t offset, uint32_t size,
+        const uint8_t* data)
+{
+    if (_whFlashFailPrograms > 0) {
+        _whFlashFailPrograms--;
+        return WH_ERROR_ABORTED;
+    }
+    return posixFlashFile_Program(c, offset, size, data);
 }
 
-static void _whCommClientServerThreadTest( whCommClientConfig* c_conf,
-                                    whCommServerConfig* s_conf)
+/* POSIX flash whose programs fail while _whFlashFailPrograms is nonzero */
+#define TEST_FAILING_FLASH_CB                       \
+{                                                   \
+    .Init = posixFlashFile_Init,                    \
+    .Cleanup = posixFlashFile_Cleanup,              \
+    .PartitionSize = posixFlashFile_PartitionSize,  \
+    .WriteLock = posixFlashFile_WriteLock,          \
+    .WriteUnlock = posixFlashFile_WriteUnlock,      \
+    .Read = posixFlashFile_Read,                    \
+    .Program = _whFailingFlashProgram,              \
+    .Erase = posixFlashFile_Erase,                  \
+    .Verify = posixFlashFile_Verify,                \
+    .BlankCheck = posixFlashFile_BlankCheck,        \
+    .Copy = posixFlashFile_Copy,                    \
+    .Sync = posixFlashFile_Sync,                    \
+}
+
+/* Add config objects by message, then enumerate them with LISTMETADATA and
+ * load them all with one READMULTI */
+void wh_ClientServer_NvmMessageTest(void)
 {
-    pthread_t cthread;
-    pthread_t sthread;
+    whTransportClientCb tmrccb[1] = {WH_TRANSPORT_MEM_RING_CLIENT_CB};
+    whTransportMemClientContext tmrcc[1] = {};
+    whCommClientConfig cc_conf[1] = {{
+            .transport_cb = tmrccb,
+            .transport_context = (void*)tmrcc,
+            .transport_config = (void*)tmrcf,
+            .client_id = 1234,
+    }};
+    whCommClient client[1] = {0};
 
-    void* retval;
-    int rc = 0;
+    const whNvmCb nvm_cb[1] = {WH_NVM_FLASH_CB};
+    whNvmFlashContext nvm[1] = {0};
+    posixFlashFileContext msg_flash[1] = {0};
+    posixFlashFileConfig msg_flash_config = myHalFlashConfig[0];
+    whNvmFlashConfig nvm_config = myNvmConfig;
+    const whFlashCb msg_flash_cb[1] = {TEST_FAILING_FLASH_CB};
 
-    rc = pthread_create(&sthread, NULL, _whCommServerTask, s_conf);
-    printf("Server thread create:%d\n", rc);
-    if (rc == 0) {
-        rc = pthread_create(&cthread, NULL, _whCommClientTask, c_conf);
-        printf("Client thread create:%d\n", rc);
-        if (rc == 0) {
-            /* All good. Block on joining */
+    whTransportServerCb tmrscb[1] = {WH_TRANSPORT_MEM_RING_SERVER_CB};
+    whTransportMemServerContext tmrsc[1] = {};
+    whCommServerConfig cs_conf[1] = {{
+            .transport_cb = tmrscb,
+            .transport_context = (void*)tmrsc,
+            .transport_config = (void*)tmrcf,
+            .server_id = 5678,
+    }};
+    whServerConfig s_conf[1] = {{
+            .comm = cs_conf,
+            .nvm_cb = nvm_cb,
+            .nvm_context = nvm,
+    }};
+    whServer server[1];
 
-            pthread_join(cthread, &retval);
-            pthread_join(sthread, &retval);
+    enum { OBJECT_COUNT = 12 };
+    static whMessageNvmAddObjectRequest add;
+    static whMessageNvmListMetadataResponse list;
+    static whMessageNvmReadMultiResponse multi;
+    static whMessageNvmReadResponse read;
+    whMessageNvmResponse resp = {0};
+    whMessageNvmGetAvailableResponse avail = {0};
+    whMessageNvmListRequest list_req = {0};
+    whMessageNvmReadMultiRequest multi_req = {0};
+    whMessageNvmReadRequest read_req = {0};
+    whMessageNvmDestroyObjectsRequest destroy = {0};
+    whMessageNvmRecord rec = {0};
+    char expect[32];
+    uint16_t size = 0;
+    uint16_t listed = 0;
+    uint16_t trips = 0;
+    uint16_t offset = 0;
+    uint16_t magic = 0;
+    uint16_t msg_type = 0;
+    uint16_t seq = 0;
+    int compacting = 0;
+    int passes = 0;
+    uint32_t pending = 0;
+    int match = 1;
+    int i = 0;
+    int ret = 0;
+
+    msg_flash_config.filename = "myNvmMessage.bin";
+    nvm_config.cb = msg_flash_cb;
+    nvm_config.context = msg_flash;
+    nvm_config.config = &msg_flash_config;
+    ret = nvm_cb->Init(nvm, &nvm_config);
+    if (ret == 0) {
+        ret = wh_CommClient_Init(client, cc_conf);
+    }
+    if (ret == 0) {
+        ret = wh_Server_Init(server, s_conf);
+    }
+    printf("NVM message init:%d\n", ret);
+
+    /* Remove the objects of a previous run */
+    for (i = 1; (ret == 0) && (i <= OBJECT_COUNT); i++) {
+        destroy.list[destroy.list_count++] = i;
+        if (    (destroy.list_count == WH_NVM_MAX_DESTROY_OBJECTS_COUNT) ||
+                (i == OBJECT_COUNT)) {
+            ret = _whRingMessage(client, server,
+                    WOLFHSM_MESSAGE_TYPE_NVM_DESTROYOBJECTS, sizeof(destroy),
+                    &destroy, &size, &resp);
+            destroy.list_count = 0;
+        }
+    }
+    printf("NVM message clear:%d rc:%d\n", ret, (int)resp.rc);
+
+    for (i = 1; i <= OBJECT_COUNT; i++) {
+        memset(&add, 0, sizeof(add));
+        add.meta.id = i;
+        add.meta.len = sprintf((char*)add.data, "Config:%d", i) + 1;
+        sprintf((char*)add.meta.label, "Label:%d", i);
+        ret = _whRingMessage(client, server, WOLFHSM_MESSAGE_TYPE_NVM_ADDOBJECT,
+                offsetof(whMessageNvmAddObjectRequest, data) + add.meta.len,
+                &add, &size, &resp);
+        if ((ret != 0) || (resp.rc != 0)) {
+            break;
+        }
+    }
+    printf("NVM message add:%d rc:%d objects:%d\n", ret, (int)resp.rc,
+            i - 1);
+
+    ret = _whRingMessage(client, server,
+            WOLFHSM_MESSAGE_TYPE_NVM_GETAVAILABLE, 0, NULL, &size, &avail);
+    printf("NVM message available:%d rc:%d size:%u objects:%u\n", ret,
+            (int)avail.rc, (unsigned)avail.avail_size,
+            (unsigned)avail.avail_objects);
+
+    /* Every object fits in one LISTMETADATA response */
+    ret = _whRingMessage(client, server,
+            WOLFHSM_MESSAGE_TYPE_NVM_LISTMETADATA, sizeof(list_req),
+            &list_req, &size, &list);
+    printf("NVM message list all:%d rc:%d count:%u remaining:%u ok:%d\n",
+            ret, (int)list.rc, list.count, list.remaining,
+            (list.count == OBJECT_COUNT) && (list.remaining == 0) &&
+                (list.entries[OBJECT_COUNT - 1].id == OBJECT_COUNT));
+
+    /* Continue from the last entry when limited to 5 per response */
+    list_req.max_count = 5;
+    do {
+        ret = _whRingMessage(client, server,
+                WOLFHSM_MESSAGE_TYPE_NVM_LISTMETADATA, sizeof(list_req),
+                &list_req, &size, &list);
+        if ((ret != 0) || (list.rc != 0) || (list.count == 0)) {
+            break;
+        }
+        for (i = 0; i < list.count; i++) {
+            sprintf(expect, "Label:%d", listed + 1 + i);
+            match = match && (list.entries[i].id == listed + 1 + i) &&
+                    (strcmp((char*)list.entries[i].label, expect) == 0);
+        }
+        listed += list.count;
+        trips++;
+        list_req.start_id = list.entries[list.count - 1].id;
+    } while ((list.remaining != 0) && (trips < OBJECT_COUNT));
+    printf("NVM message list by 5:%d listed:%u trips:%u match:%d\n", ret,
+            listed, trips, match && (listed == OBJECT_COUNT) && (trips == 3));
+
+    /* Load every object plus a missing one in one round trip */
+    for (i = 0; i < OBJECT_COUNT; i++) {
+        multi_req.ids[i] = i + 1;
+    }
+    multi_req.ids[OBJECT_COUNT] = 99;
+    multi_req.count = OBJECT_COUNT + 1;
+    ret = _whRingMessage(client, server, WOLFHSM_MESSAGE_TYPE_NVM_READMULTI,
+            sizeof(multi_req), &multi_req, &size, &multi);
+    match = (ret == 0) && (multi.rc == 0) &&
+            (multi.count == OBJECT_COUNT + 1);
+    for (i = 0; match && (i < multi.count); i++) {
+        memcpy(&rec, &multi.records[offset], sizeof(rec));
+        if (i < OBJECT_COUNT) {
+            sprintf(expect, "Config:%d", i + 1);
+            match = (rec.id == i + 1) && (rec.rc == 0) &&
+                    (rec.len == strlen(expect) + 1) &&
+                    (memcmp(&multi.records[offset + sizeof(rec)], expect,
+                        rec.len) == 0);
         } else {
-            /* Cancel the server thread */
-            pthread_cancel(sthread);
-            pthread_join(sthread, &retval);
+            match = (rec.id == 99) && (rec.rc == WH_ERROR_NOTFOUND) &&
+                    (rec.len == 0);
+        }
+        offset += WOLFHSM_MESSAGE_NVM_RECORD_SIZE(rec.len);
+    }
+    printf("NVM message read multi:%d count:%u size:%u match:%d\n", ret,
+            multi.count, size, match);
+
+    read_req.id = 7;
+    read_req.offset = 7;
+    read_req.len = 2;
+    ret = _whRingMessage(client, server, WOLFHSM_MESSAGE_TYPE_NVM_READ,
+            sizeof(read_req), &read_req, &size, &read);
+    printf("NVM message read:%d rc:%d len:%u match:%d\n", ret, (int)read.rc,
+            (unsigned)read.len, (read.len == 2) &&
+                (memcmp(read.data, "7", 2) == 0));
+
+    /* Offsets past a whNvmSize are rejected rather than wrapped */
+    read_req.offset = 0x10000;
+    ret = _whRingMessage(client, server, WOLFHSM_MESSAGE_TYPE_NVM_READ,
+            sizeof(read_req), &read_req, &size, &read);
+    match = (ret == 0) && (read.rc == WH_ERROR_BADARGS);
+    read_req.offset = 0xFFFFFFFFul;
+    ret = _whRingMessage(client, server, WOLFHSM_MESSAGE_TYPE_NVM_READ,
+            sizeof(read_req), &read_req, &size, &read);
+    printf("NVM message read past end:%d rc:%d ok:%d\n", ret, (int)read.rc,
+            match && (read.rc == WH_ERROR_BADARGS));
+
+    /* The replication runs in idle passes, and the objects are only reported
+     * destroyed once it is committed */
+    destroy.list_count = 2;
+    destroy.list[0] = 1;
+    destroy.list[1] = 2;
+    ret = wh_CommClient_SendRequest(client, WH_COMM_MAGIC_NATIVE,
+            WOLFHSM_MESSAGE_TYPE_NVM_DESTROYOBJECTS, &seq, sizeof(destroy),
+            &destroy);
+    if (ret == 0) {
+        ret = wh_Server_HandleRequestMessage(server);
+    }
+    compacting = server->nvm_compacting;
+    while ((ret == 0) && (passes < 100)) {
+        ret = wh_CommClient_RecvResponse(client, &magic, &msg_type, &seq,
+                &size, &resp);
+        if (ret != WH_ERROR_NOTREADY) {
+            break;
+        }
+        ret = 0;
+        (void)wh_Server_HandleRequestMessage(server);
+        passes++;
+    }
+    printf("NVM message incremental destroy:%d rc:%d compacting:%d "
+            "passes:%d ok:%d\n", ret, (int)resp.rc, compacting, passes,
+            (compacting != 0) && (passes > 1) &&
+                (server->nvm_compacting == 0));
+    list_req.start_id = 0;
+    list_req.max_count = 0;
+    if (ret == 0) {
+        ret = _whRingMessage(client, server,
+                WOLFHSM_MESSAGE_TYPE_NVM_LISTMETADATA, sizeof(list_req),
+                &list_req, &size, &list);
+    }
+    printf("NVM message destroy:%d rc:%d count:%u ok:%d\n", ret,
+            (int)resp.rc, list.count, (list.count == OBJECT_COUNT - 2) &&
+                (list.entries[0].id == 3));
+
+    /* Later idle passes erase the retired partition */
+    pending = nvm->erase_pending;
+    passes = 0;
+    while ((nvm->erase_pending != 0) && (passes < 100)) {
+        (void)wh_Server_HandleRequestMessage(server);
+        passes++;
+    }
+    printf("NVM message idle erase pending:%x passes:%d ok:%d\n",
+            (unsigned)pending, passes,
+            (pending != 0) && (nvm->erase_pending == 0));
+
+    /* A replication that fails keeps the objects and its status is the
+     * response to the DESTROYOBJECTS */
+    destroy.list_count = 1;
+    destroy.list[0] = 3;
+    _whFlashFailPrograms = 1;
+    ret = _whRingMessage(client, server,
+            WOLFHSM_MESSAGE_TYPE_NVM_DESTROYOBJECTS, sizeof(destroy),
+            &destroy, &size, &resp);
+    _whFlashFailPrograms = 0;
+    if (ret == 0) {
+        ret = _whRingMessage(client, server,
+                WOLFHSM_MESSAGE_TYPE_NVM_LISTMETADATA, sizeof(list_req),
+                &list_req, &size, &list);
+    }
+    printf("NVM message failed destroy:%d rc:%d count:%u ok:%d\n", ret,
+            (int)resp.rc, list.count, (resp.rc != 0) &&
+                (server->nvm_compacting == 0) &&
+                (list.count == OBJECT_COUNT - 2) &&
+                (list.entries[0].id == 3));
+
+    wh_Server_Cleanup(server);
+    wh_CommClient_Cleanup(client);
+    nvm_cb->Cleanup(nvm);
+}
+
+enum {
+    TEST_CRYPTO_OP_SUM = 1,     /* 32-bit sum of the input bytes */
+    TEST_CRYPTO_OP_ECHO = 2,    /* Copy of the input */
+};
+
+/* Stands in for the wolfCrypt operations a server would run */
+static int _whTestCryptoCb(void* context, uint16_t op,
+        uint16_t in_len, const uint8_t* in,
+        uint16_t* inout_out_len, uint8_t* out)
+{
+    uint32_t sum = 0;
+    uint16_t i = 0;
+    int* calls = context;
+
+    (*calls)++;
+    switch (op) {
+    case TEST_CRYPTO_OP_SUM:
+        if (*inout_out_len < sizeof(sum)) {
+            return WH_ERROR_NOSPACE;
+        }
+        for (i = 0; i < in_len; i++) {
+            sum += in[i];
+        }
+        memcpy(out, &sum, sizeof(sum));
+        *inout_out_len = sizeof(sum);
+        return 0;
+    case TEST_CRYPTO_OP_ECHO:
+        if (*inout_out_len < in_len) {
+            return WH_ERROR_NOSPACE;
+        }
+        memcpy(out, in, in_len);
+        *inout_out_len = in_len;
+        return 0;
+    default:
+        return WH_ERROR_BADARGS;
+    }
+}
+
+/* Run many short operations in one batch, then split a batch whose output
+ * does not fit in one response */
+void wh_ClientServer_CryptoBatchTest(void)
+{
+    whTransportClientCb tmrccb[1] = {WH_TRANSPORT_MEM_RING_CLIENT_CB};
+    whTransportMemClientContext tmrcc[1] = {};
+    whCommClientConfig cc_conf[1] = {{
+            .transport_cb = tmrccb,
+            .transport_context = (void*)tmrcc,
+            .transport_config = (void*)tmrcf,
+            .client_id = 1234,
+    }};
+    whCommClient client[1] = {0};
+
+    int calls = 0;
+    whTransportServerCb tmrscb[1] = {WH_TRANSPORT_MEM_RING_SERVER_CB};
+    whTransportMemServerContext tmrsc[1] = {};
+    whCommServerConfig cs_conf[1] = {{
+            .transport_cb = tmrscb,
+            .transport_context = (void*)tmrsc,
+            .transport_config = (void*)tmrcf,
+            .server_id = 5678,
+    }};
+    whServerConfig s_conf[1] = {{
+            .comm = cs_conf,
+            .crypto_cb = _whTestCryptoCb,
+            .crypto_context = &calls,
+    }};
+    whServer server[1];
+
+    enum { FRAME_COUNT = 40, FRAME_LEN = 16, ECHO_COUNT = 2, ECHO_LEN = 632 };
+    static whMessageCryptoBatchRequest batch;
+    static whMessageCryptoBatchResponse resp;
+    static uint8_t echo[ECHO_LEN];
+    uint8_t frame[FRAME_LEN];
+    whMessageCryptoResult result = {0};
+    const uint8_t* out = NULL;
+    uint32_t sum = 0;
+    uint16_t batch_size = 0;
+    uint16_t size = 0;
+    uint16_t offset = 0;
+    int match = 1;
+    int echoed = 0;
+    int trips = 0;
+    int i = 0;
+    int ret = 0;
 
+    ret = wh_CommClient_Init(client, cc_conf);
+    if (ret == 0) {
+        ret = wh_Server_Init(server, s_conf);
+    }
+    printf("Crypto batch init:%d\n", ret);
+
+    /* Short frames plus an unknown op that fails on its own */
+    memset(&batch, 0, sizeof(batch));
+    for (i = 0; (ret == 0) && (i < FRAME_COUNT); i++) {
+        memset(frame, i, sizeof(frame));
+        ret = wh_MessageCrypto_BatchAdd(&batch, &batch_size,
+                TEST_CRYPTO_OP_SUM, sizeof(frame), frame);
+    }
+    if (ret == 0) {
+        ret = wh_MessageCrypto_BatchAdd(&batch, &batch_size, 99, 0, NULL);
+    }
+    if (ret == 0) {
+        ret = _whRingMessage(client, server, WOLFHSM_MESSAGE_TYPE_CRYPTO_BATCH,
+                offsetof(whMessageCryptoBatchRequest, items) + batch_size,
+                &batch, &size, &resp);
+    }
+    size -= offsetof(whMessageCryptoBatchResponse, results);
+    for (i = 0; (ret == 0) && (i < resp.count); i++) {
+        ret = wh_MessageCrypto_BatchNext(&resp, size, &offset, &result, &out);
+        if (ret != 0) {
+            break;
+        }
+        if (i < FRAME_COUNT) {
+            memcpy(&sum, out, sizeof(sum));
+            match = match && (result.rc == 0) && (result.len == sizeof(sum)) &&
+                    (sum == (uint32_t)i * FRAME_LEN);
+        } else {
+            match = match && (result.rc == WH_ERROR_BADARGS) &&
+                    (result.len == 0);
+        }
+    }
+    printf("Crypto batch frames:%d rc:%d count:%u calls:%d match:%d\n", ret,
+            (int)resp.rc, resp.count, calls,
+            match && (resp.count == FRAME_COUNT + 1) &&
+                (wh_MessageCrypto_BatchNext(&resp, size, &offset, NULL,
+                    NULL) == WH_ERROR_NOTFOUND));
+
+    /* The echoes fit in one request but their results do not fit in one
+     * response, so resend what is left */
+    for (i = 0; i < ECHO_LEN; i++) {
+        echo[i] = (uint8_t)i;
+    }
+    match = 1;
+    while ((ret == 0) && (echoed < ECHO_COUNT) && (trips < ECHO_COUNT)) {
+        memset(&batch, 0, sizeof(batch));
+        batch_size = 0;
+        for (i = echoed; (ret == 0) && (i < ECHO_COUNT); i++) {
+            ret = wh_MessageCrypto_BatchAdd(&batch, &batch_size,
+                    TEST_CRYPTO_OP_ECHO, sizeof(echo), echo);
         }
+        if (ret == 0) {
+            ret = _whRingMessage(client, server,
+                    WOLFHSM_MESSAGE_TYPE_CRYPTO_BATCH,
+                    offsetof(whMessageCryptoBatchRequest, items) + batch_size,
+                    &batch, &size, &resp);
+        }
+        size -= offsetof(whMessageCryptoBatchResponse, results);
+        offset = 0;
+        for (i = 0; (ret == 0) && (i < resp.count); i++) {
+            ret = wh_MessageCrypto_BatchNext(&resp, size, &offset, &result,
+                    &out);
+            match = match && (ret == 0) && (result.rc == 0) &&
+                    (result.len == sizeof(echo)) &&
+                    (memcmp(out, echo, sizeof(echo)) == 0);
+        }
+        echoed += resp.count;
+        trips++;
     }
+    printf("Crypto batch split:%d echoed:%d trips:%d match:%d\n", ret, echoed,
+            trips, match && (echoed == ECHO_COUNT) && (trips == ECHO_COUNT));
+
+    /* A count beyond the items sent fails after the items present */
+    memset(&batch, 0, sizeof(batch));
+    batch_size = 0;
+    ret = wh_MessageCrypto_BatchAdd(&batch, &batch_size, TEST_CRYPTO_OP_SUM,
+            sizeof(frame), frame);
+    batch.count = 2;
+    if (ret == 0) {
+        ret = _whRingMessage(client, server, WOLFHSM_MESSAGE_TYPE_CRYPTO_BATCH,
+                offsetof(whMessageCryptoBatchRequest, items) + batch_size,
+                &batch, &size, &resp);
+    }
+    printf("Crypto batch truncated:%d rc:%d count:%u ok:%d\n", ret,
+            (int)resp.rc, resp.count,
+            (resp.rc == WH_ERROR_BADARGS) && (resp.count == 1));
+
+    wh_Server_Cleanup(server);
+    wh_CommClient_Cleanup(client);
 }
 
-void wh_CommClientServer_MemThreadTest(void)
+/* Read the counters by COMM_STATS after echoes and NVM updates, then reset
+ * them.  Servers without WOLFHSM_STATS respond with an empty packet */
+void wh_ClientServer_StatsMessageTest(void)
 {
-    /* Client configuration/contexts */
-    whTransportClientCb tmccb[1] = {WH_TRANSPORT_MEM_CLIENT_CB};
-    whTransportMemClientContext csc[1] = {};
-    whCommClientConfig c_conf[1] = {{
-            .transport_cb = tmccb,
-            .transport_context = (void*)csc,
-            .transport_config = (void*)tmcf,
+    whTransportClientCb tmrccb[1] = {WH_TRANSPORT_MEM_RING_CLIENT_CB};
+    whTransportMemClientContext tmrcc[1] = {};
+    whCommClientConfig cc_conf[1] = {{
+            .transport_cb = tmrccb,
+            .transport_context = (void*)tmrcc,
+            .transport_config = (void*)tmrcf,
             .client_id = 1234,
     }};
+    whCommClient client[1] = {0};
 
-    /* Server configuration/contexts */
-    whTransportServerCb tmscb[1] = {WH_TRANSPORT_MEM_SERVER_CB};
-    whTransportMemServerContext css[1] = {};
-    whCommServerConfig s_conf[1] = {{
-            .transport_cb = tmscb,
-            .transport_context = (void*)css,
-            .transport_config = (void*)tmcf,
+    const whNvmCb nvm_cb[1] = {WH_NVM_FLASH_CB};
+    whNvmFlashContext nvm[1] = {0};
+    posixFlashFileContext stats_flash[1] = {0};
+    posixFlashFileConfig stats_flash_config = myHalFlashConfig[0];
+    whNvmFlashConfig nvm_config = myNvmConfig;
+
+    whTransportServerCb tmrscb[1] = {WH_TRANSPORT_MEM_RING_SERVER_CB};
+    whTransportMemServerContext tmrsc[1] = {};
+    whCommServerConfig cs_conf[1] = {{
+            .transport_cb = tmrscb,
+            .transport_context = (void*)tmrsc,
+            .transport_config = (void*)tmrcf,
             .server_id = 5678,
     }};
+    whServerConfig s_conf[1] = {{
+            .comm = cs_conf,
+    }};
+    whServer server[1];
 
-    _whCommClientServerThreadTest(c_conf, s_conf);
+    static whMessageCommLenData echo;
+    static whMessageCommStatsResponse resp;
+    whMessageCommStatsRequest req = {
+            .flags = WOLFHSM_MESSAGE_COMM_STATS_RESET,
+    };
+    const whStats* st = &resp.stats;
+    unsigned char data[] = "StatsData";
+    whNvmMetadata meta = {.id = 40, .label = "Stats"};
+    whNvmId id = meta.id;
+    uint16_t size = 0;
+    int ret = 0;
+    int ok = 0;
+    int i = 0;
+
+    stats_flash_config.filename = "myStats.bin";
+    nvm_config.context = stats_flash;
+    nvm_config.config = &stats_flash_config;
+    ret = nvm_cb->Init(nvm, &nvm_config);
+    if (ret == 0) {
+        ret = wh_CommClient_Init(client, cc_conf);
+    }
+    if (ret == 0) {
+        ret = wh_Server_Init(server, s_conf);
+    }
+    printf("Stats message init:%d\n", ret);
+
+    /* Start from zero */
+    ret = _whRingMessage(client, server, WOLFHSM_MESSAGE_TYPE_COMM_STATS,
+            sizeof(req), &req, &size, &resp);
+    printf("Stats message reset:%d size:%d\n", ret, size);
+
+    echo.len = 4;
+    memcpy(echo.data, "Ping", 4);
+    for (i = 0; i < 3; i++) {
+        ret = _whRingMessage(client, server, WOLFHSM_MESSAGE_TYPE_COMM_ECHO,
+                sizeof(echo), &echo, &size, &echo);
+    }
+    nvm_cb->AddObject(nvm, &meta, sizeof(data), data);
+    nvm_cb->Read(nvm, meta.id, 0, sizeof(data), data);
+    nvm_cb->DestroyObjects(nvm, 1, &id);
+
+    /* No flags reads without resetting */
+    memset(&resp, 0, sizeof(resp));
+    ret = _whRingMessage(client, server, WOLFHSM_MESSAGE_TYPE_COMM_STATS,
+            0, NULL, &size, &resp);
+#ifdef WOLFHSM_STATS
+    ok = (size == sizeof(resp)) &&
+            (st->requests[0] == 4) &&
+            (st->comm_rx_bytes >= 3 * sizeof(echo)) &&
+            (st->comm_tx_bytes >= 3 * sizeof(echo)) &&
+            (st->flash_programs > 0) &&
+            (st->flash_reads > 0) &&
+            (st->flash_erases + st->flash_blankchecks > 0) &&
+            (st->dir_lookups > 0) &&
+            (st->compactions == 1);
+#else
+    ok = (size == 0);
+#endif
+    printf("--Stats requests:%u rx:%u tx:%u reads:%u programs:%u "
+            "erases:%u blankchecks:%u lookups:%u compactions:%u ok:%d\n",
+            st->requests[0], st->comm_rx_bytes, st->comm_tx_bytes,
+            st->flash_reads, st->flash_programs, st->flash_erases,
+            st->flash_blankchecks, st->dir_lookups, st->compactions, ok);
+
+    ret = _whRingMessage(client, server, WOLFHSM_MESSAGE_TYPE_COMM_STATS,
+            sizeof(req), &req, &size, &resp);
+    memset(&resp, 0, sizeof(resp));
+    ret = _whRingMessage(client, server, WOLFHSM_MESSAGE_TYPE_COMM_STATS,
+            0, NULL, &size, &resp);
+#ifdef WOLFHSM_STATS
+    ok = (ret == 0) && (st->requests[0] == 1) && (st->flash_programs == 0) &&
+            (st->compactions == 0);
+#else
+    ok = (ret == 0) && (size == 0);
+#endif
+    printf("--Stats after reset:%d requests:%u ok:%d\n", ret,
+            st->requests[0], ok);
+
+    wh_Server_Cleanup(server);
+    wh_CommClient_Cleanup(client);
+    nvm_cb->Cleanup(nvm);
 }
 
-posixTransportTcpConfig mytcpconfig[1] = {{
-        .server_ip_string = "127.0.0.1",
-        .server_port = 23456,
+posixTransportShmConfig myshmringconfig[1] = {{
+        .name = "/wh_test_shm_ring",
+        .req_size = RING_BUFFER_SIZE,
+        .resp_size = RING_BUFFER_SIZE,
+        .slot_count = RING_SLOT_COUNT,
 }};
 
-void wh_CommClientServer_TcpThreadTest(void)
+void wh_ClientServer_ShmRingThreadTest(void)
 {
     /* Client configuration/contexts */
-    whTransportClientCb pttccb[1] = {PTT_CLIENT_CB};
-    posixTransportTcpClientContext tcc[1] = {};
-    whCommClientConfig c_conf[1] = {{
-            .transport_cb = pttccb,
-            .transport_context = (void*)tcc,
-            .transport_config = (void*)mytcpconfig,
+    whTransportClientCb ptshmccb[1] = {PTSHM_CLIENT_CB};
+    posixTransportShmContext tshmc[1] = {};
+    whCommClientConfig cc_conf[1] = {{
+            .transport_cb = ptshmccb,
+            .transport_context = (void*)tshmc,
+            .transport_config = (void*)myshmringconfig,
             .client_id = 1234,
     }};
+    whClientConfig c_conf[1] = {{
+            .comm = cc_conf,
+    }};
 
     /* Server configuration/contexts */
-    whTransportServerCb pttscb[1] = {PTT_SERVER_CB};
-
-    posixTransportTcpServerContext tss[1] = {};
-    whCommServerConfig s_conf[1] = {{
-            .transport_cb = pttscb,
-            .transport_context = (void*)tss,
-            .transport_config = (void*)mytcpconfig,
+    whTransportServerCb ptshmscb[1] = {PTSHM_SERVER_CB};
+    posixTransportShmContext tshms[1] = {};
+    whCommServerConfig cs_conf[1] = {{
+            .transport_cb = ptshmscb,
+            .transport_context = (void*)tshms,
+            .transport_config = (void*)myshmringconfig,
             .server_id = 5678,
     }};
+    whServerConfig s_conf[1] = {{
+            .comm = cs_conf,
+    }};
 
-    _whCommClientServerThreadTest(c_conf, s_conf);
+    _whClientServerThreadTest(c_conf, s_conf);
 }
 
-static void* _whClientTask(void *cf)
+#if WH_SERVER_COMM_COUNT >= 2
+/* Second ring for a server with several clients */
+static uint64_t ring2_req[RING_BUFFER_SIZE / sizeof(uint64_t)];
+static uint64_t ring2_resp[RING_BUFFER_SIZE / sizeof(uint64_t)];
+whTransportMemConfig tmr2cf[1] = {{
+        .req = (whTransportMemCsr*)ring2_req,
+        .req_size = sizeof(ring2_req),
+        .resp = (whTransportMemCsr*)ring2_resp,
+        .resp_size = sizeof(ring2_resp),
+        .slot_count = RING_SLOT_COUNT,
+}};
+
+/* A chatty client must not starve a second client of the same server */
+void wh_ClientServer_MultiClientTest(void)
 {
-    whClientConfig* config = (whClientConfig*)cf;
-    int ret = 0;
-    whClient client[1];
-    int counter = 1;
+    enum { CLIENT_COUNT = 2 };
+    const whTransportMemConfig* tmcfs[CLIENT_COUNT] = {tmrcf, tmr2cf};
+    /* The first client sends a full ring while the second sends one */
+    const int requests[CLIENT_COUNT] = {RING_SLOT_COUNT, 1};
+
+    whTransportClientCb tmrccb[1] = {WH_TRANSPORT_MEM_RING_CLIENT_CB};
+    whTransportMemClientContext tmrcc[CLIENT_COUNT] = {};
+    whCommClientConfig cc_conf[CLIENT_COUNT] = {};
+    whCommClient client[CLIENT_COUNT];
+
+    whTransportServerCb tmrscb[1] = {WH_TRANSPORT_MEM_RING_SERVER_CB};
+    whTransportMemServerContext tmrsc[CLIENT_COUNT] = {};
+    whCommServerConfig cs_conf[CLIENT_COUNT] = {};
+    whServerConfig s_conf[1] = {{
+            .comm = cs_conf,
+            .comm_count = CLIENT_COUNT,
+    }};
+    whServer server[1];
 
-    uint8_t  tx_req[REQ_SIZE] = {0};
-    uint16_t tx_req_len = 0;
+    whMessageCommLenData msg;
+    uint32_t client_id = 0;
+    uint16_t depth = 0;
+    uint32_t handled = 0;
+    uint32_t last_handled[CLIENT_COUNT] = {0};
+    int total = 0;
+    int i = 0;
+    int j = 0;
+    int ret = 0;
 
-    uint8_t  rx_resp[RESP_SIZE] = {0};
-    uint16_t rx_resp_len = 0;
+    for (i = 0; i < CLIENT_COUNT; i++) {
+        cc_conf[i].transport_cb = tmrccb;
+        cc_conf[i].transport_context = (void*)&tmrcc[i];
+        cc_conf[i].transport_config = (void*)tmcfs[i];
+        cc_conf[i].client_id = 100 + i;
+        cs_conf[i].transport_cb = tmrscb;
+        cs_conf[i].transport_context = (void*)&tmrsc[i];
+        cs_conf[i].transport_config = (void*)tmcfs[i];
+        cs_conf[i].server_id = 5678;
+        cs_conf[i].client_id = 100 + i;
+        ret = wh_CommClient_Init(&client[i], &cc_conf[i]);
+        printf("Multi CommClientInit %d:%d\n", i, ret);
+    }
+    ret = wh_Server_Init(server, s_conf);
+    printf("Multi wh_Server_Init:%d\n", ret);
+
+    for (i = 0; i < CLIENT_COUNT; i++) {
+        for (j = 0; j < requests[i]; j++) {
+            memset(&msg, 0, sizeof(msg));
+            msg.len = sprintf((char*)msg.data, "Client%d:%d", i, j);
+            ret = wh_CommClient_SendRequest(&client[i], WH_COMM_MAGIC_NATIVE,
+                    WOLFHSM_MESSAGE_TYPE_COMM_ECHO, NULL, sizeof(msg), &msg);
+            total++;
+        }
+        wh_Server_GetClientInfo(server, i, &client_id, &depth, &handled,
+                NULL);
+        printf("Multi client_id:%u depth:%u handled:%u\n",
+                client_id, depth, handled);
+    }
 
-    if (config == NULL) {
-        return NULL;
+    /* Expect the order 0, 1, 0, 0, 0 */
+    for (j = 0; j < total; j++) {
+        ret = wh_Server_HandleRequestMessage(server);
+        for (i = 0; i < CLIENT_COUNT; i++) {
+            wh_Server_GetClientInfo(server, i, &client_id, &depth, &handled,
+                    NULL);
+            if (handled != last_handled[i]) {
+                printf("Multi HandleRequestMessage:%d client_id:%u depth:%u\n",
+                        ret, client_id, depth);
+                last_handled[i] = handled;
+            }
+        }
     }
+    ret = wh_Server_HandleRequestMessage(server);
+    printf("Multi HandleRequestMessage with no requests:%d\n", ret);
 
-    ret = wh_Client_Init(client, config);
-    printf("wh_Client_Init:%d\n", ret);
+    ret = wh_Server_Cleanup(server);
+    printf("Multi ServerCleanup:%d\n", ret);
+    for (i = 0; i < CLIENT_COUNT; i++) {
+        ret = wh_CommClient_Cleanup(&client[i]);
+        printf("Multi CommClientCleanup %d:%d\n", i, ret);
+    }
+}
 
-    for(counter = 0; counter < REPEAT_COUNT; counter++)
-    {
-        sprintf((char*)tx_req,"Request:%u",counter);
-        tx_req_len = strlen((char*)tx_req);
-        do {
-            ret = wh_Client_EchoRequest(client,
-                    tx_req_len, tx_req);
-            printf("Client EchoRequest:%d, len:%d, %s\n",
-                    ret, tx_req_len, tx_req);
-        } while ((ret == WH_ERROR_NOTREADY) && (usleep(ONE_MS)==0));
+/* Server transport whose peer has gone away */
+static int _whFailedRecvRequest(void* context, uint16_t* inout_size,
+        void* data)
+{
+    (void)context;
+    (void)inout_size;
+    (void)data;
+    return WH_ERROR_ABORTED;
+}
 
-        if (ret != 0) {
-            printf("Client had failure. Exiting\n");
-            break;
-        }
+/* A failed endpoint is reported for its client while the others are served */
+void wh_ClientServer_MultiClientErrorTest(void)
+{
+    enum { CLIENT_COUNT = 2 };
+    whTransportClientCb tmrccb[1] = {WH_TRANSPORT_MEM_RING_CLIENT_CB};
+    whTransportMemClientContext tmrcc[1] = {};
+    whCommClientConfig cc_conf[1] = {{
+            .transport_cb = tmrccb,
+            .transport_context = (void*)tmrcc,
+            .transport_config = (void*)tmr2cf,
+            .client_id = 101,
+    }};
+    whCommClient client[1];
 
-        rx_resp_len = 0;
-        memset(rx_resp, 0, sizeof(rx_resp));
+    whTransportServerCb failcb[1] = {{
+            .Init = wh_TransportMemRing_Init,
+            .Recv = _whFailedRecvRequest,
+            .Cleanup = wh_TransportMem_Cleanup,
+    }};
+    whTransportServerCb tmrscb[1] = {WH_TRANSPORT_MEM_RING_SERVER_CB};
+    whTransportMemServerContext tmrsc[CLIENT_COUNT] = {};
+    whCommServerConfig cs_conf[CLIENT_COUNT] = {{
+            .transport_cb = failcb,
+            .transport_context = (void*)&tmrsc[0],
+            .transport_config = (void*)tmrcf,
+            .server_id = 5678,
+            .client_id = 100,
+    }, {
+            .transport_cb = tmrscb,
+            .transport_context = (void*)&tmrsc[1],
+            .transport_config = (void*)tmr2cf,
+            .server_id = 5678,
+            .client_id = 101,
+    }};
+    whServerConfig s_conf[1] = {{
+            .comm = cs_conf,
+            .comm_count = CLIENT_COUNT,
+    }};
+    whServer server[1];
 
-        do {
-            ret = wh_Client_EchoResponse(client,
-                    &rx_resp_len, rx_resp);
-            printf("Client EchoResponse:%d, len:%d, %s\n",
-                    ret, rx_resp_len, rx_resp);
-        } while ((ret == WH_ERROR_NOTREADY) && (usleep(ONE_MS)==0));
+    whMessageCommLenData msg;
+    uint16_t magic = 0;
+    uint16_t type = 0;
+    uint16_t seq = 0;
+    uint16_t size = 0;
+    uint32_t handled = 0;
+    uint32_t polls = UINT32_MAX;
+    int error[CLIENT_COUNT] = {0};
+    int ret = 0;
 
-        if (ret != 0) {
-            printf("Client had failure. Exiting\n");
-            break;
-        }
-    }
+    ret = wh_CommClient_Init(client, cc_conf);
+    printf("MultiError CommClientInit:%d\n", ret);
+    ret = wh_Server_Init(server, s_conf);
+    printf("MultiError wh_Server_Init:%d\n", ret);
+
+    memset(&msg, 0, sizeof(msg));
+    msg.len = sprintf((char*)msg.data, "MultiError");
+    ret = wh_CommClient_SendRequest(client, WH_COMM_MAGIC_NATIVE,
+            WOLFHSM_MESSAGE_TYPE_COMM_ECHO, NULL, sizeof(msg), &msg);
+    printf("MultiError SendRequest:%d\n", ret);
+
+    /* The first endpoint fails but the second client is still served */
+    ret = wh_Server_HandleRequestMessage(server);
+    (void)wh_Server_GetClientInfo(server, 0, NULL, NULL, NULL, &error[0]);
+    (void)wh_Server_GetClientInfo(server, 1, NULL, NULL, &handled, &error[1]);
+    printf("MultiError HandleRequestMessage:%d error0:%d error1:%d "
+            "handled:%u ok:%d\n", ret, error[0], error[1], handled,
+            (ret == 0) && (error[0] == WH_ERROR_ABORTED) && (error[1] == 0) &&
+            (handled == 1));
+
+    memset(&msg, 0, sizeof(msg));
+    ret = wh_CommClient_RecvResponse(client, &magic, &type, &seq, &size, &msg);
+    printf("MultiError RecvResponse:%d echo ok:%d\n", ret,
+            (ret == 0) && (strcmp((char*)msg.data, "MultiError") == 0));
+
+    /* The failure is not returned while another endpoint can be served */
+    ret = wh_Server_HandleRequestMessage(server);
+    printf("MultiError HandleRequestMessage with no requests:%d ok:%d\n",
+            ret, ret == WH_ERROR_NOTREADY);
+    ret = wh_Server_Wait(server, &polls);
+    printf("MultiError wh_Server_Wait:%d ok:%d\n", ret, ret == 0);
 
-    ret = wh_Client_Cleanup(client);
-    printf("wh_Client_Cleanup:%d\n", ret);
-    return NULL;
+    ret = wh_Server_Cleanup(server);
+    printf("MultiError ServerCleanup:%d\n", ret);
+    ret = wh_CommClient_Cleanup(client);
+    printf("MultiError CommClientCleanup:%d\n", ret);
 }
 
-static void* _whServerTask(void* cf)
+/* A DESTROYOBJECTS is answered once committed while another client is served,
+ * and that client's requests that write the NVM complete it first without
+ * taking on its status */
+void wh_ClientServer_NvmDestroyDeferTest(void)
 {
-    whServerConfig* config = (whServerConfig*)cf;
-    int ret = 0;
+    enum { CLIENT_COUNT = 2, KEY_COUNT = WOLFHSM_NUM_RAMKEYS };
+    const whTransportMemConfig* tmcfs[CLIENT_COUNT] = {tmrcf, tmr2cf};
+    whTransportClientCb tmrccb[1] = {WH_TRANSPORT_MEM_RING_CLIENT_CB};
+    whTransportMemClientContext tmrcc[CLIENT_COUNT] = {};
+    whCommClientConfig cc_conf[CLIENT_COUNT] = {};
+    whCommClient client[CLIENT_COUNT];
+
+    const whNvmCb nvm_cb[1] = {WH_NVM_FLASH_CB};
+    whNvmFlashContext nvm[1] = {0};
+    const whFlashCb defer_flash_cb[1] = {TEST_FAILING_FLASH_CB};
+    posixFlashFileContext defer_flash[1] = {0};
+    posixFlashFileConfig defer_flash_config = myHalFlashConfig[0];
+    whNvmFlashConfig nvm_config = myNvmConfig;
+
+    whTransportServerCb tmrscb[1] = {WH_TRANSPORT_MEM_RING_SERVER_CB};
+    whTransportMemServerContext tmrsc[CLIENT_COUNT] = {};
+    whCommServerConfig cs_conf[CLIENT_COUNT] = {};
+    whServerConfig s_conf[1] = {{
+            .comm = cs_conf,
+            .comm_count = CLIENT_COUNT,
+            .nvm_cb = nvm_cb,
+            .nvm_context = nvm,
+    }};
     whServer server[1];
-    int counter = 1;
 
-    if (config == NULL) {
-        return NULL;
+    static whMessageNvmAddObjectRequest add;
+    static whMessageNvmReadResponse read;
+    static whMessageKeyData key;
+    static whMessageKeyExportResponse export;
+    whMessageNvmReadRequest read_req = {.id = 2, .len = 9};
+    whMessageNvmDestroyObjectsRequest destroy = {0};
+    whMessageNvmResponse resp = {0};
+    whMessageNvmResponse destroy_resp = {0};
+    whMessageKeyIdRequest id_req = {
+            .id = MAKE_WOLFHSM_KEYID(WOLFHSM_KEYID_NVM, 1),
+    };
+    whNvmMetadata meta = {0};
+    uint16_t magic = 0;
+    uint16_t type = 0;
+    uint16_t seq = 0;
+    uint16_t size = 0;
+    int pending = 0;
+    int ret = 0;
+    int i = 0;
+
+    defer_flash_config.filename = "myNvmDefer.bin";
+    nvm_config.cb = defer_flash_cb;
+    nvm_config.context = defer_flash;
+    nvm_config.config = &defer_flash_config;
+    ret = nvm_cb->Init(nvm, &nvm_config);
+    for (i = 0; (ret == 0) && (i < CLIENT_COUNT); i++) {
+        cc_conf[i].transport_cb = tmrccb;
+        cc_conf[i].transport_context = (void*)&tmrcc[i];
+        cc_conf[i].transport_config = (void*)tmcfs[i];
+        cc_conf[i].client_id = 100 + i;
+        cs_conf[i].transport_cb = tmrscb;
+        cs_conf[i].transport_context = (void*)&tmrsc[i];
+        cs_conf[i].transport_config = (void*)tmcfs[i];
+        cs_conf[i].server_id = 5678;
+        cs_conf[i].client_id = 100 + i;
+        ret = wh_CommClient_Init(&client[i], &cc_conf[i]);
     }
-
-    ret = wh_Server_Init(server, config);
-    printf("wh_Server_Init:%d\n", ret);
-
-    for(counter = 0; counter < REPEAT_COUNT; counter++)
-    {
-        do {
-            ret = wh_Server_HandleRequestMessage(server);
-            printf("Server HandleRequestMessage:%d\n",ret);
-        } while ((ret == WH_ERROR_NOTREADY) && (usleep(ONE_MS)==0));
-
-        if (ret != 0) {
-            printf("Server had failure. Exiting\n");
-            break;
-        } else {
-            printf("Server processed message %d of %d\n", counter, REPEAT_COUNT);
-        }
+    if (ret == 0) {
+        ret = wh_Server_Init(server, s_conf);
     }
-    ret = wh_Server_Cleanup(server);
-    printf("ServerCleanup:%d\n", ret);
+    printf("Defer init:%d\n", ret);
+
+    /* Objects 1 to 3, and a committed key that is not cached */
+    for (i = 1; (ret == 0) && (i <= 3); i++) {
+        memset(&add, 0, sizeof(add));
+        add.meta.id = i;
+        add.meta.len = sprintf((char*)add.data, "Config:%d", i) + 1;
+        ret = _whRingMessage(&client[1], server,
+                WOLFHSM_MESSAGE_TYPE_NVM_ADDOBJECT,
+                offsetof(whMessageNvmAddObjectRequest, data) + add.meta.len,
+                &add, &size, &resp);
+    }
+    memset(&key, 0, sizeof(key));
+    key.id = id_req.id;
+    key.len = 4;
+    memcpy(key.data, "Key1", 4);
+    if (ret == 0) {
+        ret = _whRingMessage(&client[1], server, WOLFHSM_MESSAGE_TYPE_KEY_CACHE,
+                offsetof(whMessageKeyData, data) + key.len, &key, &size,
+                &export);
+    }
+    if (ret == 0) {
+        ret = _whRingMessage(&client[1], server,
+                WOLFHSM_MESSAGE_TYPE_KEY_COMMIT, sizeof(id_req), &id_req,
+                &size, &export);
+    }
+    if (ret == 0) {
+        ret = _whRingMessage(&client[1], server,
+                WOLFHSM_MESSAGE_TYPE_KEY_EVICT, sizeof(id_req), &id_req,
+                &size, &export);
+    }
+    /* Fill the cache with uncommitted keys, so a load has to commit one */
+    for (i = 0; (ret == 0) && (i < KEY_COUNT); i++) {
+        key.id = MAKE_WOLFHSM_KEYID(WOLFHSM_KEYID_NVM, 10 + i);
+        ret = _whRingMessage(&client[1], server,
+                WOLFHSM_MESSAGE_TYPE_KEY_CACHE,
+                offsetof(whMessageKeyData, data) + key.len, &key, &size,
+                &export);
+    }
+    printf("Defer setup:%d rc:%d\n", ret, (int)export.result.rc);
+
+    /* Client 0 destroys object 1.  Client 1 is served meanwhile */
+    destroy.list_count = 1;
+    destroy.list[0] = 1;
+    ret = wh_CommClient_SendRequest(&client[0], WH_COMM_MAGIC_NATIVE,
+            WOLFHSM_MESSAGE_TYPE_NVM_DESTROYOBJECTS, &seq, sizeof(destroy),
+            &destroy);
+    if (ret == 0) {
+        ret = wh_Server_HandleRequestMessage(server);
+    }
+    pending = (wh_CommClient_RecvResponse(&client[0], &magic, &type, &seq,
+            &size, &destroy_resp) == WH_ERROR_NOTREADY);
+    if (ret == 0) {
+        ret = _whRingMessage(&client[1], server, WOLFHSM_MESSAGE_TYPE_NVM_READ,
+                sizeof(read_req), &read_req, &size, &read);
+    }
+    printf("Defer read during:%d rc:%d pending:%d ok:%d\n", ret,
+            (int)read.rc, pending, (read.rc == 0) && pending &&
+                (server->nvm_compacting != 0) &&
+                (memcmp(read.data, "Config:2", 9) == 0));
+
+    /* Loading a key evicts an uncommitted one, which completes the
+     * replication and answers client 0 */
+    memset(&export, 0, sizeof(export));
+    if (ret == 0) {
+        ret = _whRingMessage(&client[1], server,
+                WOLFHSM_MESSAGE_TYPE_KEY_EXPORT, sizeof(id_req), &id_req,
+                &size, &export);
+    }
+    memset(&destroy_resp, 0, sizeof(destroy_resp));
+    destroy_resp.rc = 1;
+    (void)wh_CommClient_RecvResponse(&client[0], &magic, &type, &seq, &size,
+            &destroy_resp);
+    printf("Defer export during:%d rc:%d destroy rc:%d ok:%d\n", ret,
+            (int)export.result.rc, (int)destroy_resp.rc,
+            (export.result.rc == 0) && (destroy_resp.rc == 0) &&
+                (memcmp(export.key.data, "Key1", 4) == 0) &&
+                (server->nvm_compacting == 0) &&
+                (nvm_cb->GetMetadata(nvm, 1, &meta) == WH_ERROR_NOTFOUND));
+
+    /* A failed replication is reported to its DESTROYOBJECTS only */
+    destroy.list[0] = 2;
+    ret = wh_CommClient_SendRequest(&client[0], WH_COMM_MAGIC_NATIVE,
+            WOLFHSM_MESSAGE_TYPE_NVM_DESTROYOBJECTS, &seq, sizeof(destroy),
+            &destroy);
+    if (ret == 0) {
+        ret = wh_Server_HandleRequestMessage(server);
+    }
+    _whFlashFailPrograms = 1;
+    memset(&add, 0, sizeof(add));
+    add.meta.id = 4;
+    add.meta.len = sprintf((char*)add.data, "Config:%d", 4) + 1;
+    if (ret == 0) {
+        ret = _whRingMessage(&client[1], server,
+                WOLFHSM_MESSAGE_TYPE_NVM_ADDOBJECT,
+                offsetof(whMessageNvmAddObjectRequest, data) + add.meta.len,
+                &add, &size, &resp);
+    }
+    _whFlashFailPrograms = 0;
+    destroy_resp.rc = 0;
+    (void)wh_CommClient_RecvResponse(&client[0], &magic, &type, &seq, &size,
+            &destroy_resp);
+    printf("Defer failed destroy:%d add rc:%d destroy rc:%d ok:%d\n", ret,
+            (int)resp.rc, (int)destroy_resp.rc, (resp.rc == 0) &&
+                (destroy_resp.rc != 0) &&
+                (nvm_cb->GetMetadata(nvm, 2, &meta) == 0) &&
+                (nvm_cb->GetMetadata(nvm, 4, &meta) == 0));
+
+    wh_Server_Cleanup(server);
+    for (i = 0; i < CLIENT_COUNT; i++) {
+        wh_CommClient_Cleanup(&client[i]);
+    }
+    nvm_cb->Cleanup(nvm);
+}
+#endif
 
-    return NULL;
+/* Completion callback recording the order of echo responses */
+static void _whClientPipelineComplete(whClient* c, void* arg,
+        uint16_t magic, uint16_t type, uint16_t seq,
+        uint16_t size, const void* data)
+{
+    int* completed = arg;
+    uint8_t echo[RESP_SIZE] = {0};
+    uint16_t len = 0;
+    int ret = wh_Client_EchoDecode(magic, type, size, data, &len, echo);
+
+    (*completed)++;
+    printf("Pipeline complete:%d, seq:%d, inflight:%d, len:%d, %s\n",
+            ret, seq, c->inflight_count, len, echo);
 }
 
-static void _whClientServerThreadTest(  whClientConfig* c_conf,
-                                whServerConfig* s_conf)
+/* Submit several echo requests before collecting their responses through the
+ * ring transport */
+void wh_ClientServer_PipelineTest(void)
 {
-    pthread_t cthread;
-    pthread_t sthread;
+    /* Client configuration/contexts */
+    whTransportClientCb tmrccb[1] = {WH_TRANSPORT_MEM_RING_CLIENT_CB};
+    whTransportMemClientContext tmrcc[1] = {};
+    whCommClientConfig cc_conf[1] = {{
+            .transport_cb = tmrccb,
+            .transport_context = (void*)tmrcc,
+            .transport_config = (void*)tmrcf,
+            .client_id = 1234,
+    }};
+    whClientConfig c_conf[1] = {{
+            .comm = cc_conf,
+    }};
+    whClient client[1];
 
-    void* retval;
-    int rc = 0;
+    /* Server configuration/contexts */
+    whTransportServerCb tmrscb[1] = {WH_TRANSPORT_MEM_RING_SERVER_CB};
+    whTransportMemServerContext tmrsc[1] = {};
+    whCommServerConfig cs_conf[1] = {{
+            .transport_cb = tmrscb,
+            .transport_context = (void*)tmrsc,
+            .transport_config = (void*)tmrcf,
+            .server_id = 5678,
+    }};
+    whServerConfig s_conf[1] = {{
+            .comm = cs_conf,
+    }};
+    whServer server[1];
 
-    rc = pthread_create(&sthread, NULL, _whServerTask, s_conf);
-    printf(" WH Server thread create:%d\n", rc);
-    if (rc == 0) {
-        rc = pthread_create(&cthread, NULL, _whClientTask, c_conf);
-        printf("WH Client thread create:%d\n", rc);
-        if (rc == 0) {
-            /* All good. Block on joining */
+    whMessageCommLenData msg;
+    uint16_t seqs[WH_CLIENT_INFLIGHT_COUNT] = {0};
+    uint8_t echo[RESP_SIZE] = {0};
+    uint16_t len = 0;
+    int completed = 0;
+    int counter = 0;
+    int ret = 0;
 
-            pthread_join(cthread, &retval);
-            pthread_join(sthread, &retval);
-        } else {
-            /* Cancel the server thread */
-            pthread_cancel(sthread);
-            pthread_join(sthread, &retval);
+    ret = wh_Client_Init(client, c_conf);
+    printf("Pipeline wh_Client_Init:%d\n", ret);
+    ret = wh_Server_Init(server, s_conf);
+    printf("Pipeline wh_Server_Init:%d\n", ret);
+
+    for (counter = 0; counter < WH_CLIENT_INFLIGHT_COUNT; counter++) {
+        memset(&msg, 0, sizeof(msg));
+        msg.len = sprintf((char*)msg.data, "Pipeline:%u", counter);
+        ret = wh_Client_SubmitRequest(client, WOLFHSM_MESSAGE_TYPE_COMM_ECHO,
+                sizeof(msg), &msg,
+                _whClientPipelineComplete, &completed, &seqs[counter]);
+        printf("Pipeline SubmitRequest:%d, seq:%d, inflight:%d\n",
+                ret, seqs[counter], client->inflight_count);
+    }
+    ret = wh_Client_SubmitRequest(client, WOLFHSM_MESSAGE_TYPE_COMM_ECHO,
+            sizeof(msg), &msg, NULL, NULL, NULL);
+    printf("Pipeline SubmitRequest with full table:%d\n", ret);
 
-        }
+    /* Nothing is complete until the server runs */
+    ret = wh_Client_Complete(client, seqs[0]);
+    printf("Pipeline Complete before server:%d\n", ret);
+
+    for (counter = 0; counter < WH_CLIENT_INFLIGHT_COUNT; counter++) {
+        ret = wh_Server_HandleRequestMessage(server);
+        printf("Pipeline Server HandleRequestMessage:%d\n", ret);
     }
+
+    /* Wait for the last request, completing the earlier ones on the way */
+    do {
+        ret = wh_Client_Complete(client, seqs[WH_CLIENT_INFLIGHT_COUNT - 1]);
+    } while (ret == WH_ERROR_NOTREADY);
+    printf("Pipeline Complete:%d, completed:%d, inflight:%d\n",
+            ret, completed, client->inflight_count);
+
+    /* Single request echo on top of the asynchronous API */
+    ret = wh_Client_EchoRequest(client, 5, "Last!");
+    printf("Pipeline EchoRequest:%d\n", ret);
+    ret = wh_Server_HandleRequestMessage(server);
+    printf("Pipeline Server HandleRequestMessage:%d\n", ret);
+    ret = wh_Client_EchoResponse(client, &len, echo);
+    printf("Pipeline EchoResponse:%d, len:%d, %s\n", ret, len, echo);
+
+    ret = wh_Server_Cleanup(server);
+    printf("Pipeline ServerCleanup:%d\n", ret);
+    ret = wh_Client_Cleanup(client);
+    printf("Pipeline wh_Client_Cleanup:%d\n", ret);
 }
 
-void wh_ClientServer_TcpThreadTest(void)
+posixTransportTcpConfig mytcpcoalesceconfig[1] = {{
+        .server_ip_string = "127.0.0.1",
+        .server_port = 23458,
+        .nodelay = 1,
+        .coalesce = 1,
+}};
+
+/* Pipelined requests coalesced by the TCP client into a single send */
+void wh_ClientServer_TcpPipelineTest(void)
 {
     /* Client configuration/contexts */
     whTransportClientCb pttccb[1] = {PTT_CLIENT_CB};
@@ -701,13 +3817,13 @@ void wh_ClientServer_TcpThreadTest(void)
     whCommClientConfig cc_conf[1] = {{
             .transport_cb = pttccb,
             .transport_context = (void*)tcc,
-            .transport_config = (void*)mytcpconfig,
+            .transport_config = (void*)mytcpcoalesceconfig,
             .client_id = 1234,
     }};
     whClientConfig c_conf[1] = {{
             .comm = cc_conf,
-            /*.nvm = NULL, */
     }};
+    whClient client[1];
 
     /* Server configuration/contexts */
     whTransportServerCb pttscb[1] = {PTT_SERVER_CB};
@@ -715,26 +3831,121 @@ void wh_ClientServer_TcpThreadTest(void)
     whCommServerConfig cs_conf[1] = {{
             .transport_cb = pttscb,
             .transport_context = (void*)tsc,
-            .transport_config = (void*)mytcpconfig,
+            .transport_config = (void*)mytcpcoalesceconfig,
             .server_id = 5678,
     }};
     whServerConfig s_conf[1] = {{
             .comm = cs_conf,
-            /*.nvm = NULL, */
     }};
+    whServer server[1];
 
-    _whClientServerThreadTest(c_conf, s_conf);
+    whMessageCommLenData msg;
+    uint16_t seqs[WH_CLIENT_INFLIGHT_COUNT] = {0};
+    uint32_t polls = 0;
+    int completed = 0;
+    int counter = 0;
+    int ret = 0;
+
+    /* Listen before the client connects */
+    ret = wh_Server_Init(server, s_conf);
+    printf("TCP Pipeline wh_Server_Init:%d\n", ret);
+    ret = wh_Client_Init(client, c_conf);
+    printf("TCP Pipeline wh_Client_Init:%d\n", ret);
+
+    for (counter = 0; counter < WH_CLIENT_INFLIGHT_COUNT; counter++) {
+        memset(&msg, 0, sizeof(msg));
+        msg.len = sprintf((char*)msg.data, "TcpPipeline:%u", counter);
+        polls = 0;
+        do {
+            ret = wh_Client_SubmitRequest(client,
+                    WOLFHSM_MESSAGE_TYPE_COMM_ECHO, sizeof(msg), &msg,
+                    _whClientPipelineComplete, &completed, &seqs[counter]);
+        } while (   (ret == WH_ERROR_NOTREADY) &&
+                    (wh_CommClient_Wait(client->comm, &polls) == 0));
+        printf("TCP Pipeline SubmitRequest:%d, seq:%d, queued:%d\n",
+                ret, seqs[counter], tcc->request_count);
+    }
 
+    /* All requests are written together once the client polls */
+    ret = wh_Client_Poll(client);
+    printf("TCP Pipeline Poll:%d, batch:%d\n", ret, tcc->batch_size);
+
+    for (counter = 0; counter < WH_CLIENT_INFLIGHT_COUNT; counter++) {
+        polls = 0;
+        do {
+            ret = wh_Server_HandleRequestMessage(server);
+        } while (   (ret == WH_ERROR_NOTREADY) &&
+                    (wh_Server_Wait(server, &polls) == 0));
+        printf("TCP Pipeline Server HandleRequestMessage:%d\n", ret);
+    }
+
+    polls = 0;
+    do {
+        ret = wh_Client_Complete(client, seqs[WH_CLIENT_INFLIGHT_COUNT - 1]);
+    } while (   (ret == WH_ERROR_NOTREADY) &&
+                (wh_CommClient_Wait(client->comm, &polls) == 0));
+    printf("TCP Pipeline Complete:%d, completed:%d, inflight:%d\n",
+            ret, completed, client->inflight_count);
+
+    ret = wh_Client_Cleanup(client);
+    printf("TCP Pipeline wh_Client_Cleanup:%d\n", ret);
+    ret = wh_Server_Cleanup(server);
+    printf("TCP Pipeline ServerCleanup:%d\n", ret);
 }
+
 int main(int argc, char** argv)
 {
     (void)argc; (void)argv;
 
+    wh_FlashUnit_MemTest();
     wh_Nvm_UnitTest();
+    wh_Nvm_BulkMountTest();
+    wh_Nvm_MmapTest();
+    wh_Nvm_IncrementalDestroyTest();
+    wh_Nvm_CopyFallbackTest();
+    wh_Nvm_AddObjectsTest();
+    wh_Nvm_StreamTest();
+#if NF_PARTITION_COUNT >= 4
+    wh_Nvm_RotationTest();
+#endif
+#if (NF_PARTITION_COUNT >= 4) && (NF_WRITE_BUFFER_SIZE > 0)
+    wh_Nvm_IdleInterleaveTest();
+#endif
+    wh_Counter_FlashTest();
+    wh_Server_KeyCacheTest();
+    wh_Image_VerifyTest();
+#if NF_WRITE_BUFFER_SIZE > 0
+    wh_Nvm_WriteBufferTest();
+#endif
+#if NF_CACHE_ENTRY_COUNT > 0
+    wh_Nvm_CacheTest();
+#endif
+#ifdef WOLFHSM_NVM_CHECKPOINT
+    wh_Nvm_CheckpointTest();
+#endif
+    wh_Comm_TranslateTest();
     wh_CommClientServer_Test();
     wh_CommClientServer_MemThreadTest();
     wh_CommClientServer_TcpThreadTest();
+    wh_CommClientServer_TcpPartialSendTest();
+    wh_CommClientServer_UnixThreadTest();
+    wh_CommClientServer_ShmThreadTest();
+    wh_ClientServer_MemThreadTest();
+    wh_ClientServer_MemRingTest();
+    wh_ClientServer_KeyMessageTest();
+    wh_ClientServer_NvmMessageTest();
+    wh_ClientServer_CryptoBatchTest();
+    wh_ClientServer_StatsMessageTest();
+    wh_ClientServer_ShmRingThreadTest();
+    wh_ClientServer_PipelineTest();
+#if WH_SERVER_COMM_COUNT >= 2
+    wh_ClientServer_MultiClientTest();
+    wh_ClientServer_MultiClientErrorTest();
+    wh_ClientServer_NvmDestroyDeferTest();
+#endif
     wh_ClientServer_TcpThreadTest();
+    wh_ClientServer_TcpMultiThreadTest();
+    wh_ClientServer_TcpPipelineTest();
     return 0;
 }
 
@@ -51,12 +51,42 @@
 #include "wolfhsm/image_remote.h"
 #endif
 
+/* Number of requests that may be in flight at once */
+#ifndef WH_CLIENT_INFLIGHT_COUNT
+#define WH_CLIENT_INFLIGHT_COUNT 4
+#endif
+
+struct whClientContext_t;
+
+/* Completion callback of a submitted request, called from wh_Client_Poll with
+ * the response.  data points into the comm buffer and is only valid until the
+ * callback returns.  The callback may submit new requests.
+ */
+typedef void (*whClientCompleteCb)(struct whClientContext_t* c, void* arg,
+        uint16_t magic, uint16_t type, uint16_t seq,
+        uint16_t size, const void* data);
+
+/* In-flight request, keyed by whHeader.seq */
+typedef struct {
+    int used;
+    uint16_t seq;
+    uint16_t type;
+    whClientCompleteCb cb;
+    void* arg;
+} whClientRequest;
+
 /* Abstract context class */
 struct whClientContext_t {
     int inited;
     whCommClient comm[1];
     uint16_t last_req_id;
     uint16_t last_type;
+    uint16_t inflight_count;
+    whClientRequest inflight[WH_CLIENT_INFLIGHT_COUNT];
+    /* Destination of the EchoResponse data */
+    int echo_rc;
+    uint16_t* echo_out_size;
+    void* echo_out_data;
 #if 0
     whNvmClient* nvm;
     whKeyClient* key;
@@ -97,6 +127,26 @@ typedef struct whClientConfig_t whClientConfig;
 int wh_Client_Init(whClient* c, const whClientConfig* config);
 int wh_Client_Cleanup(whClient* c);
 
+/* Asynchronous API
+ * Submit sends a request without waiting for its response and records it as in
+ * flight.  Returns WH_ERROR_NOTREADY if WH_CLIENT_INFLIGHT_COUNT requests are
+ * already in flight or the transport is busy, in which case polling may free
+ * both.  Poll receives at most one response and completes the matching request
+ * by calling its callback.  Responses may arrive in any order.  Complete polls
+ * once and returns 0 once the request with seq is no longer in flight.
+ */
+int wh_Client_SubmitRequest(whClient* c, uint16_t type,
+        uint16_t size, const void* data,
+        whClientCompleteCb cb, void* arg, uint16_t* out_seq);
+int wh_Client_Poll(whClient* c);
+int wh_Client_Complete(whClient* c, uint16_t seq);
+
+/* Validate an echo response and copy out its data */
+int wh_Client_EchoDecode(uint16_t magic, uint16_t type,
+        uint16_t size, const void* data,
+        uint16_t *out_size, void* out_data);
+
+/* Echo with a single request in flight, layered on the asynchronous API */
 int wh_Client_EchoRequest(whClient* c, uint16_t size, const void* data);
 int wh_Client_EchoResponse(whClient* c, uint16_t *out_size, void* data);
 int wh_Client_Echo(whClient* c, uint16_t snd_len, const void* snd_data,
@@ -40,6 +40,19 @@ enum {
     WOLFHSM_COMM_MTU = (WOLFHSM_COMM_HEADER_LEN + WOLFHSM_COMM_DATA_LEN)
 };
 
+/* Number of consecutive WH_ERROR_NOTREADY polls of one operation before
+ * wh_CommClient_Wait and wh_CommServer_Wait block in the transport Wait.  Fast
+ * operations complete while spinning and keep their latency. */
+#ifndef WOLFHSM_COMM_WAIT_SPINS
+#define WOLFHSM_COMM_WAIT_SPINS 100
+#endif
+
+/* Longest single block in the transport Wait, after which the caller polls
+ * again.  Bounds the latency of a missed notification. */
+#ifndef WOLFHSM_COMM_WAIT_TIMEOUT_US
+#define WOLFHSM_COMM_WAIT_TIMEOUT_US 10000
+#endif
+
 /* Support for endian and version differences */
 /* Version is BCD to avoid conflict with endian marker */
 #define WH_COMM_VERSION (0x01u)
@@ -51,9 +64,17 @@ enum {
 #define WH_COMM_MAGIC_NATIVE    ((WH_COMM_ENDIAN << 8) | WH_COMM_VERSION)
 #define WH_COMM_MAGIC_SWAP      (WH_COMM_ENDIAN | (WH_COMM_VERSION << 8))
 
+/* Nonzero when messages with this magic need no translation.  Defining
+ * WOLFHSM_COMM_NATIVE_ONLY, when every client has the server's endianness,
+ * makes this constant so the translate helpers compile to nothing.  Requests
+ * of the other endianness then get an empty response. */
+#ifdef WOLFHSM_COMM_NATIVE_ONLY
+#define WH_COMM_FLAGS_SWAPTEST(_magic) ((void)(_magic), 1)
+#else
 #define WH_COMM_FLAGS_SWAPTEST(_magic) \
-    (_magic                 & WH_COMM_MAGIC_ENDIAN_MASK) ==  \
-    (WH_COMM_MAGIC_NATIVE   & WH_COMM_MAGIC_ENDIAN_MASK)
+    (((_magic)              & WH_COMM_MAGIC_ENDIAN_MASK) ==  \
+     (WH_COMM_MAGIC_NATIVE  & WH_COMM_MAGIC_ENDIAN_MASK))
+#endif
 
 /* Header for a packet, request or response. On-the-wire format */
 typedef struct {
@@ -84,7 +105,7 @@ static inline uint32_t wh_Translate32(uint16_t magic, uint32_t val)
     return WH_COMM_FLAGS_SWAPTEST(magic) ? val :
             ((val & 0xFF000000ul) >> 24) |
             ((val & 0xFF0000ul) >> 8) |
-            ((val & 0xFF00ul) >> 8) |
+            ((val & 0xFF00ul) << 8) |
             ((val & 0xFFul) << 24);
 }
 
@@ -109,6 +130,8 @@ typedef struct {
     void* transport_context;
     const void* transport_config;
     uint32_t client_id;
+    uint32_t wait_spins;        /* Polls before waiting. 0 uses the default */
+    uint32_t wait_timeout_us;   /* Max wait per poll. 0 uses the default */
 } whCommClientConfig;
 
 /* Context structure for a client.  Note the client context will track the
@@ -125,6 +148,8 @@ typedef struct {
     uint8_t* data;
     uint32_t client_id;
     uint32_t server_id;
+    uint32_t wait_spins;
+    uint32_t wait_timeout_us;
     int initialized;
 } whCommClient;
 
@@ -149,6 +174,22 @@ int wh_CommClient_RecvResponse(whCommClient* context,
         uint16_t* out_magic, uint16_t* out_type, uint16_t* out_seq,
         uint16_t* out_size, void* data);
 
+/* Zero-copy alternative to RecvResponse.  If a response packet has been
+ * buffered, get the header and point out_data at the response data within the
+ * context, which remains valid until the next send or receive.
+ */
+int wh_CommClient_RecvResponseInPlace(whCommClient* context,
+        uint16_t* out_magic, uint16_t* out_type, uint16_t* out_seq,
+        uint16_t* out_size, const void** out_data);
+
+/* Call after an operation returned WH_ERROR_NOTREADY and before retrying it.
+ * Returns immediately for the first wait_spins polls counted in *inout_polls,
+ * which must be zeroed before the first attempt.  After that, blocks in the
+ * transport Wait, if any, for up to wait_timeout_us.  Returns 0 to retry or an
+ * error if the transport failed.
+ */
+int wh_CommClient_Wait(whCommClient* context, uint32_t* inout_polls);
+
 /* Inform the server that no further communications are necessary and any
  * unfinished requests can be ignored.
  */
@@ -160,6 +201,9 @@ typedef struct {
     const whTransportServerCb* transport_cb;
     const void* transport_config;
     uint32_t server_id;
+    uint32_t client_id;         /* Client served by this endpoint */
+    uint32_t wait_spins;        /* Polls before waiting. 0 uses the default */
+    uint32_t wait_timeout_us;   /* Max wait per poll. 0 uses the default */
 } whCommServerConfig;
 
 /* Context structure for a server.  Note the client context will track the
@@ -173,8 +217,11 @@ typedef struct {
     uint8_t packet[WOLFHSM_COMM_MTU];
     whHeader* hdr;
     uint8_t* data;
+    uint8_t* resp_packet;   /* Response packet lent by GetResponseBuffer */
     uint32_t client_id;
     uint32_t server_id;
+    uint32_t wait_spins;
+    uint32_t wait_timeout_us;
     int initialized;
 } whCommServer;
 
@@ -199,6 +246,38 @@ int wh_CommServer_SendResponse(whCommServer* context,
         uint16_t magic, uint16_t type, uint16_t seq,
         uint16_t data_size, const void* data);
 
+/* Zero-copy alternative to RecvRequest.  If a request packet has been
+ * buffered, get the header and point out_data at the request data, which is
+ * held either by the transport or by the context.  The data remains valid until
+ * the response is sent.
+ */
+int wh_CommServer_RecvRequestInPlace(whCommServer* context,
+        uint16_t* out_magic, uint16_t* out_type, uint16_t* out_seq,
+        uint16_t* out_size, const void** out_data);
+
+/* Lend the buffer for the response data, of at least WOLFHSM_COMM_DATA_LEN
+ * bytes, directly from the transport when supported.  Note the response buffer
+ * may be the same memory as the request data, so handlers must tolerate
+ * aliasing.
+ */
+int wh_CommServer_GetResponseBuffer(whCommServer* context,
+        uint16_t* out_size, void** out_data);
+
+/* Send the data_size bytes already written to the lent response buffer using
+ * the same seq as the incoming request.
+ */
+int wh_CommServer_SendResponseInPlace(whCommServer* context,
+        uint16_t magic, uint16_t type, uint16_t seq,
+        uint16_t data_size);
+
+/* Get the number of requests waiting in the transport, including one being
+ * handled.  Returns WH_ERROR_NOTFOUND if the transport cannot report it.
+ */
+int wh_CommServer_GetQueueDepth(whCommServer* context, uint16_t* out_depth);
+
+/* Server version of wh_CommClient_Wait */
+int wh_CommServer_Wait(whCommServer* context, uint32_t* inout_polls);
+
 int wh_CommServer_Cleanup(whCommServer* context);
 
 #endif /* WOLFHSM_WH_COMM_H_ */
@@ -46,8 +46,15 @@ typedef uint16_t whKeyId;
 /* HSM NVM object identifier type. */
 typedef uint16_t whNvmId;
 
-/* HSM NVM Size type */
+/* HSM NVM Size type.  Define WOLFHSM_NVM_LARGE_OBJECTS for 32-bit object and
+ * partition sizes, which changes the on-flash layout of whNvmMetadata */
+#ifdef WOLFHSM_NVM_LARGE_OBJECTS
+typedef uint32_t whNvmSize;
+#define WOLFHSM_NVM_MAX_OBJECT_SIZE (0xFFFFFFFFul)
+#else
 typedef uint16_t whNvmSize;
+#define WOLFHSM_NVM_MAX_OBJECT_SIZE (0xFFFFul)
+#endif
 
 /* HSM NVM Access type */
 typedef uint16_t whNvmAccess;
@@ -58,19 +65,28 @@ typedef uint16_t whNvmFlags;
 /* HSM NVM metadata structure */
 enum {
     WOLFHSM_NVM_LABEL_LEN = 24,
+#ifdef WOLFHSM_NVM_LARGE_OBJECTS
+    WOLFHSM_NVM_METADATA_LEN = 36,
+#else
     WOLFHSM_NVM_METADATA_LEN = 32,
-    WOLFHSM_NVM_MAX_OBJECT_SIZE = 65535,
+#endif
 };
 
 /* List flags */
 #define WOLFHSM_NVM_ACCESS_ANY (0xFFFF)
 #define WOLFHSM_NVM_FLAGS_ANY (0xFFFF)
 
+/* Object flags */
+#define WOLFHSM_NVM_FLAGS_NOCACHE (0x0001)  /* Never keep the data in RAM */
+
 /* User-specified metadata for an NVM object */
 typedef struct {
     whNvmId id;             /* Unique identifier */
     whNvmAccess access;     /* Growth */
     whNvmFlags flags;       /* Growth */
+#ifdef WOLFHSM_NVM_LARGE_OBJECTS
+    uint16_t reserved;      /* Aligns len.  Set to 0 */
+#endif
     whNvmSize len;          /* Length of data in bytes */
     uint8_t label[WOLFHSM_NVM_LABEL_LEN];
 } whNvmMetadata;
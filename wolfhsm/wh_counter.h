@@ -0,0 +1,31 @@
+/*
+ * wolfhsm/wh_counter.h
+ *
+ * Abstract library to provide the WOLFHSM_NUM_COUNTERS non-volatile monotonic
+ * 32-bit counters.  Counters start at 0 and are only incremented.  Each
+ * Increment must be durable before returning so a counter never moves
+ * backwards after a reset.
+ *
+ */
+
+#ifndef WOLFHSM_WH_COUNTER_H_
+#define WOLFHSM_WH_COUNTER_H_
+
+#include <stdint.h>
+
+#include "wolfhsm/wh_common.h"  /* For whCounterId */
+
+typedef struct {
+    int (*Init)(void* context, const void *config);
+    int (*Cleanup)(void* context);
+
+    /* Retrieve the current value of the counter.  Returns WH_ERROR_BADARGS if
+     * id is not less than WOLFHSM_NUM_COUNTERS. */
+    int (*Read)(void* context, whCounterId id, uint32_t* out_value);
+
+    /* Add one to the counter and optionally return the new value.  Returns
+     * WH_ERROR_NOSPACE once the counter has reached UINT32_MAX. */
+    int (*Increment)(void* context, whCounterId id, uint32_t* out_value);
+} whCounterCb;
+
+#endif /* WOLFHSM_WH_COUNTER_H_ */
@@ -0,0 +1,70 @@
+/*
+ * wolfhsm/wh_counter_flash.h
+ *
+ * Concrete library to implement the non-volatile counters using a whFlash
+ * bottom end.
+ *
+ * Each of the 2 partitions holds a header unit that commits the partition, the
+ * base values of all counters, and a log of increments.  An Increment programs
+ * the next blank log unit with the counter id, so it is a single unit program
+ * with no erase.  The values are kept in RAM, rebuilt at Init by adding the
+ * log to the bases.  When the log is full, the current values are written as
+ * the bases of the other partition, which is then committed, and the old
+ * partition is erased.
+ *
+ */
+
+#ifndef WOLFHSM_WH_COUNTER_FLASH_H_
+#define WOLFHSM_WH_COUNTER_FLASH_H_
+
+#include <stdint.h>
+
+#include "wolfhsm/wh_common.h"
+#include "wolfhsm/wh_flash.h"
+#include "wolfhsm/wh_flash_unit.h"
+
+/* Number of log units read per flash access during Init.  The read buffer of
+ * CF_LOG_READ_UNITS units is on the stack. */
+#ifndef CF_LOG_READ_UNITS
+#define CF_LOG_READ_UNITS 32
+#endif
+#if CF_LOG_READ_UNITS < 1
+#error CF_LOG_READ_UNITS must be at least 1
+#endif
+
+/** whCounter config and context structure definitions */
+/* In memory configuration structure associated with a counter instance */
+typedef struct whCounterFlashConfig_t {
+    const whFlashCb* cb;    /* whFlash callback */
+    void* context;          /* whFlash context to be passed to cb */
+    const void* config;     /* Config to be passed to cb->Init */
+} whCounterFlashConfig;
+
+typedef struct whCounterFlashContext_t {
+    int initialized;
+
+    const whFlashCb* cb;            /* Flash callbacks */
+    void* flash;                    /* Flash context to use */
+    uint32_t partition_units;       /* Size of partition in units */
+
+    int active;                     /* Which partition is active */
+    uint32_t epoch;                 /* Epoch of the active partition header */
+    uint32_t next_log;              /* Next blank log unit in the partition */
+    uint32_t values[WOLFHSM_NUM_COUNTERS];  /* Current counter values */
+} whCounterFlashContext;
+
+/** whCounter Interface */
+int wh_CounterFlash_Init(void* c, const void* cf);
+int wh_CounterFlash_Cleanup(void* c);
+int wh_CounterFlash_Read(void* c, whCounterId id, uint32_t* out_value);
+int wh_CounterFlash_Increment(void* c, whCounterId id, uint32_t* out_value);
+
+#define WH_COUNTER_FLASH_CB                         \
+{                                                   \
+    .Init = wh_CounterFlash_Init,                   \
+    .Cleanup = wh_CounterFlash_Cleanup,             \
+    .Read = wh_CounterFlash_Read,                   \
+    .Increment = wh_CounterFlash_Increment,         \
+}
+
+#endif /* WOLFHSM_WH_COUNTER_FLASH_H_ */
@@ -32,6 +32,19 @@ typedef struct {
             uint32_t offset, uint32_t size, const uint8_t* data);
     int (*BlankCheck)(void* context,
             uint32_t offset, uint32_t size);
+
+    /* Optional: Program size bytes at dst_offset with the contents at
+     * src_offset without staging through the caller's RAM.  The destination
+     * must be blank and the ranges must not overlap.  Returns
+     * WH_ERROR_NOTVERIFIED if the destination does not match the source. */
+    int (*Copy)(void* context,
+            uint32_t dst_offset, uint32_t src_offset, uint32_t size);
+
+    /* Optional: Ensure data programmed or erased within the range is durable
+     * before returning, for backends that buffer writes.  Called around each
+     * program of a state count that commits an object or partition. */
+    int (*Sync)(void* context,
+            uint32_t offset, uint32_t size);
 } whFlashCb;
 
 #endif /* WOLFHSM_WH_FLASH_H_ */
@@ -47,16 +47,31 @@ int wh_FlashUnit_WriteLock(const whFlashCb* cb, void* context, uint32_t offset,
 int wh_FlashUnit_Read(const whFlashCb* cb, void* context, uint32_t offset,
         uint32_t count, whFlashUnit* data);
 
+/* Checks performed around programming by the _Ex functions */
+#define WHFU_PROGRAM_BLANKCHECK (1 << 0)    /* BlankCheck before Program */
+#define WHFU_PROGRAM_VERIFY     (1 << 1)    /* Verify after Program */
+#define WHFU_PROGRAM_DEFAULT    (WHFU_PROGRAM_BLANKCHECK | WHFU_PROGRAM_VERIFY)
+
 /* Program from data count units starting at offset */
 int wh_FlashUnit_Program(const whFlashCb* cb, void* context, uint32_t offset,
         uint32_t count, const whFlashUnit* data);
 
+/* Program as above, performing only the checks selected in flags */
+int wh_FlashUnit_ProgramEx(const whFlashCb* cb, void* context, uint32_t offset,
+        uint32_t count, const whFlashUnit* data, uint32_t flags);
+
 int wh_FlashUnit_BlankCheck(const whFlashCb* cb, void* context, uint32_t offset,
         uint32_t count);
 
 int wh_FlashUnit_Erase(const whFlashCb* cb, void* context, uint32_t offset,
         uint32_t count);
 
+/* Program count units at dst_offset from the units at src_offset using the
+ * optional flash Copy callback.  Returns WH_ERROR_BADARGS if not supported.
+ * Only WHFU_PROGRAM_BLANKCHECK is used from flags as Copy always verifies */
+int wh_FlashUnit_Copy(const whFlashCb* cb, void* context, uint32_t dst_offset,
+        uint32_t src_offset, uint32_t count, uint32_t flags);
+
 /** Helper functions to use buffered reads and writes for bytes */
 
 int wh_FlashUnit_ReadBytes(const whFlashCb* cb, void* context, uint32_t byte_offset,
@@ -65,4 +80,23 @@ int wh_FlashUnit_ReadBytes(const whFlashCb* cb, void* context, uint32_t byte_off
 int wh_FlashUnit_ProgramBytes(const whFlashCb* cb, void* context, uint32_t byte_offset,
         uint32_t byte_count, const uint8_t* data);
 
+int wh_FlashUnit_ProgramBytesEx(const whFlashCb* cb, void* context,
+        uint32_t byte_offset, uint32_t byte_count, const uint8_t* data,
+        uint32_t flags);
+
+/** Memory kernels for flash backends that can access their array directly,
+ * such as memory mapped flash or a RAM simulation.  Each scans 64-bit words,
+ * or SSE2/NEON vectors where available unless WHFU_NO_SIMD is defined, and
+ * returns at the first mismatching block. */
+
+/* Check that size bytes at data all equal erased_byte.  Returns 0 if blank or
+ * WH_ERROR_NOTBLANK */
+int wh_FlashUnit_MemBlankCheck(const uint8_t* data, uint32_t size,
+        uint8_t erased_byte);
+
+/* Check that size bytes at flash match data.  Returns 0 on a match or
+ * WH_ERROR_NOTVERIFIED */
+int wh_FlashUnit_MemVerify(const uint8_t* flash, uint32_t size,
+        const uint8_t* data);
+
 #endif /* WOLFHSM_WH_FLASH_UNIT_H_ */
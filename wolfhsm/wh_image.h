@@ -0,0 +1,94 @@
+/*
+ * wolfhsm/wh_image.h
+ *
+ * Verification of boot images described by whManifest_ex entries.
+ *
+ * The manifest_cmac of each entry is checked over the bytes of the entry that
+ * precede it, then the payload is streamed through the CMAC in
+ * WH_IMAGE_CHUNK_SIZE chunks and checked against payload_cmac.  With a read
+ * callback, such as a DMA engine starting a copy from flash, chunks alternate
+ * between two buffers so the read of the next chunk runs while the current one
+ * is in the CMAC, including the first chunk of the next manifest.  Without a
+ * read callback the payload is memory mapped and fed to the CMAC in place.
+ *
+ * With an NVM, the manifests verified are recorded in object cache_id along
+ * with the epoch given by the caller, authenticated with a CMAC using cmac_cb
+ * so a record written by another NVM user is ignored.  A later Verify with
+ * the same epoch still checks each manifest_cmac but skips the payloads
+ * recorded as verified with that manifest_cmac.  The caller must change the
+ * epoch, for example with a counter bumped on every image update, whenever a
+ * payload may have changed.
+ *
+ */
+
+#ifndef WOLFHSM_WH_IMAGE_H_
+#define WOLFHSM_WH_IMAGE_H_
+
+#include <stdint.h>
+
+#include "wolfhsm/wh_common.h"
+#include "wolfhsm/wh_nvm.h"
+
+/* Bytes of payload per CMAC update and per read.  A multiple of the AES block
+ * size.  With a read callback, 2 buffers of this size are in the context */
+#ifndef WH_IMAGE_CHUNK_SIZE
+#define WH_IMAGE_CHUNK_SIZE 4096
+#endif
+#if (WH_IMAGE_CHUNK_SIZE < 16) || ((WH_IMAGE_CHUNK_SIZE % 16) != 0)
+#error WH_IMAGE_CHUNK_SIZE must be a nonzero multiple of 16
+#endif
+
+/* CMAC with the image verification key, which the context holds */
+typedef struct {
+    int (*Init)(void* context);
+    int (*Update)(void* context, const uint8_t* data, uint32_t len);
+    int (*Final)(void* context, uint8_t* out_mac);  /* CMAC_LEN bytes */
+} whImageCmacCb;
+
+/* Copy of payload bytes into RAM, such as by DMA */
+typedef struct {
+    /* Start copying len bytes from src to dst.  Only one copy is started at a
+     * time. */
+    int (*ReadStart)(void* context, const uint8_t* src, uint32_t len,
+            uint8_t* dst);
+    /* Wait for the copy started last to complete */
+    int (*ReadWait)(void* context);
+} whImageReadCb;
+
+typedef struct {
+    const whImageCmacCb* cmac_cb;
+    void* cmac_context;
+    const whImageReadCb* read_cb;   /* Optional. NULL if memory mapped */
+    void* read_context;
+    const whNvmCb* nvm_cb;          /* Optional initialized NVM for the record
+                                     * of verified manifests */
+    void* nvm_context;
+    whNvmId cache_id;               /* NVM id of the record.  0 for none */
+} whImageConfig;
+
+typedef struct {
+    int initialized;
+    const whImageCmacCb* cmac_cb;
+    void* cmac_context;
+    const whImageReadCb* read_cb;
+    void* read_context;
+    const whNvmCb* nvm_cb;
+    void* nvm_context;
+    whNvmId cache_id;
+    uint32_t chunks;        /* Payload chunks passed to the CMAC */
+    uint32_t cache_hits;    /* Payloads skipped using the record */
+    uint32_t buffer[2][WH_IMAGE_CHUNK_SIZE / sizeof(uint32_t)];
+} whImageContext;
+
+int wh_Image_Init(whImageContext* context, const whImageConfig* config);
+int wh_Image_Cleanup(whImageContext* context);
+
+/* Verify the count manifests of list back-to-back.  Bit i of out_verified is
+ * set if list[i] was verified now or recorded as verified at epoch.  Returns
+ * WH_ERROR_NOTVERIFIED if any manifest or payload does not match.  count is
+ * at most WOLFHSM_NUM_MANIFESTS, and the record assumes the same manifest is
+ * at the same index on every call. */
+int wh_Image_Verify(whImageContext* context, const whManifest_ex* list,
+        int count, uint32_t epoch, uint32_t* out_verified);
+
+#endif /* WOLFHSM_WH_IMAGE_H_ */
@@ -9,6 +9,7 @@
 #include <stdint.h>
 
 #include "wolfhsm/wh_message.h"
+#include "wolfhsm/wh_stats.h"
 
 enum {
     WOLFHSM_MESSAGE_TYPE_COMM_NONE      = WOLFHSM_MESSAGE_GROUP_COMM + 0x00,
@@ -17,6 +18,7 @@ enum {
     WOLFHSM_MESSAGE_TYPE_COMM_CLOSE     = WOLFHSM_MESSAGE_GROUP_COMM + 0x03,
     WOLFHSM_MESSAGE_TYPE_COMM_INFO      = WOLFHSM_MESSAGE_GROUP_COMM + 0x04,
     WOLFHSM_MESSAGE_TYPE_COMM_ECHO      = WOLFHSM_MESSAGE_GROUP_COMM + 0x05,
+    WOLFHSM_MESSAGE_TYPE_COMM_STATS     = WOLFHSM_MESSAGE_GROUP_COMM + 0x06,
 };
 
 typedef struct {
@@ -43,6 +45,8 @@ typedef struct {
     uint8_t data[WOLFHSM_COMM_DATA_LEN - sizeof(uint16_t)];
 } whMessageCommLenData;
 
+/* Translates len.  Copies len bytes of data unless src and dest are the
+ * same */
 int wh_MessageComm_TranslateLenData(uint16_t magic,
         const whMessageCommLenData* src,
         whMessageCommLenData* dest);
@@ -65,4 +69,26 @@ typedef struct {
     uint8_t nvm_state;
 } whMessageCommInfo;
 
+/* Stats request/response data.  Servers built without WOLFHSM_STATS respond
+ * with an empty packet */
+enum {
+    WOLFHSM_MESSAGE_COMM_STATS_RESET = 0x1,     /* Reset after reading */
+};
+
+typedef struct {
+    uint32_t flags;
+} whMessageCommStatsRequest;
+
+int wh_MessageComm_TranslateStatsRequest(uint16_t magic,
+        const whMessageCommStatsRequest* src,
+        whMessageCommStatsRequest* dest);
+
+typedef struct {
+    whStats stats;
+} whMessageCommStatsResponse;
+
+int wh_MessageComm_TranslateStatsResponse(uint16_t magic,
+        const whMessageCommStatsResponse* src,
+        whMessageCommStatsResponse* dest);
+
 #endif /* WOLFHSM_WH_MESSAGE_COMM_H_ */
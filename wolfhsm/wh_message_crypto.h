@@ -0,0 +1,98 @@
+/*
+ * wolfhsm/wh_message_crypto.h
+ *
+ * Messages of the crypto group.
+ *
+ * CRYPTO_BATCH packs several independent crypto operations into one request.
+ * Each item is a whMessageCryptoItem header followed by its data, and each
+ * result is a whMessageCryptoResult header followed by its output, both padded
+ * to a multiple of 4 bytes.  The server executes the items in order and
+ * returns one result per item executed, each with its own status, so a batch
+ * of short operations costs a single round trip.  The op of an item is defined
+ * by the server's crypto callback.
+ *
+ */
+
+#ifndef WOLFHSM_WH_MESSAGE_CRYPTO_H_
+#define WOLFHSM_WH_MESSAGE_CRYPTO_H_
+
+#include <stdint.h>
+
+#include "wolfhsm/wh_common.h"
+#include "wolfhsm/wh_comm.h"
+#include "wolfhsm/wh_message.h"
+
+enum {
+    WOLFHSM_MESSAGE_TYPE_CRYPTO_NONE    = WOLFHSM_MESSAGE_GROUP_CRYPTO + 0x00,
+    WOLFHSM_MESSAGE_TYPE_CRYPTO_BATCH   = WOLFHSM_MESSAGE_GROUP_CRYPTO + 0x01,
+};
+
+/* Header of each item of a batch request */
+typedef struct {
+    uint16_t op;
+    uint16_t len;           /* Bytes of data following the header */
+} whMessageCryptoItem;
+
+int wh_MessageCrypto_TranslateItem(uint16_t magic,
+        const whMessageCryptoItem* src,
+        whMessageCryptoItem* dest);
+
+/* Header of each result of a batch response.  len is 0 unless rc is 0 */
+typedef struct {
+    uint16_t op;
+    uint16_t len;           /* Bytes of output following the header */
+    int32_t rc;
+} whMessageCryptoResult;
+
+int wh_MessageCrypto_TranslateResult(uint16_t magic,
+        const whMessageCryptoResult* src,
+        whMessageCryptoResult* dest);
+
+/* Size of an item or result with len bytes following its header */
+#define WOLFHSM_MESSAGE_CRYPTO_ITEM_SIZE(len) \
+    (sizeof(whMessageCryptoItem) + (((len) + 3u) & ~3u))
+#define WOLFHSM_MESSAGE_CRYPTO_RESULT_SIZE(len) \
+    (sizeof(whMessageCryptoResult) + (((len) + 3u) & ~3u))
+
+typedef struct {
+    uint16_t count;
+    uint16_t pad;
+    uint8_t items[WOLFHSM_COMM_DATA_LEN - 4];
+} whMessageCryptoBatchRequest;
+
+/* Results follow for the first count items of the request.  When the output
+ * of the next item does not fit, it is left unexecuted and count is less than
+ * the requested count, so the client sends the remaining items again.  rc is
+ * nonzero if the request itself was malformed */
+typedef struct {
+    int32_t rc;
+    uint16_t count;
+    uint16_t pad;
+    uint8_t results[WOLFHSM_COMM_DATA_LEN - 8];
+} whMessageCryptoBatchResponse;
+
+/* Translates count.  Items are translated individually */
+int wh_MessageCrypto_TranslateBatchRequest(uint16_t magic,
+        const whMessageCryptoBatchRequest* src,
+        whMessageCryptoBatchRequest* dest);
+
+/* Translates rc and count.  Results are translated individually */
+int wh_MessageCrypto_TranslateBatchResponse(uint16_t magic,
+        const whMessageCryptoBatchResponse* src,
+        whMessageCryptoBatchResponse* dest);
+
+/* Append an item to a native batch whose items use *inout_size bytes, and
+ * add the size of the item to *inout_size.  Returns WH_ERROR_NOSPACE if the
+ * item does not fit. */
+int wh_MessageCrypto_BatchAdd(whMessageCryptoBatchRequest* batch,
+        uint16_t* inout_size, uint16_t op, uint16_t len, const void* data);
+
+/* Get the result at *inout_offset of a native batch response whose results
+ * use size bytes, and advance *inout_offset to the next one.  out_data points
+ * to its output within the response.  Returns WH_ERROR_NOTFOUND after the
+ * last result and WH_ERROR_ABORTED if a result overruns size. */
+int wh_MessageCrypto_BatchNext(const whMessageCryptoBatchResponse* batch,
+        uint16_t size, uint16_t* inout_offset,
+        whMessageCryptoResult* out_result, const uint8_t** out_data);
+
+#endif /* WOLFHSM_WH_MESSAGE_CRYPTO_H_ */
@@ -0,0 +1,74 @@
+/*
+ * wolfhsm/wh_message_key.h
+ *
+ * Messages of the key management group, served by the server key cache.
+ *
+ */
+
+#ifndef WOLFHSM_WH_MESSAGE_KEY_H_
+#define WOLFHSM_WH_MESSAGE_KEY_H_
+
+#include <stdint.h>
+
+#include "wolfhsm/wh_common.h"
+#include "wolfhsm/wh_comm.h"
+#include "wolfhsm/wh_message.h"
+
+enum {
+    WOLFHSM_MESSAGE_TYPE_KEY_NONE       = WOLFHSM_MESSAGE_GROUP_KEY + 0x00,
+    WOLFHSM_MESSAGE_TYPE_KEY_CACHE      = WOLFHSM_MESSAGE_GROUP_KEY + 0x01,
+    WOLFHSM_MESSAGE_TYPE_KEY_EVICT      = WOLFHSM_MESSAGE_GROUP_KEY + 0x02,
+    WOLFHSM_MESSAGE_TYPE_KEY_COMMIT     = WOLFHSM_MESSAGE_GROUP_KEY + 0x03,
+    WOLFHSM_MESSAGE_TYPE_KEY_EXPORT     = WOLFHSM_MESSAGE_GROUP_KEY + 0x04,
+    WOLFHSM_MESSAGE_TYPE_KEY_ERASE      = WOLFHSM_MESSAGE_GROUP_KEY + 0x05,
+};
+
+/* Largest key carried by a message.  Leaves room for a whMessageKeyResponse
+ * and the other fields of a whMessageKeyData */
+enum {
+    WOLFHSM_MESSAGE_KEY_DATA_LEN = WOLFHSM_COMM_DATA_LEN - 16 -
+            WOLFHSM_NVM_LABEL_LEN,
+};
+
+/* Key id, metadata and data of KEY_CACHE requests and KEY_EXPORT responses */
+typedef struct {
+    uint16_t id;
+    uint16_t access;
+    uint16_t flags;
+    uint16_t len;
+    uint8_t label[WOLFHSM_NVM_LABEL_LEN];
+    uint8_t data[WOLFHSM_MESSAGE_KEY_DATA_LEN];
+} whMessageKeyData;
+
+/* Translates the fields before data, which is not translated */
+int wh_MessageKey_TranslateData(uint16_t magic,
+        const whMessageKeyData* src,
+        whMessageKeyData* dest);
+
+/* Request of KEY_EVICT, KEY_COMMIT, KEY_EXPORT and KEY_ERASE */
+typedef struct {
+    uint16_t id;
+} whMessageKeyIdRequest;
+
+int wh_MessageKey_TranslateIdRequest(uint16_t magic,
+        const whMessageKeyIdRequest* src,
+        whMessageKeyIdRequest* dest);
+
+/* Response of every request */
+typedef struct {
+    int32_t rc;
+    uint16_t id;
+    uint16_t pad;
+} whMessageKeyResponse;
+
+int wh_MessageKey_TranslateResponse(uint16_t magic,
+        const whMessageKeyResponse* src,
+        whMessageKeyResponse* dest);
+
+/* Response of KEY_EXPORT.  key is only sent when result.rc is 0 */
+typedef struct {
+    whMessageKeyResponse result;
+    whMessageKeyData key;
+} whMessageKeyExportResponse;
+
+#endif /* WOLFHSM_WH_MESSAGE_KEY_H_ */
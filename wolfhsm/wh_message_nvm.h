@@ -0,0 +1,225 @@
+/*
+ * wolfhsm/wh_message_nvm.h
+ *
+ * Messages of the NVM group, served by the server's whNvmCb.
+ *
+ * Besides one message per NVM function, LISTMETADATA returns the metadata of
+ * as many objects as fit in a packet and READMULTI returns the data of several
+ * small objects, so a client can enumerate and load the store in a few round
+ * trips.  Lengths and offsets are 32-bit on the wire regardless of whNvmSize.
+ *
+ */
+
+#ifndef WOLFHSM_WH_MESSAGE_NVM_H_
+#define WOLFHSM_WH_MESSAGE_NVM_H_
+
+#include <stdint.h>
+
+#include "wolfhsm/wh_common.h"
+#include "wolfhsm/wh_comm.h"
+#include "wolfhsm/wh_message.h"
+#include "wolfhsm/wh_nvm.h"
+
+enum {
+    WOLFHSM_MESSAGE_TYPE_NVM_NONE           = WOLFHSM_MESSAGE_GROUP_NVM + 0x00,
+    WOLFHSM_MESSAGE_TYPE_NVM_GETAVAILABLE   = WOLFHSM_MESSAGE_GROUP_NVM + 0x01,
+    WOLFHSM_MESSAGE_TYPE_NVM_ADDOBJECT      = WOLFHSM_MESSAGE_GROUP_NVM + 0x02,
+    WOLFHSM_MESSAGE_TYPE_NVM_LIST           = WOLFHSM_MESSAGE_GROUP_NVM + 0x03,
+    WOLFHSM_MESSAGE_TYPE_NVM_GETMETADATA    = WOLFHSM_MESSAGE_GROUP_NVM + 0x04,
+    WOLFHSM_MESSAGE_TYPE_NVM_DESTROYOBJECTS = WOLFHSM_MESSAGE_GROUP_NVM + 0x05,
+    WOLFHSM_MESSAGE_TYPE_NVM_READ           = WOLFHSM_MESSAGE_GROUP_NVM + 0x06,
+    WOLFHSM_MESSAGE_TYPE_NVM_LISTMETADATA   = WOLFHSM_MESSAGE_GROUP_NVM + 0x07,
+    WOLFHSM_MESSAGE_TYPE_NVM_READMULTI      = WOLFHSM_MESSAGE_GROUP_NVM + 0x08,
+};
+
+/* Object metadata as sent on the wire */
+typedef struct {
+    uint16_t id;
+    uint16_t access;
+    uint16_t flags;
+    uint16_t pad;
+    uint32_t len;
+    uint8_t label[WOLFHSM_NVM_LABEL_LEN];
+} whMessageNvmMetadata;
+
+enum {
+    /* Largest object data carried by ADDOBJECT and READ */
+    WOLFHSM_MESSAGE_NVM_DATA_LEN = WOLFHSM_COMM_DATA_LEN -
+            sizeof(whMessageNvmMetadata),
+    /* Largest number of ids in a READMULTI request */
+    WOLFHSM_MESSAGE_NVM_MULTI_COUNT = 16,
+};
+
+/* Translates the fixed fields.  label is only copied */
+int wh_MessageNvm_TranslateMetadata(uint16_t magic,
+        const whMessageNvmMetadata* src,
+        whMessageNvmMetadata* dest);
+
+/* Response of ADDOBJECT and DESTROYOBJECTS, and of every request that fails
+ * before its own response could be built */
+typedef struct {
+    int32_t rc;
+} whMessageNvmResponse;
+
+int wh_MessageNvm_TranslateResponse(uint16_t magic,
+        const whMessageNvmResponse* src,
+        whMessageNvmResponse* dest);
+
+/* GETAVAILABLE has an empty request */
+typedef struct {
+    int32_t rc;
+    uint32_t avail_size;
+    uint32_t reclaim_size;
+    uint16_t avail_objects;
+    uint16_t reclaim_objects;
+} whMessageNvmGetAvailableResponse;
+
+int wh_MessageNvm_TranslateGetAvailableResponse(uint16_t magic,
+        const whMessageNvmGetAvailableResponse* src,
+        whMessageNvmGetAvailableResponse* dest);
+
+/* meta.len bytes of data follow the metadata.  Translate meta with
+ * wh_MessageNvm_TranslateMetadata */
+typedef struct {
+    whMessageNvmMetadata meta;
+    uint8_t data[WOLFHSM_MESSAGE_NVM_DATA_LEN];
+} whMessageNvmAddObjectRequest;
+
+/* Request of LIST and LISTMETADATA.  As with whNvmCb List, a start_id of 0
+ * begins with the first object and any other id continues after it.
+ * max_count limits the entries of a LISTMETADATA response, with 0 for as many
+ * as fit, and is ignored by LIST. */
+typedef struct {
+    uint16_t access;
+    uint16_t flags;
+    uint16_t start_id;
+    uint16_t max_count;
+} whMessageNvmListRequest;
+
+int wh_MessageNvm_TranslateListRequest(uint16_t magic,
+        const whMessageNvmListRequest* src,
+        whMessageNvmListRequest* dest);
+
+typedef struct {
+    int32_t rc;
+    uint16_t count;
+    uint16_t id;
+} whMessageNvmListResponse;
+
+int wh_MessageNvm_TranslateListResponse(uint16_t magic,
+        const whMessageNvmListResponse* src,
+        whMessageNvmListResponse* dest);
+
+/* Request of GETMETADATA */
+typedef struct {
+    uint16_t id;
+    uint16_t pad;
+} whMessageNvmIdRequest;
+
+int wh_MessageNvm_TranslateIdRequest(uint16_t magic,
+        const whMessageNvmIdRequest* src,
+        whMessageNvmIdRequest* dest);
+
+typedef struct {
+    int32_t rc;
+    whMessageNvmMetadata meta;
+} whMessageNvmGetMetadataResponse;
+
+int wh_MessageNvm_TranslateGetMetadataResponse(uint16_t magic,
+        const whMessageNvmGetMetadataResponse* src,
+        whMessageNvmGetMetadataResponse* dest);
+
+typedef struct {
+    uint16_t list_count;
+    uint16_t list[WH_NVM_MAX_DESTROY_OBJECTS_COUNT];
+} whMessageNvmDestroyObjectsRequest;
+
+int wh_MessageNvm_TranslateDestroyObjectsRequest(uint16_t magic,
+        const whMessageNvmDestroyObjectsRequest* src,
+        whMessageNvmDestroyObjectsRequest* dest);
+
+typedef struct {
+    uint16_t id;
+    uint16_t pad;
+    uint32_t offset;
+    uint32_t len;
+} whMessageNvmReadRequest;
+
+int wh_MessageNvm_TranslateReadRequest(uint16_t magic,
+        const whMessageNvmReadRequest* src,
+        whMessageNvmReadRequest* dest);
+
+/* len bytes of data follow.  data is not translated */
+typedef struct {
+    int32_t rc;
+    uint32_t len;
+    uint8_t data[WOLFHSM_MESSAGE_NVM_DATA_LEN];
+} whMessageNvmReadResponse;
+
+int wh_MessageNvm_TranslateReadResponse(uint16_t magic,
+        const whMessageNvmReadResponse* src,
+        whMessageNvmReadResponse* dest);
+
+enum {
+    /* Entries that fit in a LISTMETADATA response */
+    WOLFHSM_MESSAGE_NVM_LIST_COUNT = (WOLFHSM_COMM_DATA_LEN - 8) /
+            sizeof(whMessageNvmMetadata),
+};
+
+/* count entries follow.  remaining is the number of matching objects after
+ * the last entry, so a client continues with that entry's id as start_id
+ * until remaining is 0 */
+typedef struct {
+    int32_t rc;
+    uint16_t count;
+    uint16_t remaining;
+    whMessageNvmMetadata entries[WOLFHSM_MESSAGE_NVM_LIST_COUNT];
+} whMessageNvmListMetadataResponse;
+
+/* Translates rc, count and remaining.  Entries are translated individually */
+int wh_MessageNvm_TranslateListMetadataResponse(uint16_t magic,
+        const whMessageNvmListMetadataResponse* src,
+        whMessageNvmListMetadataResponse* dest);
+
+typedef struct {
+    uint16_t count;
+    uint16_t ids[WOLFHSM_MESSAGE_NVM_MULTI_COUNT];
+} whMessageNvmReadMultiRequest;
+
+int wh_MessageNvm_TranslateReadMultiRequest(uint16_t magic,
+        const whMessageNvmReadMultiRequest* src,
+        whMessageNvmReadMultiRequest* dest);
+
+/* Header of each object in a READMULTI response, followed by len bytes of
+ * data padded to a multiple of 4.  len is 0 unless rc is 0.  An object larger
+ * than an entire response has rc WH_ERROR_NOSPACE and must be READ instead */
+typedef struct {
+    uint16_t id;
+    uint16_t pad;
+    int32_t rc;
+    uint32_t len;
+} whMessageNvmRecord;
+
+int wh_MessageNvm_TranslateRecord(uint16_t magic,
+        const whMessageNvmRecord* src,
+        whMessageNvmRecord* dest);
+
+/* Size of a record with len bytes of data */
+#define WOLFHSM_MESSAGE_NVM_RECORD_SIZE(len) \
+    (sizeof(whMessageNvmRecord) + (((len) + 3u) & ~3u))
+
+/* Records follow for the first count ids of the request, in order.  A client
+ * requests the remaining ids again when count is less than it asked for */
+typedef struct {
+    int32_t rc;
+    uint16_t count;
+    uint16_t pad;
+    uint8_t records[WOLFHSM_COMM_DATA_LEN - 8];
+} whMessageNvmReadMultiResponse;
+
+/* Translates rc and count.  Records are translated individually */
+int wh_MessageNvm_TranslateReadMultiResponse(uint16_t magic,
+        const whMessageNvmReadMultiResponse* src,
+        whMessageNvmReadMultiResponse* dest);
+
+#endif /* WOLFHSM_WH_MESSAGE_NVM_H_ */
@@ -55,6 +55,12 @@ typedef struct {
     int (*AddObject)(void* context, whNvmMetadata *meta,
             whNvmSize data_len, const uint8_t* data);
 
+    /* Optional: Add count objects as with AddObject, where meta_list[i] is
+     * stored with len_list[i] bytes from data_list[i].  Returns
+     * WH_ERROR_NOSPACE without modifying the NVM if all objects do not fit. */
+    int (*AddObjects)(void* context, whNvmId count, whNvmMetadata* meta_list,
+            const whNvmSize* len_list, const uint8_t* const* data_list);
+
     /* Retrieve the next matching id starting at start_id. Sets out_count to the
      * total number of id's that match access and flags. */
     int (*List)(void* context, whNvmAccess access, whNvmFlags flags,
@@ -77,6 +83,39 @@ typedef struct {
     /* Read the data of the object starting at the byte offset */
     int (*Read)(void* context, whNvmId id, whNvmSize offset,
             whNvmSize data_len, uint8_t* out_data);
+
+    /* Optional: Incremental version of DestroyObjects with the same recovery
+     * semantics.  Begin marks the listed id's as destroyed.  Each call to Step
+     * performs a bounded amount of the replication, limited to approximately
+     * max_bytes of object data, and returns WH_ERROR_NOTREADY until the
+     * replication is complete.  Storage the replication retires may be left
+     * for Idle to erase.  Finish completes any remaining
+     * Steps.  Other functions may be called between Steps, but functions that
+     * modify the NVM return WH_ERROR_NOTREADY until the replication is done. */
+    int (*DestroyObjectsBegin)(void* context, whNvmId list_count,
+            const whNvmId* id_list);
+    int (*DestroyObjectsStep)(void* context, uint32_t max_bytes);
+    int (*DestroyObjectsFinish)(void* context);
+
+    /* Optional: Add an object by appending its data over several calls and
+     * committing it once.  Begin reserves an object with the metadata in meta,
+     * ignoring meta->len.  Append adds data_len bytes after the data appended
+     * so far.  Finish sets the length to the total appended and makes the
+     * object visible.  Abort discards the open object.  Only one object may be
+     * open, and functions that modify the NVM return WH_ERROR_NOTREADY until
+     * it is finished or aborted.  Interruption before Finish recovers as if
+     * the object was never added. */
+    int (*AddObjectBegin)(void* context, const whNvmMetadata* meta);
+    int (*AddObjectAppend)(void* context, whNvmSize data_len,
+            const uint8_t* data);
+    int (*AddObjectFinish)(void* context);
+    int (*AddObjectAbort)(void* context);
+
+    /* Optional: Perform deferred maintenance, such as erasing storage retired
+     * by DestroyObjects.  Returns WH_ERROR_NOTREADY while more work remains,
+     * including while an incremental DestroyObjects or appended object is
+     * open and the maintenance must wait */
+    int (*Idle)(void* context);
 } whNvmCb;
 
 #if 0
@@ -15,7 +15,89 @@
 #include "wolfhsm/wh_flash_unit.h"
 
 /* Number of objects in a directory */
+#ifndef NF_OBJECT_COUNT
 #define NF_OBJECT_COUNT 32
+#endif
+
+/* Number of slots in the in-memory id index of the directory.  Must be a power
+ * of 2 and larger than NF_OBJECT_COUNT.  Each slot uses 2 bytes of RAM, and a
+ * larger index reduces the probe length of each lookup. */
+#ifndef NF_ID_INDEX_SIZE
+#define NF_ID_INDEX_SIZE 64
+#endif
+
+#if ((NF_ID_INDEX_SIZE & (NF_ID_INDEX_SIZE - 1)) != 0)
+#error "NF_ID_INDEX_SIZE must be a power of 2"
+#endif
+#if (NF_ID_INDEX_SIZE <= NF_OBJECT_COUNT)
+#error "NF_ID_INDEX_SIZE must be larger than NF_OBJECT_COUNT"
+#endif
+
+/* Value of an unused slot in the id index */
+#define NF_ID_INDEX_EMPTY (-1)
+
+/* Number of directory objects read per flash access during a bulk mount.  The
+ * default reads the entire directory at once using a stack buffer of
+ * NF_OBJECT_COUNT on-flash objects.  Reduce to limit stack usage. */
+#ifndef NF_DIRECTORY_READ_COUNT
+#define NF_DIRECTORY_READ_COUNT NF_OBJECT_COUNT
+#endif
+
+/* Define WOLFHSM_NVM_CHECKPOINT to reserve a checkpoint of the directory in
+ * each partition, following the directory.  DestroyObjects programs it with
+ * the compacted objects, free pointers and id index, protected by a CRC.  Init
+ * loads it in one read and then reads only the objects added after it,
+ * falling back to reading the whole directory if it is blank or damaged.  The
+ * checkpoint is read and programmed through a stack buffer of its size, about
+ * 40 bytes per object.  This changes the partition layout. */
+
+/* Number of flash units copied per read/program when replicating an object
+ * during DestroyObjects, which is also the granularity of incremental Steps.
+ * The copy buffer of NF_COPY_OBJECT_BUFFER_UNITS units is on the stack.  Not
+ * used when the flash provides a Copy callback. */
+#ifndef NF_COPY_OBJECT_BUFFER_UNITS
+#define NF_COPY_OBJECT_BUFFER_UNITS 32
+#endif
+#if NF_COPY_OBJECT_BUFFER_UNITS < 1
+#error NF_COPY_OBJECT_BUFFER_UNITS must be at least 1
+#endif
+
+/* Largest number of flash partitions the NVM rotates through, selected by
+ * whNvmFlashConfig.partition_count.  Each DestroyObjects copies the objects to
+ * another erased partition, so updates wear all of the partitions evenly.
+ * Retired partitions are erased later by wh_NvmFlash_Idle. */
+#ifndef NF_PARTITION_COUNT
+#define NF_PARTITION_COUNT 4
+#endif
+#if (NF_PARTITION_COUNT < 2) || (NF_PARTITION_COUNT > 32)
+#error "NF_PARTITION_COUNT must be from 2 to 32"
+#endif
+
+/* Number of objects kept in the RAM read cache, each of up to
+ * NF_CACHE_ENTRY_SIZE bytes.  Set to 0 to remove the cache.  Objects with
+ * WOLFHSM_NVM_FLAGS_NOCACHE or larger than an entry are always read from
+ * flash. */
+#ifndef NF_CACHE_ENTRY_COUNT
+#define NF_CACHE_ENTRY_COUNT 0
+#endif
+#ifndef NF_CACHE_ENTRY_SIZE
+#define NF_CACHE_ENTRY_SIZE 64
+#endif
+
+/* Largest flash page, in bytes, held by the write buffer that coalesces the
+ * adjacent unit programs of object headers and data into one Program per
+ * page.  The page size is selected by whNvmFlashConfig.write_page_size.  Must
+ * be a power of 2 of at least 8 bytes.  Set to 0 to remove the buffer. */
+#ifndef NF_WRITE_BUFFER_SIZE
+#define NF_WRITE_BUFFER_SIZE 256
+#endif
+#if ((NF_WRITE_BUFFER_SIZE & (NF_WRITE_BUFFER_SIZE - 1)) != 0)
+#error "NF_WRITE_BUFFER_SIZE must be a power of 2"
+#endif
+#if (NF_WRITE_BUFFER_SIZE > 0) && (NF_WRITE_BUFFER_SIZE < 8)
+#error "NF_WRITE_BUFFER_SIZE must hold at least one whFlashUnit"
+#endif
+#define NF_WRITE_BUFFER_UNITS (NF_WRITE_BUFFER_SIZE / WHFU_BYTES_PER_UNIT)
 
 /* In-memory computed status of an Object or Directory */
 typedef enum {
@@ -47,14 +129,94 @@ typedef struct {
     uint32_t next_free_data;
     int reclaimable_entries;
     uint32_t reclaimable_data;
+    /* Open-addressed (linear probe) hash of metadata.id to the index of the
+     * USED object with that id, or NF_ID_INDEX_EMPTY */
+    int16_t id_index[NF_ID_INDEX_SIZE];
 } nfMemDirectory;
 
+/* Phases of an incremental DestroyObjects */
+typedef enum {
+    NF_COMPACT_IDLE      = 0,    /* No compaction in progress */
+    NF_COMPACT_ERASE     = 1,    /* Erase the destination partition */
+    NF_COMPACT_BEGIN     = 2,    /* Program the destination epoch and start */
+    NF_COMPACT_COPY      = 3,    /* Copy used objects to the destination */
+    NF_COMPACT_COMMIT    = 4,    /* Program the destination count and retire
+                                  * the previously active partition */
+} nfCompactPhase;
+
+/* In-memory state of an incremental DestroyObjects */
+typedef struct {
+    nfCompactPhase phase;
+    int partition;              /* Destination partition */
+    nfMemState state;           /* State to program into the destination */
+    int entry;                  /* Next source object to copy */
+    uint32_t data_offset;       /* Bytes already copied of the source object */
+    uint32_t next_object;       /* Next free destination object */
+    uint32_t next_data;         /* Next free destination data unit */
+} nfCompaction;
+
+#if NF_CACHE_ENTRY_COUNT > 0
+/* Copy of the data of a recently read object */
+typedef struct {
+    int used;
+    whNvmId id;
+    whNvmSize len;
+    uint32_t epoch;
+    uint32_t last_use;          /* Cache tick of the most recent access */
+    uint8_t data[NF_CACHE_ENTRY_SIZE];
+} nfCacheEntry;
+
+/* Read cache of object data with LRU eviction */
+typedef struct {
+    nfCacheEntry entries[NF_CACHE_ENTRY_COUNT];
+    uint32_t tick;
+    uint32_t hits;
+    uint32_t misses;
+} nfCache;
+#endif
+
+#if NF_WRITE_BUFFER_SIZE > 0
+/* Units programmed within one flash page that are not yet on flash */
+typedef struct {
+    uint32_t page_units;    /* Units per page.  0 when the buffer is off */
+    uint32_t base;          /* Flash unit offset of the buffered page */
+    uint32_t flags;         /* ProgramEx flags of the buffered units */
+    int pending;            /* Nonzero when any unit is dirty */
+    uint32_t dirty[(NF_WRITE_BUFFER_UNITS + 31) / 32];  /* Bit per unit */
+    whFlashUnit units[NF_WRITE_BUFFER_UNITS];
+} nfWriteBuffer;
+#endif
+
+/* Object being added over several AddObjectAppend calls */
+typedef struct {
+    int open;                   /* Nonzero between Begin and Finish */
+    uint32_t epoch;
+    whNvmMetadata meta;         /* meta.len counts the bytes appended */
+    uint32_t tail_len;          /* Bytes held in tail */
+    whFlashUnitBuffer tail;     /* Partial final unit not yet programmed */
+} nfStream;
+
+/* Policy for verifying programmed flash */
+typedef enum {
+    NF_VERIFY_ALWAYS     = 0,    /* Verify every program operation */
+    NF_VERIFY_COMMIT     = 1,    /* Verify only the state counts that commit */
+    NF_VERIFY_NONE       = 2,    /* Trust the flash ECC to report failures */
+} nfVerifyMode;
+
 /** whNvm config and context structure definitions */
 /* In memory configuration structure associated with an NVM instance */
 typedef struct whNvmFlashConfig_t {
     const whFlashCb* cb;    /* whFlash callback */
     void* context;          /* whFlash context to be passed to cb */
     const void* config;     /* Config to be passed to cb->Init */
+    int bulk_mount;         /* Nonzero to read the directory with bulk reads
+                             * and compute blank state in memory */
+    uint8_t erased_byte;    /* Value of erased flash bytes.  Used by bulk_mount */
+    nfVerifyMode verify;    /* When to Verify after programming */
+    uint32_t write_page_size;   /* Flash page bytes to coalesce programs
+                                 * into.  0 programs each write directly */
+    int partition_count;    /* Partitions of cb->PartitionSize bytes in the
+                             * flash.  0 for 2 */
 } whNvmFlashConfig;
 
 typedef struct whNvmFlashContext_t {
@@ -63,10 +225,28 @@ typedef struct whNvmFlashContext_t {
     const whFlashCb* cb;            /* Flash callbacks */
     void* flash;                    /* Flash context to use */
     uint32_t partition_units;       /* Size of partition in units */
+    int bulk_mount;                 /* Use bulk reads instead of BlankCheck */
+    whFlashUnit erased_unit;        /* Value of an erased unit for bulk_mount */
+    nfVerifyMode verify;            /* When to Verify after programming */
 
-    int active;                     /* Which partition (0 or 1) is active */
+    int partition_count;            /* Partitions in rotation */
+    int active;                     /* Which partition is active */
     nfMemState state;               /* State of active partition */
     nfMemDirectory directory;       /* Cache of active objects */
+    nfCompaction compaction;        /* State of incremental DestroyObjects */
+    nfStream stream;                /* Object open for appending */
+#ifdef WOLFHSM_NVM_CHECKPOINT
+    int checkpoint_mounted;         /* Directory was last loaded using the
+                                     * checkpoint */
+#endif
+    uint32_t erase_pending;         /* Bit per retired partition to erase */
+    uint32_t erase_count[NF_PARTITION_COUNT];   /* Erases since Init */
+#if NF_CACHE_ENTRY_COUNT > 0
+    nfCache cache;                  /* Recently read object data */
+#endif
+#if NF_WRITE_BUFFER_SIZE > 0
+    nfWriteBuffer write_buffer;     /* Programs not yet issued to flash */
+#endif
 } whNvmFlashContext;
 
 /** whNvm Interface */
@@ -80,11 +260,52 @@ int wh_NvmFlash_GetAvailable(void* c,
 int wh_NvmFlash_GetMetadata(void* c, whNvmId id, whNvmMetadata* out_meta);
 int wh_NvmFlash_AddObject(void* c, whNvmMetadata *meta,
         whNvmSize data_len,const uint8_t* data);
+int wh_NvmFlash_AddObjects(void* c, whNvmId count, whNvmMetadata* meta_list,
+        const whNvmSize* len_list, const uint8_t* const* data_list);
 int wh_NvmFlash_DestroyObjects(void* c, whNvmId list_count,
         const whNvmId* id_list);
 int wh_NvmFlash_Read(void* c, whNvmId id, whNvmSize offset,
         whNvmSize data_len, uint8_t* out_data);
 
+/* Incremental DestroyObjects.  Begin marks the listed objects as destroyed,
+ * each Step performs one phase of the replication, copying roughly max_bytes
+ * of object data, and Finish runs the remaining Steps.  Step returns
+ * WH_ERROR_NOTREADY while more work remains and 0 once the new partition is
+ * active.  The old partition is left for wh_NvmFlash_Idle to erase.  Read,
+ * List, GetMetadata and GetAvailable may be used between Steps, while
+ * AddObject and DestroyObjects return WH_ERROR_NOTREADY. */
+int wh_NvmFlash_DestroyObjectsBegin(void* c, whNvmId list_count,
+        const whNvmId* id_list);
+int wh_NvmFlash_DestroyObjectsStep(void* c, uint32_t max_bytes);
+int wh_NvmFlash_DestroyObjectsFinish(void* c);
+
+/* Erase one retired partition, so that erases happen while the NVM is otherwise
+ * idle.  Returns WH_ERROR_NOTREADY while more partitions remain to erase and 0
+ * once all are done, and WH_ERROR_NOTREADY without erasing while an
+ * incremental DestroyObjects or an appended object is open.  A DestroyObjects
+ * into a partition that is not yet erased erases it first. */
+int wh_NvmFlash_Idle(void* c);
+
+/* Add an object whose data is appended over several calls, so it may be larger
+ * than a single request.  Begin programs the object epoch and start, reserving
+ * the next entry.  Each Append programs data_len bytes after the previous
+ * ones, up to the free space in the partition.  Finish programs the metadata,
+ * with len set to the bytes appended, and commits the count once.  Abort
+ * leaves the object for the next DestroyObjects to reclaim.  AddObject,
+ * AddObjects and DestroyObjects return WH_ERROR_NOTREADY while an object is
+ * open.  After a reset with an object open, the remaining data space is
+ * unusable until the next DestroyObjects. */
+int wh_NvmFlash_AddObjectBegin(void* c, const whNvmMetadata* meta);
+int wh_NvmFlash_AddObjectAppend(void* c, whNvmSize data_len,
+        const uint8_t* data);
+int wh_NvmFlash_AddObjectFinish(void* c);
+int wh_NvmFlash_AddObjectAbort(void* c);
+
+/* Retrieve the number of Read calls served from and missing the RAM cache.
+ * Both are 0 when the cache is not compiled in. */
+int wh_NvmFlash_GetCacheStats(void* c, uint32_t* out_hits,
+        uint32_t* out_misses);
+
 #define WH_NVM_FLASH_CB                             \
 {                                                   \
     .Init = wh_NvmFlash_Init,                       \
@@ -93,8 +314,17 @@ int wh_NvmFlash_Read(void* c, whNvmId id, whNvmSize offset,
     .GetAvailable = wh_NvmFlash_GetAvailable,       \
     .GetMetadata = wh_NvmFlash_GetMetadata,         \
     .AddObject = wh_NvmFlash_AddObject,             \
+    .AddObjects = wh_NvmFlash_AddObjects,           \
     .DestroyObjects = wh_NvmFlash_DestroyObjects,   \
     .Read = wh_NvmFlash_Read,                       \
+    .DestroyObjectsBegin = wh_NvmFlash_DestroyObjectsBegin,     \
+    .DestroyObjectsStep = wh_NvmFlash_DestroyObjectsStep,       \
+    .DestroyObjectsFinish = wh_NvmFlash_DestroyObjectsFinish,   \
+    .AddObjectBegin = wh_NvmFlash_AddObjectBegin,               \
+    .AddObjectAppend = wh_NvmFlash_AddObjectAppend,             \
+    .AddObjectFinish = wh_NvmFlash_AddObjectFinish,             \
+    .AddObjectAbort = wh_NvmFlash_AddObjectAbort,               \
+    .Idle = wh_NvmFlash_Idle,                                   \
 }
 
 #endif /* WOLFHSM_WH_NVMFLASH_H_ */
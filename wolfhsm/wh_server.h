@@ -2,15 +2,66 @@
 #define WOLFHSM_WH_SERVER_H_
 
 #include "wolfhsm/wh_comm.h"
+#include "wolfhsm/wh_nvm.h"
+#include "wolfhsm/wh_server_keycache.h"
 
 #if 0
 #include "wolfhsm/nvm.h"
 #include "wolfhsm/nvm_remote.h"
 #endif
 
+/* Number of comm endpoints, each serving one client, held by a server */
+#ifndef WH_SERVER_COMM_COUNT
+#define WH_SERVER_COMM_COUNT 1
+#endif
+
+/* Bytes of object data copied in each idle pass of a DestroyObjects that the
+ * NVM runs incrementally */
+#ifndef WH_SERVER_NVM_STEP_BYTES
+#define WH_SERVER_NVM_STEP_BYTES 1024
+#endif
+
+/* Queue depth reported for transports that cannot report it */
+#define WH_SERVER_DEPTH_UNKNOWN 0xFFFF
+
+/* Execute one item of a CRYPTO_BATCH.  Writes at most *inout_out_len bytes of
+ * output to out and sets *inout_out_len to the length written.  The return
+ * value is the status of the item.  Return WH_ERROR_NOSPACE without side
+ * effects if the output does not fit, so the item can be sent again in
+ * another batch. */
+typedef int (*whServerCryptoCb)(void* context, uint16_t op,
+        uint16_t in_len, const uint8_t* in,
+        uint16_t* inout_out_len, uint8_t* out);
+
+/* Response held until the work its request started completes */
+typedef struct {
+    whCommServer* comm;     /* Endpoint waiting for the response, or NULL */
+    void* resp_data;        /* Response buffer lent by the endpoint */
+    uint16_t magic;
+    uint16_t type;
+    uint16_t seq;
+} whServerDeferred;
+
 /* Context structure to maintain the state of an HSM server */
 typedef struct whServerContext_t {
-    whCommServer comm[1];
+    whCommServer comm[WH_SERVER_COMM_COUNT];
+    int comm_count;
+    int next_comm;                  /* Endpoint polled first */
+    uint16_t served;                /* Requests served from next_comm */
+    uint16_t weight[WH_SERVER_COMM_COUNT];
+    uint32_t handled[WH_SERVER_COMM_COUNT];
+    int error[WH_SERVER_COMM_COUNT];    /* Status of the last request */
+    whKeyCache keycache;            /* Keys served to the KEY group */
+    const whNvmCb* nvm_cb;          /* NVM served to the NVM group */
+    void* nvm_context;
+    int nvm_compacting;             /* Incremental DestroyObjects running */
+    whServerDeferred nvm_destroy;   /* DESTROYOBJECTS answered once the
+                                     * replication is committed */
+    int defer_response;             /* Set by a handler to hold its response */
+    whServerCryptoCb crypto_cb;     /* Executes CRYPTO_BATCH items */
+    void* crypto_context;
+    /* Copy of a batch request whose results overwrite it in place */
+    uint8_t crypto_batch[WOLFHSM_COMM_DATA_LEN];
 #if 0
     whNvmContext* nvm_device;
     whNvmServer* nvm;
@@ -18,7 +69,16 @@ typedef struct whServerContext_t {
 } whServer;
 
 typedef struct whServerConfig_t {
-    whCommServerConfig* comm;
+    whCommServerConfig* comm;       /* Array of comm_count endpoint configs */
+    int comm_count;                 /* 0 is the same as 1 */
+    const uint16_t* comm_weights;   /* Optional. Requests served in a row from
+                                     * each endpoint while others wait */
+    const whNvmCb* nvm_cb;          /* Optional. Initialized NVM served to
+                                     * the NVM group and backing
+                                     * WOLFHSM_KEYID_NVM keys */
+    void* nvm_context;              /* Context passed to nvm_cb */
+    whServerCryptoCb crypto_cb;     /* Optional. Executes CRYPTO_BATCH items */
+    void* crypto_context;           /* Context passed to crypto_cb */
 #if 0
     whNvmConfig* nvm_device;
     whNvmServerConfig* nvm;
@@ -29,10 +89,42 @@ typedef struct whServerConfig_t {
  */
 int wh_Server_Init(whServer* server, whServerConfig* config);
 
-/* Receive and handle an incoming request message if present.
+/* Receive and handle an incoming request message if present.  Endpoints are
+ * polled round-robin, and each is served up to its weight of requests in a row
+ * before the next endpoint with a pending request is served.  When no request
+ * is pending, one Step of a running DestroyObjects is performed, else one
+ * cached key is committed to NVM if any are uncommitted, else the NVM Idle is
+ * called to erase storage that DestroyObjects retired.  A key that does not
+ * fit in the NVM stays uncommitted while a DestroyObjects of nothing reclaims
+ * the space of older versions in the following passes.  NVM DESTROYOBJECTS
+ * requests start an incremental DestroyObjects when the NVM supports it.  Its
+ * response, with the status of the replication, is only sent once the new
+ * partition is committed, and its endpoint is not polled until then.  Requests
+ * of other endpoints that modify the NVM complete the replication first.
+ * An endpoint whose request fails is recorded with the error and the other
+ * endpoints are still served.  Returns 0 when a request was handled,
+ * WH_ERROR_NOTREADY when none was pending, or the error when every endpoint
+ * failed.
  */
 int wh_Server_HandleRequestMessage(whServer* server);
 
+/* Wait for a request on any endpoint after HandleRequestMessage returned
+ * WH_ERROR_NOTREADY, as wh_CommServer_Wait does for one endpoint.  Transports
+ * cannot wait together, so with several endpoints each one that has not
+ * failed is waited on in turn for a share of its wait_timeout_us.  A request
+ * arriving on another endpoint is then noticed within that share.  Returns at
+ * once while a DestroyObjects replication runs in the idle passes.
+ */
+int wh_Server_Wait(whServer* server, uint32_t* inout_polls);
+
+/* Get the client_id, number of pending requests, number of requests handled,
+ * and status of the last request of an endpoint.  out_depth is
+ * WH_SERVER_DEPTH_UNKNOWN if the transport cannot report it.
+ */
+int wh_Server_GetClientInfo(whServer* server, int index,
+        uint32_t* out_client_id, uint16_t* out_depth, uint32_t* out_handled,
+        int* out_error);
+
 /* Stop all active and pending work, disconnect, and close all used resources.
  */
 int wh_Server_Cleanup(whServer* server);
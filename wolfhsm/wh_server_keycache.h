@@ -0,0 +1,94 @@
+/*
+ * wolfhsm/wh_server_keycache.h
+ *
+ * Server cache of key material in a fixed pool of WOLFHSM_NUM_RAMKEYS RAM
+ * slots.
+ *
+ * Keys with WOLFHSM_KEYID_RAM ids exist only in the cache.  Keys with
+ * WOLFHSM_KEYID_NVM ids are backed by the NVM object with the same id: they
+ * are loaded from NVM the first time they are acquired, and keys cached by the
+ * client are committed to NVM by Commit, by Idle, or before their slot is
+ * reused.  A key is pinned while acquired and is never evicted while pinned.
+ * Otherwise the least recently used NVM key is evicted when another slot is
+ * needed, preferring keys already committed.  RAM keys are only removed by
+ * Evict or Erase.  Slots are zeroized when evicted.
+ *
+ * The cache does not reclaim NVM space itself.  A commit that finds the NVM
+ * full returns WH_ERROR_NOSPACE, leaves the key uncommitted and sets nvm_full
+ * until a later commit succeeds, so the owner of the NVM can run a
+ * DestroyObjects and retry.
+ *
+ */
+
+#ifndef WOLFHSM_WH_SERVER_KEYCACHE_H_
+#define WOLFHSM_WH_SERVER_KEYCACHE_H_
+
+#include <stdint.h>
+
+#include "wolfhsm/wh_common.h"
+#include "wolfhsm/wh_nvm.h"
+
+/* Bytes of key material held by each slot */
+#ifndef WH_KEYCACHE_BUFSIZE
+#define WH_KEYCACHE_BUFSIZE 512
+#endif
+
+/* One RAM key slot */
+typedef struct {
+    int used;
+    uint16_t pins;          /* Acquires without a Release */
+    uint16_t dirty;         /* Nonzero when NVM does not have this version */
+    uint32_t last_use;      /* Cache tick of the most recent use */
+    whNvmMetadata meta;     /* meta.id is the key id, meta.len its length */
+    uint8_t data[WH_KEYCACHE_BUFSIZE];
+} whKeyCacheSlot;
+
+typedef struct {
+    const whNvmCb* nvm_cb;  /* Optional initialized NVM for WOLFHSM_KEYID_NVM
+                             * keys.  Without it only RAM keys are cached */
+    void* nvm_context;      /* Context passed to nvm_cb */
+} whKeyCacheConfig;
+
+typedef struct {
+    const whNvmCb* nvm_cb;
+    void* nvm_context;
+    uint32_t tick;
+    uint32_t loads;         /* Keys read from NVM */
+    uint32_t evictions;     /* Slots reused for another key */
+    int nvm_full;           /* The last commit failed with WH_ERROR_NOSPACE */
+    whKeyCacheSlot slots[WOLFHSM_NUM_RAMKEYS];
+} whKeyCache;
+
+int wh_KeyCache_Init(whKeyCache* cache, const whKeyCacheConfig* config);
+
+/* Commit the uncommitted NVM keys, ignoring errors, and zeroize every slot */
+int wh_KeyCache_Cleanup(whKeyCache* cache);
+
+/* Place a copy of meta->len bytes of data in a slot as key meta->id,
+ * replacing any cached version.  An NVM key is committed later.  Returns
+ * WH_ERROR_NOTREADY if the key is pinned and WH_ERROR_NOSPACE if no slot can
+ * be evicted. */
+int wh_KeyCache_Cache(whKeyCache* cache, const whNvmMetadata* meta,
+        const uint8_t* data);
+
+/* Pin the key, loading an NVM key if it is not cached, and point to its
+ * metadata and data.  Both remain valid until the matching Release. */
+int wh_KeyCache_Acquire(whKeyCache* cache, whKeyId id,
+        const whNvmMetadata** out_meta, const uint8_t** out_data);
+int wh_KeyCache_Release(whKeyCache* cache, whKeyId id);
+
+/* Write an uncommitted NVM key to NVM now.  Returns WH_ERROR_BADARGS for RAM
+ * keys. */
+int wh_KeyCache_Commit(whKeyCache* cache, whKeyId id);
+
+/* Commit if necessary, then zeroize the slot.  The NVM copy remains */
+int wh_KeyCache_Evict(whKeyCache* cache, whKeyId id);
+
+/* Zeroize any cached copy and destroy the NVM copy */
+int wh_KeyCache_Erase(whKeyCache* cache, whKeyId id);
+
+/* Commit one uncommitted NVM key.  Returns WH_ERROR_NOTREADY while more
+ * remain and 0 when all are committed. */
+int wh_KeyCache_Idle(whKeyCache* cache);
+
+#endif /* WOLFHSM_WH_SERVER_KEYCACHE_H_ */
@@ -0,0 +1,87 @@
+/*
+ * wolfhsm/wh_stats.h
+ *
+ * Optional counters and cycle timers on the hot paths of the comm, server,
+ * flash and NVM layers, served to clients with the COMM_STATS message.
+ *
+ * Define WOLFHSM_STATS to enable them.  Otherwise the macros below compile to
+ * nothing and no storage is used.  The counters are shared by every instance
+ * in the image and are not updated atomically, so with several threads they
+ * are approximate.  Counters wrap at 32 bits.
+ *
+ */
+
+#ifndef WOLFHSM_WH_STATS_H_
+#define WOLFHSM_WH_STATS_H_
+
+#include <stdint.h>
+
+/* One request counter per message group, indexed by group >> 5 */
+#define WH_STATS_GROUP_COUNT 8
+#define WH_STATS_GROUP_INDEX(_group) (((_group) >> 5) & 0x7)
+
+typedef struct {
+    uint32_t requests[WH_STATS_GROUP_COUNT];   /* Requests handled */
+    uint32_t notready_polls;        /* Polls of comm Wait while NOTREADY */
+    uint32_t comm_rx_bytes;         /* Request bytes received by servers */
+    uint32_t comm_tx_bytes;         /* Response bytes sent by servers */
+    uint32_t flash_reads;
+    uint32_t flash_read_bytes;
+    uint32_t flash_programs;        /* Including copies */
+    uint32_t flash_program_bytes;
+    uint32_t flash_erases;
+    uint32_t flash_erase_bytes;
+    uint32_t flash_blankchecks;
+    uint32_t flash_blankcheck_bytes;
+    uint32_t flash_verifies;
+    uint32_t flash_verify_bytes;
+    uint32_t dir_lookups;           /* NVM directory lookups by id */
+    uint32_t compactions;           /* NVM replications committed */
+    uint32_t pad;
+    uint64_t compaction_cycles;     /* Cycles in NVM replication steps */
+    uint64_t request_cycles;        /* Cycles in server request handlers */
+} whStats;
+
+#ifdef WOLFHSM_STATS
+
+/* Free running counter for the cycle timers.  Ports without one of the
+ * counters below define it, for example to read DWT->CYCCNT */
+#ifndef WH_STATS_CYCLES
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define WH_STATS_CYCLES() ((uint64_t)__builtin_ia32_rdtsc())
+#elif defined(__GNUC__) && defined(__aarch64__)
+static inline uint64_t wh_Stats_Cycles(void)
+{
+    uint64_t val;
+    __asm__ volatile("mrs %0, cntvct_el0" : "=r"(val));
+    return val;
+}
+#define WH_STATS_CYCLES() wh_Stats_Cycles()
+#else
+#define WH_STATS_CYCLES() ((uint64_t)0)
+#endif
+#endif
+
+extern whStats whStatsCounters;
+
+#define WH_STATS_ADD(_field, _n) \
+    (whStatsCounters._field += (uint32_t)(_n))
+#define WH_STATS_INC(_field) WH_STATS_ADD(_field, 1)
+#define WH_STATS_TIMER_START(_var) \
+    uint64_t _var = WH_STATS_CYCLES()
+#define WH_STATS_TIMER_ADD(_field, _var) \
+    (whStatsCounters._field += WH_STATS_CYCLES() - (_var))
+
+/* Copy the counters to out_stats and reset them if reset is nonzero */
+void wh_Stats_Get(whStats* out_stats, int reset);
+
+#else
+
+#define WH_STATS_ADD(_field, _n) do { } while (0)
+#define WH_STATS_INC(_field) do { } while (0)
+#define WH_STATS_TIMER_START(_var) do { } while (0)
+#define WH_STATS_TIMER_ADD(_field, _var) do { } while (0)
+
+#endif /* WOLFHSM_STATS */
+
+#endif /* WOLFHSM_WH_STATS_H_ */
@@ -49,6 +49,16 @@ typedef struct {
      *          WH_ERROR_BADARGS if NULL context
      */
     int (*Cleanup)(void* context);
+
+    /* Optional: Block until the server may have made progress, such as a
+     * response arriving or the send buffer becoming free, or until timeout_us
+     * has elapsed.  Returning early is allowed, so callers must poll again.
+     * Returns: 0 on progress or early return,
+     *          WH_ERROR_BADARGS if NULL context
+     *          WH_ERROR_NOTREADY if the timeout elapsed
+     *          WH_ERROR_ABORTED if fatal error occurred. Cleanup.
+     */
+    int (*Wait)(void* context, uint32_t timeout_us);
 } whTransportClientCb;
 
 typedef struct {
@@ -80,6 +90,41 @@ typedef struct {
      *          WH_ERROR_BADARGS if NULL context
      */
     int (*Cleanup)(void* context);
+
+    /* Optional: Receive a new request without copying it.  On success,
+     * out_data points to the request packet within the transport, which
+     * remains valid until the response is sent.
+     * Returns: as Recv
+     */
+    int (*RecvInPlace)(void* context, uint16_t* out_size, void** out_data);
+
+    /* Optional: Lend the transport buffer for the next response packet, which
+     * is sent with SendInPlace once filled.  The buffer may be the same memory
+     * as the current request.
+     * Returns: 0 on success,
+     *          WH_ERROR_BADARGS if NULL context or outputs
+     *          WH_ERROR_NOTREADY if send buffer is not free. Retry.
+     */
+    int (*GetSendBuffer)(void* context, uint16_t* out_size, void** out_data);
+
+    /* Optional: Send data_size bytes already written to the send buffer.
+     * Returns: as Send
+     */
+    int (*SendInPlace)(void* context, uint16_t data_size);
+
+    /* Optional: Block until the client may have made progress, such as a
+     * request arriving or the send buffer becoming free, or until timeout_us
+     * has elapsed.
+     * Returns: as the client Wait
+     */
+    int (*Wait)(void* context, uint32_t timeout_us);
+
+    /* Optional: Get the number of requests received by the transport and not
+     * yet responded to.
+     * Returns: 0 on success,
+     *          WH_ERROR_BADARGS if NULL context or out_depth
+     */
+    int (*GetQueueDepth)(void* context, uint16_t* out_depth);
 } whTransportServerCb;
 
 #endif /* WOLFHSM_WH_TRANSPORT_H_ */
@@ -71,23 +71,38 @@
  * whCommServer cs[1] = {0};
  * wh_CommServer_Init(cs, csc);
  *
+ *
+ * Ring mode
+ * The WH_TRANSPORT_MEM_RING_*_CB callbacks split each buffer into slot_count
+ * slots following the top CSR, so the client may have up to slot_count
+ * requests outstanding.  Each slot begins with its own CSR holding the length
+ * and the ring count of the packet. Responses are matched to requests using
+ * whHeader.seq.  The top CSR's count the packets:
+ *  req->notify:  Requests sent by the client
+ *  req->ack:     Responses received by the client
+ *  resp->notify: Requests handled and responses sent by the server
+ *
+ * The client sends a request when req->notify - req->ack < slot_count into
+ * request slot req->notify % slot_count, and receives a response when
+ * req->ack != resp->notify from response slot req->ack % slot_count.  The
+ * server handles requests in order while req->notify != resp->notify, using
+ * slot resp->notify % slot_count of both buffers.
+ *
+ * whTransportMemConfig tmrcfg[1] = {{
+ *      .req = req_buffer,
+ *      .req_size = sizeof(req_buffer),
+ *      .resp = resp_buffer
+ *      .resp_size = sizeof(resp_buffer),
+ *      .slot_count = 4,
+ * }};
+ * whTransportClientCb tmrccb[1] = {WH_TRANSPORT_MEM_RING_CLIENT_CB};
+ * whTransportServerCb tmrscb[1] = {WH_TRANSPORT_MEM_RING_SERVER_CB};
  */
 
 #include <stdint.h>
 
 #include "wolfhsm/wh_transport.h"
 
-/** Common configuration structure */
-typedef struct {
-    void* req;
-    uint16_t req_size;
-    void* resp;
-    uint16_t resp_size;
-} whTransportMemConfig;
-
-
-/** Common context */
-
 /* Memory buffer control/status layout.  Data buffer follows immediately */
 typedef union whTransportMemCsr_t {
     uint64_t u64;
@@ -99,6 +114,33 @@ typedef union whTransportMemCsr_t {
     } s;
 } whTransportMemCsr;
 
+/* Optional doorbell used instead of polling the partner's CSR, such as an IPC
+ * interrupt, a futex or an eventfd */
+typedef struct {
+    /* Signal the partner after csr has been written */
+    int (*Notify)(void* context, volatile whTransportMemCsr* csr);
+
+    /* Block until csr may no longer equal expected or timeout_us elapsed.
+     * Returns: 0 on change or early return,
+     *          WH_ERROR_NOTREADY on timeout
+     */
+    int (*Wait)(void* context, volatile whTransportMemCsr* csr,
+            uint64_t expected, uint32_t timeout_us);
+} whTransportMemNotifyCb;
+
+/** Common configuration structure */
+typedef struct {
+    void* req;
+    uint16_t req_size;
+    void* resp;
+    uint16_t resp_size;
+    uint16_t slot_count;    /* Ring mode only. Number of slots, a power of 2 */
+    const whTransportMemNotifyCb* notify_cb;    /* Optional doorbell */
+    void* notify_context;   /* Context passed to notify_cb */
+} whTransportMemConfig;
+
+
+/** Common context */
 typedef struct {
     volatile whTransportMemCsr* req;
     void* req_data;
@@ -106,6 +148,10 @@ typedef struct {
     volatile whTransportMemCsr* resp;
     void* resp_data;
     uint16_t resp_size;
+    uint16_t slot_count;    /* Ring mode only */
+    uint16_t slot_size;     /* Ring mode only. Bytes per slot including CSR */
+    const whTransportMemNotifyCb* notify_cb;
+    void* notify_context;
     int initialized;
 } whTransportMemContext;
 
@@ -121,6 +167,29 @@ int wh_TransportMem_SendRequest(void* c, uint16_t len, const void* data);
 int wh_TransportMem_RecvRequest(void* c, uint16_t *out_len, void* data);
 int wh_TransportMem_SendResponse(void* c, uint16_t len, const void* data);
 int wh_TransportMem_RecvResponse(void* c, uint16_t *out_len, void* data);
+int wh_TransportMem_RecvRequestInPlace(void* c, uint16_t *out_len,
+        void** out_data);
+int wh_TransportMem_GetResponseBuffer(void* c, uint16_t *out_size,
+        void** out_data);
+int wh_TransportMem_SendResponseInPlace(void* c, uint16_t len);
+int wh_TransportMem_ClientWait(void* c, uint32_t timeout_us);
+int wh_TransportMem_ServerWait(void* c, uint32_t timeout_us);
+int wh_TransportMem_GetQueueDepth(void* c, uint16_t* out_depth);
+
+/** Ring mode callback function declarations */
+int wh_TransportMemRing_Init(void* c, const void* cf);
+int wh_TransportMemRing_InitClear(void* c, const void* cf);
+int wh_TransportMemRing_SendRequest(void* c, uint16_t len, const void* data);
+int wh_TransportMemRing_RecvRequest(void* c, uint16_t *out_len, void* data);
+int wh_TransportMemRing_SendResponse(void* c, uint16_t len, const void* data);
+int wh_TransportMemRing_RecvResponse(void* c, uint16_t *out_len, void* data);
+int wh_TransportMemRing_RecvRequestInPlace(void* c, uint16_t *out_len,
+        void** out_data);
+int wh_TransportMemRing_GetResponseBuffer(void* c, uint16_t *out_size,
+        void** out_data);
+int wh_TransportMemRing_SendResponseInPlace(void* c, uint16_t len);
+int wh_TransportMemRing_ClientWait(void* c, uint32_t timeout_us);
+int wh_TransportMemRing_GetQueueDepth(void* c, uint16_t* out_depth);
 
 #define WH_TRANSPORT_MEM_CLIENT_CB              \
 {                                               \
@@ -128,6 +197,7 @@ int wh_TransportMem_RecvResponse(void* c, uint16_t *out_len, void* data);
     .Send =     wh_TransportMem_SendRequest,    \
     .Recv =     wh_TransportMem_RecvResponse,   \
     .Cleanup =  wh_TransportMem_Cleanup,        \
+    .Wait =     wh_TransportMem_ClientWait,     \
 }
 
 #define WH_TRANSPORT_MEM_SERVER_CB              \
@@ -136,7 +206,33 @@ int wh_TransportMem_RecvResponse(void* c, uint16_t *out_len, void* data);
     .Recv =     wh_TransportMem_RecvRequest,    \
     .Send =     wh_TransportMem_SendResponse,   \
     .Cleanup =  wh_TransportMem_Cleanup,        \
+    .RecvInPlace = wh_TransportMem_RecvRequestInPlace,      \
+    .GetSendBuffer = wh_TransportMem_GetResponseBuffer,     \
+    .SendInPlace = wh_TransportMem_SendResponseInPlace,     \
+    .Wait =     wh_TransportMem_ServerWait,     \
+    .GetQueueDepth = wh_TransportMem_GetQueueDepth, \
+}
+
+#define WH_TRANSPORT_MEM_RING_CLIENT_CB             \
+{                                                   \
+    .Init =     wh_TransportMemRing_InitClear,      \
+    .Send =     wh_TransportMemRing_SendRequest,    \
+    .Recv =     wh_TransportMemRing_RecvResponse,   \
+    .Cleanup =  wh_TransportMem_Cleanup,            \
+    .Wait =     wh_TransportMemRing_ClientWait,     \
 }
 
+#define WH_TRANSPORT_MEM_RING_SERVER_CB             \
+{                                                   \
+    .Init =     wh_TransportMemRing_Init,           \
+    .Recv =     wh_TransportMemRing_RecvRequest,    \
+    .Send =     wh_TransportMemRing_SendResponse,   \
+    .Cleanup =  wh_TransportMem_Cleanup,            \
+    .RecvInPlace = wh_TransportMemRing_RecvRequestInPlace,  \
+    .GetSendBuffer = wh_TransportMemRing_GetResponseBuffer, \
+    .SendInPlace = wh_TransportMemRing_SendResponseInPlace, \
+    .Wait =     wh_TransportMem_ServerWait,         \
+    .GetQueueDepth = wh_TransportMemRing_GetQueueDepth, \
+}
 
 #endif /* WH_TRANSPORT_MEM_H_ */